@@ -0,0 +1,167 @@
+// Job handoff benchmark: lock-free MPMC queue vs. mutex + semaphore
+//
+// Build: make bench
+// Run:   ./bin/bench_job_queue [items_per_config]
+
+#include "../include/mpmc_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+
+#define QUEUE_CAPACITY 1024
+#define STOP_ITEM ((void*)1)
+
+// The path the server used before: ring buffer + jobs mutex + job semaphore
+typedef struct {
+    void* items[QUEUE_CAPACITY];
+    int head;
+    int count;
+    pthread_mutex_t mutex;
+    sem_t available;
+} locked_queue_t;
+
+static int locked_push(locked_queue_t* queue, void* item) {
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == QUEUE_CAPACITY) {
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
+    }
+    queue->items[(queue->head + queue->count) % QUEUE_CAPACITY] = item;
+    queue->count++;
+    pthread_mutex_unlock(&queue->mutex);
+    sem_post(&queue->available);
+    return 0;
+}
+
+static void* locked_pop(locked_queue_t* queue) {
+    while (sem_wait(&queue->available) == -1) {
+        // EINTR
+    }
+    pthread_mutex_lock(&queue->mutex);
+    void* item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % QUEUE_CAPACITY;
+    queue->count--;
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+typedef struct {
+    int use_mpmc;
+    mpmc_queue_t* mpmc;
+    locked_queue_t* locked;
+    long items;             // Items per producer
+    long producer_id;
+    uint64_t checksum;      // Consumers: sum of received items
+} bench_thread_t;
+
+static void queue_push(bench_thread_t* ctx, void* item) {
+    if (ctx->use_mpmc) {
+        while (mpmc_queue_push(ctx->mpmc, item) != 0) {
+            sched_yield();
+        }
+    } else {
+        while (locked_push(ctx->locked, item) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+static void* producer(void* arg) {
+    bench_thread_t* ctx = arg;
+    for (long i = 0; i < ctx->items; i++) {
+        // Items are never 0 or STOP_ITEM
+        queue_push(ctx, (void*)(uintptr_t)(ctx->producer_id * ctx->items + i + 2));
+    }
+    return NULL;
+}
+
+static void* consumer(void* arg) {
+    bench_thread_t* ctx = arg;
+    for (;;) {
+        void* item = ctx->use_mpmc ? mpmc_queue_pop_wait(ctx->mpmc, 100) : locked_pop(ctx->locked);
+        if (!item) continue;
+        if (item == STOP_ITEM) break;
+        ctx->checksum += (uintptr_t)item;
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int use_mpmc, int threads, long total_items) {
+    static mpmc_queue_t mpmc __attribute__((aligned(CACHE_LINE_SIZE)));
+    static locked_queue_t locked;
+
+    if (use_mpmc) {
+        mpmc_queue_init(&mpmc, QUEUE_CAPACITY);
+    } else {
+        memset(&locked, 0, sizeof(locked));
+        pthread_mutex_init(&locked.mutex, NULL);
+        sem_init(&locked.available, 0, 0);
+    }
+
+    long per_producer = total_items / threads;
+    pthread_t producers[threads], consumers[threads];
+    bench_thread_t producer_ctx[threads], consumer_ctx[threads];
+
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++) {
+        bench_thread_t base = { use_mpmc, &mpmc, &locked, per_producer, i, 0 };
+        producer_ctx[i] = base;
+        consumer_ctx[i] = base;
+        pthread_create(&consumers[i], NULL, consumer, &consumer_ctx[i]);
+        pthread_create(&producers[i], NULL, producer, &producer_ctx[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        queue_push(&producer_ctx[0], STOP_ITEM);
+    }
+    uint64_t checksum = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(consumers[i], NULL);
+        checksum += consumer_ctx[i].checksum;
+    }
+    double elapsed = now_seconds() - start;
+
+    // Every item must be delivered exactly once
+    uint64_t n = (uint64_t)per_producer * threads;
+    uint64_t expected = n * (n - 1) / 2 + 2 * n;
+    if (checksum != expected) {
+        fprintf(stderr, "checksum mismatch: %llu != %llu\n",
+                (unsigned long long)checksum, (unsigned long long)expected);
+        exit(1);
+    }
+
+    if (use_mpmc) {
+        mpmc_queue_destroy(&mpmc);
+    } else {
+        pthread_mutex_destroy(&locked.mutex);
+        sem_destroy(&locked.available);
+    }
+    return n / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+    long items = (argc > 1) ? atol(argv[1]) : 2000000;
+    int configs[] = { 1, 4, 16 };
+
+    printf("%-22s %18s %18s %8s\n", "producers/consumers", "mutex+sem ops/s", "mpmc ops/s", "speedup");
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        double locked_rate = run(0, configs[i], items);
+        double mpmc_rate = run(1, configs[i], items);
+        printf("%9d/%-12d %18.0f %18.0f %7.2fx\n", configs[i], configs[i],
+               locked_rate, mpmc_rate, mpmc_rate / locked_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,245 @@
+// Multi-pattern matcher benchmark: scan throughput against 1k, 10k and
+// 100k patterns, for each prefilter kernel the CPU supports
+//
+// Three workloads: random binary IOCs over random data (every byte can
+// start a pattern, the pair bitmap alone filters), lowercase text IOCs
+// over random data (uploads are mostly binary; the SIMD byte-set tests
+// skip most positions) and text IOCs over text of the same alphabet.
+// Before timing, every kernel is checked against a naive search for all
+// match positions, with the data fed in random block sizes. A mismatch
+// fails the run.
+//
+// Build: make bench
+// Run:   ./bin/bench_patterns [corpus_mb] [max_patterns]
+
+#include "../include/common.h"
+#include "../include/pattern_engine.h"
+
+static const char* kernel_names[] = { "scalar", "ssse3", "avx2" };
+#define NUM_KERNEL_NAMES (sizeof(kernel_names) / sizeof(kernel_names[0]))
+
+typedef enum { FAMILY_BINARY, FAMILY_TEXT } family_t;
+
+static uint64_t g_random = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t next_random(void) {
+    g_random ^= g_random << 13;
+    g_random ^= g_random >> 7;
+    g_random ^= g_random << 17;
+    return (uint32_t)(g_random >> 16);
+}
+
+static unsigned char random_byte(family_t family) {
+    if (family == FAMILY_TEXT) {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_.";
+        return (unsigned char)alphabet[next_random() % (sizeof(alphabet) - 1)];
+    }
+    return (unsigned char)next_random();
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// count patterns of min_length..max_length bytes in one buffer
+static pattern_t* make_patterns(size_t count, family_t family, size_t min_length, size_t max_length,
+                                unsigned char** storage) {
+    pattern_t* patterns = malloc(count * sizeof(pattern_t));
+    *storage = malloc(count * max_length);
+    if (!patterns || !*storage) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = min_length + next_random() % (max_length - min_length + 1);
+        unsigned char* bytes = *storage + i * max_length;
+        for (size_t j = 0; j < length; j++) bytes[j] = random_byte(family);
+        patterns[i].name = "Bench.IOC";
+        patterns[i].bytes = bytes;
+        patterns[i].length = length;
+    }
+    return patterns;
+}
+
+static void fill_corpus(unsigned char* data, size_t length, family_t family) {
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (family == FAMILY_TEXT && next_random() % 8 == 0) ? ' ' : random_byte(family);
+    }
+}
+
+// Self-check: every position where some pattern ends, naive vs. engine
+static int check_matches(const char* kernel, family_t family) {
+    const size_t count = 300;
+    const size_t length = 256 * 1024;
+    unsigned char* storage;
+    pattern_t* patterns = make_patterns(count, family, 2, 12, &storage);
+    unsigned char* data = malloc(length);
+    unsigned char* expected = calloc(length + 1, 1);
+    if (!patterns || !data || !expected) return -1;
+
+    // Suffixes and prefixes of other patterns exercise the fail links
+    for (size_t i = 0; i + 1 < count; i += 7) {
+        if (patterns[i].length > 3) {
+            patterns[i + 1].bytes = patterns[i].bytes + 1;
+            patterns[i + 1].length = patterns[i].length - 1;
+        }
+    }
+    fill_corpus(data, length, family);
+    for (size_t k = 0; k < 2000; k++) {
+        const pattern_t* pattern = &patterns[next_random() % count];
+        size_t at = next_random() % (length - pattern->length);
+        memcpy(data + at, pattern->bytes, pattern->length);
+    }
+    for (size_t p = 0; p < count; p++) {
+        for (size_t at = 0; at + patterns[p].length <= length; at++) {
+            if (memcmp(data + at, patterns[p].bytes, patterns[p].length) == 0) {
+                expected[at + patterns[p].length] = 1;
+            }
+        }
+    }
+
+    char error[256];
+    pattern_engine_t* engine = pattern_engine_compile(patterns, count, error, sizeof(error));
+    if (!engine) {
+        printf("  compile failed: %s\n", error);
+        return -1;
+    }
+
+    // Random block sizes: matches across block boundaries must be found
+    int failures = 0;
+    uint32_t state = 0;
+    size_t position = 0;
+    size_t expected_next = 1;
+    while (position < length && !failures) {
+        size_t block = 1 + next_random() % 5000;
+        if (block > length - position) block = length - position;
+        size_t offset = 0;
+        while (offset < block) {
+            size_t end;
+            uint32_t match = pattern_engine_scan(engine, &state, data + position + offset, block - offset, &end);
+            size_t found = match == PATTERN_NO_MATCH ? position + block + 1 : position + offset + end;
+            for (; expected_next < found && expected_next <= position + block; expected_next++) {
+                if (expected[expected_next]) {
+                    printf("  %s: missed match ending at %zu\n", kernel, expected_next);
+                    failures++;
+                    break;
+                }
+            }
+            if (match == PATTERN_NO_MATCH || failures) break;
+            const pattern_t* pattern = &patterns[match];
+            if (!expected[found] || found < pattern->length ||
+                memcmp(data + found - pattern->length, pattern->bytes, pattern->length) != 0) {
+                printf("  %s: wrong match ending at %zu\n", kernel, found);
+                failures++;
+                break;
+            }
+            expected_next = found + 1;
+            offset = found - position;
+        }
+        position += block;
+    }
+
+    pattern_engine_free(engine);
+    free(patterns);
+    free(storage);
+    free(data);
+    free(expected);
+    return failures ? -1 : 0;
+}
+
+static double measure(const pattern_engine_t* engine, const unsigned char* data, size_t length) {
+    const size_t block = 1024 * 1024;  // Scanned like the server reads files
+    size_t total = 0;
+    double start = now_seconds();
+    double elapsed;
+    do {
+        uint32_t state = 0;
+        for (size_t offset = 0; offset < length; offset += block) {
+            size_t size = length - offset < block ? length - offset : block;
+            size_t end;
+            size_t at = 0;
+            while (pattern_engine_scan(engine, &state, data + offset + at, size - at, &end) != PATTERN_NO_MATCH) {
+                at += end;
+            }
+        }
+        total += length;
+        elapsed = now_seconds() - start;
+    } while (elapsed < 0.5);
+    return (double)total / elapsed / 1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t corpus_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    size_t max_patterns = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+    size_t corpus_size = corpus_mb * 1024 * 1024;
+    const size_t pattern_counts[] = { 1000, 10000, 100000 };
+    const struct { const char* name; family_t patterns; family_t corpus; } workloads[] = {
+        { "bin/bin", FAMILY_BINARY, FAMILY_BINARY },
+        { "txt/bin", FAMILY_TEXT, FAMILY_BINARY },
+        { "txt/txt", FAMILY_TEXT, FAMILY_TEXT },
+    };
+
+    unsigned char* corpus = malloc(corpus_size);
+    if (!corpus) return 1;
+
+    int failed = 0;
+    printf("Self-check (naive search, random block sizes):\n");
+    for (size_t k = 0; k < NUM_KERNEL_NAMES; k++) {
+        if (pattern_kernel_select(kernel_names[k]) != 0) {
+            printf("  %-8s not supported\n", kernel_names[k]);
+            continue;
+        }
+        int binary = check_matches(kernel_names[k], FAMILY_BINARY);
+        int text = check_matches(kernel_names[k], FAMILY_TEXT);
+        printf("  %-8s %s\n", kernel_names[k], binary == 0 && text == 0 ? "ok" : "FAILED");
+        if (binary != 0 || text != 0) failed = 1;
+    }
+
+    printf("\nCorpus %zu MB, patterns of 8-32 bytes\n\n", corpus_mb);
+    printf("%-8s %8s %9s %9s %9s %10s %8s %8s %8s\n",
+           "workload", "patterns", "build ms", "states", "memory", "prefilter", "scalar", "ssse3", "avx2");
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        fill_corpus(corpus, corpus_size, workloads[w].corpus);
+        for (size_t c = 0; c < sizeof(pattern_counts) / sizeof(pattern_counts[0]); c++) {
+            size_t count = pattern_counts[c];
+            if (count > max_patterns) continue;
+
+            unsigned char* storage;
+            pattern_t* patterns = make_patterns(count, workloads[w].patterns, 8, 32, &storage);
+            char error[256];
+            double start = now_seconds();
+            pattern_engine_t* engine = patterns ? pattern_engine_compile(patterns, count, error, sizeof(error)) : NULL;
+            double build_ms = (now_seconds() - start) * 1000.0;
+            if (!engine) {
+                printf("%-8s %8zu  compile failed\n", workloads[w].name, count);
+                failed = 1;
+                continue;
+            }
+
+            printf("%-8s %8zu %9.0f %9zu %7.1fMB", workloads[w].name, count, build_ms,
+                   pattern_engine_states(engine), (double)pattern_engine_memory(engine) / (1024 * 1024));
+            const char* prefilter = NULL;
+            for (size_t k = 0; k < NUM_KERNEL_NAMES; k++) {
+                if (pattern_kernel_select(kernel_names[k]) != 0) {
+                    if (!prefilter) printf(" %10s", "-");
+                    printf(" %8s", "-");
+                    continue;
+                }
+                if (!prefilter) {
+                    prefilter = strcmp(pattern_engine_kernel(engine), "pairs") == 0 ? "pairs" : "simd";
+                    printf(" %10s", prefilter);
+                }
+                printf(" %6.2fGB", measure(engine, corpus, corpus_size));
+                fflush(stdout);
+            }
+            printf("\n");
+
+            pattern_engine_free(engine);
+            free(patterns);
+            free(storage);
+        }
+    }
+
+    free(corpus);
+    return failed;
+}
@@ -0,0 +1,139 @@
+// Keystream XOR benchmark: the original byte loop vs. the scalar, SSE2,
+// AVX2 and AVX-512 kernels (those the CPU supports)
+//
+// Before timing, every kernel is checked against the byte loop for all
+// lengths up to 1 KB plus a few large odd ones, every key offset, and
+// unaligned input/output pointers, in place and out of place. A mismatch
+// fails the run.
+//
+// Build: make bench
+// Run:   ./bin/bench_xor [buffer_kb] [total_mb]
+
+#include "../include/common.h"
+
+static const char* kernel_names[] = { "scalar", "sse2", "avx2", "avx512" };
+#define NUM_KERNEL_NAMES (sizeof(kernel_names) / sizeof(kernel_names[0]))
+
+// The loop the kernels replace
+static void reference_xor(const unsigned char* input, unsigned char* output, size_t length,
+                          const unsigned char* key, size_t key_offset) {
+    for (size_t i = 0; i < length; i++) {
+        output[i] = input[i] ^ key[(key_offset + i) % 32];
+    }
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_case(const unsigned char* key, const unsigned char* source, unsigned char* expected,
+                      unsigned char* actual, size_t length, size_t key_offset, size_t misalign) {
+    const unsigned char* input = source + misalign;
+    unsigned char* output = actual + (misalign * 7) % 64;
+
+    reference_xor(input, expected, length, key, key_offset);
+
+    // Out of place; the guard bytes after the output must stay untouched
+    memset(output, 0xA5, length + 64);
+    xor_keystream(input, output, length, key, key_offset);
+    if (memcmp(output, expected, length) != 0) return -1;
+    for (size_t i = length; i < length + 64; i++) {
+        if (output[i] != 0xA5) return -1;
+    }
+
+    // In place
+    memcpy(output, input, length);
+    xor_keystream(output, output, length, key, key_offset);
+    return memcmp(output, expected, length) == 0 ? 0 : -1;
+}
+
+static int self_check(const unsigned char* key) {
+    const size_t large_lengths[] = { 4095, 4097, 65537, 262143, 1048577 };
+    size_t max_length = 1048577 + 128;
+    unsigned char* source = malloc(max_length);
+    unsigned char* expected = malloc(max_length);
+    unsigned char* actual = malloc(max_length + 128);
+    if (!source || !expected || !actual) return -1;
+
+    for (size_t i = 0; i < max_length; i++) source[i] = (unsigned char)(i * 131 + 7);
+
+    int failures = 0;
+    for (size_t length = 0; length <= 1024 && !failures; length++) {
+        for (size_t key_offset = 0; key_offset < 64 && !failures; key_offset += (length < 128 ? 1 : 13)) {
+            for (size_t misalign = 0; misalign < 64 && !failures; misalign += 9) {
+                if (check_case(key, source, expected, actual, length, key_offset, misalign) != 0) {
+                    printf("  MISMATCH: length %zu, key offset %zu, misalign %zu\n", length, key_offset, misalign);
+                    failures++;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(large_lengths) / sizeof(large_lengths[0]) && !failures; i++) {
+        for (size_t key_offset = 0; key_offset < 32 && !failures; key_offset += 5) {
+            if (check_case(key, source, expected, actual, large_lengths[i], key_offset, 3) != 0) {
+                printf("  MISMATCH: length %zu, key offset %zu\n", large_lengths[i], key_offset);
+                failures++;
+            }
+        }
+    }
+
+    free(source);
+    free(expected);
+    free(actual);
+    return failures ? -1 : 0;
+}
+
+static double measure(const char* kernel, unsigned char* buffer, size_t buffer_size, size_t total,
+                      const unsigned char* key) {
+    size_t rounds = total / buffer_size;
+    if (rounds == 0) rounds = 1;
+
+    double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        if (kernel) {
+            xor_keystream(buffer, buffer, buffer_size, key, r);
+        } else {
+            reference_xor(buffer, buffer, buffer_size, key, r);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    return (double)rounds * buffer_size / elapsed / 1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t buffer_kb = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    size_t total_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 2048;
+    size_t buffer_size = buffer_kb * 1024;
+    size_t total = total_mb * 1024 * 1024;
+
+    unsigned char key[XOR_KEY_SIZE];
+    for (int i = 0; i < XOR_KEY_SIZE; i++) key[i] = (unsigned char)(rand() % 256);
+
+    unsigned char* buffer = malloc(buffer_size);
+    if (!buffer) return 1;
+    memset(buffer, 0x5A, buffer_size);
+
+    printf("Dispatch selects: %s\n", xor_kernel_name());
+    printf("Buffer %zu KB, %zu MB per run\n\n", buffer_kb, total_mb);
+    printf("%-10s %10s %10s  %s\n", "kernel", "GB/s", "speedup", "self-check");
+
+    double baseline = measure(NULL, buffer, buffer_size, total, key);
+    printf("%-10s %10.2f %10s  %s\n", "byte loop", baseline, "1.00x", "-");
+
+    int failed = 0;
+    for (size_t i = 0; i < NUM_KERNEL_NAMES; i++) {
+        if (xor_kernel_select(kernel_names[i]) != 0) {
+            printf("%-10s %10s %10s  %s\n", kernel_names[i], "-", "-", "not supported");
+            continue;
+        }
+        int check = self_check(key);
+        double rate = measure(kernel_names[i], buffer, buffer_size, total, key);
+        printf("%-10s %10.2f %9.2fx  %s\n", kernel_names[i], rate, rate / baseline, check == 0 ? "ok" : "FAILED");
+        if (check != 0) failed = 1;
+    }
+
+    free(buffer);
+    return failed;
+}
@@ -0,0 +1,40 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "common.h"
+
+#define ADMISSION_MAX_BYTES_IN_FLIGHT (4ULL * 1024 * 1024 * 1024)  // Being uploaded or waiting for a scan
+#define ADMISSION_DISK_RESERVE (64ULL * 1024 * 1024)   // Left free on the disk under UPLOAD_DIR
+#define ADMISSION_RETRY_MIN_MS 250
+#define ADMISSION_RETRY_MAX_MS 30000
+#define ADMISSION_RETRY_DISK_MS 5000                    // Space comes back as scans finish
+
+// Admission control for uploads.
+//
+// UPLOAD_FILE is answered "Ready to receive file" only if the upload can
+// complete and be queued for scanning:
+//  - the job table keeps a slot for it once every upload already
+//    accepted has been submitted, so submit_scan_job cannot fail;
+//  - the bytes being uploaded or waiting for a scan stay under
+//    ADMISSION_MAX_BYTES_IN_FLIGHT (a file is always accepted when
+//    nothing else is in flight, however large);
+//  - the disk under UPLOAD_DIR has room for it and for the rest of the
+//    accepted uploads, plus ADMISSION_DISK_RESERVE.
+// Otherwise the answer is RETRY_AFTER "<ms> <reason>", with a delay
+// estimated from the scan backlog, and the session stops reading from
+// the connection for that long: whatever the client sends meanwhile
+// stays in the socket buffers and TCP flow control slows it down,
+// rather than the server buffering it.
+//
+// The upload counters belong to the reactor thread; the scan byte count
+// is updated by the workers (atomics).
+
+// 0 if an upload of size bytes may start; otherwise -1 with the delay
+// for the client and the reason
+int admission_check(server_state_t* state, size_t size, unsigned int* retry_ms, const char** reason);
+
+// An accepted upload opened its file / was submitted or abandoned
+void admission_upload_started(server_state_t* state, size_t size);
+void admission_upload_ended(server_state_t* state, size_t size);
+
+#endif // ADMISSION_H
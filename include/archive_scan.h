@@ -0,0 +1,119 @@
+#ifndef ARCHIVE_SCAN_H
+#define ARCHIVE_SCAN_H
+
+#include "common.h"
+#include "scanner.h"
+
+#define ARCHIVE_MAX_DEPTH 5                             // Archives inside archives
+#define ARCHIVE_MAX_FILES 10000                         // Members of one job, all levels
+#define ARCHIVE_MAX_MEMBER_SIZE (64ULL * 1024 * 1024)   // Decompressed, held in memory for the scan
+#define ARCHIVE_MAX_TOTAL_SIZE (1024ULL * 1024 * 1024)  // Decompressed bytes of one job
+#define ARCHIVE_MAX_RATIO 100                           // Decompressed / compressed size of a member
+#define ARCHIVE_RATIO_MIN_SIZE (1024 * 1024)            // Smaller members are never bombs
+#define ARCHIVE_MAX_BUFFERED (256ULL * 1024 * 1024)     // Members waiting for a worker
+#define ARCHIVE_MAX_NAME 256
+#define ARCHIVE_BOMB_NAME "Heuristics.Archive.Bomb"
+#define ARCHIVE_PROBE_SIZE 512                          // Head of a file that tells an archive
+
+// Recursive scan of ZIP, tar and gzip (tar.gz) archives.
+//
+// The worker that takes the job walks the archive as a stream: ZIP local
+// headers in order, tar headers, gzip through zlib. Nothing is extracted
+// to disk. Every member is decompressed into memory and becomes a task
+// for the scan workers, like the chunks of chunked_scan.h; a member that
+// is itself an archive is walked in turn, up to ARCHIVE_MAX_DEPTH (deeper
+// ones are handed to ClamAV whole). The worker that finishes the last
+// member merges the verdicts: the first infected member wins, then any
+// member that could not be scanned, otherwise the archive is clean.
+//
+// Limits, all per job:
+//  - ARCHIVE_MAX_FILES members and ARCHIVE_MAX_TOTAL_SIZE decompressed
+//    bytes; past them the walk stops and the verdict is an error;
+//  - a member larger than ARCHIVE_MAX_MEMBER_SIZE is not held in memory:
+//    the archive it is in goes to ClamAV whole instead;
+//  - a member, or a gzip stream, that expands more than ARCHIVE_MAX_RATIO
+//    times (once over ARCHIVE_RATIO_MIN_SIZE) is reported as infected
+//    with ARCHIVE_BOMB_NAME, without decompressing the rest;
+//  - at most ARCHIVE_MAX_BUFFERED bytes of members wait in memory for a
+//    worker; past that the walking worker scans them itself.
+// Encrypted ZIP members cannot be scanned: each one is an error, so an
+// archive holding one is never reported clean.
+// Whatever the walker cannot parse (other compression methods, damaged
+// headers, a ZIP central directory that does not match the local headers
+// walked or is not at the end of the file) is scanned by ClamAV as a
+// whole, so nothing is skipped. After a complete walk ClamAV still scans
+// the archive file itself, with its archive parser off, for whole-file
+// hash signatures and signatures on the container.
+//
+// Office Open XML, OpenDocument and JAR files are ZIP archives ClamAV
+// understands better whole (macros, manifests): archive_scan_create
+// leaves them alone.
+//
+// Archive verdicts are not cached: the job result lists the member
+// verdicts, which a cached verdict does not keep, so an archive is walked
+// every time it is submitted.
+typedef struct archive_scan archive_scan_t;
+
+typedef struct archive_member {
+    archive_scan_t* scan;
+    struct archive_member* next;        // Walk order
+    unsigned char* data;                // Decompressed content, NULL: the whole archive file
+    size_t size;
+    unsigned int parsers;               // ClamAV parsers for the whole archive file
+    int status;                         // SCAN_RESULT_*
+    int scanned;                        // 0: skipped (an earlier member was infected) or not scannable
+    char virus_name[MAX_VIRUS_NAME];    // Or why it was not scanned
+    char name[ARCHIVE_MAX_NAME];        // Path in the archive, nested archives joined with '/'
+} archive_member_t;
+
+struct archive_scan {
+    scan_job_t* job;
+    int fd;
+    size_t file_size;
+    int format;                         // Of the file itself
+    unsigned long long start_ms;        // Job taken by a worker
+    unsigned long long split_ms;        // Walk started (after hashing)
+    unsigned long long busy_ms;         // Sum of the member scan times
+    int members_left;                   // Plus one held during the walk
+    int infected;
+    size_t buffered;                    // Bytes of members not scanned yet (atomic)
+
+    // Walk state (walking worker only until the last release)
+    archive_member_t* members;
+    archive_member_t* members_tail;
+    int member_count;
+    int file_count;
+    unsigned long long total_size;
+    char limit[MAX_VIRUS_NAME];         // Why the walk stopped early, "" if it did not
+};
+
+// A member is ready: queue it for the workers or scan it now (archive_scan_run)
+typedef void (*archive_member_handler_t)(archive_member_t* member, void* context);
+
+// 1 if a file starting with head (its first ARCHIVE_PROBE_SIZE bytes, or
+// all of a shorter file) is one archive_scan_create walks
+int archive_scan_probe(const unsigned char* head, size_t length);
+
+// NULL if the job's file is not a ZIP, tar or gzip archive
+archive_scan_t* archive_scan_create(scan_job_t* job);
+void archive_scan_destroy(archive_scan_t* scan);
+
+// Walk the whole archive, passing every member to handler
+void archive_scan_walk(archive_scan_t* scan, archive_member_handler_t handler, void* context);
+
+size_t archive_scan_buffered(const archive_scan_t* scan);
+
+// Scan one member and free its content
+void archive_scan_run(archive_member_t* member);
+
+// Add scan_ms of member work and drop one count; returns 1 to the caller
+// that dropped the last one, which then merges and destroys the scan
+int archive_scan_release(archive_scan_t* scan, unsigned long long scan_ms);
+
+// Merged verdict (SCAN_RESULT_*), result as for scan_file_with_clamav
+// (with the member path for INFECTED); members gets the member verdicts
+// for the job result
+int archive_scan_verdict(const archive_scan_t* scan, char* result, size_t result_size,
+                         char* members, size_t members_size);
+
+#endif // ARCHIVE_SCAN_H
@@ -0,0 +1,84 @@
+#ifndef CHUNKED_SCAN_H
+#define CHUNKED_SCAN_H
+
+#include "common.h"
+#include "scanner.h"
+
+#define SCAN_CHUNK_SIZE_DEFAULT (16 * 1024 * 1024)
+#define SCAN_CHUNK_OVERLAP (1024 * 1024)   // Longer than any fixed-length body signature
+#define SCAN_CHUNK_MIN_COUNT 4             // Smaller files are scanned whole
+#define SCAN_CHUNK_MIN_FILE_SIZE (SCAN_CHUNK_MIN_COUNT * 1024 * 1024)  // Smallest file split (-c 1)
+#define SCAN_QUEUE_CHUNK_SLOTS 1024        // Scan queue entries for chunks, on top of MAX_JOBS
+
+// Parallel scan of one large file.
+//
+// The file is cut into chunks of chunk_size bytes; each chunk is scanned
+// together with the first SCAN_CHUNK_OVERLAP bytes of the next one, so a
+// signature crossing a boundary is still seen whole by one of them. Every
+// chunk is an independent task for the scan workers. Chunk verdicts are
+// merged by whichever worker finishes the last one: the first infected
+// chunk (by offset) wins, then any error, otherwise the file is clean.
+// Once a chunk is infected the chunks not started yet are skipped.
+//
+// ClamAV sees each chunk as a file of its own, so two kinds of
+// signatures need the whole file:
+//  - hash signatures (.hdb/.hsb) match the hash and size of the whole
+//    file. The splitting worker checks them with chunked_scan_run_hashes
+//    while the chunks are scanned; a match wins over the chunk verdicts.
+//  - signatures anchored at an offset (n or EOF-n in .ndb/.ldb) are
+//    matched against offsets within the chunk. They are not checked
+//    against the whole file: most are tied to a file type, and those
+//    files are never split (below), but an untyped anchored signature
+//    can be missed, or match at the start or end of a chunk.
+// .mdb/.msb section hashes and .imp import hashes apply to PE files,
+// which are not split.
+//
+// Only formats ClamAV scans as a byte stream are split. Archives,
+// executables and documents are parsed as a whole (a chunk would cut
+// their structure), so chunked_scan_create refuses them and the job is
+// scanned with scanner_scan_file.
+typedef struct chunked_scan chunked_scan_t;
+
+typedef struct {
+    chunked_scan_t* scan;
+    off_t offset;
+    size_t length;                      // Chunk plus overlap, clamped to the file
+    int status;                         // SCAN_RESULT_*
+    char virus_name[MAX_VIRUS_NAME];
+} scan_chunk_t;
+
+struct chunked_scan {
+    scan_job_t* job;
+    int fd;                             // Shared by the chunks (pread only)
+    unsigned long long start_ms;        // Job taken by a worker
+    unsigned long long split_ms;        // Chunks handed out (after hashing)
+    unsigned long long busy_ms;         // Sum of the chunk scan times
+    int chunks_left;                    // Plus one held while chunks are handed out
+    int infected;
+    int chunk_count;
+    unsigned char hash[CONTENT_HASH_SIZE];
+    int has_hash;
+    unsigned long long signature_version;
+    size_t size;
+    int hash_status;                    // Whole-file hash signatures, SCAN_RESULT_*
+    char hash_virus_name[MAX_VIRUS_NAME];
+    scan_chunk_t chunks[];
+};
+
+// NULL if the file is too small for chunk_size or has a structured format
+chunked_scan_t* chunked_scan_create(scan_job_t* job, size_t chunk_size);
+void chunked_scan_destroy(chunked_scan_t* scan);
+
+void chunked_scan_run(scan_chunk_t* chunk);
+// Whole-file hash signatures, using hash when has_hash is set
+void chunked_scan_run_hashes(chunked_scan_t* scan);
+
+// Add scan_ms of chunk work and drop one count; returns 1 to the caller
+// that dropped the last one, which then merges and destroys the scan
+int chunked_scan_release(chunked_scan_t* scan, unsigned long long scan_ms);
+
+// Merged verdict (SCAN_RESULT_*), result as for scan_file_with_clamav;
+// a whole-file hash match comes first
+int chunked_scan_verdict(const chunked_scan_t* scan, char* result, size_t result_size);
+
+#endif // CHUNKED_SCAN_H
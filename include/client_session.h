@@ -0,0 +1,33 @@
+#ifndef CLIENT_SESSION_H
+#define CLIENT_SESSION_H
+
+#include "common.h"
+
+// Per-connection protocol state machine for the client socket.
+//
+// Runs on the reactor thread and never blocks: input is consumed as it
+// arrives (key exchange, command lines, upload data) and output is queued
+// and written whenever the socket is writable. Each call handles at most
+// SESSION_IO_BUDGET bytes so one large transfer cannot starve the others.
+//
+// Framed connections multiplex transfers by stream id: uploads, downloads
+// and queries interleave, downloads take turns one DATA frame at a time,
+// and output gets at most half of each turn's budget so uploads on the
+// same connection are not starved either.
+
+#define SESSION_IO_BUDGET (256 * 1024)
+#define TRANSFER_CHUNK_SIZE (64 * 1024)
+#define SESSION_MAX_PENDING_OUTPUT (256 * 1024)  // Stop reading commands above this
+
+// client_session_handle results
+#define SESSION_CLOSED -1   // Connection must be closed
+#define SESSION_IDLE 0      // Wait for the next epoll event
+#define SESSION_MORE 1      // Budget used up, call again soon
+#define SESSION_PAUSED 2    // Input paused by admission control, call again at input_paused_until
+
+void client_session_init(client_info_t* client);
+void client_session_release(server_state_t* state, client_info_t* client);
+int client_session_handle(server_state_t* state, client_info_t* client);
+int client_session_notify(client_info_t* client, int job_id, const char* result);
+
+#endif // CLIENT_SESSION_H
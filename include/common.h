@@ -19,31 +19,57 @@
 #include <semaphore.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/sendfile.h>
+#include <stdint.h>
+
+// Shared by the C server and the C++ clients
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // Constants
-#define MAX_CLIENTS 100
+#define INITIAL_CLIENT_CAPACITY 64  // Connection table grows as needed
+#define SESSION_MAX_STREAMS 64     // Transfers open at once on one client connection
 #define BUFFER_SIZE 4096
 #define MAX_FILENAME 256
 #define MAX_PATH 512
 #define MAX_MESSAGE 1024
+#define CONTENT_HASH_SIZE 32  // SHA-256
+#define UPLOAD_HEAD_SIZE 512  // First bytes of an upload kept for archive_scan_probe
+#define XOR_KEY_SIZE 32       // Session key length, a power of two
+#define TRANSFER_BUFFER_SIZE (256 * 1024)  // Copy fallback when zero-copy is not possible
+#define TRANSFER_PIPE_SIZE (256 * 1024)     // splice pipe, one session I/O budget
 #define ADMIN_SOCKET_PATH "/tmp/antivirus_admin.sock"
 #define SERVER_PORT 8080
 #define ADMIN_TIMEOUT 300  // 5 minutes
 #define MAX_JOBS 1000
+#define UPLOAD_DIR "processing/uploads"  // Not watched by the monitor thread
+#define OUTGOING_DIR "outgoing"
+#define PUBLISHED_NAME_SIZE (MAX_FILENAME + 16)  // "<job_id>_<filename>" of a clean file in OUTGOING_DIR
 
 // Protocol Commands
 #define CMD_ADMIN_AUTH "ADMIN_AUTH"
 #define CMD_SET_LOG_LEVEL "SET_LOG_LEVEL"
 #define CMD_GET_LOGS "GET_LOGS"
 #define CMD_GET_STATS "GET_STATS"
+#define CMD_GET_WORKER_STATS "GET_WORKER_STATS"
 #define CMD_DISCONNECT_CLIENT "DISCONNECT_CLIENT"
 #define CMD_SHUTDOWN_SERVER "SHUTDOWN_SERVER"
+#define CMD_RELOAD_SIGNATURES "RELOAD_SIGNATURES"
+#define CMD_GET_QUEUE_STATS "GET_QUEUE_STATS"
+#define CMD_GET_ONACCESS_STATS "GET_ONACCESS_STATS"
+#define CMD_GET_PREFILTER_STATS "GET_PREFILTER_STATS"
 
 #define CMD_REGISTER_CLIENT "REGISTER_CLIENT"
 #define CMD_UPLOAD_FILE "UPLOAD_FILE"
 #define CMD_GET_SCAN_STATUS "GET_SCAN_STATUS"
 #define CMD_GET_SCAN_RESULT "GET_SCAN_RESULT"
 #define CMD_DOWNLOAD_FILE "DOWNLOAD_FILE"
+#define CMD_SUBSCRIBE "SUBSCRIBE"
+#define TRANSFER_MODE_PLAIN "PLAIN"  // Optional UPLOAD_FILE/DOWNLOAD_FILE argument
+#define TRANSFER_MODE_GCM "GCM"
+#define UPLOAD_PRIORITY_HIGH "HIGH"  // Optional UPLOAD_FILE argument, after the mode
+#define UPLOAD_PRIORITY_LOW "LOW"
 
 // Response codes
 #define RESP_OK "OK"
@@ -52,6 +78,8 @@
 #define RESP_CLEAN "CLEAN"
 #define RESP_PENDING "PENDING"
 #define RESP_NOT_FOUND "NOT_FOUND"
+#define RESP_NOTIFY "NOTIFY"       // Pushed by the server: NOTIFY <job_id> <result>
+#define RESP_RETRY_AFTER "RETRY_AFTER"  // Upload refused for now: RETRY_AFTER <ms> <reason>
 
 // Log levels
 typedef enum {
@@ -69,8 +97,81 @@ typedef enum {
     SCAN_ERROR = 3
 } scan_status_t;
 
-// Client info structure
+// Encryption structures
+typedef struct {
+    unsigned char key[XOR_KEY_SIZE];  // 256-bit key
+    unsigned char iv[16];   // 128-bit IV
+} crypto_key_t;
+
+// AES-256-GCM stream: a random nonce, then records of at most
+// AEAD_CHUNK_SIZE plaintext bytes, each authenticated on its own:
+//   [4-byte header: final flag | length][ciphertext][16-byte tag]
+// The header is authenticated data and the record number is part of the
+// nonce, so records cannot be cut, reordered or truncated unnoticed.
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+#define AEAD_HEADER_SIZE 4
+#define AEAD_RECORD_OVERHEAD (AEAD_HEADER_SIZE + AEAD_TAG_SIZE)
+#define AEAD_CHUNK_SIZE (64 * 1024)
+#define AEAD_FINAL_FLAG 0x80000000u
+
+typedef struct {
+    void* ctx;                      // EVP_CIPHER_CTX
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    uint64_t record_index;
+} aead_stream_t;
+
+// Incremental SHA-256, for content hashed as it passes through
+typedef struct {
+    void* ctx;                      // EVP_MD_CTX
+} sha256_stream_t;
+
+// Protocol state of a client connection (see client_session.c)
+typedef enum {
+    SESSION_KEY_EXCHANGE = 0,
+    SESSION_COMMAND = 1,
+    SESSION_UPLOAD = 2
+} session_state_t;
+
+// One upload or download of a client connection. Framed connections can
+// have several open, each on its own stream id; text connections use a
+// single stream and send its data raw.
 typedef struct {
+    uint32_t id;
+    int is_upload;
+    int plain;                     // No session encryption (splice / sendfile)
+    int aead;                      // AES-GCM records
+    unsigned char* aead_buffer;    // GCM record being received or sealed
+    size_t aead_buffered;
+    
+    // Upload (encrypted data is decrypted as it arrives, plaintext is
+    // spliced from the socket to the file)
+    int upload_fd;
+    int upload_failed;
+    int upload_final_seen;
+    aead_stream_t upload_stream;
+    char upload_name[MAX_FILENAME];
+    char upload_path[MAX_PATH];
+    unsigned char upload_iv[16];
+    size_t upload_size;
+    int upload_priority;           // scan_priority_t
+    size_t upload_received;
+    sha256_stream_t upload_hash;   // Plaintext as written; ctx NULL when not hashed (spliced)
+    unsigned char upload_head[UPLOAD_HEAD_SIZE]; // First plaintext bytes written
+    size_t upload_head_length;
+    
+    // Download (plaintext goes out with sendfile)
+    int download_fd;
+    aead_stream_t download_stream;
+    unsigned char download_prefix[16]; // IV or nonce, sent as the first DATA
+    size_t download_prefix_length;
+    int download_final_sent;       // GCM: final record sealed
+    size_t download_remaining;
+    size_t download_offset;
+} session_stream_t;
+
+// Client info structure
+typedef struct client_info {
     int socket_fd;
     struct sockaddr_in address;
     char ip_string[INET_ADDRSTRLEN];
@@ -78,10 +179,59 @@ typedef struct {
     time_t last_activity;
     int is_active;
     pthread_t thread_id;
+    int slot;                      // Index in the connection table
+    unsigned long connection_id;   // Unique per connection (slots are reused)
+    
+    // Protocol state machine
+    session_state_t session_state;
+    int framed;                    // Binary frames (frame.h), 0 = text, -1 = not known yet
+    int protocol_error;            // Malformed frame: the connection is closed
+    crypto_key_t session_key;
+    char recv_buffer[MAX_MESSAGE]; // Unprocessed input (partial command line)
+    size_t recv_length;
+    
+    // Pending output (responses and download data)
+    char* send_buffer;
+    size_t send_offset;
+    size_t send_length;
+    size_t send_capacity;
+    
+    // Open transfers, NULL = free (allocated on demand)
+    session_stream_t* streams[SESSION_MAX_STREAMS];
+    int stream_count;
+    int splice_pipe[2];            // Opened on the first plaintext upload
+    
+    // Input: the upload the bytes being read belong to (the current DATA
+    // frame, or the text upload); NULL while a frame is discarded
+    session_stream_t* input_stream;
+    size_t frame_remaining;        // Payload left in the current DATA frame
+    
+    // Output: downloads take turns, one DATA frame each
+    int next_download;             // Round-robin position in streams
+    session_stream_t* output_stream; // Its sendfile DATA frame is being sent
+    size_t output_frame_remaining;
+    
+    // Responses and notifications held back while raw file data is being
+    // sent (a text download, or the body of a sendfile DATA frame)
+    char* deferred_output;
+    size_t deferred_length;
+    
+    // Reactor list of connections with work left after their I/O budget
+    struct client_info* ready_prev;
+    struct client_info* ready_next;
+    int in_ready_list;
+    
+    // Admission control refused an upload: input is not read before this
+    // time (monotonic ms, 0 = not paused), the reactor's paused list
+    // gives the connection its next turn
+    unsigned long long input_paused_until;
+    struct client_info* paused_prev;
+    struct client_info* paused_next;
+    int in_paused_list;
 } client_info_t;
 
 // Job structure for scan queue
-typedef struct {
+typedef struct scan_job {
     int job_id;
     int client_fd;
     char filename[MAX_FILENAME];
@@ -90,10 +240,32 @@ typedef struct {
     size_t file_size;
     scan_status_t status;
     char result[MAX_MESSAGE];
+    int has_hash;                  // hash taken as the upload arrived; hash lists checked then
+    unsigned char hash[CONTENT_HASH_SIZE];
+    int known_status;              // Decided on upload (SCAN_RESULT_*), completed by a worker
+    int known_stage;               // prefilter_stage_t that decided it, -1 for the result cache
+    char known_result[128];        // Virus name or "OK" (MAX_VIRUS_NAME)
     time_t created_time;
     time_t completed_time;
+    int subscriber_slot;           // Connection that sent SUBSCRIBE
+    unsigned long subscriber_id;   // Its connection_id, 0 = no subscriber
+    
+    // Fair queuing (scan_scheduler.h)
+    char client_address[INET_ADDRSTRLEN];
+    int priority;                  // scan_priority_t
+    unsigned long long queued_ms;
+    struct scan_job* sched_next;
 } scan_job_t;
 
+// Completion of a subscribed job, passed from a scan worker to the reactor
+typedef struct job_notification {
+    int slot;
+    unsigned long connection_id;
+    int job_id;
+    char result[MAX_MESSAGE];
+    struct job_notification* next;
+} job_notification_t;
+
 // Server statistics
 typedef struct {
     int total_connections;
@@ -105,15 +277,56 @@ typedef struct {
     time_t server_start_time;
 } server_stats_t;
 
-// Global server state
+struct server_state;
+
+// Job table (see job_queue.h)
+typedef struct job_table job_table_t;
+
+// Client connection table (see conn_table.h)
+typedef struct conn_table conn_table_t;
+
+// Scan verdicts by content hash (see result_cache.h)
+typedef struct result_cache result_cache_t;
+
+// Persistent verdicts (see verdict_store.h)
+typedef struct verdict_store verdict_store_t;
+
+// Per-client fair queuing of scan jobs (see scan_scheduler.h)
+typedef struct scan_scheduler scan_scheduler_t;
+
+// fanotify on-access scanning (see onaccess.h)
+typedef struct onaccess onaccess_t;
+
+// Hash lists and file type triage before the engine (see prefilter.h)
+typedef struct prefilter prefilter_t;
+
+// Scanner worker (one per thread in the scan pool).
+// Counters are only written by the owning worker; aligned so that
+// workers never share a cache line.
 typedef struct {
+    int worker_id;
+    pthread_t thread_id;
+    struct server_state* state;
+    unsigned long jobs_processed;
+    unsigned long clean_files;
+    unsigned long infected_files;
+    unsigned long errors;
+    unsigned long long busy_ms;
+} __attribute__((aligned(64))) scan_worker_t;
+
+// Global server state
+typedef struct server_state {
     int admin_socket_fd;
     int client_socket_fd;
     int admin_client_fd;
-    client_info_t clients[MAX_CLIENTS];
-    scan_job_t job_queue[MAX_JOBS];
-    int job_count;
-    int next_job_id;
+    conn_table_t* clients;
+    int epoll_fd;
+    job_table_t* job_table;
+    result_cache_t* result_cache;
+    verdict_store_t* verdict_store;     // NULL when the store could not be opened
+    scan_scheduler_t* scheduler;        // Order in which jobs enter scan_queue
+    onaccess_t* onaccess;               // NULL unless on-access scanning is enabled
+    prefilter_t* prefilter;
     server_stats_t stats;
     log_level_t current_log_level;
     int server_running;
@@ -122,23 +335,34 @@ typedef struct {
     pthread_mutex_t clients_mutex;
     pthread_mutex_t jobs_mutex;
     pthread_mutex_t stats_mutex;
-    pthread_mutex_t log_mutex;
-    pthread_cond_t job_available;
-    sem_t job_semaphore;
+    
+    // Lock-free handoff of scan_job_t* from uploads to the scan workers,
+    // and of the chunks of large files split across them (chunked_scan.h)
+    struct mpmc_queue* scan_queue;
+    int queued_chunks;                  // At most SCAN_QUEUE_CHUNK_SLOTS
+    size_t scan_chunk_size;             // 0 = never split a file
+    
+    // Upload admission control (admission.h)
+    int admitted_uploads;               // Accepted, not submitted yet (reactor thread)
+    size_t admitted_bytes;              // Their declared sizes (reactor thread)
+    size_t queued_scan_bytes;           // Submitted and not scanned yet (atomic)
+    
+    // Job notifications for the reactor; notify_event_fd wakes it up
+    pthread_mutex_t notify_mutex;
+    job_notification_t* notify_head;
+    job_notification_t* notify_tail;
+    int notify_event_fd;
     
     // Threads
     pthread_t admin_thread;
     pthread_t client_thread;
-    pthread_t processor_thread;
     pthread_t monitor_thread;
+    
+    // Scan worker pool
+    scan_worker_t* workers;
+    int num_workers;
 } server_state_t;
 
-// Encryption structures
-typedef struct {
-    unsigned char key[32];  // 256-bit key
-    unsigned char iv[16];   // 128-bit IV
-} crypto_key_t;
-
 // Function prototypes
 void log_message(log_level_t level, const char* format, ...);
 void init_server_state(server_state_t* state);
@@ -148,7 +372,15 @@ int create_client_socket(void);
 void* admin_thread_handler(void* arg);
 void* client_thread_handler(void* arg);
 void* processor_thread_handler(void* arg);
+int start_scan_workers(server_state_t* state, int num_workers);
+int submit_scan_job(server_state_t* state, const char* filename, const char* filepath,
+                    int client_fd, size_t file_size, const char* client_address, int priority,
+                    const unsigned char* hash, int archive);
 void* monitor_thread_handler(void* arg);
+int lookup_verdict(server_state_t* state, const unsigned char* hash, unsigned long long signature_version,
+                   int* verdict, char* result, size_t result_size);
+void store_verdict(server_state_t* state, const unsigned char* hash, unsigned long long signature_version,
+                   int verdict, const char* result);
 
 // Encryption functions
 int encrypt_file(const char* input_file, const char* output_file, const crypto_key_t* key);
@@ -156,6 +388,31 @@ int decrypt_file(const char* input_file, const char* output_file, const crypto_k
 void generate_key(crypto_key_t* key);
 int send_encrypted_data(int socket_fd, const void* data, size_t size, const crypto_key_t* key);
 int receive_encrypted_data(int socket_fd, void* data, size_t size, const crypto_key_t* key);
+void xor_stream_crypt(const unsigned char* input, unsigned char* output, size_t length,
+                      const crypto_key_t* key, size_t stream_offset);
+void xor_keystream(const unsigned char* input, unsigned char* output, size_t length,
+                   const unsigned char key[XOR_KEY_SIZE], size_t key_offset);
+const char* xor_kernel_name(void);
+int xor_kernel_select(const char* name);
+int aead_stream_init(aead_stream_t* stream, const crypto_key_t* key, const unsigned char nonce[AEAD_NONCE_SIZE]);
+void aead_stream_free(aead_stream_t* stream);
+int aead_random_nonce(unsigned char nonce[AEAD_NONCE_SIZE]);
+int aead_seal_record(aead_stream_t* stream, const unsigned char* input, size_t length, int final,
+                     unsigned char* output);
+int aead_parse_header(const unsigned char* header, size_t* length, int* final);
+int aead_open_record(aead_stream_t* stream, const unsigned char* record, unsigned char* output,
+                     size_t* length, int* final);
+size_t aead_stream_size(size_t plaintext_size);
+int encrypt_file_aead(const char* input_file, const char* output_file, const crypto_key_t* key);
+int decrypt_file_aead(const char* input_file, const char* output_file, const crypto_key_t* key);
+int perform_key_exchange(int socket_fd, crypto_key_t* shared_key, int is_server);
+unsigned int respond_key_exchange(unsigned int peer_public_key, crypto_key_t* shared_key);
+int sha256_file(const char* filepath, unsigned char digest[CONTENT_HASH_SIZE]);
+int sha256_fd(int fd, unsigned char digest[CONTENT_HASH_SIZE]);
+int sha256_stream_init(sha256_stream_t* stream);
+int sha256_stream_update(sha256_stream_t* stream, const void* data, size_t length);
+int sha256_stream_final(sha256_stream_t* stream, unsigned char digest[CONTENT_HASH_SIZE]);
+void sha256_stream_free(sha256_stream_t* stream);
 
 // Protocol functions
 int parse_admin_command(const char* command, char* cmd, char* args);
@@ -164,8 +421,15 @@ int send_response(int socket_fd, const char* status, const char* message);
 int receive_file(int socket_fd, const char* filepath, size_t expected_size);
 int send_file(int socket_fd, const char* filepath);
 
+// Zero-copy transfer functions (splice/sendfile)
+int transfer_pipe_open(int pipe_fds[2]);
+void transfer_pipe_close(int pipe_fds[2]);
+ssize_t splice_socket_to_file(int socket_fd, int pipe_fds[2], int file_fd, size_t length);
+int send_file_range(int socket_fd, int file_fd, off_t offset, size_t length);
+
 // Scanner functions
 int scan_file_with_clamav(const char* filepath, char* result, size_t result_size);
+int scan_file_with_parsers(const char* filepath, unsigned int parsers, char* result, size_t result_size);
 int is_file_infected(const char* filepath);
 
 // Utility functions
@@ -173,6 +437,12 @@ const char* log_level_to_string(log_level_t level);
 log_level_t string_to_log_level(const char* level_str);
 const char* scan_status_to_string(scan_status_t status);
 void get_current_timestamp(char* buffer, size_t buffer_size);
+unsigned long long monotonic_ms(void);
+unsigned long long monotonic_us(void);
 int create_directory_if_not_exists(const char* path);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // COMMON_H 
\ No newline at end of file
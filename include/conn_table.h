@@ -0,0 +1,24 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include "common.h"
+
+// Growable table of client connections.
+// Slots hold pointers, so a client_info_t never moves once allocated and
+// can be stored in epoll_event.data.ptr. Free slots are kept on a stack;
+// the table doubles in size when it runs out. Callers hold clients_mutex.
+struct conn_table {
+    client_info_t** slots;
+    int* free_slots;
+    int free_count;
+    int capacity;
+    int count;
+};
+
+conn_table_t* conn_table_create(int initial_capacity);
+void conn_table_destroy(conn_table_t* table);
+
+client_info_t* conn_table_add(conn_table_t* table);
+void conn_table_remove(conn_table_t* table, client_info_t* client);
+
+#endif // CONN_TABLE_H
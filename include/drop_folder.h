@@ -0,0 +1,89 @@
+#ifndef DROP_FOLDER_H
+#define DROP_FOLDER_H
+
+#include "common.h"
+
+#define DROP_DIR "processing"                   // Files copied here are scanned
+#define DROP_CLAIM_DIR "processing/ingest"      // Taken from DROP_DIR, waiting for their scan
+#define DROP_CLIENT_ADDRESS "drop-folder"       // Scheduler flow of the drop folder jobs
+#define DROP_COALESCE_MS 200                    // Quiet time after the last event on a file
+#define DROP_SETTLE_MS 2000                     // Sweeps skip files modified more recently
+#define DROP_MAX_ACTIVE_JOBS (MAX_JOBS / 2)     // The rest of the job table is for uploads
+#define DROP_FULL_RETRY_MS 50                   // Job table check while files are waiting
+#define DROP_HASH_BUCKETS 65536
+#define DROP_EVENT_BUFFER (64 * 1024)
+
+// Drop folder ingestion.
+//
+// Files written or moved into DROP_DIR become scan jobs. Only complete
+// files are taken: inotify reports IN_CLOSE_WRITE (the writer closed the
+// file) and IN_MOVED_TO (renamed in, e.g. from a temporary name), never
+// IN_CREATE. Every event of a read is parsed and the inotify queue is
+// drained completely each time, so bursts do not overflow it.
+//
+// Events only put the name in a backlog (a FIFO plus a hash set, so a
+// file is queued once however many events it gets). A file is due
+// DROP_COALESCE_MS after its last event; then it is claimed with a
+// rename into DROP_CLAIM_DIR, which keeps it out of later sweeps and
+// away from a writer that reopens the name, and submitted. Files are
+// only claimed while the job table has fewer than DROP_MAX_ACTIVE_JOBS
+// active jobs, so a drop of 100k files waits in the backlog instead of
+// filling the table.
+//
+// The directory is swept with readdir at startup and after IN_Q_OVERFLOW
+// (events were lost). A sweep cannot tell a finished file from one still
+// being written, so it skips files modified in the last DROP_SETTLE_MS
+// and sweeps again DROP_SETTLE_MS later; a writer still busy then
+// gets its IN_CLOSE_WRITE anyway. Files left in DROP_CLAIM_DIR by a
+// previous run are queued again at startup.
+//
+// Owned by the monitor thread, no locking.
+typedef struct drop_entry {
+    struct drop_entry* next;           // Backlog FIFO
+    struct drop_entry* hash_next;
+    unsigned long long due_ms;         // Monotonic
+    int claimed;                       // name is in DROP_CLAIM_DIR (recovered at startup)
+    char name[];
+} drop_entry_t;
+
+typedef struct {
+    int inotify_fd;
+    int watch;
+    drop_entry_t* head;
+    drop_entry_t* tail;
+    drop_entry_t* buckets[DROP_HASH_BUCKETS];  // Unclaimed entries by name
+    unsigned long backlog;
+    unsigned long long sweep_ms;       // Next sweep (monotonic), 0 = none
+    unsigned long run_id;              // Claimed names are unique across restarts
+    unsigned long sequence;
+
+    unsigned long events;
+    unsigned long coalesced;           // Events for a file already in the backlog
+    unsigned long overflows;
+    unsigned long queued;
+} drop_folder_t;
+
+// Watches DROP_DIR and schedules the startup sweep; NULL on error
+drop_folder_t* drop_folder_open(void);
+void drop_folder_close(drop_folder_t* folder);
+
+// Read every pending inotify event (inotify_fd is non-blocking)
+int drop_folder_read_events(drop_folder_t* folder, unsigned long long now_ms);
+
+void drop_folder_sweep_if_due(drop_folder_t* folder, unsigned long long now_ms);
+
+// A file in the backlog is due
+int drop_folder_has_due(const drop_folder_t* folder, unsigned long long now_ms);
+
+// Claim the next due file: 1 with its name, claimed path and size, 0 when
+// nothing is due (files that disappeared meanwhile are skipped)
+int drop_folder_claim(drop_folder_t* folder, unsigned long long now_ms, char* filename, size_t filename_size,
+                      char* path, size_t path_size, size_t* file_size);
+
+// Put a claimed file back at the head of the backlog (it could not be submitted)
+void drop_folder_unclaim(drop_folder_t* folder, const char* path);
+
+// Milliseconds until the next file is due or the next sweep, at most max_ms
+int drop_folder_timeout(const drop_folder_t* folder, unsigned long long now_ms, int max_ms);
+
+#endif // DROP_FOLDER_H
@@ -0,0 +1,151 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary framing for the client and admin sockets.
+//
+// Every message is a fixed 16-byte header followed by `length` bytes of
+// payload; all fields are in network byte order:
+//
+//   0  magic   FRAME_MAGIC (never the first byte of a text command)
+//   1  type    FRAME_* below
+//   2  flags   transfer mode / FRAME_FLAG_END, or the status code of a
+//              FRAME_RESPONSE / FRAME_NOTIFY
+//   4  stream  request the message belongs to, chosen by the client
+//   8  job_id  scan job the message refers to, 0 if none
+//  12  length  payload bytes
+//
+// Arguments that used to be text travel as binary fields: the job id in
+// the header, the transfer mode in flags, the upload size as 8 bytes in
+// front of the file name. Messages are read with a streaming decoder, so
+// a frame split over several reads or several frames in one read are
+// handled the same way.
+//
+// Streams multiplex one connection: a response carries the stream of its
+// command, and the DATA frames of an upload or download carry the stream
+// of its UPLOAD_FILE / DOWNLOAD_FILE, so several transfers and any number
+// of queries can be in progress at once. Up to SESSION_MAX_STREAMS
+// transfers may be open per connection; NOTIFY uses stream 0.
+//
+// The first byte a peer sends decides the protocol of the connection:
+// FRAME_MAGIC selects frames, anything else the old line-based text
+// protocol, which the server converts to frames (frame_from_text).
+
+#define FRAME_MAGIC 0xFA
+#define FRAME_HEADER_SIZE 16
+#define FRAME_MAX_PAYLOAD (1024 * 1024)
+#define FRAME_MAX_COMMAND (MAX_MESSAGE - FRAME_HEADER_SIZE)  // Payload of a command frame
+#define FRAME_DATA_CHUNK (64 * 1024)  // DATA payload senders use, so streams interleave finely
+
+typedef enum {
+    FRAME_UNKNOWN = 0,
+
+    // Client socket
+    FRAME_REGISTER_CLIENT = 1,
+    FRAME_UPLOAD_FILE = 2,          // flags: mode, priority, payload: size (8 bytes) + filename
+    FRAME_GET_SCAN_STATUS = 3,      // job_id
+    FRAME_GET_SCAN_RESULT = 4,      // job_id
+    FRAME_DOWNLOAD_FILE = 5,        // flags: mode, payload: filename
+    FRAME_SUBSCRIBE = 6,            // job_id
+
+    // Admin socket
+    FRAME_ADMIN_AUTH = 32,
+    FRAME_SET_LOG_LEVEL = 33,       // payload: level name
+    FRAME_GET_LOGS = 34,
+    FRAME_GET_STATS = 35,
+    FRAME_GET_WORKER_STATS = 36,
+    FRAME_DISCONNECT_CLIENT = 37,   // payload: client IP
+    FRAME_SHUTDOWN_SERVER = 38,
+    FRAME_RELOAD_SIGNATURES = 39,
+    FRAME_GET_QUEUE_STATS = 40,
+    FRAME_GET_ONACCESS_STATS = 41,
+    FRAME_GET_PREFILTER_STATS = 42,
+
+    // Either direction
+    FRAME_RESPONSE = 64,            // flags: status, payload: message
+    FRAME_NOTIFY = 65,              // flags: status, job_id, payload: scan result
+    FRAME_DATA = 66                 // Upload / download bytes
+} frame_type_t;
+
+// Flags of commands and data frames
+#define FRAME_FLAG_PLAIN 0x0001     // Transfer mode PLAIN
+#define FRAME_FLAG_GCM 0x0002       // Transfer mode GCM
+#define FRAME_FLAG_END 0x0004       // Last data frame of a download
+#define FRAME_FLAG_HIGH 0x0010      // UPLOAD_FILE priority HIGH
+#define FRAME_FLAG_LOW 0x0020       // UPLOAD_FILE priority LOW
+#define FRAME_FLAG_MALFORMED 0x8000 // Text command with unusable arguments (shim)
+
+// Status codes of FRAME_RESPONSE / FRAME_NOTIFY (the RESP_* words)
+typedef enum {
+    FRAME_STATUS_OK = 0,
+    FRAME_STATUS_ERROR = 1,
+    FRAME_STATUS_NOT_FOUND = 2,
+    FRAME_STATUS_PENDING = 3,
+    FRAME_STATUS_SIZE = 4,          // Download accepted, payload: stream size
+    FRAME_STATUS_CLEAN = 5,
+    FRAME_STATUS_INFECTED = 6,
+    FRAME_STATUS_RETRY_AFTER = 7    // Upload refused for now, payload: "<ms> <reason>"
+} frame_status_t;
+
+typedef struct {
+    uint8_t type;
+    uint16_t flags;
+    uint32_t stream_id;
+    uint32_t job_id;
+    uint32_t length;
+} frame_header_t;
+
+void frame_header_encode(const frame_header_t* header, unsigned char* out);
+int frame_header_decode(const unsigned char* in, frame_header_t* header);
+
+int frame_status_code(const char* status);
+const char* frame_status_name(int code);
+const char* frame_type_name(int type);
+
+// Encode header + payload into out (FRAME_HEADER_SIZE + length bytes)
+size_t frame_encode(unsigned char* out, int type, int flags, uint32_t stream_id, uint32_t job_id,
+                    const void* payload, size_t length);
+
+// UPLOAD_FILE payload
+size_t frame_upload_payload(unsigned char* out, size_t out_size, const char* filename, uint64_t size);
+int frame_parse_upload(const unsigned char* payload, size_t length, char* filename, size_t filename_size,
+                       uint64_t* size);
+
+// Text compatibility: one command line ("UPLOAD_FILE a.txt 1040 GCM LOW") as
+// a frame. Unknown commands get FRAME_UNKNOWN; a known command with bad
+// arguments gets FRAME_FLAG_MALFORMED so the usage message can be sent.
+void frame_from_text(const char* line, frame_header_t* header, unsigned char* payload, size_t payload_size);
+
+// Streaming decoder: feed it whatever recv returned, then take complete
+// messages with frame_decoder_next. With allow_text, a connection whose
+// first byte is not FRAME_MAGIC is read as text lines, which come out as
+// frames through frame_from_text.
+typedef struct {
+    unsigned char* buffer;
+    size_t start;                   // First unconsumed byte
+    size_t length;                  // End of the buffered bytes
+    size_t capacity;
+    int allow_text;
+    int mode;                       // -1 not known yet, 0 frames, 1 text
+    unsigned char* text_payload;    // Shim output (FRAME_MAX_COMMAND bytes)
+} frame_decoder_t;
+
+int frame_decoder_init(frame_decoder_t* decoder, int allow_text);
+void frame_decoder_free(frame_decoder_t* decoder);
+int frame_decoder_feed(frame_decoder_t* decoder, const void* data, size_t length);
+int frame_decoder_next(frame_decoder_t* decoder, frame_header_t* header, unsigned char** payload);
+size_t frame_decoder_buffered(const frame_decoder_t* decoder);
+
+// Blocking send of one response in the connection's protocol
+int send_frame_response(int socket_fd, int framed, const char* status, uint32_t job_id, const char* message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_H
@@ -0,0 +1,54 @@
+#ifndef HASH_SIGNATURES_H
+#define HASH_SIGNATURES_H
+
+#include "common.h"
+#include "scan_engine.h"
+
+#define HASH_SIGNATURE_ANY_SIZE ((size_t)-1)   // "*" in a .hsb line
+
+// Whole-file hash signatures from the ClamAV database directory.
+//
+// ClamAV matches .hdb (MD5) and .hsb (MD5, SHA-1 or SHA-256) signatures
+// against the hash of the whole file it scans. A file scanned in chunks
+// (chunked_scan.h) is never seen whole by ClamAV, so these signatures are
+// loaded a second time here and checked against the complete file.
+//
+// The plain .hdb/.hsb files of the directory are read, and the ones
+// inside .cvd/.cld/.cud containers (a 512-byte header, then a tar that
+// is usually gzipped). Names listed in .ign2 files are dropped, as
+// cl_load does. Only signatures for files of at least min_size bytes,
+// or of any size, are kept: smaller files are always scanned whole.
+typedef enum {
+    HASH_MD5,
+    HASH_SHA1,
+    HASH_SHA256,
+    HASH_TYPE_COUNT
+} hash_type_t;
+
+typedef struct {
+    size_t size;                        // File size, HASH_SIGNATURE_ANY_SIZE for any
+    hash_type_t type;
+    unsigned char digest[32];
+    char* name;
+} hash_signature_t;
+
+typedef struct {
+    hash_signature_t* signatures;       // Sorted by size, then type and digest
+    size_t count;
+    size_t capacity;
+    size_t any_size_start;              // Index of the first "*" signature
+} hash_signatures_t;
+
+// flevel is the libclamav functionality level: .hsb lines asking for a
+// newer one are skipped. NULL only when out of memory; unreadable files
+// are logged and skipped.
+hash_signatures_t* hash_signatures_load(const char* db_dir, size_t min_size, unsigned int flevel);
+void hash_signatures_free(hash_signatures_t* set);
+
+// Check the size bytes of fd against the set. The file is read only when
+// a signature has its size; sha256 (may be NULL) is the content hash
+// already known, so a SHA-256 signature alone does not need a read.
+int hash_signatures_match(const hash_signatures_t* set, int fd, size_t size,
+                          const unsigned char* sha256, char* virus_name, size_t virus_name_size);
+
+#endif // HASH_SIGNATURES_H
@@ -0,0 +1,35 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include "common.h"
+
+// Job table.
+//
+// Jobs live in a fixed array of slots. A job id encodes its slot
+// (slot = (job_id - 1) % capacity), so lookups by id are O(1); the stored
+// job_id is compared to detect ids whose slot has already been recycled.
+// Finished slots go to a ring from which new jobs are allocated (oldest
+// result is recycled first). All operations are O(1); callers hold
+// state->jobs_mutex. Pending jobs are handed to the scan workers through
+// the lock-free scan queue (mpmc_queue.h), not through this table.
+struct job_table {
+    scan_job_t* jobs;
+    unsigned int* generation;   // Times each slot has been reused
+    int capacity;
+
+    int* reusable;              // Ring of free or finished slots, oldest first
+    int reusable_head;
+    int reusable_count;
+};
+
+job_table_t* job_table_create(int capacity);
+void job_table_destroy(job_table_t* table);
+
+scan_job_t* job_table_alloc(job_table_t* table);
+scan_job_t* job_table_lookup(job_table_t* table, int job_id);
+void job_table_finish(job_table_t* table, scan_job_t* job);
+
+// Jobs pending or being scanned
+int job_table_active(const job_table_t* table);
+
+#endif // JOB_QUEUE_H
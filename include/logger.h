@@ -0,0 +1,27 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "common.h"
+#include <stdarg.h>
+
+// Asynchronous batched logger.
+//
+// Every thread formats its lines into its own single-producer ring, so
+// logging takes no lock and makes no system call on the hot path. A
+// flusher thread collects the rings and writes each batch with one
+// writev to the console and one to the log file, which stays open.
+// When a ring is full, warnings and errors wait briefly for the flusher
+// (backpressure); lower levels are dropped and counted.
+
+#define LOG_RING_SIZE 1024              // Lines per thread, power of two
+#define LOG_ENTRY_SIZE 512              // Longer lines are truncated
+#define LOG_FLUSH_INTERVAL_MS 100
+#define LOG_BACKPRESSURE_SPINS 1000     // Yields before a full ring drops the line
+#define LOG_FILE_PATH "logs/server.log"
+
+int logger_init(const char* path);
+void logger_shutdown(void);
+void logger_vwrite(log_level_t level, const char* format, va_list args);
+unsigned long logger_dropped_count(void);
+
+#endif // LOGGER_H
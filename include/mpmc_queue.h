@@ -0,0 +1,38 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+#define MPMC_SPIN_COUNT 16      // try_pop attempts before a consumer parks
+
+// Bounded lock-free multi-producer/multi-consumer queue (Vyukov).
+// Each cell carries a sequence number telling producers and consumers
+// whether it is free or full for the current lap, so push and pop only
+// need one CAS on the shared position. Consumers that find the queue
+// empty park on an eventfd; producers only signal it when someone waits.
+typedef struct {
+    size_t sequence;
+    void* data;
+} mpmc_cell_t;
+
+struct mpmc_queue {
+    mpmc_cell_t* cells;
+    size_t mask;
+    int event_fd;
+
+    size_t enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+    int waiters __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+typedef struct mpmc_queue mpmc_queue_t;
+
+int mpmc_queue_init(mpmc_queue_t* queue, size_t capacity);
+void mpmc_queue_destroy(mpmc_queue_t* queue);
+int mpmc_queue_push(mpmc_queue_t* queue, void* item);
+void* mpmc_queue_try_pop(mpmc_queue_t* queue);
+void* mpmc_queue_pop_wait(mpmc_queue_t* queue, int timeout_ms);
+size_t mpmc_queue_size(mpmc_queue_t* queue);
+
+#endif // MPMC_QUEUE_H
@@ -0,0 +1,65 @@
+#ifndef ONACCESS_H
+#define ONACCESS_H
+
+#include "common.h"
+
+#define ONACCESS_TIMEOUT_DEFAULT_MS 1000    // Longest an open waits for its verdict
+#define ONACCESS_SCAN_THREADS 2
+#define ONACCESS_MAX_PENDING 1024           // Opens waiting for a verdict (each holds an fd)
+#define ONACCESS_CACHE_SLOTS 65536          // Identity cache, direct mapped
+#define ONACCESS_EVENT_BUFFER (64 * 1024)
+#define ONACCESS_HISTOGRAM_BUCKETS 25       // Bucket i: latency < 2^i us, the last one is everything else
+
+// Fail policy: the answer when no verdict is available in time
+typedef enum {
+    ONACCESS_FAIL_OPEN,                 // Allow the open
+    ONACCESS_FAIL_CLOSED                // Deny it (EPERM)
+} onaccess_policy_t;
+
+// How an open was decided
+typedef enum {
+    ONACCESS_PASS,                      // Not subject to scanning (outside the tree, empty, the server itself)
+    ONACCESS_CACHED,                    // Identity cache: same inode, unchanged since its scan
+    ONACCESS_VERDICT,                   // Same content scanned before (result cache / verdict store)
+    ONACCESS_SCANNED,                   // Scanned in time
+    ONACCESS_ERROR,                     // Scan failed: fail policy
+    ONACCESS_TIMEOUT,                   // No verdict within the timeout: fail policy
+    ONACCESS_OVERLOAD,                  // ONACCESS_MAX_PENDING reached: fail policy
+    ONACCESS_DECISION_COUNT
+} onaccess_decision_t;
+
+typedef struct {
+    unsigned long allowed;
+    unsigned long denied;
+    unsigned long histogram[ONACCESS_HISTOGRAM_BUCKETS];
+} onaccess_stats_t;
+
+// On-access scanning with fanotify.
+//
+// Every open of a regular file on the mount holding path (and, if path
+// is not the root of its mount, under path) waits for a verdict
+// (FAN_OPEN_PERM, in a FAN_CLASS_CONTENT group): infected files fail to
+// open with EPERM. A reader thread answers what it can at once (opens
+// outside the tree, empty files, opens by the server itself, inodes
+// unchanged since their last scan) and queues the rest for
+// ONACCESS_SCAN_THREADS threads. These hash the file through the fd of
+// the event, look the hash up in the result cache and verdict store, and
+// only scan content never seen with the current signatures. Every
+// verdict is shared with the upload path through those caches.
+//
+// An open is answered within timeout_ms whatever happens: if the scan is
+// still running then, the fail policy decides and the scan goes on to
+// fill the caches for the next open. The identity cache entry of a file
+// is dropped when a writer closes it (FAN_CLOSE_WRITE).
+//
+// Needs CAP_SYS_ADMIN.
+onaccess_t* onaccess_start(server_state_t* state, const char* path, onaccess_policy_t policy, int timeout_ms);
+void onaccess_stop(onaccess_t* onaccess);
+
+// Counters and latency histogram of each decision
+void onaccess_get_stats(onaccess_t* onaccess, onaccess_stats_t stats[ONACCESS_DECISION_COUNT]);
+void onaccess_format_stats(onaccess_t* onaccess, char* buffer, size_t buffer_size);
+
+int onaccess_parse_policy(const char* name, onaccess_policy_t* policy);
+
+#endif // ONACCESS_H
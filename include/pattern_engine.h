@@ -0,0 +1,68 @@
+#ifndef PATTERN_ENGINE_H
+#define PATTERN_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PATTERN_MIN_LENGTH 2                // The prefilter works on the first two bytes
+#define PATTERN_MAX_LENGTH 255
+#define PATTERN_MAX_NAME 128
+#define PATTERN_DENSE_STATES 1024           // Shallowest states with full 256-entry rows
+#define PATTERN_NO_MATCH ((uint32_t)-1)
+
+// Multi-pattern byte matcher (in-house IOCs next to ClamAV).
+//
+// The patterns compile into an Aho-Corasick automaton numbered in BFS
+// order, so the shallow states, where scanning spends its time, are
+// packed together: the first PATTERN_DENSE_STATES have full transition
+// rows (failure links resolved), deeper ones a fail link and their edges
+// as a sorted label array plus targets. Every state knows the first
+// pattern ending at it or at a state on its fail chain, so a match is
+// found on the byte that completes it.
+//
+// Whenever the automaton is back within three bytes of the root, a
+// prefilter jumps to the next position where some pattern may start: a
+// 64 Kbit bitmap of first byte pairs, then a hashed bitmap of the first
+// four bytes (patterns of two or three bytes are decided by the pair),
+// with SIMD byte-set tests (SSSE3 / AVX2, picked from the CPU) in front
+// when the first and second bytes of the patterns are selective enough
+// for them to skip anything.
+//
+// Scanning is streaming: the state is carried from one block to the next.
+
+typedef struct {
+    const char* name;
+    const unsigned char* bytes;
+    size_t length;
+} pattern_t;
+
+typedef struct pattern_engine pattern_engine_t;
+
+// NULL on error, with the reason in error
+pattern_engine_t* pattern_engine_compile(const pattern_t* patterns, size_t count, char* error, size_t error_size);
+
+// Signature file: one "Name:hexbytes" per line, '#' starts a comment
+pattern_engine_t* pattern_engine_load(const char* path, char* error, size_t error_size);
+
+void pattern_engine_free(pattern_engine_t* engine);
+
+// Scan the next block of a stream (*state starts at 0). Returns the index
+// of the first pattern that ends in the block, or PATTERN_NO_MATCH;
+// *end gets the offset in the block just past the match.
+uint32_t pattern_engine_scan(const pattern_engine_t* engine, uint32_t* state,
+                             const unsigned char* data, size_t length, size_t* end);
+
+size_t pattern_engine_count(const pattern_engine_t* engine);
+size_t pattern_engine_states(const pattern_engine_t* engine);
+size_t pattern_engine_memory(const pattern_engine_t* engine);
+const char* pattern_engine_name(const pattern_engine_t* engine, uint32_t pattern);
+
+// Content digest of the patterns (changes when the signature file does)
+uint64_t pattern_engine_version(const pattern_engine_t* engine);
+
+// Prefilter kernel in use ("avx2", "ssse3", "scalar"; "pairs" when the
+// patterns are not selective enough for SIMD) and override (benchmarks)
+const char* pattern_engine_kernel(const pattern_engine_t* engine);
+int pattern_kernel_select(const char* name);
+
+#endif // PATTERN_ENGINE_H
@@ -0,0 +1,45 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "common.h"
+#include "scan_engine.h"
+
+#define RESULT_CACHE_CAPACITY 16384
+
+// Scan verdicts keyed by content hash + signature version.
+// Fixed number of entries in a hash table with chaining; when it is
+// full, CLOCK picks the victim (entries hit since the hand last passed
+// get a second chance). Only CLEAN and INFECTED verdicts are cached.
+typedef struct {
+    unsigned char hash[CONTENT_HASH_SIZE];
+    unsigned long long signature_version;
+    int verdict;                        // SCAN_RESULT_CLEAN / SCAN_RESULT_INFECTED
+    char virus_name[MAX_VIRUS_NAME];
+    int next;                           // Bucket chain, -1 terminates
+    int in_use;
+    int referenced;                     // CLOCK bit
+} result_cache_entry_t;
+
+struct result_cache {
+    result_cache_entry_t* entries;
+    int* buckets;
+    size_t capacity;
+    size_t num_buckets;
+    size_t count;
+    size_t clock_hand;
+    pthread_mutex_t mutex;
+
+    unsigned long hits;
+    unsigned long misses;
+};
+
+result_cache_t* result_cache_create(size_t capacity);
+void result_cache_destroy(result_cache_t* cache);
+int result_cache_lookup(result_cache_t* cache, const unsigned char* hash, unsigned long long signature_version,
+                        int* verdict, char* virus_name, size_t virus_name_size);
+void result_cache_insert(result_cache_t* cache, const unsigned char* hash, unsigned long long signature_version,
+                         int verdict, const char* virus_name);
+void result_cache_clear(result_cache_t* cache);
+void result_cache_get_stats(result_cache_t* cache, unsigned long* hits, unsigned long* misses, size_t* entries);
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,31 @@
+#ifndef SCAN_ENGINE_H
+#define SCAN_ENGINE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Scan results (same meaning as the return value of scan_file_with_clamav)
+#define SCAN_RESULT_ERROR -1
+#define SCAN_RESULT_CLEAN 0
+#define SCAN_RESULT_INFECTED 1
+
+#define MAX_VIRUS_NAME 128
+#define SCAN_PARSERS_ALL (~0u)    // ClamAV parser mask (CL_SCAN_PARSE_*): every format
+
+// In-process ClamAV engine.
+// The signature database is loaded and compiled by scan_engine_init; the
+// engine is then read-only and shared by all scanner threads until
+// scan_engine_reload replaces it.
+int scan_engine_init(const char* db_dir);
+int scan_engine_reload(void);
+void scan_engine_cleanup(void);
+int scan_engine_scan_file(const char* filepath, unsigned int parsers, char* virus_name, size_t virus_name_size);
+int scan_engine_scan_range(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                           size_t virus_name_size);
+int scan_engine_scan_buffer(const void* data, size_t length, char* virus_name, size_t virus_name_size);
+int scan_engine_scan_hashes(int fd, size_t size, const unsigned char* sha256, char* virus_name,
+                            size_t virus_name_size);
+unsigned int scan_engine_signature_count(void);
+unsigned long long scan_engine_signature_version(void);
+
+#endif // SCAN_ENGINE_H
@@ -0,0 +1,95 @@
+#ifndef SCAN_SCHEDULER_H
+#define SCAN_SCHEDULER_H
+
+#include "common.h"
+#include "mpmc_queue.h"
+
+#define SCHED_FLOW_BUCKETS 256
+#define SCHED_QUANTUM (1024 * 1024)             // Bytes a client may send to scan per round
+#define SCHED_MIN_COST (64 * 1024)              // Per-job overhead of a scan, in bytes
+#define SCHED_MAX_COST (16 * 1024 * 1024)       // Larger files are split (chunked_scan.h)
+#define SCHED_LOW_PRIORITY_FACTOR 4             // LOW jobs cost four times their size
+#define SCHED_FAST_LANE_SIZE (256 * 1024)       // Files up to this size take the fast lane
+#define SCHED_FAST_LANE_BURST 8                 // Fast lane picks before a normal one is due
+
+typedef enum {
+    SCAN_PRIORITY_NORMAL = 0,
+    SCAN_PRIORITY_HIGH = 1,                     // Fast lane whatever the size
+    SCAN_PRIORITY_LOW = 2                       // Never in the fast lane, costs more
+} scan_priority_t;
+
+typedef enum {
+    SCHED_LANE_FAST = 0,
+    SCHED_LANE_NORMAL = 1,
+    SCHED_NUM_LANES = 2
+} sched_lane_t;
+
+// Order in which pending jobs reach the scan workers.
+//
+// Each client (by IP address) has a flow with one FIFO per lane. Within
+// a lane, flows take turns by deficit round robin: every turn adds
+// SCHED_QUANTUM to the flow's deficit and the flow may dispatch jobs as
+// long as their cost (file size, clamped) fits in it. A client with ten
+// thousand queued files therefore gets the same share as a client with
+// one. The fast lane goes round robin by job (small files cost about the
+// same to scan) and is served first, but after SCHED_FAST_LANE_BURST
+// fast picks in a row a waiting normal job is taken, so large files are
+// never starved.
+//
+// Jobs leave the scheduler as late as possible: only `window` of them
+// (one per worker) sit in scan_queue at a time, the rest wait here where
+// later arrivals from other clients can overtake them.
+typedef struct sched_flow sched_flow_t;
+
+typedef struct {
+    scan_job_t* head;                  // FIFO through scan_job_t.sched_next
+    scan_job_t* tail;
+    long long deficit;
+    int count;
+    sched_flow_t* next_active;
+} sched_flow_queue_t;
+
+struct sched_flow {
+    char address[INET_ADDRSTRLEN];
+    sched_flow_queue_t lanes[SCHED_NUM_LANES];
+    size_t queued_bytes;
+    unsigned long dispatched;          // Since the flow last had an empty queue
+    unsigned long long total_wait_ms;
+    sched_flow_t* next;                // Hash bucket chain
+};
+
+// Flows with jobs in a lane, in turn order
+typedef struct {
+    sched_flow_t* head;
+    sched_flow_t* tail;
+    int jobs;
+} sched_active_list_t;
+
+struct scan_scheduler {
+    pthread_mutex_t mutex;
+    mpmc_queue_t* queue;
+    int window;
+    int dispatched;                    // In scan_queue, not taken by a worker yet
+    int fast_streak;
+    sched_flow_t* buckets[SCHED_FLOW_BUCKETS];
+    int flow_count;
+    sched_active_list_t lanes[SCHED_NUM_LANES];
+
+    unsigned long total_dispatched;
+    unsigned long long total_wait_ms;
+};
+
+scan_scheduler_t* scan_scheduler_create(mpmc_queue_t* queue, int window);
+void scan_scheduler_destroy(scan_scheduler_t* scheduler);
+void scan_scheduler_set_window(scan_scheduler_t* scheduler, int window);
+
+// Queue a pending job (client_address and priority set) and dispatch
+void scan_scheduler_submit(scan_scheduler_t* scheduler, scan_job_t* job);
+
+// A worker took a dispatched job from scan_queue: its place goes to the next one
+void scan_scheduler_job_started(scan_scheduler_t* scheduler);
+
+// "Queued: 12, Avg wait: 340 ms | 10.0.0.5: 9000 jobs (fast 0) 812 MB, oldest 8400 ms, avg wait 4100 ms | ..."
+void scan_scheduler_format_stats(scan_scheduler_t* scheduler, char* buffer, size_t buffer_size);
+
+#endif // SCAN_SCHEDULER_H
@@ -0,0 +1,48 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include "scan_engine.h"
+
+// Scan backends behind one interface: the in-house pattern matcher
+// (pattern_engine.h, loaded from the file given with -s) and ClamAV
+// (scan_engine.h). A scan runs the backends in that order and stops at
+// the first detection, so a pattern hit never reaches ClamAV; an error
+// from one backend is reported only when none detects anything.
+//
+// Callers use scanner_* for every scan and signature version; the
+// scan_engine_* functions are the ClamAV backend.
+
+typedef struct {
+    const char* name;
+    int (*scan_file)(const char* filepath, unsigned int parsers, char* virus_name, size_t virus_name_size);
+    int (*scan_range)(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                      size_t virus_name_size);
+    int (*scan_buffer)(const void* data, size_t length, char* virus_name, size_t virus_name_size);
+    // Whole-file hash signatures of a file scanned in ranges; NULL without any
+    int (*scan_hashes)(int fd, size_t size, const unsigned char* sha256, char* virus_name,
+                       size_t virus_name_size);
+    unsigned long long (*signature_version)(void);
+} scanner_backend_t;
+
+// patterns_path may be NULL (ClamAV only)
+int scanner_init(const char* db_dir, const char* patterns_path);
+
+// Reload every backend. -1 if the ClamAV database could not be loaded
+// (nothing changes then); otherwise 1 if the combined signature version
+// changed, 0 if not, with *patterns_failed set when the pattern file
+// could not be loaded and the old patterns stay in use.
+int scanner_reload(int* patterns_failed);
+void scanner_cleanup(void);
+
+int scanner_scan_file(const char* filepath, unsigned int parsers, char* virus_name, size_t virus_name_size);
+int scanner_scan_range(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                       size_t virus_name_size);
+int scanner_scan_buffer(const void* data, size_t length, char* virus_name, size_t virus_name_size);
+int scanner_scan_hashes(int fd, size_t size, const unsigned char* sha256, char* virus_name,
+                        size_t virus_name_size);
+
+// Identifies the signatures of all backends (verdict caches key on it)
+unsigned long long scanner_signature_version(void);
+size_t scanner_pattern_count(void);
+
+#endif // SCANNER_H
@@ -0,0 +1,78 @@
+#ifndef VERDICT_STORE_H
+#define VERDICT_STORE_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Persistent verdict cache (content hash -> verdict), kept across restarts.
+//
+// Two files:
+//   verdicts.db  - records sorted by (hash, signature version), mapped
+//                  read-only and searched with a binary search, so startup
+//                  cost does not depend on how many entries it holds
+//   verdicts.log - new verdicts appended as they are produced; at most
+//                  VERDICT_COMPACT_THRESHOLD records, indexed in memory
+// A background thread merges the log into a new verdicts.db and drops
+// records of older signature versions. Losing the tail of the log in a
+// crash only costs a rescan.
+
+#define VERDICT_STORE_DIR "cache"
+#define VERDICT_DB_PATH VERDICT_STORE_DIR "/verdicts.db"
+#define VERDICT_LOG_PATH VERDICT_STORE_DIR "/verdicts.log"
+#define VERDICT_COMPACT_THRESHOLD 65536
+#define VERDICT_NAME_SIZE 72            // Longer virus names are truncated
+#define VERDICT_DB_MAGIC "AVVDB001"
+
+typedef struct {
+    unsigned char hash[CONTENT_HASH_SIZE];
+    uint64_t signature_version;
+    int64_t timestamp;
+    int32_t verdict;                    // SCAN_RESULT_CLEAN / SCAN_RESULT_INFECTED
+    uint32_t checksum;                  // Rejects torn records in the log
+    char virus_name[VERDICT_NAME_SIZE];
+} verdict_record_t;                     // 128 bytes
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t reserved[6];
+} verdict_db_header_t;                  // 64 bytes, records follow
+
+struct verdict_store {
+    pthread_rwlock_t lock;
+
+    // Sorted base file
+    void* base_map;
+    size_t base_map_size;
+    const verdict_record_t* base;
+    size_t base_count;
+
+    // Log records, in memory with an open-addressing index. During a
+    // compaction the first frozen_count records belong to the rotated log.
+    int log_fd;
+    verdict_record_t* log_records;
+    size_t log_count;
+    size_t log_capacity;
+    size_t frozen_count;
+    uint32_t* log_index;                // Record index + 1, 0 = empty
+    size_t log_index_size;
+
+    // Compaction thread
+    pthread_t compactor;
+    pthread_mutex_t compact_mutex;
+    pthread_cond_t compact_cond;
+    int compact_requested;
+    int running;
+    unsigned long long (*current_version)(void);
+};
+
+verdict_store_t* verdict_store_open(unsigned long long (*current_version)(void));
+void verdict_store_close(verdict_store_t* store);
+int verdict_store_lookup(verdict_store_t* store, const unsigned char* hash, unsigned long long signature_version,
+                         int* verdict, char* virus_name, size_t virus_name_size);
+void verdict_store_append(verdict_store_t* store, const unsigned char* hash, unsigned long long signature_version,
+                          int verdict, const char* virus_name);
+void verdict_store_compact(verdict_store_t* store);
+size_t verdict_store_count(verdict_store_t* store);
+
+#endif // VERDICT_STORE_H
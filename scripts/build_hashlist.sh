@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# =============================================================================
+# Antivirus Server - Hash list builder
+# =============================================================================
+#
+# Turns SHA-256 digests (sha256sum output, or one hex digest per line) into
+# the sorted binary list the server maps (hashlists/allow.sha256,
+# hashlists/block.sha256). Reload with RELOAD_SIGNATURES from the admin
+# client, or restart the server.
+#
+# Usage: scripts/build_hashlist.sh <output> [input...]   (stdin without inputs)
+# Example: sha256sum /opt/vendor/bin/* | scripts/build_hashlist.sh hashlists/allow.sha256
+
+set -e
+set -o pipefail
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <output> [input...]" >&2
+    exit 1
+fi
+
+OUTPUT="$1"
+shift
+
+mkdir -p "$(dirname "$OUTPUT")"
+TMP="$OUTPUT.tmp.$$"
+trap 'rm -f "$TMP"' EXIT
+
+# Lowercase hex sorted bytewise is the byte order of the digests
+cat "$@" | grep -oE '^[0-9a-fA-F]{64}' | tr 'A-F' 'a-f' | LC_ALL=C sort -u |
+    perl -ne 'chomp; print pack("H64", $_)' > "$TMP"
+
+# Replaced in one step: the server may be mapping the old list
+mv "$TMP" "$OUTPUT"
+trap - EXIT
+echo "$OUTPUT: $(( $(wc -c < "$OUTPUT") / 32 )) digests"
@@ -1,4 +1,5 @@
 #include "../../include/common.h"
+#include "../../include/frame.h"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -17,13 +18,17 @@ private:
     
     std::vector<std::string> log_messages;
     std::string current_command;
+    frame_decoder_t decoder;       // Response frames received but not read yet
     
 public:
     AdminClient() : socket_fd(-1), connected(false), main_win(NULL), 
-                   log_win(NULL), command_win(NULL), stats_win(NULL) {}
+                   log_win(NULL), command_win(NULL), stats_win(NULL) {
+        frame_decoder_init(&decoder, 0);
+    }
     
     ~AdminClient() {
         cleanup();
+        frame_decoder_free(&decoder);
     }
     
     bool connect_to_server() {
@@ -57,29 +62,43 @@ public:
         connected = false;
     }
     
+    // Text command ("SET_LOG_LEVEL DEBUG"), sent as the equivalent frame
     bool send_command(const std::string& command) {
         if (!connected) return false;
         
-        std::string cmd = command + "\n";
-        int bytes_sent = send(socket_fd, cmd.c_str(), cmd.length(), 0);
-        if (bytes_sent == -1) {
+        unsigned char frame[FRAME_HEADER_SIZE + FRAME_MAX_COMMAND];
+        frame_header_t header;
+        frame_from_text(command.c_str(), &header, frame + FRAME_HEADER_SIZE, FRAME_MAX_COMMAND);
+        frame_header_encode(&header, frame);
+        
+        size_t length = FRAME_HEADER_SIZE + header.length;
+        if (send(socket_fd, frame, length, MSG_NOSIGNAL) != (ssize_t)length) {
             perror("send");
             return false;
         }
         return true;
     }
     
+    // Next response as "<status> <message>" (the text protocol's form)
     std::string receive_response() {
         if (!connected) return "";
         
-        char buffer[MAX_MESSAGE];
-        int bytes_received = recv(socket_fd, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            return "";
+        frame_header_t header;
+        unsigned char* payload;
+        for (;;) {
+            int result = frame_decoder_next(&decoder, &header, &payload);
+            if (result == 1) break;
+            if (result == -1) return "";
+            
+            char buffer[MAX_MESSAGE];
+            ssize_t bytes_received = recv(socket_fd, buffer, sizeof(buffer), 0);
+            if (bytes_received <= 0 || frame_decoder_feed(&decoder, buffer, bytes_received) != 0) {
+                return "";
+            }
         }
         
-        buffer[bytes_received] = '\0';
-        return std::string(buffer);
+        return std::string(frame_status_name(header.flags)) + " " +
+               std::string((const char*)payload, header.length);
     }
     
     void init_ui() {
@@ -173,8 +192,8 @@ public:
         
         // Command help
         mvwprintw(command_win, 1, 2, "1: Set Log Level  2: Get Stats");
-        mvwprintw(command_win, 2, 2, "3: Get Logs       4: Disconnect Client");
-        mvwprintw(command_win, 3, 2, "5: Shutdown       q: Quit");
+        mvwprintw(command_win, 2, 2, "3: Get Logs       4: Disconnect Client  8: Queue Stats  9: On-access Stats");
+        mvwprintw(command_win, 3, 2, "5: Shutdown       6: Worker Stats   7: Reload Signatures  0: Prefilter Stats  q: Quit");
         mvwprintw(command_win, 4, 2, "Command: %s", current_command.c_str());
         
         wrefresh(command_win);
@@ -258,6 +277,29 @@ public:
         }
     }
     
+    // One-line counters: GET_WORKER_STATS, GET_QUEUE_STATS and the like
+    void handle_stats(const std::string& command, const std::string& title) {
+        send_command(command);
+        std::string response = receive_response();
+        
+        if (!response.empty()) {
+            if (response.find("OK ") == 0) {
+                add_log_message(title + ": " + response.substr(3));
+            } else {
+                add_log_message("Error getting " + title + ": " + response);
+            }
+        }
+    }
+    
+    void handle_reload_signatures() {
+        send_command("RELOAD_SIGNATURES");
+        std::string response = receive_response();
+        
+        if (!response.empty()) {
+            add_log_message("Reload signatures: " + response);
+        }
+    }
+    
     void handle_disconnect_client() {
         wclear(command_win);
         box(command_win, 0, 0);
@@ -326,6 +368,21 @@ public:
                 case '5':
                     handle_shutdown();
                     break;
+                case '6':
+                    handle_stats("GET_WORKER_STATS", "Worker stats");
+                    break;
+                case '7':
+                    handle_reload_signatures();
+                    break;
+                case '8':
+                    handle_stats("GET_QUEUE_STATS", "Queue stats");
+                    break;
+                case '9':
+                    handle_stats("GET_ONACCESS_STATS", "On-access stats");
+                    break;
+                case '0':
+                    handle_stats("GET_PREFILTER_STATS", "Prefilter stats");
+                    break;
                 case KEY_RESIZE:
                     // Handle terminal resize
                     endwin();
@@ -37,6 +37,19 @@ void get_current_timestamp(char* buffer, size_t buffer_size) {
     strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", timeinfo);
 }
 
+// Monotonic clock for timeouts and durations (not affected by clock changes)
+unsigned long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+unsigned long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000;
+}
+
 int create_directory_if_not_exists(const char* path) {
     struct stat st = {0};
     if (stat(path, &st) == -1) {
@@ -79,105 +92,201 @@ int send_response(int socket_fd, const char* status, const char* message) {
     return bytes_sent;
 }
 
-int receive_file(int socket_fd, const char* filepath, size_t expected_size) {
-    FILE* file = fopen(filepath, "wb");
-    if (!file) {
-        perror("fopen");
+// Zero-copy transfer layer
+
+// Pipe used as the in-kernel buffer between a socket and a file
+int transfer_pipe_open(int pipe_fds[2]) {
+    if (pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) == -1) {
         return -1;
     }
-    
-    char buffer[BUFFER_SIZE];
-    size_t total_received = 0;
-    
-    while (total_received < expected_size) {
-        size_t remaining = expected_size - total_received;
-        size_t to_receive = (remaining < BUFFER_SIZE) ? remaining : BUFFER_SIZE;
-        
-        int bytes_received = recv(socket_fd, buffer, to_receive, 0);
-        if (bytes_received <= 0) {
-            fclose(file);
-            unlink(filepath); // Remove incomplete file
-            return -1;
+    // Bigger pipe = fewer splice round trips; keep the default if refused
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, TRANSFER_PIPE_SIZE);
+    return 0;
+}
+
+void transfer_pipe_close(int pipe_fds[2]) {
+    for (int i = 0; i < 2; i++) {
+        if (pipe_fds[i] != -1) {
+            close(pipe_fds[i]);
+            pipe_fds[i] = -1;
         }
-        
-        fwrite(buffer, 1, bytes_received, file);
-        total_received += bytes_received;
     }
-    
-    fclose(file);
-    return 0;
 }
 
-int send_file(int socket_fd, const char* filepath) {
-    FILE* file = fopen(filepath, "rb");
-    if (!file) {
-        perror("fopen");
-        return -1;
+// Move up to length bytes socket -> pipe -> file without copying them
+// through user space. Returns the bytes written to the file, 0 on EOF or
+// -1 on error (EAGAIN: socket empty, EINVAL: splice not supported here).
+ssize_t splice_socket_to_file(int socket_fd, int pipe_fds[2], int file_fd, size_t length) {
+    ssize_t in_pipe;
+    do {
+        in_pipe = splice(socket_fd, NULL, pipe_fds[1], NULL, length,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (in_pipe == -1 && errno == EINTR);
+
+    if (in_pipe <= 0) {
+        return in_pipe;
     }
-    
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    // Send file size first
-    char size_header[64];
-    snprintf(size_header, sizeof(size_header), "SIZE %ld\n", file_size);
-    if (send(socket_fd, size_header, strlen(size_header), 0) == -1) {
-        fclose(file);
+
+    // The pipe must be drained completely before it is reused
+    ssize_t written = 0;
+    while (written < in_pipe) {
+        ssize_t result = splice(pipe_fds[0], NULL, file_fd, NULL, in_pipe - written, SPLICE_F_MOVE);
+        if (result == -1 && errno == EINTR) continue;
+        if (result <= 0) {
+            return -1;
+        }
+        written += result;
+    }
+    return written;
+}
+
+// Fallback when splice is unavailable: one large buffer instead of 4 KB
+static int copy_socket_to_file(int socket_fd, int file_fd, size_t remaining) {
+    char* buffer = malloc(TRANSFER_BUFFER_SIZE);
+    if (!buffer) {
         return -1;
     }
-    
-    // Send file content
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, file)) > 0) {
-        if (send(socket_fd, buffer, bytes_read, 0) == -1) {
-            fclose(file);
+
+    while (remaining > 0) {
+        size_t to_receive = (remaining < TRANSFER_BUFFER_SIZE) ? remaining : TRANSFER_BUFFER_SIZE;
+        ssize_t bytes_received = recv(socket_fd, buffer, to_receive, 0);
+        if (bytes_received == -1 && errno == EINTR) continue;
+        if (bytes_received <= 0) {
+            free(buffer);
             return -1;
         }
+
+        ssize_t written = 0;
+        while (written < bytes_received) {
+            ssize_t result = write(file_fd, buffer + written, bytes_received - written);
+            if (result == -1) {
+                if (errno == EINTR) continue;
+                free(buffer);
+                return -1;
+            }
+            written += result;
+        }
+        remaining -= bytes_received;
     }
-    
-    fclose(file);
+
+    free(buffer);
     return 0;
 }
 
-// Scanner functions (ClamAV integration)
-int scan_file_with_clamav(const char* filepath, char* result, size_t result_size) {
-    char command[MAX_PATH + 50];
-    snprintf(command, sizeof(command), "clamscan --no-summary %s", filepath);
-    
-    FILE* fp = popen(command, "r");
-    if (!fp) {
-        strncpy(result, "Error running scanner", result_size - 1);
-        result[result_size - 1] = '\0';
+// Blocking helper: wait until the socket has data again
+static int wait_readable(int socket_fd) {
+    struct pollfd pfd;
+    pfd.fd = socket_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
         return -1;
     }
-    
-    char line[256];
-    int infected = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        if (strstr(line, "FOUND")) {
-            infected = 1;
-            strncpy(result, line, result_size - 1);
-            result[result_size - 1] = '\0';
+    return 0;
+}
+
+int receive_file(int socket_fd, const char* filepath, size_t expected_size) {
+    int file_fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file_fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    size_t total_received = 0;
+    int pipe_fds[2] = { -1, -1 };
+    int use_splice = (transfer_pipe_open(pipe_fds) == 0);
+
+    while (use_splice && total_received < expected_size) {
+        ssize_t moved = splice_socket_to_file(socket_fd, pipe_fds, file_fd,
+                                              expected_size - total_received);
+        if (moved > 0) {
+            total_received += moved;
+        } else if (moved == -1 && errno == EAGAIN) {
+            if (wait_readable(socket_fd) == -1) break;
+        } else if (moved == -1 && errno == EINVAL && total_received == 0) {
+            use_splice = 0;  // Not a socket splice can read from
+        } else {
             break;
         }
     }
-    
-    pclose(fp);
-    
-    if (!infected) {
-        strncpy(result, "OK", result_size - 1);
-        result[result_size - 1] = '\0';
+    transfer_pipe_close(pipe_fds);
+
+    int result = 0;
+    if (total_received < expected_size) {
+        result = use_splice ? -1 : copy_socket_to_file(socket_fd, file_fd, expected_size - total_received);
     }
-    
-    return infected;
+
+    close(file_fd);
+    if (result != 0) {
+        unlink(filepath); // Remove incomplete file
+    }
+    return result;
+}
+
+// Send exactly length bytes of file_fd starting at offset with sendfile,
+// falling back to read/send with a large buffer if sendfile is refused.
+int send_file_range(int socket_fd, int file_fd, off_t offset, size_t length) {
+    while (length > 0) {
+        ssize_t sent = sendfile(socket_fd, file_fd, &offset, length);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS)) break;
+        if (sent <= 0) {
+            return -1;
+        }
+        length -= sent;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    char* buffer = malloc(TRANSFER_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    while (length > 0) {
+        size_t to_read = (length < TRANSFER_BUFFER_SIZE) ? length : TRANSFER_BUFFER_SIZE;
+        ssize_t bytes_read = pread(file_fd, buffer, to_read, offset);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        if (bytes_read <= 0) {
+            free(buffer);
+            return -1;
+        }
+
+        ssize_t sent = 0;
+        while (sent < bytes_read) {
+            ssize_t result = send(socket_fd, buffer + sent, bytes_read - sent, MSG_NOSIGNAL);
+            if (result == -1) {
+                if (errno == EINTR) continue;
+                free(buffer);
+                return -1;
+            }
+            sent += result;
+        }
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+
+    free(buffer);
+    return 0;
 }
 
-int is_file_infected(const char* filepath) {
-    char result[MAX_MESSAGE];
-    return scan_file_with_clamav(filepath, result, sizeof(result));
-} 
\ No newline at end of file
+int send_file(int socket_fd, const char* filepath) {
+    int file_fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1) {
+        perror("open");
+        if (file_fd != -1) close(file_fd);
+        return -1;
+    }
+
+    // Send file size first
+    char size_header[64];
+    snprintf(size_header, sizeof(size_header), "SIZE %ld\n", (long)st.st_size);
+    if (send(socket_fd, size_header, strlen(size_header), MSG_NOSIGNAL) == -1) {
+        close(file_fd);
+        return -1;
+    }
+
+    int result = send_file_range(socket_fd, file_fd, 0, st.st_size);
+    close(file_fd);
+    return result;
+}
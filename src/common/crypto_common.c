@@ -1,20 +1,26 @@
 #include "../../include/common.h"
 #include <openssl/rand.h>
+#include <openssl/evp.h>
 
 // Simple XOR-based encryption (for educational purposes)
 // In a real implementation, use proper AES encryption
 
 static void simple_xor_encrypt(const unsigned char* input, unsigned char* output, 
-                              size_t length, const unsigned char* key, size_t key_length) {
-    for (size_t i = 0; i < length; i++) {
-        output[i] = input[i] ^ key[i % key_length];
-    }
+                              size_t length, const unsigned char* key) {
+    xor_keystream(input, output, length, key, 0);
 }
 
 static void simple_xor_decrypt(const unsigned char* input, unsigned char* output, 
-                              size_t length, const unsigned char* key, size_t key_length) {
+                              size_t length, const unsigned char* key) {
     // XOR is symmetric
-    simple_xor_encrypt(input, output, length, key, key_length);
+    simple_xor_encrypt(input, output, length, key);
+}
+
+// Encrypt/decrypt part of a stream: stream_offset is the position of input[0]
+// in the data that follows the IV (same keystream as encrypt_file)
+void xor_stream_crypt(const unsigned char* input, unsigned char* output, size_t length,
+                      const crypto_key_t* key, size_t stream_offset) {
+    xor_keystream(input, output, length, key->key, stream_offset);
 }
 
 void generate_key(crypto_key_t* key) {
@@ -49,7 +55,7 @@ int encrypt_file(const char* input_file, const char* output_file, const crypto_k
     size_t bytes_read;
     
     while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, in)) > 0) {
-        simple_xor_encrypt(buffer, encrypted_buffer, bytes_read, key->key, 32);
+        simple_xor_encrypt(buffer, encrypted_buffer, bytes_read, key->key);
         fwrite(encrypted_buffer, 1, bytes_read, out);
     }
     
@@ -94,7 +100,7 @@ int decrypt_file(const char* input_file, const char* output_file, const crypto_k
     size_t bytes_read;
     
     while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, in)) > 0) {
-        simple_xor_decrypt(buffer, decrypted_buffer, bytes_read, key->key, 32);
+        simple_xor_decrypt(buffer, decrypted_buffer, bytes_read, key->key);
         fwrite(decrypted_buffer, 1, bytes_read, out);
     }
     
@@ -109,7 +115,7 @@ int send_encrypted_data(int socket_fd, const void* data, size_t size, const cryp
         return -1;
     }
     
-    simple_xor_encrypt((const unsigned char*)data, encrypted_data, size, key->key, 32);
+    simple_xor_encrypt((const unsigned char*)data, encrypted_data, size, key->key);
     
     int result = send(socket_fd, encrypted_data, size, 0);
     free(encrypted_data);
@@ -125,13 +131,261 @@ int receive_encrypted_data(int socket_fd, void* data, size_t size, const crypto_
     
     int result = recv(socket_fd, encrypted_data, size, 0);
     if (result > 0) {
-        simple_xor_decrypt(encrypted_data, (unsigned char*)data, result, key->key, 32);
+        simple_xor_decrypt(encrypted_data, (unsigned char*)data, result, key->key);
     }
     
     free(encrypted_data);
     return result;
 }
 
+// AES-256-GCM streams (format in common.h). EVP uses AES-NI and a
+// carry-less multiply GHASH when the CPU has them.
+
+// Nonce of the current record: stream nonce XOR record number
+static void record_nonce(const aead_stream_t* stream, unsigned char nonce[AEAD_NONCE_SIZE]) {
+    memcpy(nonce, stream->nonce, AEAD_NONCE_SIZE);
+    for (int i = 0; i < 8; i++) {
+        nonce[AEAD_NONCE_SIZE - 1 - i] ^= (unsigned char)(stream->record_index >> (8 * i));
+    }
+}
+
+int aead_stream_init(aead_stream_t* stream, const crypto_key_t* key, const unsigned char nonce[AEAD_NONCE_SIZE]) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return -1;
+    }
+
+    // The key schedule is built once; each record only sets a new nonce
+    if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL, 1) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_SIZE, NULL) != 1 ||
+        EVP_CipherInit_ex(ctx, NULL, NULL, key->key, NULL, 1) != 1) {
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    stream->ctx = ctx;
+    memcpy(stream->nonce, nonce, AEAD_NONCE_SIZE);
+    stream->record_index = 0;
+    return 0;
+}
+
+void aead_stream_free(aead_stream_t* stream) {
+    EVP_CIPHER_CTX_free(stream->ctx);
+    stream->ctx = NULL;
+}
+
+// Every stream needs its own nonce: the session key is reused across transfers
+int aead_random_nonce(unsigned char nonce[AEAD_NONCE_SIZE]) {
+    return RAND_bytes(nonce, AEAD_NONCE_SIZE) == 1 ? 0 : -1;
+}
+
+// Encrypt the next record into output (length + AEAD_RECORD_OVERHEAD
+// bytes). output must not overlap input.
+int aead_seal_record(aead_stream_t* stream, const unsigned char* input, size_t length, int final,
+                     unsigned char* output) {
+    if (length > AEAD_CHUNK_SIZE) {
+        return -1;
+    }
+
+    uint32_t header = (uint32_t)length | (final ? AEAD_FINAL_FLAG : 0);
+    output[0] = header >> 24;
+    output[1] = header >> 16;
+    output[2] = header >> 8;
+    output[3] = header;
+
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned char* ciphertext = output + AEAD_HEADER_SIZE;
+    int out_length;
+    record_nonce(stream, nonce);
+
+    if (EVP_CipherInit_ex(stream->ctx, NULL, NULL, NULL, nonce, 1) != 1 ||
+        EVP_CipherUpdate(stream->ctx, NULL, &out_length, output, AEAD_HEADER_SIZE) != 1 ||
+        (length > 0 && EVP_CipherUpdate(stream->ctx, ciphertext, &out_length, input, (int)length) != 1) ||
+        EVP_CipherFinal_ex(stream->ctx, ciphertext + length, &out_length) != 1 ||
+        EVP_CIPHER_CTX_ctrl(stream->ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_SIZE, ciphertext + length) != 1) {
+        return -1;
+    }
+
+    stream->record_index++;
+    return 0;
+}
+
+// Plaintext length and final flag of a record; -1 if the length is invalid
+int aead_parse_header(const unsigned char* header, size_t* length, int* final) {
+    uint32_t value = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+                     ((uint32_t)header[2] << 8) | header[3];
+    *final = (value & AEAD_FINAL_FLAG) != 0;
+    *length = value & ~AEAD_FINAL_FLAG;
+    return *length <= AEAD_CHUNK_SIZE ? 0 : -1;
+}
+
+// Decrypt and authenticate a whole record. Returns -1 if it was forged,
+// damaged or is out of order; output is then not to be used.
+int aead_open_record(aead_stream_t* stream, const unsigned char* record, unsigned char* output,
+                     size_t* length, int* final) {
+    if (aead_parse_header(record, length, final) != 0) {
+        return -1;
+    }
+
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    unsigned char tag[AEAD_TAG_SIZE];
+    const unsigned char* ciphertext = record + AEAD_HEADER_SIZE;
+    int out_length;
+    record_nonce(stream, nonce);
+    memcpy(tag, ciphertext + *length, AEAD_TAG_SIZE);
+
+    if (EVP_CipherInit_ex(stream->ctx, NULL, NULL, NULL, nonce, 0) != 1 ||
+        EVP_CipherUpdate(stream->ctx, NULL, &out_length, record, AEAD_HEADER_SIZE) != 1 ||
+        (*length > 0 && EVP_CipherUpdate(stream->ctx, output, &out_length, ciphertext, (int)*length) != 1) ||
+        EVP_CIPHER_CTX_ctrl(stream->ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_SIZE, tag) != 1 ||
+        EVP_CipherFinal_ex(stream->ctx, output + *length, &out_length) != 1) {
+        return -1;
+    }
+
+    stream->record_index++;
+    return 0;
+}
+
+// Bytes on the wire for a file: nonce plus full records, the last one final
+// (an empty file is a single empty final record)
+size_t aead_stream_size(size_t plaintext_size) {
+    size_t records = (plaintext_size + AEAD_CHUNK_SIZE - 1) / AEAD_CHUNK_SIZE;
+    if (records == 0) {
+        records = 1;
+    }
+    return AEAD_NONCE_SIZE + plaintext_size + records * AEAD_RECORD_OVERHEAD;
+}
+
+static ssize_t read_full(int fd, unsigned char* buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t result = read(fd, buffer + total, length - total);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (result == 0) break;
+        total += result;
+    }
+    return total;
+}
+
+static int write_full(int fd, const unsigned char* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t result = write(fd, buffer, length);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += result;
+        length -= result;
+    }
+    return 0;
+}
+
+int encrypt_file_aead(const char* input_file, const char* output_file, const crypto_key_t* key) {
+    int in = open(input_file, O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        perror("open input file");
+        return -1;
+    }
+    int out = open(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out == -1) {
+        perror("open output file");
+        close(in);
+        return -1;
+    }
+
+    struct stat st;
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    aead_stream_t stream = { 0 };
+    unsigned char* plaintext = malloc(AEAD_CHUNK_SIZE);
+    unsigned char* record = malloc(AEAD_CHUNK_SIZE + AEAD_RECORD_OVERHEAD);
+    int result = -1;
+
+    if (plaintext && record && fstat(in, &st) == 0 && aead_random_nonce(nonce) == 0 &&
+        aead_stream_init(&stream, key, nonce) == 0 && write_full(out, nonce, sizeof(nonce)) == 0) {
+        size_t remaining = st.st_size;
+        do {
+            size_t length = remaining < AEAD_CHUNK_SIZE ? remaining : AEAD_CHUNK_SIZE;
+            if (read_full(in, plaintext, length) != (ssize_t)length) {
+                break;  // File changed while encrypting
+            }
+            remaining -= length;
+            if (aead_seal_record(&stream, plaintext, length, remaining == 0, record) != 0 ||
+                write_full(out, record, length + AEAD_RECORD_OVERHEAD) != 0) {
+                break;
+            }
+            result = (remaining == 0) ? 0 : -1;
+        } while (remaining > 0);
+    }
+
+    if (result != 0) {
+        fprintf(stderr, "AES-GCM encryption of %s failed\n", input_file);
+        unlink(output_file);
+    }
+    aead_stream_free(&stream);
+    free(plaintext);
+    free(record);
+    close(in);
+    close(out);
+    return result;
+}
+
+int decrypt_file_aead(const char* input_file, const char* output_file, const crypto_key_t* key) {
+    int in = open(input_file, O_RDONLY | O_CLOEXEC);
+    if (in == -1) {
+        perror("open input file");
+        return -1;
+    }
+    int out = open(output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out == -1) {
+        perror("open output file");
+        close(in);
+        return -1;
+    }
+
+    unsigned char nonce[AEAD_NONCE_SIZE];
+    aead_stream_t stream = { 0 };
+    unsigned char* record = malloc(AEAD_CHUNK_SIZE + AEAD_RECORD_OVERHEAD);
+    unsigned char* plaintext = malloc(AEAD_CHUNK_SIZE + AEAD_TAG_SIZE);
+    int result = -1;
+
+    if (record && plaintext && read_full(in, nonce, sizeof(nonce)) == sizeof(nonce) &&
+        aead_stream_init(&stream, key, nonce) == 0) {
+        for (;;) {
+            size_t length;
+            int final;
+            if (read_full(in, record, AEAD_HEADER_SIZE) != AEAD_HEADER_SIZE ||
+                aead_parse_header(record, &length, &final) != 0) {
+                break;  // Truncated before the final record
+            }
+            size_t body = length + AEAD_TAG_SIZE;
+            if (read_full(in, record + AEAD_HEADER_SIZE, body) != (ssize_t)body ||
+                aead_open_record(&stream, record, plaintext, &length, &final) != 0 ||
+                write_full(out, plaintext, length) != 0) {
+                break;
+            }
+            if (final) {
+                // Nothing may follow the final record
+                result = (read_full(in, record, 1) == 0) ? 0 : -1;
+                break;
+            }
+        }
+    }
+
+    if (result != 0) {
+        fprintf(stderr, "AES-GCM decryption of %s failed: damaged or wrong key\n", input_file);
+        unlink(output_file);
+    }
+    aead_stream_free(&stream);
+    free(record);
+    free(plaintext);
+    close(in);
+    close(out);
+    return result;
+}
+
 // Key exchange helpers (simplified Diffie-Hellman)
 typedef struct {
     unsigned int p;  // prime
@@ -179,6 +433,20 @@ unsigned int calculate_shared_secret(const dh_key_t* dh, unsigned int other_publ
     return result;
 }
 
+static void derive_shared_key(unsigned int shared_secret, crypto_key_t* shared_key) {
+    // Derive encryption key from shared secret (simple method)
+    memset(shared_key, 0, sizeof(crypto_key_t));
+    
+    // Use shared secret to seed key generation
+    srand(shared_secret);
+    for (int i = 0; i < 32; i++) {
+        shared_key->key[i] = rand() % 256;
+    }
+    for (int i = 0; i < 16; i++) {
+        shared_key->iv[i] = rand() % 256;
+    }
+}
+
 int perform_key_exchange(int socket_fd, crypto_key_t* shared_key, int is_server) {
     dh_key_t dh;
     generate_dh_keys(&dh);
@@ -209,18 +477,84 @@ int perform_key_exchange(int socket_fd, crypto_key_t* shared_key, int is_server)
     
     // Calculate shared secret
     unsigned int shared_secret = calculate_shared_secret(&dh, other_public_key);
+    derive_shared_key(shared_secret, shared_key);
     
-    // Derive encryption key from shared secret (simple method)
-    memset(shared_key, 0, sizeof(crypto_key_t));
+    return 0;
+}
+
+// Server side of perform_key_exchange for non-blocking sockets: the caller
+// has already read the peer's public key and must send back the returned one
+unsigned int respond_key_exchange(unsigned int peer_public_key, crypto_key_t* shared_key) {
+    dh_key_t dh;
+    generate_dh_keys(&dh);
     
-    // Use shared secret to seed key generation
-    srand(shared_secret);
-    for (int i = 0; i < 32; i++) {
-        shared_key->key[i] = rand() % 256;
+    unsigned int shared_secret = calculate_shared_secret(&dh, peer_public_key);
+    derive_shared_key(shared_secret, shared_key);
+    
+    return dh.public_key;
+}
+
+// SHA-256 of the content of an open file, read with pread from offset 0
+// (the file position is left alone). Returns 0 on success, -1 on error.
+int sha256_fd(int fd, unsigned char digest[CONTENT_HASH_SIZE]) {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    unsigned char* buffer = malloc(TRANSFER_BUFFER_SIZE);
+    int result = -1;
+
+    if (ctx && buffer && EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1) {
+        off_t offset = 0;
+        for (;;) {
+            ssize_t bytes_read = pread(fd, buffer, TRANSFER_BUFFER_SIZE, offset);
+            if (bytes_read == -1 && errno == EINTR) continue;
+            if (bytes_read == 0) {
+                unsigned int length = 0;
+                result = (EVP_DigestFinal_ex(ctx, digest, &length) == 1) ? 0 : -1;
+                break;
+            }
+            if (bytes_read < 0 || EVP_DigestUpdate(ctx, buffer, bytes_read) != 1) {
+                break;
+            }
+            offset += bytes_read;
+        }
     }
-    for (int i = 0; i < 16; i++) {
-        shared_key->iv[i] = rand() % 256;
+
+    free(buffer);
+    EVP_MD_CTX_free(ctx);
+    return result;
+}
+
+// SHA-256 of a file's content. Returns 0 on success, -1 on error.
+int sha256_file(const char* filepath, unsigned char digest[CONTENT_HASH_SIZE]) {
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
     }
-    
+    int result = sha256_fd(fd, digest);
+    close(fd);
+    return result;
+}
+
+// Incremental SHA-256: init, update as the data goes by, final once
+int sha256_stream_init(sha256_stream_t* stream) {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return -1;
+    }
+    stream->ctx = ctx;
     return 0;
-} 
\ No newline at end of file
+}
+
+int sha256_stream_update(sha256_stream_t* stream, const void* data, size_t length) {
+    return EVP_DigestUpdate(stream->ctx, data, length) == 1 ? 0 : -1;
+}
+
+int sha256_stream_final(sha256_stream_t* stream, unsigned char digest[CONTENT_HASH_SIZE]) {
+    unsigned int length = 0;
+    return EVP_DigestFinal_ex(stream->ctx, digest, &length) == 1 ? 0 : -1;
+}
+
+void sha256_stream_free(sha256_stream_t* stream) {
+    EVP_MD_CTX_free(stream->ctx);
+    stream->ctx = NULL;
+}
@@ -0,0 +1,319 @@
+#include "../../include/frame.h"
+
+// Header
+
+void frame_header_encode(const frame_header_t* header, unsigned char* out) {
+    uint16_t flags = htons(header->flags);
+    uint32_t stream_id = htonl(header->stream_id);
+    uint32_t job_id = htonl(header->job_id);
+    uint32_t length = htonl(header->length);
+    out[0] = FRAME_MAGIC;
+    out[1] = header->type;
+    memcpy(out + 2, &flags, sizeof(flags));
+    memcpy(out + 4, &stream_id, sizeof(stream_id));
+    memcpy(out + 8, &job_id, sizeof(job_id));
+    memcpy(out + 12, &length, sizeof(length));
+}
+
+int frame_header_decode(const unsigned char* in, frame_header_t* header) {
+    if (in[0] != FRAME_MAGIC) {
+        return -1;
+    }
+    uint16_t flags;
+    uint32_t stream_id, job_id, length;
+    memcpy(&flags, in + 2, sizeof(flags));
+    memcpy(&stream_id, in + 4, sizeof(stream_id));
+    memcpy(&job_id, in + 8, sizeof(job_id));
+    memcpy(&length, in + 12, sizeof(length));
+    header->type = in[1];
+    header->flags = ntohs(flags);
+    header->stream_id = ntohl(stream_id);
+    header->job_id = ntohl(job_id);
+    header->length = ntohl(length);
+    return header->length <= FRAME_MAX_PAYLOAD ? 0 : -1;
+}
+
+size_t frame_encode(unsigned char* out, int type, int flags, uint32_t stream_id, uint32_t job_id,
+                    const void* payload, size_t length) {
+    frame_header_t header = { (uint8_t)type, (uint16_t)flags, stream_id, job_id, (uint32_t)length };
+    frame_header_encode(&header, out);
+    if (length > 0) {
+        memcpy(out + FRAME_HEADER_SIZE, payload, length);
+    }
+    return FRAME_HEADER_SIZE + length;
+}
+
+// Status words <-> codes (index = frame_status_t)
+
+static const char* g_status_names[] = {
+    RESP_OK, RESP_ERROR, RESP_NOT_FOUND, RESP_PENDING, "SIZE", RESP_CLEAN, RESP_INFECTED, RESP_RETRY_AFTER
+};
+
+#define NUM_STATUS_NAMES (sizeof(g_status_names) / sizeof(g_status_names[0]))
+
+int frame_status_code(const char* status) {
+    for (size_t i = 0; i < NUM_STATUS_NAMES; i++) {
+        if (strcmp(g_status_names[i], status) == 0) {
+            return (int)i;
+        }
+    }
+    return FRAME_STATUS_ERROR;
+}
+
+const char* frame_status_name(int code) {
+    return code >= 0 && (size_t)code < NUM_STATUS_NAMES ? g_status_names[code] : RESP_ERROR;
+}
+
+// Text command names
+
+typedef struct {
+    const char* name;
+    int type;
+} frame_command_t;
+
+static const frame_command_t g_commands[] = {
+    { CMD_REGISTER_CLIENT, FRAME_REGISTER_CLIENT },
+    { CMD_UPLOAD_FILE, FRAME_UPLOAD_FILE },
+    { CMD_GET_SCAN_STATUS, FRAME_GET_SCAN_STATUS },
+    { CMD_GET_SCAN_RESULT, FRAME_GET_SCAN_RESULT },
+    { CMD_DOWNLOAD_FILE, FRAME_DOWNLOAD_FILE },
+    { CMD_SUBSCRIBE, FRAME_SUBSCRIBE },
+    { CMD_ADMIN_AUTH, FRAME_ADMIN_AUTH },
+    { CMD_SET_LOG_LEVEL, FRAME_SET_LOG_LEVEL },
+    { CMD_GET_LOGS, FRAME_GET_LOGS },
+    { CMD_GET_STATS, FRAME_GET_STATS },
+    { CMD_GET_WORKER_STATS, FRAME_GET_WORKER_STATS },
+    { CMD_DISCONNECT_CLIENT, FRAME_DISCONNECT_CLIENT },
+    { CMD_SHUTDOWN_SERVER, FRAME_SHUTDOWN_SERVER },
+    { CMD_RELOAD_SIGNATURES, FRAME_RELOAD_SIGNATURES },
+    { CMD_GET_QUEUE_STATS, FRAME_GET_QUEUE_STATS },
+    { CMD_GET_ONACCESS_STATS, FRAME_GET_ONACCESS_STATS },
+    { CMD_GET_PREFILTER_STATS, FRAME_GET_PREFILTER_STATS },
+};
+
+#define NUM_COMMANDS (sizeof(g_commands) / sizeof(g_commands[0]))
+
+const char* frame_type_name(int type) {
+    for (size_t i = 0; i < NUM_COMMANDS; i++) {
+        if (g_commands[i].type == type) {
+            return g_commands[i].name;
+        }
+    }
+    switch (type) {
+        case FRAME_RESPONSE: return "RESPONSE";
+        case FRAME_NOTIFY: return RESP_NOTIFY;
+        case FRAME_DATA: return "DATA";
+        default: return "UNKNOWN";
+    }
+}
+
+// UPLOAD_FILE payload: 8-byte size, then the file name (no terminator)
+
+size_t frame_upload_payload(unsigned char* out, size_t out_size, const char* filename, uint64_t size) {
+    size_t name_length = strlen(filename);
+    if (8 + name_length > out_size) {
+        return 0;
+    }
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(size >> (56 - 8 * i));
+    }
+    memcpy(out + 8, filename, name_length);
+    return 8 + name_length;
+}
+
+int frame_parse_upload(const unsigned char* payload, size_t length, char* filename, size_t filename_size,
+                       uint64_t* size) {
+    if (length < 8 || length - 8 >= filename_size || memchr(payload + 8, '\0', length - 8)) {
+        return -1;
+    }
+    *size = 0;
+    for (int i = 0; i < 8; i++) {
+        *size = (*size << 8) | payload[i];
+    }
+    memcpy(filename, payload + 8, length - 8);
+    filename[length - 8] = '\0';
+    return 0;
+}
+
+// Text compatibility shim
+
+static int transfer_mode_flags(const char* mode) {
+    if (mode[0] == '\0') return 0;
+    if (strcmp(mode, TRANSFER_MODE_PLAIN) == 0) return FRAME_FLAG_PLAIN;
+    if (strcmp(mode, TRANSFER_MODE_GCM) == 0) return FRAME_FLAG_GCM;
+    return FRAME_FLAG_MALFORMED;
+}
+
+// UPLOAD_FILE options after the size: a transfer mode, a priority, or both
+static int upload_option_flags(const char* option) {
+    if (strcmp(option, UPLOAD_PRIORITY_HIGH) == 0) return FRAME_FLAG_HIGH;
+    if (strcmp(option, UPLOAD_PRIORITY_LOW) == 0) return FRAME_FLAG_LOW;
+    return transfer_mode_flags(option);
+}
+
+void frame_from_text(const char* line, frame_header_t* header, unsigned char* payload, size_t payload_size) {
+    memset(header, 0, sizeof(*header));
+
+    size_t name_length = strcspn(line, " ");
+    const char* args = line[name_length] ? line + name_length + 1 : line + name_length;
+    for (size_t i = 0; i < NUM_COMMANDS; i++) {
+        if (strlen(g_commands[i].name) == name_length && memcmp(g_commands[i].name, line, name_length) == 0) {
+            header->type = g_commands[i].type;
+            break;
+        }
+    }
+
+    char filename[PUBLISHED_NAME_SIZE];     // Downloads name "<job_id>_<filename>"
+    char mode[16] = "";
+    char priority[16] = "";
+    switch (header->type) {
+        case FRAME_UPLOAD_FILE: {
+            unsigned long long size;
+            if (sscanf(args, "%255s %llu %15s %15s", filename, &size, mode, priority) < 2) {
+                header->flags = FRAME_FLAG_MALFORMED;
+                break;
+            }
+            header->flags = upload_option_flags(mode) | upload_option_flags(priority);
+            header->length = frame_upload_payload(payload, payload_size, filename, size);
+            break;
+        }
+        case FRAME_DOWNLOAD_FILE:
+            if (sscanf(args, "%271s %15s", filename, mode) < 1) {
+                header->flags = FRAME_FLAG_MALFORMED;
+                break;
+            }
+            header->flags = transfer_mode_flags(mode);
+            header->length = strlen(filename);
+            memcpy(payload, filename, header->length);
+            break;
+        case FRAME_GET_SCAN_STATUS:
+        case FRAME_GET_SCAN_RESULT:
+        case FRAME_SUBSCRIBE:
+            header->job_id = (uint32_t)atoi(args);
+            break;
+        case FRAME_ADMIN_AUTH:
+        case FRAME_SET_LOG_LEVEL:
+        case FRAME_DISCONNECT_CLIENT:
+            header->length = strlen(args) < payload_size ? strlen(args) : payload_size;
+            memcpy(payload, args, header->length);
+            break;
+        default:
+            break;
+    }
+}
+
+// Streaming decoder
+
+int frame_decoder_init(frame_decoder_t* decoder, int allow_text) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->allow_text = allow_text;
+    decoder->mode = -1;
+    if (allow_text) {
+        decoder->text_payload = malloc(FRAME_MAX_COMMAND);
+        if (!decoder->text_payload) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void frame_decoder_free(frame_decoder_t* decoder) {
+    free(decoder->buffer);
+    free(decoder->text_payload);
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+int frame_decoder_feed(frame_decoder_t* decoder, const void* data, size_t length) {
+    // Drop what has already been returned before growing the buffer
+    if (decoder->start > 0) {
+        memmove(decoder->buffer, decoder->buffer + decoder->start, decoder->length - decoder->start);
+        decoder->length -= decoder->start;
+        decoder->start = 0;
+    }
+
+    if (decoder->length + length > decoder->capacity) {
+        size_t capacity = decoder->capacity ? decoder->capacity : BUFFER_SIZE;
+        while (capacity < decoder->length + length) {
+            capacity *= 2;
+        }
+        unsigned char* buffer = realloc(decoder->buffer, capacity);
+        if (!buffer) {
+            return -1;
+        }
+        decoder->buffer = buffer;
+        decoder->capacity = capacity;
+    }
+
+    memcpy(decoder->buffer + decoder->length, data, length);
+    decoder->length += length;
+    return 0;
+}
+
+size_t frame_decoder_buffered(const frame_decoder_t* decoder) {
+    return decoder->length - decoder->start;
+}
+
+// 1 = a message is ready (payload valid until the next feed), 0 = more
+// input needed, -1 = protocol error (the connection cannot be resynced)
+int frame_decoder_next(frame_decoder_t* decoder, frame_header_t* header, unsigned char** payload) {
+    for (;;) {
+        unsigned char* data = decoder->buffer + decoder->start;
+        size_t available = decoder->length - decoder->start;
+        if (available == 0) {
+            return 0;
+        }
+
+        if (decoder->mode == -1) {
+            decoder->mode = (data[0] != FRAME_MAGIC && decoder->allow_text) ? 1 : 0;
+        }
+
+        if (decoder->mode == 0) {
+            if (available < FRAME_HEADER_SIZE) {
+                return 0;
+            }
+            if (frame_header_decode(data, header) != 0) {
+                return -1;
+            }
+            if (available < FRAME_HEADER_SIZE + header->length) {
+                return 0;
+            }
+            *payload = data + FRAME_HEADER_SIZE;
+            decoder->start += FRAME_HEADER_SIZE + header->length;
+            return 1;
+        }
+
+        unsigned char* newline = memchr(data, '\n', available);
+        if (!newline) {
+            return available < MAX_MESSAGE ? 0 : -1;
+        }
+        decoder->start += newline - data + 1;
+        *newline = '\0';
+        if (newline > data && newline[-1] == '\r') {
+            newline[-1] = '\0';
+        }
+        if (data[0] == '\0') {
+            continue;
+        }
+        frame_from_text((const char*)data, header, decoder->text_payload, FRAME_MAX_COMMAND);
+        *payload = decoder->text_payload;
+        return 1;
+    }
+}
+
+int send_frame_response(int socket_fd, int framed, const char* status, uint32_t job_id, const char* message) {
+    if (!framed) {
+        return send_response(socket_fd, status, message);
+    }
+
+    unsigned char frame[FRAME_HEADER_SIZE + MAX_MESSAGE];
+    size_t length = strlen(message);
+    if (length > MAX_MESSAGE) length = MAX_MESSAGE;
+    size_t frame_length = frame_encode(frame, FRAME_RESPONSE, frame_status_code(status), 0, job_id,
+                                       message, length);
+    ssize_t bytes_sent = send(socket_fd, frame, frame_length, MSG_NOSIGNAL);
+    if (bytes_sent == -1) {
+        perror("send");
+        return -1;
+    }
+    return (int)bytes_sent;
+}
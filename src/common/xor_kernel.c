@@ -0,0 +1,180 @@
+#include "../../include/common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XOR_KERNEL_X86 1
+#endif
+
+// Keystream XOR kernels. The 32-byte key repeats, so the keystream is the
+// key rotated to the stream offset: it is computed once per call into a
+// 64-byte pattern and then stays in registers. Every kernel processes
+// pattern-aligned blocks and finishes the tail with pattern[i % 32].
+//
+// The kernel is chosen once from the CPU features (AVX-512, AVX2, SSE2,
+// then portable 64-bit words); no special compiler flags are needed.
+
+typedef void (*xor_kernel_fn)(const unsigned char* input, unsigned char* output, size_t length,
+                              const unsigned char* pattern);
+
+static void xor_tail(const unsigned char* input, unsigned char* output, size_t start, size_t length,
+                     const unsigned char* pattern) {
+    for (size_t i = start; i < length; i++) {
+        output[i] = input[i] ^ pattern[i & (XOR_KEY_SIZE - 1)];
+    }
+}
+
+static void xor_scalar(const unsigned char* input, unsigned char* output, size_t length,
+                       const unsigned char* pattern) {
+    uint64_t key_words[XOR_KEY_SIZE / sizeof(uint64_t)];
+    memcpy(key_words, pattern, XOR_KEY_SIZE);
+
+    size_t i = 0;
+    for (; i + XOR_KEY_SIZE <= length; i += XOR_KEY_SIZE) {
+        uint64_t words[XOR_KEY_SIZE / sizeof(uint64_t)];
+        memcpy(words, input + i, XOR_KEY_SIZE);
+        for (size_t w = 0; w < XOR_KEY_SIZE / sizeof(uint64_t); w++) {
+            words[w] ^= key_words[w];
+        }
+        memcpy(output + i, words, XOR_KEY_SIZE);
+    }
+    xor_tail(input, output, i, length, pattern);
+}
+
+#ifdef XOR_KERNEL_X86
+__attribute__((target("sse2")))
+static void xor_sse2(const unsigned char* input, unsigned char* output, size_t length,
+                     const unsigned char* pattern) {
+    const __m128i key_low = _mm_loadu_si128((const __m128i*)pattern);
+    const __m128i key_high = _mm_loadu_si128((const __m128i*)(pattern + 16));
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(input + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(input + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(input + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(input + i + 48));
+        _mm_storeu_si128((__m128i*)(output + i), _mm_xor_si128(a, key_low));
+        _mm_storeu_si128((__m128i*)(output + i + 16), _mm_xor_si128(b, key_high));
+        _mm_storeu_si128((__m128i*)(output + i + 32), _mm_xor_si128(c, key_low));
+        _mm_storeu_si128((__m128i*)(output + i + 48), _mm_xor_si128(d, key_high));
+    }
+    xor_tail(input, output, i, length, pattern);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(const unsigned char* input, unsigned char* output, size_t length,
+                     const unsigned char* pattern) {
+    const __m256i key = _mm256_loadu_si256((const __m256i*)pattern);
+
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(input + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(input + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(input + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(input + i + 96));
+        _mm256_storeu_si256((__m256i*)(output + i), _mm256_xor_si256(a, key));
+        _mm256_storeu_si256((__m256i*)(output + i + 32), _mm256_xor_si256(b, key));
+        _mm256_storeu_si256((__m256i*)(output + i + 64), _mm256_xor_si256(c, key));
+        _mm256_storeu_si256((__m256i*)(output + i + 96), _mm256_xor_si256(d, key));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(input + i));
+        _mm256_storeu_si256((__m256i*)(output + i), _mm256_xor_si256(a, key));
+    }
+    xor_tail(input, output, i, length, pattern);
+}
+
+__attribute__((target("avx512f")))
+static void xor_avx512(const unsigned char* input, unsigned char* output, size_t length,
+                       const unsigned char* pattern) {
+    const __m512i key = _mm512_loadu_si512((const void*)pattern);
+
+    size_t i = 0;
+    for (; i + 256 <= length; i += 256) {
+        __m512i a = _mm512_loadu_si512((const void*)(input + i));
+        __m512i b = _mm512_loadu_si512((const void*)(input + i + 64));
+        __m512i c = _mm512_loadu_si512((const void*)(input + i + 128));
+        __m512i d = _mm512_loadu_si512((const void*)(input + i + 192));
+        _mm512_storeu_si512((void*)(output + i), _mm512_xor_si512(a, key));
+        _mm512_storeu_si512((void*)(output + i + 64), _mm512_xor_si512(b, key));
+        _mm512_storeu_si512((void*)(output + i + 128), _mm512_xor_si512(c, key));
+        _mm512_storeu_si512((void*)(output + i + 192), _mm512_xor_si512(d, key));
+    }
+    for (; i + 64 <= length; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void*)(input + i));
+        _mm512_storeu_si512((void*)(output + i), _mm512_xor_si512(a, key));
+    }
+    xor_tail(input, output, i, length, pattern);
+}
+#endif
+
+typedef struct {
+    const char* name;
+    xor_kernel_fn fn;
+} xor_kernel_t;
+
+// Fastest first
+static const xor_kernel_t g_kernels[] = {
+#ifdef XOR_KERNEL_X86
+    { "avx512", xor_avx512 },
+    { "avx2", xor_avx2 },
+    { "sse2", xor_sse2 },
+#endif
+    { "scalar", xor_scalar },
+};
+
+#define NUM_KERNELS (sizeof(g_kernels) / sizeof(g_kernels[0]))
+
+static const xor_kernel_t* g_selected = NULL;
+
+static int kernel_supported(const xor_kernel_t* kernel) {
+#ifdef XOR_KERNEL_X86
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(kernel->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+    return strcmp(kernel->name, "scalar") == 0;
+}
+
+static const xor_kernel_t* selected_kernel(void) {
+    const xor_kernel_t* kernel = __atomic_load_n(&g_selected, __ATOMIC_ACQUIRE);
+    if (kernel) {
+        return kernel;
+    }
+
+    // Every thread that races here picks the same kernel
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+        if (kernel_supported(&g_kernels[i])) {
+            kernel = &g_kernels[i];
+            break;
+        }
+    }
+    __atomic_store_n(&g_selected, kernel, __ATOMIC_RELEASE);
+    return kernel;
+}
+
+// XOR with the key repeated from position key_offset (the stream offset)
+void xor_keystream(const unsigned char* input, unsigned char* output, size_t length,
+                   const unsigned char key[XOR_KEY_SIZE], size_t key_offset) {
+    unsigned char pattern[2 * XOR_KEY_SIZE] __attribute__((aligned(64)));
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = key[(key_offset + i) & (XOR_KEY_SIZE - 1)];
+    }
+    selected_kernel()->fn(input, output, length, pattern);
+}
+
+const char* xor_kernel_name(void) {
+    return selected_kernel()->name;
+}
+
+// Use a given kernel (benchmarks); -1 if it is unknown or the CPU lacks it
+int xor_kernel_select(const char* name) {
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(g_kernels[i].name, name) == 0 && kernel_supported(&g_kernels[i])) {
+            __atomic_store_n(&g_selected, &g_kernels[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -1,16 +1,38 @@
 #include "../../include/common.h"
+#include "../../include/frame.h"
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <map>
+#include <memory>
+#include <functional>
 #include <thread>
 #include <chrono>
+#include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <deque>
+#include <random>
+
+#define BATCH_DEFAULT_WINDOW 32    // Files uploaded at once, each on its own stream
+#define UPLOAD_MAX_RETRIES 10      // RETRY_AFTER answers before an upload is given up
+#define UPLOAD_RETRY_BASE_MS 200   // Backoff after the first RETRY_AFTER, doubled each time
+#define UPLOAD_RETRY_MAX_MS 30000
+#define OUTBOX_LOW_WATER (2 * FRAME_DATA_CHUNK)  // Below this, the next upload chunk is queued
 
 extern int perform_key_exchange(int socket_fd, crypto_key_t* shared_key, int is_server);
 
+// UPLOAD_FILE priority flags for "high" / "low" ("" = normal), -1 if unknown
+static int priority_flags(const std::string& priority) {
+    if (priority.empty() || priority == "normal") return 0;
+    if (priority == "high") return FRAME_FLAG_HIGH;
+    if (priority == "low") return FRAME_FLAG_LOW;
+    return -1;
+}
+
 class OrdinaryClient {
 private:
     int socket_fd;
@@ -18,13 +40,108 @@ private:
     crypto_key_t encryption_key;
     std::string server_host;
     int server_port;
+    frame_decoder_t decoder;       // Frames received but not read yet
+    std::string input_buffer;      // Terminal input not yet split into lines
+    bool prompt_dirty;             // Something was printed behind the prompt
+    
+    // Callbacks for SUBSCRIBE, called once with the job's result line
+    // ("CLEAN <published name>", "INFECTED <name>", "ERROR <reason>") when
+    // NOTIFY arrives
+    typedef std::function<void(int job_id, const std::string& result)> scan_callback_t;
+    std::map<int, scan_callback_t> subscriptions;
+    
+    // Names the server published clean uploads under, by job id
+    std::map<int, std::string> published;
+    
+    // Multiplexing: every request runs on a stream id of its own, so
+    // uploads, downloads and queries share the connection. A stream's
+    // handler gets its RESPONSE and DATA frames and returns true once the
+    // stream is finished.
+    typedef std::function<bool(const frame_header_t& header, unsigned char* payload)> stream_handler_t;
+    std::map<uint32_t, stream_handler_t> streams;
+    uint32_t next_stream_id;
     
+    // Frames waiting for the socket to become writable
+    std::vector<unsigned char> outbox;
+    size_t outbox_offset;
+    
+    // Transfer mode of uploads and downloads: 0 (XOR with the session
+    // key), FRAME_FLAG_GCM (AES-256-GCM records) or FRAME_FLAG_PLAIN (the
+    // file as is, for trusted networks: the server moves it with
+    // splice/sendfile), frame.h
+    int transfer_mode;
+    std::vector<unsigned char> aead_plaintext;  // Record being sealed or opened
+    
+    // An upload whose data is being sent. Uploads take turns, one DATA
+    // frame each, so a large file does not hold back the small ones.
+    struct Upload {
+        uint32_t stream_id;
+        int fd;
+        std::string name;
+        std::vector<unsigned char> command;  // UPLOAD_FILE frame, sent with the first chunk
+        size_t file_size;
+        size_t sent;               // File bytes read
+        size_t wire_size;          // Stream bytes announced: IV or nonce (none when plain), then the content
+        size_t wire_sent;
+        bool started;
+        bool aborted;              // Refused by the server: stop sending
+        bool plain;
+        
+        // GCM: the stream and the sealed record being sent
+        bool aead;
+        aead_stream_t stream;
+        unsigned char nonce[AEAD_NONCE_SIZE];
+        std::vector<unsigned char> record;
+        size_t record_length;
+        size_t record_offset;
+        
+        Upload() : stream() {}
+        ~Upload() { aead_stream_free(&stream); }
+    };
+    std::deque<std::shared_ptr<Upload>> upload_queue;
+    
+    // A download being received
+    struct Download {
+        int fd;
+        size_t size;               // Stream bytes announced by SIZE
+        size_t received;
+        
+        // GCM: the stream and the record being gathered
+        aead_stream_t stream;
+        unsigned char nonce[AEAD_NONCE_SIZE];
+        std::vector<unsigned char> record;
+        size_t record_have;
+        bool final_seen;
+        
+        Download() : fd(-1), size(0), received(0), stream(), record_have(0), final_seen(false) {}
+        ~Download() { aead_stream_free(&stream); }
+    };
+    
+    // Uploads refused with RETRY_AFTER, started again when their time comes
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> retries;
+    std::mt19937 random_engine;
+    
+    // Transfers in progress, for the "transfers" command
+    struct Progress {
+        std::string description;
+        size_t done;
+        size_t total;
+    };
+    std::map<uint32_t, Progress> transfers;
+
 public:
-    OrdinaryClient(const std::string& host = "localhost", int port = SERVER_PORT) 
-        : socket_fd(-1), connected(false), server_host(host), server_port(port) {}
+    typedef std::function<void(int job_id, const std::string& message)> upload_callback_t;
+    typedef std::function<void(bool ok, const std::string& message)> download_callback_t;
+    
+    OrdinaryClient(const std::string& host = "localhost", int port = SERVER_PORT)
+        : socket_fd(-1), connected(false), server_host(host), server_port(port), prompt_dirty(false),
+          next_stream_id(1), outbox_offset(0), transfer_mode(0), random_engine(std::random_device()()) {
+        frame_decoder_init(&decoder, 0);
+    }
     
     ~OrdinaryClient() {
         disconnect();
+        frame_decoder_free(&decoder);
     }
     
     bool connect_to_server() {
@@ -65,13 +182,7 @@ public:
         std::cout << "E2E encryption established" << std::endl;
         
         // Register with server
-        std::string register_cmd = "REGISTER_CLIENT";
-        if (!send_command(register_cmd)) {
-            disconnect();
-            return false;
-        }
-        
-        std::string response = receive_response();
+        std::string response = call(FRAME_REGISTER_CLIENT, 0, NULL, 0);
         if (response.find("OK") != 0) {
             std::cerr << "Registration failed: " << response << std::endl;
             disconnect();
@@ -88,271 +199,762 @@ public:
             socket_fd = -1;
         }
         connected = false;
+        for (auto& upload : upload_queue) {
+            close(upload->fd);
+        }
+        upload_queue.clear();
     }
     
-    bool send_command(const std::string& command) {
-        if (!connected) return false;
-        
-        std::string cmd = command + "\n";
-        int bytes_sent = send(socket_fd, cmd.c_str(), cmd.length(), 0);
-        if (bytes_sent == -1) {
-            perror("send");
+    size_t active_transfers() const {
+        return transfers.size() + retries.size();
+    }
+    
+    void set_transfer_mode(int mode) {
+        transfer_mode = mode;
+    }
+    
+    // Output
+    
+    void queue_frame(int type, int flags, uint32_t stream_id, uint32_t job_id, const void* payload, size_t length) {
+        size_t offset = outbox.size();
+        outbox.resize(offset + FRAME_HEADER_SIZE + length);
+        frame_encode(outbox.data() + offset, type, flags, stream_id, job_id, payload, length);
+    }
+    
+    // Start a request on a new stream; handler gets the frames sent back
+    uint32_t request(int type, uint32_t job_id, const void* payload, size_t length, stream_handler_t handler,
+                     int flags = 0) {
+        uint32_t stream_id = next_stream_id++;
+        streams[stream_id] = handler;
+        queue_frame(type, flags, stream_id, job_id, payload, length);
+        return stream_id;
+    }
+    
+    bool read_upload(Upload& upload, unsigned char* buffer, size_t length) {
+        size_t total_read = 0;
+        while (total_read < length) {
+            ssize_t bytes_read = read(upload.fd, buffer + total_read, length - total_read);
+            if (bytes_read == -1 && errno == EINTR) continue;
+            if (bytes_read <= 0) {
+                std::cerr << "Cannot read " << upload.name << std::endl;
+                return false;
+            }
+            total_read += bytes_read;
+        }
+        upload.sent += length;
+        return true;
+    }
+    
+    // Seal the next GCM record of an upload: AEAD_CHUNK_SIZE bytes of the
+    // file, the last record shorter and final, as aead_stream_size counts
+    bool seal_upload_record(Upload& upload) {
+        size_t length = std::min((size_t)AEAD_CHUNK_SIZE, upload.file_size - upload.sent);
+        aead_plaintext.resize(AEAD_CHUNK_SIZE);
+        if (!read_upload(upload, aead_plaintext.data(), length)) {
+            return false;
+        }
+        upload.record.resize(AEAD_CHUNK_SIZE + AEAD_RECORD_OVERHEAD);
+        if (aead_seal_record(&upload.stream, aead_plaintext.data(), length, upload.sent == upload.file_size,
+                             upload.record.data()) != 0) {
+            std::cerr << "Cannot encrypt " << upload.name << std::endl;
             return false;
         }
+        upload.record_length = length + AEAD_RECORD_OVERHEAD;
+        upload.record_offset = 0;
         return true;
     }
     
-    std::string receive_response() {
-        if (!connected) return "";
-        
-        char buffer[MAX_MESSAGE];
-        int bytes_received = recv(socket_fd, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received <= 0) {
-            return "";
+    // Append the next DATA frame of an upload to the outbox (the first one
+    // also carries the command and the IV or GCM nonce). false when the
+    // file could not be read: the server expects exactly the announced
+    // size, so the connection cannot be used any more.
+    bool queue_upload_chunk(Upload& upload) {
+        if (!upload.started) {
+            outbox.insert(outbox.end(), upload.command.begin(), upload.command.end());
+            if (upload.wire_size == 0) {
+                upload.started = true;  // Empty plaintext file: the command is the whole upload
+                return true;
+            }
         }
         
-        buffer[bytes_received] = '\0';
+        const unsigned char* prefix_data = upload.aead ? upload.nonce : encryption_key.iv;
+        size_t prefix = upload.started || upload.plain ? 0 :
+                        upload.aead ? sizeof(upload.nonce) : sizeof(encryption_key.iv);
+        size_t frame_length = std::min((size_t)FRAME_DATA_CHUNK, upload.wire_size - upload.wire_sent);
+        size_t offset = outbox.size();
+        outbox.resize(offset + FRAME_HEADER_SIZE + frame_length);
         
-        // Remove trailing newline
-        std::string response(buffer);
-        if (!response.empty() && response.back() == '\n') {
-            response.pop_back();
+        unsigned char* data = outbox.data() + offset + FRAME_HEADER_SIZE;
+        memcpy(data, prefix_data, prefix);
+        if (upload.aead) {
+            // Records run across DATA frames
+            for (size_t filled = prefix; filled < frame_length; ) {
+                if (upload.record_offset == upload.record_length && !seal_upload_record(upload)) {
+                    return false;
+                }
+                size_t take = std::min(frame_length - filled, upload.record_length - upload.record_offset);
+                memcpy(data + filled, upload.record.data() + upload.record_offset, take);
+                upload.record_offset += take;
+                filled += take;
+            }
+        } else {
+            size_t position = upload.sent;
+            if (!read_upload(upload, data + prefix, frame_length - prefix)) {
+                return false;
+            }
+            if (!upload.plain) {
+                xor_stream_crypt(data + prefix, data + prefix, frame_length - prefix, &encryption_key, position);
+            }
         }
         
-        return response;
+        frame_header_t header = { FRAME_DATA, 0, upload.stream_id, 0, (uint32_t)frame_length };
+        frame_header_encode(&header, outbox.data() + offset);
+        upload.wire_sent += frame_length;
+        upload.started = true;
+        
+        auto progress = transfers.find(upload.stream_id);
+        if (progress != transfers.end()) {
+            progress->second.done = upload.sent;
+        }
+        return true;
     }
     
-    bool upload_file(const std::string& filepath) {
-        if (!connected) {
-            std::cerr << "Not connected to server" << std::endl;
+    // Keep the outbox topped up from the upload queue, round-robin
+    bool schedule_uploads() {
+        while (outbox.size() - outbox_offset < OUTBOX_LOW_WATER && !upload_queue.empty()) {
+            std::shared_ptr<Upload> upload = upload_queue.front();
+            upload_queue.pop_front();
+            if (upload->aborted) {
+                close(upload->fd);
+                continue;
+            }
+            if (!queue_upload_chunk(*upload)) {
+                close(upload->fd);
+                disconnect();
+                return false;
+            }
+            if (upload->wire_sent < upload->wire_size) {
+                upload_queue.push_back(upload);
+            } else {
+                close(upload->fd);
+            }
+        }
+        return true;
+    }
+    
+    bool flush_outbox() {
+        while (outbox_offset < outbox.size()) {
+            ssize_t bytes_sent = send(socket_fd, outbox.data() + outbox_offset, outbox.size() - outbox_offset,
+                                      MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (bytes_sent == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                perror("send");
+                return false;
+            }
+            outbox_offset += bytes_sent;
+        }
+        if (outbox_offset == outbox.size()) {
+            outbox.clear();
+            outbox_offset = 0;
+        } else if (outbox_offset > OUTBOX_LOW_WATER) {
+            outbox.erase(outbox.begin(), outbox.begin() + outbox_offset);
+            outbox_offset = 0;
+        }
+        return true;
+    }
+    
+    // Input
+    
+    // recv into the frame decoder; false when the connection is gone
+    bool fill_decoder(int flags) {
+        char buffer[64 * 1024];
+        for (;;) {
+            ssize_t bytes_received = recv(socket_fd, buffer, sizeof(buffer), flags);
+            if (bytes_received == -1 && errno == EINTR) continue;
+            if (bytes_received == -1 && (flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            }
+            if (bytes_received <= 0) {
+                return false;
+            }
+            return frame_decoder_feed(&decoder, buffer, bytes_received) == 0;
+        }
+    }
+    
+    // FRAME_NOTIFY: run and drop the job's callback
+    void dispatch_notification(const frame_header_t& header, const unsigned char* payload) {
+        auto it = subscriptions.find(header.job_id);
+        if (it == subscriptions.end()) {
+            return;
+        }
+        scan_callback_t callback = it->second;
+        subscriptions.erase(it);
+        callback(header.job_id, std::string((const char*)payload, header.length));
+    }
+    
+    // Hand every complete frame received so far to its stream
+    bool dispatch_frames() {
+        frame_header_t header;
+        unsigned char* payload;
+        int result;
+        while ((result = frame_decoder_next(&decoder, &header, &payload)) == 1) {
+            if (header.type == FRAME_NOTIFY) {
+                dispatch_notification(header, payload);
+                continue;
+            }
+            auto it = streams.find(header.stream_id);
+            if (it == streams.end()) {
+                std::cerr << "Unexpected " << frame_type_name(header.type) << " frame on stream "
+                          << header.stream_id << std::endl;
+                continue;
+            }
+            // The handler may start new streams: keep it alive while it runs
+            stream_handler_t handler = it->second;
+            if (handler(header, payload)) {
+                streams.erase(header.stream_id);
+            }
+        }
+        if (result == -1) {
+            std::cerr << "Invalid frame from server" << std::endl;
             return false;
         }
+        return true;
+    }
+    
+    // One round of I/O: queue upload data, send what the socket takes and
+    // dispatch what arrived. Waits up to timeout_ms (-1 = until something
+    // happens) for the socket or input_fd; input_ready tells whether
+    // input_fd is readable. false when the connection is gone.
+    bool pump(int timeout_ms, int input_fd = -1, bool* input_ready = NULL) {
+        if (!connected) return false;
+        if (!schedule_uploads()) return false;
+        
+        // Wake up for the next upload retry
+        if (!retries.empty()) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                retries.begin()->first - std::chrono::steady_clock::now()).count();
+            wait = std::max((long long)wait, 0LL);
+            if (timeout_ms < 0 || wait < timeout_ms) {
+                timeout_ms = (int)wait;
+            }
+        }
         
-        // Check if file exists
-        std::ifstream file(filepath, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Cannot open file: " << filepath << std::endl;
+        struct pollfd fds[2] = { { socket_fd, POLLIN, 0 }, { input_fd, POLLIN, 0 } };
+        if (outbox_offset < outbox.size()) {
+            fds[0].events |= POLLOUT;
+        }
+        int count = poll(fds, input_fd != -1 ? 2 : 1, timeout_ms);
+        if (count == -1 && errno != EINTR) {
+            perror("poll");
             return false;
         }
+        if (input_ready) {
+            *input_ready = count > 0 && input_fd != -1 && fds[1].revents != 0;
+        }
+        run_due_retries();
+        if (count <= 0) {
+            return true;
+        }
         
-        // Get file size
-        file.seekg(0, std::ios::end);
-        size_t file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        if ((fds[0].revents & POLLOUT) && !flush_outbox()) {
+            disconnect();
+            return false;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!fill_decoder(MSG_DONTWAIT) || !dispatch_frames()) {
+                disconnect();
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void run_due_retries() {
+        auto now = std::chrono::steady_clock::now();
+        while (!retries.empty() && retries.begin()->first <= now) {
+            std::function<void()> retry = retries.begin()->second;
+            retries.erase(retries.begin());
+            retry();
+        }
+    }
+    
+    // Wait before retrying a refused upload: the server's hint, or the
+    // exponential backoff if longer, plus up to half of it again at
+    // random so that clients refused together do not come back together
+    long retry_delay_ms(unsigned long hint_ms, int attempt) {
+        unsigned long backoff_ms = std::min((unsigned long)UPLOAD_RETRY_MAX_MS,
+                                            (unsigned long)UPLOAD_RETRY_BASE_MS << std::min(attempt, 16));
+        unsigned long delay_ms = std::max(hint_ms, backoff_ms);
+        std::uniform_int_distribution<unsigned long> jitter(0, delay_ms / 2);
+        return (long)(delay_ms + jitter(random_engine));
+    }
+    
+    bool wait_until(const std::function<bool()>& done) {
+        while (!done()) {
+            if (!pump(-1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // Request and wait for its response, as "<status> <message>" (the text
+    // protocol's form). Transfers in progress keep moving meanwhile.
+    std::string call(int type, uint32_t job_id, const void* payload, size_t length) {
+        if (!connected) return "";
         
-        std::cout << "Uploading file: " << filepath << " (" << file_size << " bytes)" << std::endl;
+        std::string response;
+        bool answered = false;
+        request(type, job_id, payload, length, [&](const frame_header_t& header, unsigned char* data) {
+            response = std::string(frame_status_name(header.flags)) + " " +
+                       std::string((const char*)data, header.length);
+            answered = true;
+            return true;
+        });
+        if (!wait_until([&]() { return answered; })) {
+            return "";
+        }
+        return response;
+    }
+    
+    // Transfers
+    
+    // Start uploading a file (same layout as encrypt_file: IV + encrypted
+    // content, or as encrypt_file_aead in GCM mode, or the file alone in
+    // plaintext mode; encrypted chunk by chunk while sending). done runs with the
+    // scan job id, or -1 and the server's message. flags: scan priority
+    // (FRAME_FLAG_HIGH / FRAME_FLAG_LOW). An upload refused with
+    // RETRY_AFTER is started again later, up to UPLOAD_MAX_RETRIES times.
+    bool start_upload(const std::string& filepath, upload_callback_t done, int flags = 0, int attempt = 0) {
+        if (!connected) {
+            std::cerr << "Not connected to server" << std::endl;
+            return false;
+        }
         
-        // Extract filename from path
+        // The server rejects these names: skip them here
         size_t pos = filepath.find_last_of("/\\");
         std::string filename = (pos != std::string::npos) ? filepath.substr(pos + 1) : filepath;
-        
-        // Create temporary encrypted file
-        std::string temp_encrypted = "/tmp/client_encrypted_" + filename;
-        
-        // Encrypt file
-        if (encrypt_file(filepath.c_str(), temp_encrypted.c_str(), &encryption_key) != 0) {
-            std::cerr << "File encryption failed" << std::endl;
-            file.close();
+        if (filename.empty() || filename[0] == '.' || filename.size() >= MAX_FILENAME) {
+            std::cerr << "Invalid file name: " << filepath << std::endl;
             return false;
         }
         
-        file.close();
-        
-        // Get encrypted file size
-        std::ifstream encrypted_file(temp_encrypted, std::ios::binary);
-        encrypted_file.seekg(0, std::ios::end);
-        size_t encrypted_size = encrypted_file.tellg();
-        encrypted_file.seekg(0, std::ios::beg);
-        
-        // Send upload command
-        std::string upload_cmd = "UPLOAD_FILE " + filename + " " + std::to_string(encrypted_size);
-        if (!send_command(upload_cmd)) {
-            encrypted_file.close();
-            unlink(temp_encrypted.c_str());
+        int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            std::cerr << "Cannot open file: " << filepath << std::endl;
+            if (fd != -1) close(fd);
             return false;
         }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
         
-        // Wait for acknowledgment
-        std::string response = receive_response();
-        if (response != "OK Ready to receive file") {
-            std::cerr << "Server not ready to receive file: " << response << std::endl;
-            encrypted_file.close();
-            unlink(temp_encrypted.c_str());
+        std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+        upload->stream_id = next_stream_id++;
+        upload->fd = fd;
+        upload->name = filepath;
+        upload->file_size = st.st_size;
+        upload->sent = 0;
+        upload->started = false;
+        upload->aborted = false;
+        upload->plain = (transfer_mode & FRAME_FLAG_PLAIN) != 0;
+        upload->aead = (transfer_mode & FRAME_FLAG_GCM) != 0;
+        upload->record_length = 0;
+        upload->record_offset = 0;
+        upload->wire_size = upload->plain ? st.st_size :
+                            upload->aead ? aead_stream_size(st.st_size) : sizeof(encryption_key.iv) + st.st_size;
+        upload->wire_sent = 0;
+        if (upload->aead && (aead_random_nonce(upload->nonce) != 0 ||
+                             aead_stream_init(&upload->stream, &encryption_key, upload->nonce) != 0)) {
+            std::cerr << "Cannot set up GCM for " << filepath << std::endl;
+            close(fd);
             return false;
         }
         
-        // Send encrypted file data
-        char buffer[BUFFER_SIZE];
-        size_t total_sent = 0;
+        unsigned char payload[FRAME_MAX_COMMAND];
+        size_t payload_length = frame_upload_payload(payload, sizeof(payload), filename.c_str(), upload->wire_size);
+        upload->command.resize(FRAME_HEADER_SIZE + payload_length);
+        frame_encode(upload->command.data(), FRAME_UPLOAD_FILE, flags | transfer_mode, upload->stream_id, 0,
+                     payload, payload_length);
         
-        while (total_sent < encrypted_size) {
-            size_t to_read = std::min((size_t)BUFFER_SIZE, encrypted_size - total_sent);
-            encrypted_file.read(buffer, to_read);
-            size_t bytes_read = encrypted_file.gcount();
+        // The data follows the command without waiting for "Ready"; if the
+        // upload is refused, the server drops the stream's DATA frames
+        transfers[upload->stream_id] = { "upload " + filepath, 0, (size_t)st.st_size };
+        streams[upload->stream_id] = [this, upload, done, filepath, flags, attempt](const frame_header_t& header,
+                                                                                   unsigned char* data) {
+            std::string message((const char*)data, header.length);
+            if (header.flags == FRAME_STATUS_OK && header.job_id == 0) {
+                return false;  // "Ready to receive file"
+            }
+            upload->aborted = true;
+            transfers.erase(upload->stream_id);
             
-            if (bytes_read == 0) break;
+            // Server busy: "<ms> <reason>"
+            if (header.flags == FRAME_STATUS_RETRY_AFTER && attempt < UPLOAD_MAX_RETRIES) {
+                long delay_ms = retry_delay_ms(std::strtoul(message.c_str(), NULL, 10), attempt);
+                size_t reason = message.find(' ');
+                std::cerr << "Server busy (" << (reason != std::string::npos ? message.substr(reason + 1) : message)
+                          << "), retrying " << filepath << " in " << delay_ms << " ms" << std::endl;
+                retries.emplace(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms),
+                                [this, filepath, done, flags, attempt]() {
+                    if (!start_upload(filepath, done, flags, attempt + 1)) {
+                        done(-1, "Cannot start the upload again");
+                    }
+                });
+                return true;
+            }
+            done(header.flags == FRAME_STATUS_OK ? (int)header.job_id : -1, message);
+            return true;
+        };
+        upload_queue.push_back(upload);
+        return true;
+    }
+    
+    // Feed GCM stream bytes of a download: records are gathered across
+    // DATA frames and written once authenticated. "" or what went wrong.
+    std::string open_download_records(Download& download, const unsigned char* data, size_t length) {
+        while (length > 0) {
+            if (download.final_seen) {
+                return "data after the final GCM record";
+            }
+            size_t record_length = AEAD_HEADER_SIZE;  // Until the header is in
+            size_t plaintext_length;
+            int final;
+            if (download.record_have >= AEAD_HEADER_SIZE) {
+                aead_parse_header(download.record.data(), &plaintext_length, &final);
+                record_length = plaintext_length + AEAD_RECORD_OVERHEAD;
+            }
+            size_t take = std::min(length, record_length - download.record_have);
+            memcpy(download.record.data() + download.record_have, data, take);
+            download.record_have += take;
+            data += take;
+            length -= take;
+            if (download.record_have == AEAD_HEADER_SIZE &&
+                aead_parse_header(download.record.data(), &plaintext_length, &final) != 0) {
+                return "invalid GCM record";
+            }
+            if (record_length == AEAD_HEADER_SIZE || download.record_have < record_length) {
+                continue;
+            }
             
-            int bytes_sent = send(socket_fd, buffer, bytes_read, 0);
-            if (bytes_sent <= 0) {
-                perror("send file data");
-                encrypted_file.close();
-                unlink(temp_encrypted.c_str());
+            aead_plaintext.resize(AEAD_CHUNK_SIZE);
+            if (aead_open_record(&download.stream, download.record.data(), aead_plaintext.data(),
+                                 &plaintext_length, &final) != 0) {
+                return "GCM record failed authentication - wrong key or corrupted data";
+            }
+            download.record_have = 0;
+            download.final_seen = final != 0;
+            if (plaintext_length > 0 &&
+                write(download.fd, aead_plaintext.data(), plaintext_length) != (ssize_t)plaintext_length) {
+                return std::string("write failed: ") + strerror(errno);
+            }
+        }
+        return "";
+    }
+    
+    // Start downloading filename into local_path, decrypting the stream as
+    // it arrives: the session IV then XOR, or in GCM mode a nonce then
+    // records, each authenticated before it is written; in plaintext mode
+    // the stream is the file
+    bool start_download(const std::string& filename, const std::string& local_path, download_callback_t done) {
+        if (!connected) return false;
+        
+        std::shared_ptr<Download> download = std::make_shared<Download>();
+        bool plain = (transfer_mode & FRAME_FLAG_PLAIN) != 0;
+        bool aead = (transfer_mode & FRAME_FLAG_GCM) != 0;
+        size_t prefix_size = plain ? 0 : aead ? sizeof(download->nonce) : sizeof(encryption_key.iv);
+        if (aead) {
+            download->record.resize(AEAD_CHUNK_SIZE + AEAD_RECORD_OVERHEAD);
+        }
+        
+        uint32_t stream_id = next_stream_id;
+        transfers[stream_id] = { "download " + filename, 0, 0 };
+        auto fail = [this, download, local_path, done, stream_id](const std::string& message) {
+            if (download->fd != -1) {
+                close(download->fd);
+                unlink(local_path.c_str());
+            }
+            transfers.erase(stream_id);
+            done(false, message);
+            return true;
+        };
+        
+        request(FRAME_DOWNLOAD_FILE, 0, filename.data(), filename.size(),
+                [this, download, plain, aead, prefix_size, local_path, done, stream_id,
+                 fail](const frame_header_t& header, unsigned char* data) {
+            if (header.type == FRAME_RESPONSE) {
+                std::string message((const char*)data, header.length);
+                if (header.flags != FRAME_STATUS_SIZE) {
+                    return fail(message);
+                }
+                // Stream size (IV or nonce + encrypted content), then DATA frames
+                download->size = std::strtoull(message.c_str(), NULL, 10);
+                download->fd = open(local_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (download->fd == -1 || download->size < prefix_size + (aead ? AEAD_RECORD_OVERHEAD : 0)) {
+                    return fail("cannot write " + local_path);
+                }
+                transfers[stream_id].total = download->size;
+                if (download->size == 0) {
+                    // Empty plaintext file: no DATA frames follow
+                    close(download->fd);
+                    transfers.erase(stream_id);
+                    done(true, local_path);
+                    return true;
+                }
                 return false;
             }
             
-            total_sent += bytes_sent;
+            if (download->fd == -1 || header.length > download->size - download->received) {
+                return fail("invalid data from server");
+            }
             
-            // Show progress
-            int progress = (total_sent * 100) / encrypted_size;
-            std::cout << "\rProgress: " << progress << "% (" << total_sent << "/" << encrypted_size << " bytes)" << std::flush;
+            // IV (it must match the session's) or nonce first, then the content
+            size_t offset = 0;
+            if (download->received < prefix_size) {
+                size_t take = std::min((size_t)header.length, prefix_size - download->received);
+                if (aead) {
+                    memcpy(download->nonce + download->received, data, take);
+                    if (download->received + take == prefix_size &&
+                        aead_stream_init(&download->stream, &encryption_key, download->nonce) != 0) {
+                        return fail("cannot set up GCM");
+                    }
+                } else if (memcmp(data, encryption_key.iv + download->received, take) != 0) {
+                    return fail("IV mismatch - wrong key or corrupted file");
+                }
+                offset = take;
+            }
+            size_t length = header.length - offset;
+            if (aead) {
+                std::string error = open_download_records(*download, data + offset, length);
+                if (!error.empty()) {
+                    return fail(error);
+                }
+            } else {
+                if (!plain) {
+                    size_t position = download->received + offset - prefix_size;
+                    xor_stream_crypt(data + offset, data + offset, length, &encryption_key, position);
+                }
+                if (length > 0 && write(download->fd, data + offset, length) != (ssize_t)length) {
+                    return fail(std::string("write failed: ") + strerror(errno));
+                }
+            }
+            download->received += header.length;
+            transfers[stream_id].done = download->received;
+            
+            if (download->received < download->size) {
+                return false;
+            }
+            if (aead && !download->final_seen) {
+                return fail("GCM stream cut short");
+            }
+            close(download->fd);
+            transfers.erase(stream_id);
+            done(true, local_path);
+            return true;
+        }, transfer_mode);
+        return true;
+    }
+    
+    void print_transfers() {
+        if (transfers.empty()) {
+            std::cout << "No transfers in progress" << std::endl;
+            return;
+        }
+        for (const auto& transfer : transfers) {
+            const Progress& progress = transfer.second;
+            int percent = progress.total ? (int)(progress.done * 100 / progress.total) : 0;
+            std::cout << "  [" << transfer.first << "] " << progress.description << ": " << percent << "% ("
+                      << progress.done << "/" << progress.total << " bytes)" << std::endl;
+        }
+    }
+    
+    // Regular files under dir, depth first
+    static void collect_files(const std::string& dir, std::vector<std::string>& files) {
+        DIR* handle = opendir(dir.c_str());
+        if (!handle) {
+            perror(dir.c_str());
+            return;
         }
         
-        std::cout << std::endl;
-        encrypted_file.close();
-        unlink(temp_encrypted.c_str());
+        struct dirent* entry;
+        while ((entry = readdir(handle)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            
+            std::string path = dir + "/" + entry->d_name;
+            struct stat st;
+            if (lstat(path.c_str(), &st) == -1) continue;
+            if (S_ISDIR(st.st_mode)) {
+                collect_files(path, files);
+            } else if (S_ISREG(st.st_mode)) {
+                files.push_back(path);
+            }
+        }
+        closedir(handle);
+    }
+    
+    // Upload every file under dir over this connection, up to window files
+    // at once, each on its own stream. Their DATA frames interleave, so a
+    // large file does not delay the results of the small ones.
+    bool upload_directory(const std::string& dir, size_t window, int flags = 0) {
+        if (!connected) {
+            std::cerr << "Not connected to server" << std::endl;
+            return false;
+        }
+        window = std::max((size_t)1, std::min(window, (size_t)SESSION_MAX_STREAMS));
+        
+        std::vector<std::string> files;
+        collect_files(dir, files);
+        std::cout << "Uploading " << files.size() << " files from " << dir
+                  << " (window " << window << ")" << std::endl;
         
-        // Wait for upload confirmation
-        response = receive_response();
-        if (response.find("OK") == 0) {
-            std::cout << "File uploaded successfully" << std::endl;
+        std::deque<std::string> to_send(files.begin(), files.end());
+        size_t in_flight = 0, uploaded = 0, failed = 0, skipped = 0;
+        auto start = std::chrono::steady_clock::now();
+        
+        while (!to_send.empty() || in_flight > 0) {
+            // Fill the window. A file refused with RETRY_AFTER keeps its
+            // place while it waits, so a busy server slows the batch down.
+            while (!to_send.empty() && in_flight < window) {
+                std::string path = to_send.front();
+                to_send.pop_front();
+                
+                bool started = start_upload(path, [&, path](int job_id, const std::string& message) {
+                    in_flight--;
+                    if (job_id > 0) {
+                        std::cout << "JOB " << job_id << " " << path << std::endl;
+                        uploaded++;
+                    } else {
+                        std::cerr << "Failed: " << path << ": " << message << std::endl;
+                        failed++;
+                    }
+                }, flags);
+                if (started) {
+                    in_flight++;
+                } else {
+                    std::cerr << "Skipped: " << path << std::endl;
+                    skipped++;
+                }
+            }
             
-            // Extract job ID from response
-            size_t pos = response.find("Job ID: ");
-            if (pos != std::string::npos) {
-                std::string job_id = response.substr(pos + 8);
-                std::cout << "Scan job created with ID: " << job_id << std::endl;
-                return true;
+            if (in_flight > 0 && !pump(-1)) {
+                std::cerr << "Connection lost during batch upload" << std::endl;
+                return false;
             }
-        } else {
-            std::cerr << "Upload failed: " << response << std::endl;
         }
         
-        return false;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Batch done: " << uploaded << " uploaded, " << failed << " failed, "
+                  << skipped << " skipped in " << seconds << " s ("
+                  << (seconds > 0 ? uploaded / seconds : 0) << " files/s)" << std::endl;
+        return failed == 0;
     }
     
     std::string check_scan_status(const std::string& job_id) {
         if (!connected) return "Not connected";
-        
-        std::string status_cmd = "GET_SCAN_STATUS " + job_id;
-        if (!send_command(status_cmd)) {
-            return "Command failed";
-        }
-        
-        return receive_response();
+        return call(FRAME_GET_SCAN_STATUS, std::strtoul(job_id.c_str(), NULL, 10), NULL, 0);
     }
     
     std::string get_scan_result(const std::string& job_id) {
         if (!connected) return "Not connected";
+        return call(FRAME_GET_SCAN_RESULT, std::strtoul(job_id.c_str(), NULL, 10), NULL, 0);
+    }
+    
+    // Ask the server to push the job's result; callback runs on this
+    // thread when the NOTIFY frame is read (possibly before this returns)
+    void subscribe(int job_id, scan_callback_t callback) {
+        if (!connected) return;
         
-        std::string result_cmd = "GET_SCAN_RESULT " + job_id;
-        if (!send_command(result_cmd)) {
-            return "Command failed";
+        subscriptions[job_id] = callback;
+        request(FRAME_SUBSCRIBE, job_id, NULL, 0, [this, job_id](const frame_header_t& header, unsigned char* data) {
+            if (header.flags != FRAME_STATUS_OK) {
+                std::cerr << "Subscribe failed: " << std::string((const char*)data, header.length) << std::endl;
+                subscriptions.erase(job_id);
+            }
+            return true;
+        });
+    }
+    
+    // A clean result names the copy published for download,
+    // "<job_id>_<filename>"; the filename may hold spaces, so the name is
+    // matched rather than split off. "" if there is none.
+    static std::string published_name(int job_id, const std::string& filename, const std::string& result) {
+        std::string name = std::to_string(job_id) + "_" + filename;
+        std::string prefix = std::string(RESP_CLEAN) + " " + name;
+        if (result.compare(0, prefix.size(), prefix) != 0 ||
+            (result.size() > prefix.size() && result[prefix.size()] != ' ')) {
+            return "";
         }
-        
-        return receive_response();
+        return name;
     }
     
-    void monitor_scan_async(const std::string& job_id) {
-        std::thread monitor_thread([this, job_id]() {
-            std::cout << "Monitoring scan job " << job_id << " (async)..." << std::endl;
-            
-            while (connected) {
-                std::string status = check_scan_status(job_id);
-                
-                if (status.find("COMPLETED") != std::string::npos) {
-                    std::cout << "\n*** Scan completed for job " << job_id << " ***" << std::endl;
-                    
-                    std::string result = get_scan_result(job_id);
-                    std::cout << "Result: " << result << std::endl;
-                    break;
-                } else if (status.find("ERROR") != std::string::npos) {
-                    std::cout << "\n*** Scan error for job " << job_id << " ***" << std::endl;
-                    std::cout << "Status: " << status << std::endl;
-                    break;
-                } else if (status.find("PENDING") != std::string::npos || 
-                          status.find("PROCESSING") != std::string::npos) {
-                    std::cout << "Scan status: " << status << std::endl;
-                }
-                
-                std::this_thread::sleep_for(std::chrono::seconds(2));
+    void watch_scan(int job_id, const std::string& filename) {
+        subscribe(job_id, [this, filename](int id, const std::string& result) {
+            if (result.find(RESP_ERROR) == 0) {
+                std::cout << "\n*** Scan error for job " << id << " ***" << std::endl;
+            } else {
+                std::cout << "\n*** Scan completed for job " << id << " ***" << std::endl;
+            }
+            std::cout << "Result: " << result << std::endl;
+            std::string name = published_name(id, filename, result);
+            if (!name.empty()) {
+                published[id] = name;
+                std::cout << "Available as " << name << " (download " << id << ")" << std::endl;
             }
+            prompt_dirty = true;
         });
-        
-        monitor_thread.detach();
     }
     
-    bool download_file(const std::string& filename, const std::string& local_path) {
-        if (!connected) return false;
-        
-        std::string download_cmd = "DOWNLOAD_FILE " + filename;
-        if (!send_command(download_cmd)) {
-            return false;
-        }
-        
-        std::string response = receive_response();
-        if (response.find("SIZE ") != 0) {
-            std::cerr << "Download failed: " << response << std::endl;
-            return false;
-        }
-        
-        // Parse file size
-        size_t file_size = std::stoul(response.substr(5));
-        std::cout << "Downloading " << filename << " (" << file_size << " bytes)" << std::endl;
-        
-        // Receive encrypted file
-        std::string temp_encrypted = "/tmp/client_download_" + filename;
-        std::ofstream encrypted_file(temp_encrypted, std::ios::binary);
-        
-        char buffer[BUFFER_SIZE];
-        size_t total_received = 0;
-        
-        while (total_received < file_size) {
-            size_t to_receive = std::min((size_t)BUFFER_SIZE, file_size - total_received);
-            int bytes_received = recv(socket_fd, buffer, to_receive, 0);
+    // Next line from the terminal. Transfers, responses and notifications
+    // are handled while waiting, so they progress without typing anything.
+    bool read_input_line(std::string& input) {
+        for (;;) {
+            size_t newline = input_buffer.find('\n');
+            if (newline != std::string::npos) {
+                input = input_buffer.substr(0, newline);
+                input_buffer.erase(0, newline + 1);
+                return true;
+            }
             
-            if (bytes_received <= 0) {
-                perror("recv file data");
-                encrypted_file.close();
-                unlink(temp_encrypted.c_str());
+            bool input_ready = false;
+            if (!pump(-1, STDIN_FILENO, &input_ready)) {
+                std::cout << "\nConnection closed by server" << std::endl;
                 return false;
             }
-            
-            encrypted_file.write(buffer, bytes_received);
-            total_received += bytes_received;
-            
-            int progress = (total_received * 100) / file_size;
-            std::cout << "\rProgress: " << progress << "% (" << total_received << "/" << file_size << " bytes)" << std::flush;
-        }
-        
-        std::cout << std::endl;
-        encrypted_file.close();
-        
-        // Decrypt file
-        if (decrypt_file(temp_encrypted.c_str(), local_path.c_str(), &encryption_key) != 0) {
-            std::cerr << "File decryption failed" << std::endl;
-            unlink(temp_encrypted.c_str());
-            return false;
+            if (prompt_dirty) {
+                std::cout << "client> " << std::flush;
+                prompt_dirty = false;
+            }
+            if (input_ready) {
+                char buffer[BUFFER_SIZE];
+                ssize_t bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+                if (bytes_read == -1 && errno == EINTR) continue;
+                if (bytes_read <= 0) {
+                    // EOF: hand out a last line without newline
+                    input.swap(input_buffer);
+                    input_buffer.clear();
+                    return !input.empty();
+                }
+                input_buffer.append(buffer, bytes_read);
+            }
         }
-        
-        unlink(temp_encrypted.c_str());
-        std::cout << "File downloaded and decrypted: " << local_path << std::endl;
-        return true;
     }
     
     void interactive_mode() {
         std::string input;
         std::cout << "\n=== Antivirus Client Interactive Mode ===" << std::endl;
         std::cout << "Commands:" << std::endl;
-        std::cout << "  upload <filepath>     - Upload file for scanning" << std::endl;
+        std::cout << "  upload <filepath> [high|low] - Upload file for scanning (in the background)" << std::endl;
+        std::cout << "  upload-dir <path> [window] [high|low] - Upload a directory tree, several files at once" << std::endl;
         std::cout << "  status <job_id>       - Check scan status" << std::endl;
         std::cout << "  result <job_id>       - Get scan result" << std::endl;
-        std::cout << "  download <filename>   - Download file from server" << std::endl;
-        std::cout << "  quit                  - Exit client" << std::endl;
+        std::cout << "  download <job_id|name> - Download a clean file from server (in the background)" << std::endl;
+        std::cout << "  transfers             - Show uploads and downloads in progress" << std::endl;
+        std::cout << "  quit                  - Exit client (after the transfers finish)" << std::endl;
         std::cout << std::endl;
         
         while (connected) {
-            std::cout << "client> ";
-            std::getline(std::cin, input);
+            std::cout << "client> " << std::flush;
+            if (!read_input_line(input)) break;
             
             if (input.empty()) continue;
             
@@ -363,15 +965,35 @@ public:
             if (cmd == "quit" || cmd == "exit") {
                 break;
             } else if (cmd == "upload") {
-                std::string filepath;
-                iss >> filepath;
-                if (!filepath.empty()) {
-                    if (upload_file(filepath)) {
-                        // Start async monitoring (simplified - assume job ID 1)
-                        monitor_scan_async("1");
+                std::string filepath, priority;
+                iss >> filepath >> priority;
+                int flags = priority_flags(priority);
+                if (!filepath.empty() && flags != -1) {
+                    bool started = start_upload(filepath, [this, filepath](int job_id, const std::string& message) {
+                        if (job_id > 0) {
+                            std::cout << "\nFile uploaded: " << filepath << ", scan job ID: " << job_id << std::endl;
+                            size_t slash = filepath.find_last_of("/\\");
+                            watch_scan(job_id, slash != std::string::npos ? filepath.substr(slash + 1) : filepath);
+                        } else {
+                            std::cerr << "\nUpload of " << filepath << " failed: " << message << std::endl;
+                        }
+                        prompt_dirty = true;
+                    }, flags);
+                    if (started) {
+                        std::cout << "Uploading " << filepath << std::endl;
                     }
                 } else {
-                    std::cout << "Usage: upload <filepath>" << std::endl;
+                    std::cout << "Usage: upload <filepath> [high|low]" << std::endl;
+                }
+            } else if (cmd == "upload-dir") {
+                std::string path, priority;
+                size_t window = BATCH_DEFAULT_WINDOW;
+                iss >> path >> window >> priority;
+                int flags = priority_flags(priority);
+                if (!path.empty() && flags != -1) {
+                    upload_directory(path, window, flags);
+                } else {
+                    std::cout << "Usage: upload-dir <path> [window] [high|low]" << std::endl;
                 }
             } else if (cmd == "status") {
                 std::string job_id;
@@ -394,16 +1016,37 @@ public:
             } else if (cmd == "download") {
                 std::string filename;
                 iss >> filename;
+                // A job id of this session stands for the name its file was published under
+                auto job = published.find(std::atoi(filename.c_str()));
+                if (job != published.end() && filename == std::to_string(job->first)) {
+                    filename = job->second;
+                }
                 if (!filename.empty()) {
                     std::string local_path = "downloaded_" + filename;
-                    download_file(filename, local_path);
+                    start_download(filename, local_path, [this, filename](bool ok, const std::string& message) {
+                        if (ok) {
+                            std::cout << "\nFile downloaded and decrypted: " << message << std::endl;
+                        } else {
+                            std::cerr << "\nDownload of " << filename << " failed: " << message << std::endl;
+                        }
+                        prompt_dirty = true;
+                    });
+                    std::cout << "Downloading " << filename << std::endl;
                 } else {
-                    std::cout << "Usage: download <filename>" << std::endl;
+                    std::cout << "Usage: download <job_id|name>" << std::endl;
                 }
+            } else if (cmd == "transfers") {
+                print_transfers();
             } else {
                 std::cout << "Unknown command: " << cmd << std::endl;
             }
         }
+        
+        // Let the uploads and downloads that were started complete
+        if (connected && active_transfers() > 0) {
+            std::cout << "Waiting for " << active_transfers() << " transfers..." << std::endl;
+            wait_until([this]() { return active_transfers() == 0; });
+        }
     }
 };
 
@@ -413,24 +1056,54 @@ int main(int argc, char* argv[]) {
     std::string server_host = "localhost";
     int server_port = SERVER_PORT;
     
-    // Parse command line arguments
-    if (argc >= 2) {
-        server_host = argv[1];
-    }
-    if (argc >= 3) {
-        server_port = std::atoi(argv[2]);
+    std::string batch_dir;
+    size_t batch_window = BATCH_DEFAULT_WINDOW;
+    int batch_flags = 0;
+    int transfer_mode = 0;
+    
+    // Parse command line arguments: [host] [port] [--batch <dir>] [--window <n>] [--priority high|low] [--gcm|--plain]
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--gcm") {
+            transfer_mode = FRAME_FLAG_GCM;  // Authenticated AES-256-GCM instead of the XOR stream
+        } else if (arg == "--plain") {
+            transfer_mode = FRAME_FLAG_PLAIN;  // No encryption: trusted networks only
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_dir = argv[++i];
+        } else if (arg == "--window" && i + 1 < argc) {
+            batch_window = std::strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--priority" && i + 1 < argc) {
+            batch_flags = priority_flags(argv[++i]);
+            if (batch_flags == -1) {
+                std::cerr << "Invalid priority: " << argv[i] << " (high or low)" << std::endl;
+                return 1;
+            }
+        } else if (positional == 0) {
+            server_host = arg;
+            positional++;
+        } else if (positional == 1) {
+            server_port = std::atoi(arg.c_str());
+            positional++;
+        }
     }
     
     OrdinaryClient client(server_host, server_port);
+    client.set_transfer_mode(transfer_mode);
     
     if (!client.connect_to_server()) {
         std::cerr << "Failed to connect to server at " << server_host << ":" << server_port << std::endl;
         return 1;
     }
     
+    // Batch mode: upload the tree and exit
+    if (!batch_dir.empty()) {
+        return client.upload_directory(batch_dir, batch_window, batch_flags) ? 0 : 1;
+    }
+    
     // Run interactive mode
     client.interactive_mode();
     
     std::cout << "Client disconnected." << std::endl;
     return 0;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,62 @@
+#include "../../include/admission.h"
+#include "../../include/job_queue.h"
+#include <sys/statvfs.h>
+
+// How long the scan workers need to get through half of backlog jobs, at
+// the average scan time seen so far
+static unsigned int estimate_retry_ms(server_state_t* state, int backlog) {
+    unsigned long jobs = 0;
+    unsigned long long busy_ms = 0;
+    for (int i = 0; i < state->num_workers; i++) {
+        jobs += __atomic_load_n(&state->workers[i].jobs_processed, __ATOMIC_RELAXED);
+        busy_ms += __atomic_load_n(&state->workers[i].busy_ms, __ATOMIC_RELAXED);
+    }
+
+    unsigned long long average_ms = jobs ? busy_ms / jobs : ADMISSION_RETRY_MIN_MS;
+    int workers = state->num_workers > 0 ? state->num_workers : 1;
+    unsigned long long retry_ms = average_ms * (unsigned long long)backlog / 2 / workers;
+    if (retry_ms < ADMISSION_RETRY_MIN_MS) retry_ms = ADMISSION_RETRY_MIN_MS;
+    if (retry_ms > ADMISSION_RETRY_MAX_MS) retry_ms = ADMISSION_RETRY_MAX_MS;
+    return (unsigned int)retry_ms;
+}
+
+int admission_check(server_state_t* state, size_t size, unsigned int* retry_ms, const char** reason) {
+    pthread_mutex_lock(&state->jobs_mutex);
+    int active_jobs = job_table_active(state->job_table);
+    pthread_mutex_unlock(&state->jobs_mutex);
+
+    if (active_jobs + state->admitted_uploads >= MAX_JOBS) {
+        *reason = "Scan queue full";
+        *retry_ms = estimate_retry_ms(state, active_jobs);
+        return -1;
+    }
+
+    size_t in_flight = state->admitted_bytes + __atomic_load_n(&state->queued_scan_bytes, __ATOMIC_RELAXED);
+    if (in_flight > 0 && in_flight + size > ADMISSION_MAX_BYTES_IN_FLIGHT) {
+        *reason = "Too much data waiting for a scan";
+        *retry_ms = estimate_retry_ms(state, active_jobs);
+        return -1;
+    }
+
+    // The accepted uploads may not have written anything yet: count them whole
+    struct statvfs disk;
+    if (statvfs(UPLOAD_DIR, &disk) == 0 &&
+        (unsigned long long)disk.f_bavail * disk.f_frsize <
+            (unsigned long long)state->admitted_bytes + size + ADMISSION_DISK_RESERVE) {
+        *reason = "Not enough disk space";
+        *retry_ms = estimate_retry_ms(state, active_jobs);
+        if (*retry_ms < ADMISSION_RETRY_DISK_MS) *retry_ms = ADMISSION_RETRY_DISK_MS;
+        return -1;
+    }
+    return 0;
+}
+
+void admission_upload_started(server_state_t* state, size_t size) {
+    state->admitted_uploads++;
+    state->admitted_bytes += size;
+}
+
+void admission_upload_ended(server_state_t* state, size_t size) {
+    state->admitted_uploads--;
+    state->admitted_bytes -= size;
+}
@@ -1,6 +1,24 @@
 #include "../../include/common.h"
+#include "../../include/scanner.h"
+#include "../../include/job_queue.h"
+#include "../../include/mpmc_queue.h"
+#include "../../include/conn_table.h"
+#include "../../include/client_session.h"
+#include "../../include/logger.h"
+#include "../../include/result_cache.h"
+#include "../../include/verdict_store.h"
+#include "../../include/frame.h"
+#include "../../include/chunked_scan.h"
+#include "../../include/archive_scan.h"
+#include "../../include/scan_scheduler.h"
+#include "../../include/drop_folder.h"
+#include "../../include/onaccess.h"
+#include "../../include/prefilter.h"
 #include <stdarg.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 
 // Global server state
 server_state_t g_server_state;
@@ -8,7 +26,7 @@ server_state_t g_server_state;
 // Signal handling
 void signal_handler(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
-        log_message(LOG_INFO, "Received shutdown signal, stopping server gracefully...");
+        // No logging here: the handler may interrupt a log call on this thread
         g_server_state.server_running = 0;
     }
 }
@@ -20,27 +38,50 @@ void init_server_state(server_state_t* state) {
     state->admin_socket_fd = -1;
     state->client_socket_fd = -1;
     state->admin_client_fd = -1;
+    state->epoll_fd = -1;
+    state->notify_event_fd = -1;
     state->current_log_level = LOG_INFO;
     state->server_running = 1;
-    state->next_job_id = 1;
     
-    // Initialize mutexes and condition variables
+    // Initialize mutexes
     pthread_mutex_init(&state->clients_mutex, NULL);
     pthread_mutex_init(&state->jobs_mutex, NULL);
     pthread_mutex_init(&state->stats_mutex, NULL);
-    pthread_mutex_init(&state->log_mutex, NULL);
-    pthread_cond_init(&state->job_available, NULL);
-    sem_init(&state->job_semaphore, 0, 0);
+    pthread_mutex_init(&state->notify_mutex, NULL);
     
-    // Initialize stats
-    state->stats.server_start_time = time(NULL);
+    // Job table and scan queue (the queue can hold every job in the table
+    // plus the chunks allowed in it)
+    state->job_table = job_table_create(MAX_JOBS);
+    state->scan_chunk_size = SCAN_CHUNK_SIZE_DEFAULT;
+    void* queue_memory = NULL;
+    if (posix_memalign(&queue_memory, CACHE_LINE_SIZE, sizeof(mpmc_queue_t)) == 0) {
+        state->scan_queue = queue_memory;
+        if (mpmc_queue_init(state->scan_queue, MAX_JOBS + SCAN_QUEUE_CHUNK_SLOTS) != 0) {
+            free(state->scan_queue);
+            state->scan_queue = NULL;
+        }
+    }
+    
+    // Client connection table
+    state->clients = conn_table_create(INITIAL_CLIENT_CAPACITY);
+    
+    state->result_cache = result_cache_create(RESULT_CACHE_CAPACITY);
     
-    // Initialize client array
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        state->clients[i].socket_fd = -1;
-        state->clients[i].is_active = 0;
+    if (state->scan_queue) {
+        state->scheduler = scan_scheduler_create(state->scan_queue, 1);
     }
     
+    state->notify_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
+    if (!state->job_table || !state->scan_queue || !state->scheduler || !state->clients ||
+        !state->result_cache || state->notify_event_fd == -1) {
+        log_message(LOG_ERROR, "Failed to allocate server state");
+        state->server_running = 0;
+    }
+    
+    // Initialize stats
+    state->stats.server_start_time = time(NULL);
+    
     log_message(LOG_INFO, "Server state initialized");
 }
 
@@ -48,6 +89,18 @@ void init_server_state(server_state_t* state) {
 void cleanup_server_state(server_state_t* state) {
     state->server_running = 0;
     
+    // Stop gating opens first: it uses the verdict caches freed below
+    onaccess_stop(state->onaccess);
+    state->onaccess = NULL;
+    
+    // Wait for threads to finish
+    if (state->admin_thread) pthread_join(state->admin_thread, NULL);
+    if (state->client_thread) pthread_join(state->client_thread, NULL);
+    for (int i = 0; i < state->num_workers; i++) {
+        pthread_join(state->workers[i].thread_id, NULL);
+    }
+    if (state->monitor_thread) pthread_join(state->monitor_thread, NULL);
+    
     // Close sockets
     if (state->admin_socket_fd != -1) {
         close(state->admin_socket_fd);
@@ -59,30 +112,63 @@ void cleanup_server_state(server_state_t* state) {
     if (state->admin_client_fd != -1) {
         close(state->admin_client_fd);
     }
+    if (state->epoll_fd != -1) {
+        close(state->epoll_fd);
+    }
+    if (state->notify_event_fd != -1) {
+        close(state->notify_event_fd);
+    }
+    while (state->notify_head) {
+        job_notification_t* notification = state->notify_head;
+        state->notify_head = notification->next;
+        free(notification);
+    }
     
     // Close client connections
     pthread_mutex_lock(&state->clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (state->clients[i].is_active && state->clients[i].socket_fd != -1) {
-            close(state->clients[i].socket_fd);
-            state->clients[i].is_active = 0;
+    if (state->clients) {
+        for (int i = 0; i < state->clients->capacity; i++) {
+            client_info_t* client = state->clients->slots[i];
+            if (client && client->socket_fd != -1) {
+                client_session_release(state, client);
+                close(client->socket_fd);
+            }
         }
+        conn_table_destroy(state->clients);
+        state->clients = NULL;
     }
     pthread_mutex_unlock(&state->clients_mutex);
     
-    // Wait for threads to finish
-    if (state->admin_thread) pthread_join(state->admin_thread, NULL);
-    if (state->client_thread) pthread_join(state->client_thread, NULL);
-    if (state->processor_thread) pthread_join(state->processor_thread, NULL);
-    if (state->monitor_thread) pthread_join(state->monitor_thread, NULL);
-    
     // Cleanup synchronization objects
     pthread_mutex_destroy(&state->clients_mutex);
     pthread_mutex_destroy(&state->jobs_mutex);
     pthread_mutex_destroy(&state->stats_mutex);
-    pthread_mutex_destroy(&state->log_mutex);
-    pthread_cond_destroy(&state->job_available);
-    sem_destroy(&state->job_semaphore);
+    pthread_mutex_destroy(&state->notify_mutex);
+    
+    free(state->workers);
+    state->workers = NULL;
+    state->num_workers = 0;
+    
+    job_table_destroy(state->job_table);
+    state->job_table = NULL;
+    result_cache_destroy(state->result_cache);
+    state->result_cache = NULL;
+    verdict_store_close(state->verdict_store);
+    state->verdict_store = NULL;
+    if (state->prefilter) {
+        char prefilter_stats[MAX_MESSAGE];
+        prefilter_format_stats(state->prefilter, prefilter_stats, sizeof(prefilter_stats));
+        log_message(LOG_INFO, "Prefilter: %s", prefilter_stats);
+        prefilter_destroy(state->prefilter);
+        state->prefilter = NULL;
+    }
+    scan_scheduler_destroy(state->scheduler);
+    state->scheduler = NULL;
+    if (state->scan_queue) {
+        mpmc_queue_destroy(state->scan_queue);
+        free(state->scan_queue);
+        state->scan_queue = NULL;
+    }
     
     log_message(LOG_INFO, "Server state cleaned up");
 }
@@ -93,38 +179,10 @@ void log_message(log_level_t level, const char* format, ...) {
         return;
     }
     
-    pthread_mutex_lock(&g_server_state.log_mutex);
-    
-    time_t now = time(NULL);
-    struct tm* timeinfo = localtime(&now);
-    char timestamp[64];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", timeinfo);
-    
-    const char* level_str = log_level_to_string(level);
-    
-    // Print to console
-    printf("[%s] [%s] ", timestamp, level_str);
-    
     va_list args;
     va_start(args, format);
-    vprintf(format, args);
+    logger_vwrite(level, format, args);
     va_end(args);
-    
-    printf("\n");
-    fflush(stdout);
-    
-    // Also write to log file
-    FILE* log_file = fopen("logs/server.log", "a");
-    if (log_file) {
-        fprintf(log_file, "[%s] [%s] ", timestamp, level_str);
-        va_start(args, format);
-        vfprintf(log_file, format, args);
-        va_end(args);
-        fprintf(log_file, "\n");
-        fclose(log_file);
-    }
-    
-    pthread_mutex_unlock(&g_server_state.log_mutex);
 }
 
 // Create admin socket (UNIX domain socket)
@@ -189,7 +247,7 @@ int create_client_socket(void) {
         return -1;
     }
     
-    if (listen(sock_fd, MAX_CLIENTS) == -1) {
+    if (listen(sock_fd, SOMAXCONN) == -1) {
         log_message(LOG_ERROR, "Failed to listen on client socket: %s", strerror(errno));
         close(sock_fd);
         return -1;
@@ -199,7 +257,127 @@ int create_client_socket(void) {
     return sock_fd;
 }
 
+// Per-worker counters for GET_WORKER_STATS, e.g. "Workers: 2 | W0: 10 jobs 812 ms | W1: ..."
+static void format_worker_stats(server_state_t* state, char* buffer, size_t buffer_size) {
+    size_t len = snprintf(buffer, buffer_size, "Workers: %d", state->num_workers);
+    
+    for (int i = 0; i < state->num_workers && len < buffer_size; i++) {
+        scan_worker_t* worker = &state->workers[i];
+        len += snprintf(buffer + len, buffer_size - len, " | W%d: %lu jobs %llu ms",
+                        worker->worker_id,
+                        __atomic_load_n(&worker->jobs_processed, __ATOMIC_RELAXED),
+                        __atomic_load_n(&worker->busy_ms, __ATOMIC_RELAXED));
+    }
+}
+
 // Admin thread handler
+// One admin command; -1 ends the admin session
+static int handle_admin_frame(server_state_t* state, int client_fd, int framed,
+                              const frame_header_t* header, const unsigned char* payload) {
+    char args[256];
+    size_t args_length = header->length < sizeof(args) ? header->length : sizeof(args) - 1;
+    memcpy(args, payload, args_length);
+    args[args_length] = '\0';
+    
+    switch (header->type) {
+        case FRAME_SET_LOG_LEVEL: {
+            log_level_t new_level = string_to_log_level(args);
+            if (new_level != -1) {
+                state->current_log_level = new_level;
+                send_frame_response(client_fd, framed, RESP_OK, 0, "Log level updated");
+                log_message(LOG_INFO, "Log level changed to %s", args);
+            } else {
+                send_frame_response(client_fd, framed, RESP_ERROR, 0, "Invalid log level");
+            }
+            return 0;
+        }
+        case FRAME_GET_STATS: {
+            char stats_msg[MAX_MESSAGE];
+            unsigned long cache_hits, cache_misses;
+            size_t cache_entries;
+            result_cache_get_stats(state->result_cache, &cache_hits, &cache_misses, &cache_entries);
+            pthread_mutex_lock(&state->stats_mutex);
+            snprintf(stats_msg, sizeof(stats_msg), 
+                    "Connections: %d, Active: %d, Scans: %d, Clean: %d, Infected: %d, "
+                    "Cache hits: %lu, Cache misses: %lu, Cached: %zu, Stored: %zu, Log drops: %lu",
+                    state->stats.total_connections, state->stats.active_connections,
+                    state->stats.total_scans, state->stats.clean_files,
+                    state->stats.infected_files, cache_hits, cache_misses, cache_entries,
+                    state->verdict_store ? verdict_store_count(state->verdict_store) : 0,
+                    logger_dropped_count());
+            pthread_mutex_unlock(&state->stats_mutex);
+            send_frame_response(client_fd, framed, RESP_OK, 0, stats_msg);
+            return 0;
+        }
+        case FRAME_GET_WORKER_STATS: {
+            char stats_msg[MAX_MESSAGE];
+            format_worker_stats(state, stats_msg, sizeof(stats_msg));
+            send_frame_response(client_fd, framed, RESP_OK, 0, stats_msg);
+            return 0;
+        }
+        case FRAME_GET_QUEUE_STATS: {
+            // Admission counters (read from the admin thread, approximate)
+            char stats_msg[MAX_MESSAGE];
+            int length = snprintf(stats_msg, sizeof(stats_msg), "Uploading: %d (%zu MB), Unscanned: %zu MB, ",
+                                  __atomic_load_n(&state->admitted_uploads, __ATOMIC_RELAXED),
+                                  __atomic_load_n(&state->admitted_bytes, __ATOMIC_RELAXED) / (1024 * 1024),
+                                  __atomic_load_n(&state->queued_scan_bytes, __ATOMIC_RELAXED) / (1024 * 1024));
+            scan_scheduler_format_stats(state->scheduler, stats_msg + length, sizeof(stats_msg) - length);
+            send_frame_response(client_fd, framed, RESP_OK, 0, stats_msg);
+            return 0;
+        }
+        case FRAME_GET_ONACCESS_STATS: {
+            char stats_msg[MAX_MESSAGE];
+            if (state->onaccess) {
+                onaccess_format_stats(state->onaccess, stats_msg, sizeof(stats_msg));
+            } else {
+                snprintf(stats_msg, sizeof(stats_msg), "On-access scanning is disabled");
+            }
+            send_frame_response(client_fd, framed, RESP_OK, 0, stats_msg);
+            return 0;
+        }
+        case FRAME_GET_PREFILTER_STATS: {
+            char stats_msg[MAX_MESSAGE];
+            prefilter_format_stats(state->prefilter, stats_msg, sizeof(stats_msg));
+            send_frame_response(client_fd, framed, RESP_OK, 0, stats_msg);
+            return 0;
+        }
+        case FRAME_RELOAD_SIGNATURES: {
+            int patterns_failed;
+            int changed = scanner_reload(&patterns_failed);
+            if (changed == -1) {
+                send_frame_response(client_fd, framed, RESP_ERROR, 0, "Failed to reload signatures");
+                return 0;
+            }
+            // Cached verdicts are keyed by signature version and
+            // could never match again: free their slots now
+            if (changed) {
+                result_cache_clear(state->result_cache);
+                if (state->verdict_store) {
+                    verdict_store_compact(state->verdict_store);
+                }
+            }
+            // Hash lists are updated with the signatures
+            int lists_failed = (prefilter_reload(state->prefilter) != 0);
+            char reload_msg[MAX_MESSAGE];
+            snprintf(reload_msg, sizeof(reload_msg), "Signatures reloaded: %u, patterns: %zu%s%s%s",
+                     scan_engine_signature_count(), scanner_pattern_count(), changed ? "" : " (unchanged)",
+                     patterns_failed ? ", pattern file unchanged (see log)" : "",
+                     lists_failed ? ", hash lists unchanged (see log)" : "");
+            send_frame_response(client_fd, framed, RESP_OK, 0, reload_msg);
+            return 0;
+        }
+        case FRAME_SHUTDOWN_SERVER:
+            send_frame_response(client_fd, framed, RESP_OK, 0, "Server shutting down");
+            log_message(LOG_INFO, "Shutdown requested by admin");
+            state->server_running = 0;
+            return -1;
+        default:
+            send_frame_response(client_fd, framed, RESP_ERROR, 0, "Unknown command");
+            return 0;
+    }
+}
+
 void* admin_thread_handler(void* arg) {
     server_state_t* state = (server_state_t*)arg;
     struct sockaddr_un client_addr;
@@ -240,6 +418,15 @@ void* admin_thread_handler(void* arg) {
         state->admin_client_fd = client_fd;
         log_message(LOG_INFO, "Admin client connected");
         
+        // Frames, or text lines from older admin clients
+        frame_decoder_t decoder;
+        if (frame_decoder_init(&decoder, 1) != 0) {
+            log_message(LOG_ERROR, "Out of memory for admin connection");
+            close(client_fd);
+            state->admin_client_fd = -1;
+            continue;
+        }
+        
         // Handle admin commands
         time_t last_activity = time(NULL);
         while (state->server_running && state->admin_client_fd != -1) {
@@ -262,50 +449,34 @@ void* admin_thread_handler(void* arg) {
                 continue;
             }
             
-            int bytes_received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
+            int bytes_received = recv(client_fd, buffer, sizeof(buffer), 0);
             if (bytes_received <= 0) {
                 log_message(LOG_INFO, "Admin client disconnected");
                 break;
             }
             
-            buffer[bytes_received] = '\0';
             last_activity = time(NULL);
             
-            // Process admin command (simplified)
-            char cmd[256], args[256];
-            if (parse_admin_command(buffer, cmd, args) == 0) {
-                if (strcmp(cmd, CMD_SET_LOG_LEVEL) == 0) {
-                    log_level_t new_level = string_to_log_level(args);
-                    if (new_level != -1) {
-                        state->current_log_level = new_level;
-                        send_response(client_fd, RESP_OK, "Log level updated");
-                        log_message(LOG_INFO, "Log level changed to %s", args);
-                    } else {
-                        send_response(client_fd, RESP_ERROR, "Invalid log level");
-                    }
-                } else if (strcmp(cmd, CMD_GET_STATS) == 0) {
-                    char stats_msg[MAX_MESSAGE];
-                    pthread_mutex_lock(&state->stats_mutex);
-                    snprintf(stats_msg, sizeof(stats_msg), 
-                            "Connections: %d, Active: %d, Scans: %d, Clean: %d, Infected: %d",
-                            state->stats.total_connections, state->stats.active_connections,
-                            state->stats.total_scans, state->stats.clean_files,
-                            state->stats.infected_files);
-                    pthread_mutex_unlock(&state->stats_mutex);
-                    send_response(client_fd, RESP_OK, stats_msg);
-                } else if (strcmp(cmd, CMD_SHUTDOWN_SERVER) == 0) {
-                    send_response(client_fd, RESP_OK, "Server shutting down");
-                    log_message(LOG_INFO, "Shutdown requested by admin");
-                    state->server_running = 0;
-                    break;
-                } else {
-                    send_response(client_fd, RESP_ERROR, "Unknown command");
-                }
-            } else {
-                send_response(client_fd, RESP_ERROR, "Invalid command format");
+            // One recv may hold part of a command or several of them
+            if (frame_decoder_feed(&decoder, buffer, bytes_received) != 0) {
+                log_message(LOG_ERROR, "Out of memory reading admin commands");
+                break;
             }
+            frame_header_t header;
+            unsigned char* payload;
+            int next, keep = 1;
+            while (keep && (next = frame_decoder_next(&decoder, &header, &payload)) == 1) {
+                keep = handle_admin_frame(state, client_fd, decoder.mode == 0, &header, payload) == 0;
+            }
+            if (keep && next == -1) {
+                send_frame_response(client_fd, decoder.mode == 0, RESP_ERROR, 0, "Invalid command format");
+                log_message(LOG_WARNING, "Invalid admin message, disconnecting");
+                keep = 0;
+            }
+            if (!keep) break;
         }
         
+        frame_decoder_free(&decoder);
         close(client_fd);
         state->admin_client_fd = -1;
         log_message(LOG_INFO, "Admin client disconnected");
@@ -315,122 +486,280 @@ void* admin_thread_handler(void* arg) {
     return NULL;
 }
 
-// Client thread handler
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Accept every pending connection (the listening socket is edge-triggered)
+// Only touched by the reactor thread
+static unsigned long g_connection_sequence = 0;
+
+static void accept_clients(server_state_t* state) {
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int client_fd = accept4(state->client_socket_fd, (struct sockaddr*)&client_addr,
+                                &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_message(LOG_ERROR, "Failed to accept client connection: %s", strerror(errno));
+            }
+            return;
+        }
+        
+        pthread_mutex_lock(&state->clients_mutex);
+        client_info_t* client = conn_table_add(state->clients);
+        if (!client) {
+            pthread_mutex_unlock(&state->clients_mutex);
+            log_message(LOG_WARNING, "Out of memory for new client, rejecting connection");
+            close(client_fd);
+            continue;
+        }
+        
+        client->socket_fd = client_fd;
+        client->address = client_addr;
+        inet_ntop(AF_INET, &client_addr.sin_addr, client->ip_string, INET_ADDRSTRLEN);
+        client->connect_time = time(NULL);
+        client->last_activity = client->connect_time;
+        client->is_active = 1;
+        client->connection_id = ++g_connection_sequence;
+        client_session_init(client);
+        
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = client;
+        if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            log_message(LOG_ERROR, "Failed to register client with epoll: %s", strerror(errno));
+            conn_table_remove(state->clients, client);
+            pthread_mutex_unlock(&state->clients_mutex);
+            close(client_fd);
+            continue;
+        }
+        int slot = client->slot;
+        pthread_mutex_unlock(&state->clients_mutex);
+        
+        pthread_mutex_lock(&state->stats_mutex);
+        state->stats.total_connections++;
+        state->stats.active_connections++;
+        pthread_mutex_unlock(&state->stats_mutex);
+        
+        log_message(LOG_INFO, "Client connected from %s (slot %d)", client->ip_string, slot);
+    }
+}
+
+// Connections that used up their I/O budget and still have work to do.
+// With edge-triggered epoll they get no new event, so the reactor keeps
+// serving them round-robin between epoll_wait calls.
+static client_info_t* g_ready_head = NULL;
+static client_info_t* g_ready_tail = NULL;
+
+static void ready_list_push(client_info_t* client) {
+    if (client->in_ready_list) return;
+    client->ready_prev = g_ready_tail;
+    client->ready_next = NULL;
+    if (g_ready_tail) g_ready_tail->ready_next = client;
+    else g_ready_head = client;
+    g_ready_tail = client;
+    client->in_ready_list = 1;
+}
+
+static void ready_list_remove(client_info_t* client) {
+    if (!client->in_ready_list) return;
+    if (client->ready_prev) client->ready_prev->ready_next = client->ready_next;
+    else g_ready_head = client->ready_next;
+    if (client->ready_next) client->ready_next->ready_prev = client->ready_prev;
+    else g_ready_tail = client->ready_prev;
+    client->ready_prev = client->ready_next = NULL;
+    client->in_ready_list = 0;
+}
+
+// Connections whose input is paused by admission control. Data they send
+// meanwhile may have raised their only epoll event already, so the
+// reactor wakes up when a pause ends and gives them a turn.
+static client_info_t* g_paused_head = NULL;
+
+static void paused_list_push(client_info_t* client) {
+    if (client->in_paused_list) return;
+    client->paused_prev = NULL;
+    client->paused_next = g_paused_head;
+    if (g_paused_head) g_paused_head->paused_prev = client;
+    g_paused_head = client;
+    client->in_paused_list = 1;
+}
+
+static void paused_list_remove(client_info_t* client) {
+    if (!client->in_paused_list) return;
+    if (client->paused_prev) client->paused_prev->paused_next = client->paused_next;
+    else g_paused_head = client->paused_next;
+    if (client->paused_next) client->paused_next->paused_prev = client->paused_prev;
+    client->paused_prev = client->paused_next = NULL;
+    client->in_paused_list = 0;
+}
+
+// epoll_wait timeout: until the first pause ends, at most timeout_ms
+static int paused_list_timeout(int timeout_ms) {
+    unsigned long long now = monotonic_ms();
+    for (client_info_t* client = g_paused_head; client; client = client->paused_next) {
+        unsigned long long wait_ms = client->input_paused_until > now ? client->input_paused_until - now : 0;
+        if (wait_ms < (unsigned long long)timeout_ms) {
+            timeout_ms = (int)wait_ms;
+        }
+    }
+    return timeout_ms;
+}
+
+// Paused connections whose time is up go to the ready list
+static void resume_paused_clients(void) {
+    unsigned long long now = monotonic_ms();
+    client_info_t* client = g_paused_head;
+    while (client) {
+        client_info_t* next = client->paused_next;
+        if (client->input_paused_until <= now) {
+            paused_list_remove(client);
+            ready_list_push(client);
+        }
+        client = next;
+    }
+}
+
+static void disconnect_client(server_state_t* state, client_info_t* client) {
+    int slot = client->slot;
+    
+    ready_list_remove(client);
+    paused_list_remove(client);
+    client_session_release(state, client);
+    
+    // Closing the fd also removes it from the epoll set
+    close(client->socket_fd);
+    
+    pthread_mutex_lock(&state->clients_mutex);
+    conn_table_remove(state->clients, client);
+    pthread_mutex_unlock(&state->clients_mutex);
+    
+    pthread_mutex_lock(&state->stats_mutex);
+    state->stats.active_connections--;
+    pthread_mutex_unlock(&state->stats_mutex);
+    
+    log_message(LOG_INFO, "Client disconnected from slot %d", slot);
+}
+
+static void serve_client(server_state_t* state, client_info_t* client) {
+    int result = client_session_handle(state, client);
+    if (result == SESSION_CLOSED) {
+        disconnect_client(state, client);
+    } else if (result == SESSION_MORE) {
+        ready_list_push(client);
+    } else if (result == SESSION_PAUSED) {
+        paused_list_push(client);
+    }
+}
+
+// Hand the notifications posted by the scan workers to their connections.
+// A subscriber that has disconnected in the meantime is skipped: its slot
+// is empty or holds a connection with another id.
+static void deliver_job_notifications(server_state_t* state) {
+    uint64_t count;
+    if (read(state->notify_event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        log_message(LOG_WARNING, "Failed to read notification eventfd: %s", strerror(errno));
+    }
+    
+    pthread_mutex_lock(&state->notify_mutex);
+    job_notification_t* notification = state->notify_head;
+    state->notify_head = state->notify_tail = NULL;
+    pthread_mutex_unlock(&state->notify_mutex);
+    
+    while (notification) {
+        job_notification_t* next = notification->next;
+        client_info_t* client = notification->slot < state->clients->capacity ?
+                                state->clients->slots[notification->slot] : NULL;
+        if (client && client->connection_id == notification->connection_id) {
+            if (client_session_notify(client, notification->job_id, notification->result) != 0) {
+                log_message(LOG_WARNING, "Out of memory queueing a notification for slot %d", client->slot);
+            } else {
+                // Sent after the epoll events, which may still refer to this client
+                ready_list_push(client);
+            }
+        }
+        free(notification);
+        notification = next;
+    }
+}
+
+// Client thread handler (epoll reactor)
 void* client_thread_handler(void* arg) {
     server_state_t* state = (server_state_t*)arg;
-    struct pollfd pfds[MAX_CLIENTS + 1];
-    int nfds = 1;
+    struct epoll_event events[64];
     
     log_message(LOG_INFO, "Client thread started");
     
-    // Initialize poll structure
-    pfds[0].fd = state->client_socket_fd;
-    pfds[0].events = POLLIN;
+    state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state->epoll_fd == -1) {
+        log_message(LOG_ERROR, "Failed to create epoll instance: %s", strerror(errno));
+        return NULL;
+    }
+    
+    // The listening socket is registered with data.ptr = NULL
+    set_nonblocking(state->client_socket_fd);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, state->client_socket_fd, &ev) == -1) {
+        log_message(LOG_ERROR, "Failed to register client socket with epoll: %s", strerror(errno));
+        return NULL;
+    }
+    
+    // The notification eventfd is registered with data.ptr = &notify_event_fd
+    ev.events = EPOLLIN;
+    ev.data.ptr = &state->notify_event_fd;
+    if (epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, state->notify_event_fd, &ev) == -1) {
+        log_message(LOG_ERROR, "Failed to register notification eventfd with epoll: %s", strerror(errno));
+        return NULL;
+    }
     
     while (state->server_running) {
-        // Set up poll for all active clients
-        nfds = 1;
-        pthread_mutex_lock(&state->clients_mutex);
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (state->clients[i].is_active) {
-                pfds[nfds].fd = state->clients[i].socket_fd;
-                pfds[nfds].events = POLLIN;
-                nfds++;
-            }
-        }
-        pthread_mutex_unlock(&state->clients_mutex);
-        
-        int poll_result = poll(pfds, nfds, 1000);
-        if (poll_result == -1) {
+        // Don't sleep while some connection still has budgeted work pending,
+        // or past the end of an input pause
+        int nfds = epoll_wait(state->epoll_fd, events, 64, g_ready_head ? 0 : paused_list_timeout(1000));
+        if (nfds == -1) {
             if (errno == EINTR) continue;
-            log_message(LOG_ERROR, "Client poll error: %s", strerror(errno));
+            log_message(LOG_ERROR, "Client epoll error: %s", strerror(errno));
             break;
         }
         
-        if (poll_result == 0) continue;
-        
-        // Check for new connections
-        if (pfds[0].revents & POLLIN) {
-            struct sockaddr_in client_addr;
-            socklen_t addr_len = sizeof(client_addr);
-            int client_fd = accept(state->client_socket_fd, (struct sockaddr*)&client_addr, &addr_len);
+        for (int i = 0; i < nfds; i++) {
+            client_info_t* client = events[i].data.ptr;
             
-            if (client_fd != -1) {
-                // Find free slot for client
-                pthread_mutex_lock(&state->clients_mutex);
-                int slot = -1;
-                for (int i = 0; i < MAX_CLIENTS; i++) {
-                    if (!state->clients[i].is_active) {
-                        slot = i;
-                        break;
-                    }
-                }
-                
-                if (slot != -1) {
-                    state->clients[slot].socket_fd = client_fd;
-                    state->clients[slot].address = client_addr;
-                    inet_ntop(AF_INET, &client_addr.sin_addr, state->clients[slot].ip_string, INET_ADDRSTRLEN);
-                    state->clients[slot].connect_time = time(NULL);
-                    state->clients[slot].last_activity = time(NULL);
-                    state->clients[slot].is_active = 1;
-                    
-                    pthread_mutex_lock(&state->stats_mutex);
-                    state->stats.total_connections++;
-                    state->stats.active_connections++;
-                    pthread_mutex_unlock(&state->stats_mutex);
-                    
-                    log_message(LOG_INFO, "Client connected from %s (slot %d)", 
-                               state->clients[slot].ip_string, slot);
-                } else {
-                    log_message(LOG_WARNING, "Maximum clients reached, rejecting connection");
-                    close(client_fd);
-                }
-                pthread_mutex_unlock(&state->clients_mutex);
+            if (!client) {
+                accept_clients(state);
+                continue;
+            }
+            if (events[i].data.ptr == &state->notify_event_fd) {
+                deliver_job_notifications(state);
+                continue;
+            }
+            
+            if (events[i].events & EPOLLERR) {
+                disconnect_client(state, client);
+            } else {
+                // Sent after the epoll events, which may still refer to this client
+                ready_list_push(client);
             }
         }
         
-        // Handle client data
-        for (int i = 1; i < nfds; i++) {
-            if (pfds[i].revents & POLLIN) {
-                // Find client by socket fd
-                pthread_mutex_lock(&state->clients_mutex);
-                int client_slot = -1;
-                for (int j = 0; j < MAX_CLIENTS; j++) {
-                    if (state->clients[j].is_active && state->clients[j].socket_fd == pfds[i].fd) {
-                        client_slot = j;
-                        break;
-                    }
-                }
-                pthread_mutex_unlock(&state->clients_mutex);
-                
-                if (client_slot != -1) {
-                    // Handle client request (simplified)
-                    char buffer[BUFFER_SIZE];
-                    int bytes_received = recv(pfds[i].fd, buffer, sizeof(buffer) - 1, 0);
-                    
-                    if (bytes_received <= 0) {
-                        // Client disconnected
-                        pthread_mutex_lock(&state->clients_mutex);
-                        close(state->clients[client_slot].socket_fd);
-                        state->clients[client_slot].is_active = 0;
-                        pthread_mutex_lock(&state->stats_mutex);
-                        state->stats.active_connections--;
-                        pthread_mutex_unlock(&state->stats_mutex);
-                        log_message(LOG_INFO, "Client disconnected from slot %d", client_slot);
-                        pthread_mutex_unlock(&state->clients_mutex);
-                    } else {
-                        buffer[bytes_received] = '\0';
-                        state->clients[client_slot].last_activity = time(NULL);
-                        
-                        // Process client command (basic implementation)
-                        if (strncmp(buffer, CMD_REGISTER_CLIENT, strlen(CMD_REGISTER_CLIENT)) == 0) {
-                            send_response(pfds[i].fd, RESP_OK, "Client registered");
-                        } else {
-                            send_response(pfds[i].fd, RESP_ERROR, "Command not implemented");
-                        }
-                    }
-                }
-            }
+        // One more turn for every connection that ran out of budget or
+        // may read again
+        resume_paused_clients();
+        client_info_t* last = g_ready_tail;
+        while (g_ready_head) {
+            client_info_t* client = g_ready_head;
+            ready_list_remove(client);
+            serve_client(state, client);
+            if (client == last) break;
         }
     }
     
@@ -438,124 +767,617 @@ void* client_thread_handler(void* arg) {
     return NULL;
 }
 
-// Processor thread handler
+// Clean files become available for DOWNLOAD_FILE as "<job_id>_<filename>"
+// (published gets that name, "" if the move failed), so uploads of the
+// same name do not replace each other; the rest are removed
+static void publish_scanned_file(const scan_job_t* job, int scan_status, char* published, size_t published_size) {
+    published[0] = '\0';
+    if (scan_status == SCAN_RESULT_CLEAN) {
+        char name[PUBLISHED_NAME_SIZE];
+        char outgoing_path[MAX_PATH];
+        snprintf(name, sizeof(name), "%d_%s", job->job_id, job->filename);
+        snprintf(outgoing_path, sizeof(outgoing_path), "%s/%s", OUTGOING_DIR, name);
+        if (rename(job->filepath, outgoing_path) == -1) {
+            log_message(LOG_WARNING, "Failed to move %s to %s: %s",
+                       job->filepath, OUTGOING_DIR, strerror(errno));
+        } else {
+            snprintf(published, published_size, "%s", name);
+        }
+    } else {
+        unlink(job->filepath);
+    }
+}
+
+// Verdict of content already scanned with the current signatures, from the
+// result cache or the verdict store. Returns 0 on a miss.
+int lookup_verdict(server_state_t* state, const unsigned char* hash, unsigned long long signature_version,
+                   int* verdict, char* result, size_t result_size) {
+    char virus_name[MAX_VIRUS_NAME];
+    if (result_cache_lookup(state->result_cache, hash, signature_version,
+                            verdict, virus_name, sizeof(virus_name))) {
+        snprintf(result, result_size, "%s", *verdict == SCAN_RESULT_INFECTED ? virus_name : "OK");
+        return 1;
+    }
+    if (state->verdict_store &&
+        verdict_store_lookup(state->verdict_store, hash, signature_version,
+                             verdict, virus_name, sizeof(virus_name))) {
+        result_cache_insert(state->result_cache, hash, signature_version, *verdict, virus_name);
+        snprintf(result, result_size, "%s", *verdict == SCAN_RESULT_INFECTED ? virus_name : "OK");
+        return 1;
+    }
+    return 0;
+}
+
+void store_verdict(server_state_t* state, const unsigned char* hash, unsigned long long signature_version,
+                   int verdict, const char* result) {
+    result_cache_insert(state->result_cache, hash, signature_version, verdict, result);
+    if (state->verdict_store) {
+        verdict_store_append(state->verdict_store, hash, signature_version, verdict, result);
+    }
+}
+
+// Queue the job's result for the subscribed connection and wake up the
+// reactor, which owns the connection
+static void post_job_notification(server_state_t* state, int slot, unsigned long connection_id,
+                                  int job_id, const char* result) {
+    job_notification_t* notification = malloc(sizeof(job_notification_t));
+    if (!notification) {
+        log_message(LOG_WARNING, "Out of memory, notification for job %d dropped", job_id);
+        return;
+    }
+    notification->slot = slot;
+    notification->connection_id = connection_id;
+    notification->job_id = job_id;
+    notification->next = NULL;
+    snprintf(notification->result, sizeof(notification->result), "%s", result);
+    
+    pthread_mutex_lock(&state->notify_mutex);
+    if (state->notify_tail) state->notify_tail->next = notification;
+    else state->notify_head = notification;
+    state->notify_tail = notification;
+    pthread_mutex_unlock(&state->notify_mutex);
+    
+    uint64_t one = 1;
+    if (write(state->notify_event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        log_message(LOG_WARNING, "Failed to signal notification eventfd: %s", strerror(errno));
+    }
+}
+
+// Scan queue entries: scan_job_t*, scan_chunk_t* of a split job with
+// the low bit set, archive_member_t* of an archive with the next bit
+// set, or a scan_job_t* decided on upload with both set (all are at
+// least 8-byte aligned)
+#define SCAN_TASK_CHUNK ((uintptr_t)1)
+#define SCAN_TASK_MEMBER ((uintptr_t)2)
+#define SCAN_TASK_KNOWN ((uintptr_t)3)
+#define SCAN_TASK_MASK ((uintptr_t)3)
+
+// Archive member verdicts in a job result, leaving room for the verdict
+#define ARCHIVE_MEMBERS_RESULT 640
+
+// Record the verdict of a job and hand it to its subscriber. detail is
+// appended to the log line (cache hit, chunk timings), members (archive
+// member verdicts, may be NULL) to the result.
+static void complete_scan_job(server_state_t* state, scan_worker_t* worker, scan_job_t* job,
+                              int scan_status, const char* scan_result, unsigned long long elapsed_ms,
+                              const char* detail, const char* members) {
+    int job_id = job->job_id;
+    char published[PUBLISHED_NAME_SIZE];
+    publish_scanned_file(job, scan_status, published, sizeof(published));
+    __atomic_sub_fetch(&state->queued_scan_bytes, job->file_size, __ATOMIC_RELAXED);
+    
+    char job_result[MAX_MESSAGE];
+    pthread_mutex_lock(&state->jobs_mutex);
+    job->completed_time = time(NULL);
+    
+    pthread_mutex_lock(&state->stats_mutex);
+    if (scan_status == SCAN_RESULT_INFECTED) {
+        job->status = SCAN_COMPLETED;
+        snprintf(job->result, sizeof(job->result), "%s %s", RESP_INFECTED, scan_result);
+        state->stats.infected_files++;
+    } else if (scan_status == SCAN_RESULT_CLEAN) {
+        job->status = SCAN_COMPLETED;
+        if (published[0]) {
+            snprintf(job->result, sizeof(job->result), "%s %s", RESP_CLEAN, published);
+        } else {
+            strcpy(job->result, RESP_CLEAN);
+        }
+        state->stats.clean_files++;
+    } else {
+        job->status = SCAN_ERROR;
+        snprintf(job->result, sizeof(job->result), "%s %s", RESP_ERROR, scan_result);
+        state->stats.errors++;
+    }
+    state->stats.total_scans++;
+    pthread_mutex_unlock(&state->stats_mutex);
+    if (members && members[0]) {
+        size_t length = strlen(job->result);
+        snprintf(job->result + length, sizeof(job->result) - length, " %s", members);
+    }
+    
+    strcpy(job_result, job->result);
+    int subscriber_slot = job->subscriber_slot;
+    unsigned long subscriber_id = job->subscriber_id;
+    job_table_finish(state->job_table, job);
+    pthread_mutex_unlock(&state->jobs_mutex);
+    
+    if (subscriber_id != 0) {
+        post_job_notification(state, subscriber_slot, subscriber_id, job_id, job_result);
+    }
+    
+    // Per-worker counters (only this thread writes them)
+    __atomic_add_fetch(&worker->jobs_processed, 1, __ATOMIC_RELAXED);
+    if (scan_status == SCAN_RESULT_INFECTED) {
+        __atomic_add_fetch(&worker->infected_files, 1, __ATOMIC_RELAXED);
+    } else if (scan_status == SCAN_RESULT_CLEAN) {
+        __atomic_add_fetch(&worker->clean_files, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&worker->errors, 1, __ATOMIC_RELAXED);
+    }
+    
+    log_message(LOG_INFO, "Scan job %d completed by worker %d in %llu ms%s: %s",
+               job_id, worker->worker_id, elapsed_ms, detail, job_result);
+}
+
+// One chunk of a split job is done (or the splitting worker has handed
+// out every chunk and checked the whole-file hashes, taking scan_ms). The
+// last one merges the verdicts.
+static void finish_scan_chunk(server_state_t* state, scan_worker_t* worker, chunked_scan_t* scan,
+                              unsigned long long scan_ms) {
+    if (!chunked_scan_release(scan, scan_ms)) {
+        return;
+    }
+    
+    char scan_result[MAX_VIRUS_NAME * 2];
+    int scan_status = chunked_scan_verdict(scan, scan_result, sizeof(scan_result));
+    if (scan->has_hash) {
+        store_verdict(state, scan->hash, scan->signature_version, scan_status, scan_result);
+    }
+    
+    // Sum of the chunk scan times over the wall time of the chunked part
+    // = speedup from the split
+    unsigned long long now = monotonic_ms();
+    unsigned long long elapsed_ms = now - scan->start_ms;
+    unsigned long long chunked_ms = now - scan->split_ms;
+    char detail[128];
+    snprintf(detail, sizeof(detail), " (%d chunks: %llu ms of scanning in %llu ms, %.1fx)",
+             scan->chunk_count, scan->busy_ms, chunked_ms,
+             (double)scan->busy_ms / (double)(chunked_ms > 0 ? chunked_ms : 1));
+    complete_scan_job(state, worker, scan->job, scan_status, scan_result, elapsed_ms, detail, NULL);
+    chunked_scan_destroy(scan);
+}
+
+static void run_scan_chunk(server_state_t* state, scan_worker_t* worker, scan_chunk_t* chunk) {
+    unsigned long long scan_start = monotonic_ms();
+    chunked_scan_run(chunk);
+    unsigned long long scan_time = monotonic_ms() - scan_start;
+    __atomic_add_fetch(&worker->busy_ms, scan_time, __ATOMIC_RELAXED);
+    finish_scan_chunk(state, worker, chunk->scan, scan_time);
+}
+
+// Queue the chunks of a large file for all workers. Chunks that do not
+// fit in the queue's chunk slots are scanned here, then the whole-file
+// hash signatures are checked while the other workers scan.
+static void split_scan_job(server_state_t* state, scan_worker_t* worker, chunked_scan_t* scan) {
+    log_message(LOG_INFO, "Scan job %d split into %d chunks", scan->job->job_id, scan->chunk_count);
+    scan->split_ms = monotonic_ms();
+    
+    for (int i = 0; i < scan->chunk_count; i++) {
+        scan_chunk_t* chunk = &scan->chunks[i];
+        if (__atomic_add_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED) <= SCAN_QUEUE_CHUNK_SLOTS) {
+            mpmc_queue_push(state->scan_queue, (void*)((uintptr_t)chunk | SCAN_TASK_CHUNK));
+        } else {
+            __atomic_sub_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED);
+            run_scan_chunk(state, worker, chunk);
+        }
+    }
+    
+    unsigned long long hash_start = monotonic_ms();
+    chunked_scan_run_hashes(scan);
+    unsigned long long hash_time = monotonic_ms() - hash_start;
+    __atomic_add_fetch(&worker->busy_ms, hash_time, __ATOMIC_RELAXED);
+    finish_scan_chunk(state, worker, scan, hash_time);
+}
+
+// One member of an archive is done (or, with scan_ms 0, the walking
+// worker has reached the end of the archive). The last one merges the
+// member verdicts.
+static void finish_archive_member(server_state_t* state, scan_worker_t* worker, archive_scan_t* scan,
+                                  unsigned long long scan_ms) {
+    if (!archive_scan_release(scan, scan_ms)) {
+        return;
+    }
+    
+    char scan_result[MAX_VIRUS_NAME * 2];
+    char members[ARCHIVE_MEMBERS_RESULT];
+    int scan_status = archive_scan_verdict(scan, scan_result, sizeof(scan_result), members, sizeof(members));
+    
+    unsigned long long now = monotonic_ms();
+    unsigned long long elapsed_ms = now - scan->start_ms;
+    unsigned long long archive_ms = now - scan->split_ms;
+    char detail[128];
+    snprintf(detail, sizeof(detail), " (archive, %d members: %llu ms of scanning in %llu ms, %.1fx)",
+             scan->member_count, scan->busy_ms, archive_ms,
+             (double)scan->busy_ms / (double)(archive_ms > 0 ? archive_ms : 1));
+    complete_scan_job(state, worker, scan->job, scan_status, scan_result, elapsed_ms, detail, members);
+    archive_scan_destroy(scan);
+}
+
+static void run_archive_member(server_state_t* state, scan_worker_t* worker, archive_member_t* member) {
+    archive_scan_t* scan = member->scan;
+    unsigned long long scan_start = monotonic_ms();
+    archive_scan_run(member);
+    unsigned long long scan_time = monotonic_ms() - scan_start;
+    __atomic_add_fetch(&worker->busy_ms, scan_time, __ATOMIC_RELAXED);
+    finish_archive_member(state, worker, scan, scan_time);
+}
+
+typedef struct {
+    server_state_t* state;
+    scan_worker_t* worker;
+} archive_walk_context_t;
+
+// Queue a member for all workers while it fits in the chunk slots and the
+// buffered member bytes stay bounded; otherwise scan it here
+static void emit_archive_member(archive_member_t* member, void* context) {
+    archive_walk_context_t* walk = context;
+    server_state_t* state = walk->state;
+    if (archive_scan_buffered(member->scan) <= ARCHIVE_MAX_BUFFERED) {
+        if (__atomic_add_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED) <= SCAN_QUEUE_CHUNK_SLOTS) {
+            mpmc_queue_push(state->scan_queue, (void*)((uintptr_t)member | SCAN_TASK_MEMBER));
+            return;
+        }
+        __atomic_sub_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED);
+    }
+    run_archive_member(state, walk->worker, member);
+}
+
+// Walk an archive, handing its members to the workers as they come out
+static void split_archive_job(server_state_t* state, scan_worker_t* worker, archive_scan_t* scan) {
+    log_message(LOG_INFO, "Scan job %d is an archive, scanning its members", scan->job->job_id);
+    scan->split_ms = monotonic_ms();
+    
+    archive_walk_context_t context = { state, worker };
+    archive_scan_walk(scan, emit_archive_member, &context);
+    finish_archive_member(state, worker, scan, 0);
+}
+
+static void process_scan_job(server_state_t* state, scan_worker_t* worker, scan_job_t* job) {
+    __atomic_store_n(&job->status, SCAN_PROCESSING, __ATOMIC_RELAXED);
+    log_message(LOG_INFO, "Worker %d processing scan job %d: %s",
+               worker->worker_id, job->job_id, job->filename);
+    
+    unsigned long long scan_start = monotonic_ms();
+    unsigned char hash[CONTENT_HASH_SIZE];
+    int has_hash = job->has_hash;
+    if (has_hash) {
+        memcpy(hash, job->hash, sizeof(hash));  // Hashed on upload, hash lists already checked
+    } else {
+        has_hash = (sha256_file(job->filepath, hash) == 0);
+    }
+    unsigned long long signature_version = scanner_signature_version();
+    char scan_result[MAX_VIRUS_NAME * 2];
+    int scan_status;
+    
+    // Hash lists and uniform content, ahead of any cached verdict
+    prefilter_stage_t stage;
+    prefilter_type_t type;
+    if (prefilter_check(state->prefilter, job->filepath, has_hash && !job->has_hash ? hash : NULL, &scan_status,
+                        scan_result, sizeof(scan_result), &stage, &type)) {
+        unsigned long long scan_time = monotonic_ms() - scan_start;
+        __atomic_add_fetch(&worker->busy_ms, scan_time, __ATOMIC_RELAXED);
+        char detail[64];
+        snprintf(detail, sizeof(detail), " (prefilter: %s)", prefilter_stage_name(stage));
+        complete_scan_job(state, worker, job, scan_status, scan_result, scan_time, detail, NULL);
+        return;
+    }
+    
+    // Archives are walked every time: a cached verdict has no member listing
+    archive_scan_t* archive = archive_scan_create(job);
+    if (!archive && has_hash && lookup_verdict(state, hash, signature_version, &scan_status,
+                                               scan_result, sizeof(scan_result))) {
+        unsigned long long scan_time = monotonic_ms() - scan_start;
+        __atomic_add_fetch(&worker->busy_ms, scan_time, __ATOMIC_RELAXED);
+        complete_scan_job(state, worker, job, scan_status, scan_result, scan_time, " (cached)", NULL);
+        return;
+    }
+    
+    if (archive) {
+        archive->start_ms = scan_start;
+        split_archive_job(state, worker, archive);
+        return;
+    }
+    
+    chunked_scan_t* scan = chunked_scan_create(job, state->scan_chunk_size);
+    if (scan) {
+        scan->start_ms = scan_start;
+        scan->has_hash = has_hash;
+        memcpy(scan->hash, hash, sizeof(hash));
+        scan->signature_version = signature_version;
+        split_scan_job(state, worker, scan);
+        return;
+    }
+    
+    scan_status = prefilter_scan(state->prefilter, job->filepath, job->file_size, type,
+                                 scan_result, sizeof(scan_result));
+    if (has_hash) {
+        store_verdict(state, hash, signature_version, scan_status, scan_result);
+    }
+    unsigned long long scan_time = monotonic_ms() - scan_start;
+    __atomic_add_fetch(&worker->busy_ms, scan_time, __ATOMIC_RELAXED);
+    complete_scan_job(state, worker, job, scan_status, scan_result, scan_time, "", NULL);
+}
+
+// Complete a job decided on upload (SCAN_TASK_KNOWN): publishing the
+// file renames it, which is kept off the reactor too
+static void complete_known_job(server_state_t* state, scan_worker_t* worker, scan_job_t* job) {
+    char detail[64];
+    if (job->known_stage >= 0) {
+        snprintf(detail, sizeof(detail), " (on upload, prefilter: %s)",
+                 prefilter_stage_name((prefilter_stage_t)job->known_stage));
+    } else {
+        snprintf(detail, sizeof(detail), " (on upload, cached)");
+    }
+    complete_scan_job(state, worker, job, job->known_status, job->known_result, 0, detail, NULL);
+}
+
+// Processor thread handler (one instance per scan worker)
 void* processor_thread_handler(void* arg) {
-    server_state_t* state = (server_state_t*)arg;
+    scan_worker_t* worker = (scan_worker_t*)arg;
+    server_state_t* state = worker->state;
     
-    log_message(LOG_INFO, "Processor thread started");
+    log_message(LOG_INFO, "Scan worker %d started", worker->worker_id);
     
     while (state->server_running) {
-        // Wait for jobs to be available
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 1;
-        
-        if (sem_timedwait(&state->job_semaphore, &timeout) == -1) {
-            if (errno == ETIMEDOUT) continue;
-            if (errno == EINTR) continue;
-            log_message(LOG_ERROR, "Semaphore wait error: %s", strerror(errno));
-            break;
-        }
+        // Take the next job or chunk (parks for up to 1 second when the queue is empty)
+        void* task = mpmc_queue_pop_wait(state->scan_queue, 1000);
         
-        // Process job from queue
-        pthread_mutex_lock(&state->jobs_mutex);
-        scan_job_t* job = NULL;
-        for (int i = 0; i < state->job_count; i++) {
-            if (state->job_queue[i].status == SCAN_PENDING) {
-                job = &state->job_queue[i];
-                job->status = SCAN_PROCESSING;
-                break;
-            }
+        uintptr_t tag = (uintptr_t)task & SCAN_TASK_MASK;
+        if (tag == SCAN_TASK_CHUNK) {
+            __atomic_sub_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED);
+            run_scan_chunk(state, worker, (scan_chunk_t*)((uintptr_t)task & ~SCAN_TASK_MASK));
+        } else if (tag == SCAN_TASK_MEMBER) {
+            __atomic_sub_fetch(&state->queued_chunks, 1, __ATOMIC_RELAXED);
+            run_archive_member(state, worker, (archive_member_t*)((uintptr_t)task & ~SCAN_TASK_MASK));
+        } else if (tag == SCAN_TASK_KNOWN) {
+            complete_known_job(state, worker, (scan_job_t*)((uintptr_t)task & ~SCAN_TASK_MASK));
+        } else if (task) {
+            scan_scheduler_job_started(state->scheduler);
+            process_scan_job(state, worker, task);
         }
+    }
+    
+    log_message(LOG_INFO, "Scan worker %d terminated", worker->worker_id);
+    return NULL;
+}
+
+// A job whose content was hashed as it was uploaded: the hash lists and
+// the result cache can decide it at once, with no wait in the scheduler.
+// This runs on the reactor, so only memory is looked at: the verdict
+// store (its pages may have to be read from disk) is left to the worker.
+// An archive is only checked against the lists: a cached verdict has no
+// member listing. Returns 1 if the job is decided (known_*); otherwise
+// the hash goes with the job, so the worker does not hash again.
+static int decide_known_job(server_state_t* state, scan_job_t* job, const unsigned char* hash, int archive) {
+    char virus_name[MAX_VIRUS_NAME];
+    prefilter_stage_t stage;
+    if (prefilter_check_hash(state->prefilter, hash, job->file_size, &job->known_status,
+                             job->known_result, sizeof(job->known_result), &stage)) {
+        job->known_stage = (int)stage;
+        return 1;
+    }
+    if (!archive && result_cache_lookup(state->result_cache, hash, scanner_signature_version(),
+                                        &job->known_status, virus_name, sizeof(virus_name))) {
+        snprintf(job->known_result, sizeof(job->known_result), "%s",
+                 job->known_status == SCAN_RESULT_INFECTED ? virus_name : "OK");
+        job->known_stage = -1;
+        return 1;
+    }
+    job->has_hash = 1;
+    memcpy(job->hash, hash, sizeof(job->hash));
+    return 0;
+}
+
+// Create a scan job for a file and hand it to the scheduler, which
+// queues it for the scan workers in its client's turn. hash is the
+// content hash taken during the upload, or NULL (the worker computes it);
+// archive is set when the upload starts like one (archive_scan_probe).
+// Returns the new job id, or -1 if the job table is full.
+int submit_scan_job(server_state_t* state, const char* filename, const char* filepath,
+                    int client_fd, size_t file_size, const char* client_address, int priority,
+                    const unsigned char* hash, int archive) {
+    pthread_mutex_lock(&state->jobs_mutex);
+    scan_job_t* job = job_table_alloc(state->job_table);
+    if (!job) {
         pthread_mutex_unlock(&state->jobs_mutex);
+        log_message(LOG_WARNING, "Job table full, rejecting scan of %s", filename);
+        return -1;
+    }
+    
+    snprintf(job->filename, sizeof(job->filename), "%s", filename);
+    snprintf(job->filepath, sizeof(job->filepath), "%s", filepath);
+    job->client_fd = client_fd;
+    job->file_size = file_size;
+    snprintf(job->client_address, sizeof(job->client_address), "%s", client_address);
+    job->priority = priority;
+    int job_id = job->job_id;
+    pthread_mutex_unlock(&state->jobs_mutex);
+    __atomic_add_fetch(&state->queued_scan_bytes, file_size, __ATOMIC_RELAXED);
+    
+    if (hash && decide_known_job(state, job, hash, archive)) {
+        // Straight to the workers: the scan queue has room for every job
+        mpmc_queue_push(state->scan_queue, (void*)((uintptr_t)job | SCAN_TASK_KNOWN));
+        return job_id;
+    }
+    scan_scheduler_submit(state->scheduler, job);
+    log_message(LOG_DEBUG, "Scan job %d queued: %s", job_id, filename);
+    return job_id;
+}
+
+// Start the scan worker pool (num_workers <= 0 means one worker per online CPU)
+int start_scan_workers(server_state_t* state, int num_workers) {
+    if (num_workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = (cpus > 0) ? (int)cpus : 1;
+    }
+    
+    state->workers = calloc(num_workers, sizeof(scan_worker_t));
+    if (!state->workers) {
+        log_message(LOG_ERROR, "Failed to allocate scan worker pool");
+        return -1;
+    }
+    
+    for (int i = 0; i < num_workers; i++) {
+        scan_worker_t* worker = &state->workers[i];
+        worker->worker_id = i;
+        worker->state = state;
         
-        if (job) {
-            log_message(LOG_INFO, "Processing scan job %d: %s", job->job_id, job->filename);
-            
-            // Simulate scanning (replace with actual ClamAV integration)
-            char scan_result[MAX_MESSAGE];
-            int is_infected = scan_file_with_clamav(job->filepath, scan_result, sizeof(scan_result));
-            
-            pthread_mutex_lock(&state->jobs_mutex);
-            job->status = SCAN_COMPLETED;
-            job->completed_time = time(NULL);
-            
-            if (is_infected) {
-                strcpy(job->result, "INFECTED");
-                pthread_mutex_lock(&state->stats_mutex);
-                state->stats.infected_files++;
-                pthread_mutex_unlock(&state->stats_mutex);
-            } else {
-                strcpy(job->result, "CLEAN");
-                pthread_mutex_lock(&state->stats_mutex);
-                state->stats.clean_files++;
-                pthread_mutex_unlock(&state->stats_mutex);
-            }
-            
-            pthread_mutex_lock(&state->stats_mutex);
-            state->stats.total_scans++;
-            pthread_mutex_unlock(&state->stats_mutex);
-            
-            pthread_mutex_unlock(&state->jobs_mutex);
-            
-            log_message(LOG_INFO, "Scan job %d completed: %s", job->job_id, job->result);
+        if (pthread_create(&worker->thread_id, NULL, processor_thread_handler, worker) != 0) {
+            log_message(LOG_ERROR, "Failed to create scan worker %d", i);
+            return -1;
         }
+        state->num_workers++;
     }
     
-    log_message(LOG_INFO, "Processor thread terminated");
-    return NULL;
+    // One dispatched job per worker, the rest wait in their client's queue
+    scan_scheduler_set_window(state->scheduler, state->num_workers);
+    log_message(LOG_INFO, "Scan worker pool started with %d workers", state->num_workers);
+    return 0;
 }
 
-// Monitor thread handler (inotify)
+// Monitor thread handler: drop folder ingestion (drop_folder.h)
 void* monitor_thread_handler(void* arg) {
     server_state_t* state = (server_state_t*)arg;
     
     log_message(LOG_INFO, "Monitor thread started");
     
-    int inotify_fd = inotify_init();
-    if (inotify_fd == -1) {
-        log_message(LOG_ERROR, "Failed to initialize inotify: %s", strerror(errno));
-        return NULL;
-    }
-    
-    int wd = inotify_add_watch(inotify_fd, "processing", IN_CREATE | IN_MOVED_TO);
-    if (wd == -1) {
-        log_message(LOG_ERROR, "Failed to add inotify watch: %s", strerror(errno));
-        close(inotify_fd);
+    drop_folder_t* folder = drop_folder_open();
+    if (!folder) {
         return NULL;
     }
     
-    char buffer[4096];
     while (state->server_running) {
+        // Claim due files while the job table has room for them
+        unsigned long long now = monotonic_ms();
+        int table_full = 0;
+        while (drop_folder_has_due(folder, now)) {
+            pthread_mutex_lock(&state->jobs_mutex);
+            int active_jobs = job_table_active(state->job_table);
+            pthread_mutex_unlock(&state->jobs_mutex);
+            if (active_jobs + __atomic_load_n(&state->admitted_uploads, __ATOMIC_RELAXED) >= DROP_MAX_ACTIVE_JOBS) {
+                table_full = 1;
+                break;
+            }
+            
+            char filename[MAX_FILENAME];
+            char path[MAX_PATH];
+            size_t file_size;
+            if (!drop_folder_claim(folder, now, filename, sizeof(filename), path, sizeof(path), &file_size)) {
+                break;
+            }
+            if (submit_scan_job(state, filename, path, -1, file_size, DROP_CLIENT_ADDRESS,
+                                SCAN_PRIORITY_NORMAL, NULL, 0) == -1) {
+                drop_folder_unclaim(folder, path);
+                table_full = 1;
+                break;
+            }
+            log_message(LOG_DEBUG, "Drop folder: %s queued for scanning", filename);
+        }
+        
         struct pollfd pfd;
-        pfd.fd = inotify_fd;
+        pfd.fd = folder->inotify_fd;
         pfd.events = POLLIN;
-        
-        int poll_result = poll(&pfd, 1, 1000);
+        int timeout = drop_folder_timeout(folder, now, table_full ? DROP_FULL_RETRY_MS : 1000);
+        int poll_result = poll(&pfd, 1, timeout);
         if (poll_result == -1) {
             if (errno == EINTR) continue;
             log_message(LOG_ERROR, "Monitor poll error: %s", strerror(errno));
             break;
         }
         
-        if (poll_result == 0) continue;
-        
-        int length = read(inotify_fd, buffer, sizeof(buffer));
-        if (length > 0) {
-            struct inotify_event* event = (struct inotify_event*)buffer;
-            log_message(LOG_DEBUG, "File created in processing: %s", event->name);
+        now = monotonic_ms();
+        if (poll_result > 0 && drop_folder_read_events(folder, now) != 0) {
+            break;
         }
+        drop_folder_sweep_if_due(folder, now);
     }
     
-    inotify_rm_watch(inotify_fd, wd);
-    close(inotify_fd);
+    log_message(LOG_INFO, "Drop folder: %lu events, %lu files queued, %lu coalesced, %lu overflows, %lu left",
+               folder->events, folder->queued, folder->coalesced, folder->overflows, folder->backlog);
+    drop_folder_close(folder);
     
     log_message(LOG_INFO, "Monitor thread terminated");
     return NULL;
 }
 
 // Main function
+static void print_usage(const char* program) {
+    printf("Usage: %s [-w workers] [-c chunk_mb] [-s patterns] [-a path [-p open|closed] [-t timeout_ms]]\n",
+           program);
+    printf("  -w workers   Number of scan worker threads (default: online CPUs)\n");
+    printf("  -c chunk_mb  Split files of at least %d chunks across workers (default: %d MB, 0 = never)\n",
+           SCAN_CHUNK_MIN_COUNT, SCAN_CHUNK_SIZE_DEFAULT / (1024 * 1024));
+    printf("  -s patterns  Match the byte patterns in this file (Name:hexbytes per line) ahead of ClamAV\n");
+    printf("  -a path      Scan files on open under path (fanotify, needs CAP_SYS_ADMIN)\n");
+    printf("  -p policy    Answer to opens without a verdict in time: open (allow, default) or closed (deny)\n");
+    printf("  -t ms        On-access decision timeout (default: %d ms)\n", ONACCESS_TIMEOUT_DEFAULT_MS);
+}
+
 int main(int argc, char* argv[]) {
+    int num_workers = 0;
+    long chunk_mb = -1;
+    const char* patterns_path = NULL;
+    const char* onaccess_path = NULL;
+    onaccess_policy_t onaccess_policy = ONACCESS_FAIL_OPEN;
+    int onaccess_timeout_ms = ONACCESS_TIMEOUT_DEFAULT_MS;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "w:c:s:a:p:t:h")) != -1) {
+        switch (opt) {
+            case 'w':
+                num_workers = atoi(optarg);
+                if (num_workers <= 0) {
+                    fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c': {
+                char* end;
+                chunk_mb = strtol(optarg, &end, 10);
+                if (*end != '\0' || chunk_mb < 0 || chunk_mb > 4096) {
+                    fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 's':
+                patterns_path = optarg;
+                break;
+            case 'a':
+                onaccess_path = optarg;
+                break;
+            case 'p':
+                if (onaccess_parse_policy(optarg, &onaccess_policy) != 0) {
+                    fprintf(stderr, "Invalid fail policy: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                onaccess_timeout_ms = atoi(optarg);
+                if (onaccess_timeout_ms <= 0) {
+                    fprintf(stderr, "Invalid decision timeout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
     printf("Antivirus Server Starting...\n");
     
     // Install signal handlers
@@ -563,13 +1385,66 @@ int main(int argc, char* argv[]) {
     signal(SIGTERM, signal_handler);
     signal(SIGPIPE, SIG_IGN);
     
+    // Allow as many client connections as the hard fd limit permits
+    struct rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max) {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fd_limit);
+    }
+    
     // Create directories
     create_directory_if_not_exists("logs");
-    create_directory_if_not_exists("processing");
-    create_directory_if_not_exists("outgoing");
+    create_directory_if_not_exists(DROP_DIR);
+    create_directory_if_not_exists(UPLOAD_DIR);
+    create_directory_if_not_exists(DROP_CLAIM_DIR);
+    create_directory_if_not_exists(OUTGOING_DIR);
+    
+    // Without the log file, lines still go to the console synchronously
+    if (logger_init(LOG_FILE_PATH) == 0) {
+        atexit(logger_shutdown);
+    }
     
     // Initialize server state
     init_server_state(&g_server_state);
+    if (!g_server_state.job_table) {
+        cleanup_server_state(&g_server_state);
+        return 1;
+    }
+    if (chunk_mb >= 0) {
+        g_server_state.scan_chunk_size = (size_t)chunk_mb * 1024 * 1024;
+    }
+    
+    // Load and compile the signature database (and the pattern file)
+    // once for the whole server
+    if (scanner_init(NULL, patterns_path) != 0) {
+        log_message(LOG_ERROR, "Failed to initialize scan engine");
+        cleanup_server_state(&g_server_state);
+        return 1;
+    }
+    
+    // Allow/block hash lists in front of the engine (missing lists are empty)
+    g_server_state.prefilter = prefilter_create();
+    if (!g_server_state.prefilter) {
+        log_message(LOG_ERROR, "Failed to load hash lists from %s", PREFILTER_DIR);
+        cleanup_server_state(&g_server_state);
+        return 1;
+    }
+    
+    // Verdicts from earlier runs, keyed by the version loaded above;
+    // the server works without them
+    g_server_state.verdict_store = verdict_store_open(scanner_signature_version);
+    if (!g_server_state.verdict_store) {
+        log_message(LOG_WARNING, "Verdict store unavailable, verdicts will not persist");
+    }
+    
+    if (onaccess_path) {
+        g_server_state.onaccess = onaccess_start(&g_server_state, onaccess_path,
+                                                 onaccess_policy, onaccess_timeout_ms);
+        if (!g_server_state.onaccess) {
+            cleanup_server_state(&g_server_state);
+            return 1;
+        }
+    }
     
     // Create sockets
     g_server_state.admin_socket_fd = create_admin_socket();
@@ -597,8 +1472,7 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    if (pthread_create(&g_server_state.processor_thread, NULL, processor_thread_handler, &g_server_state) != 0) {
-        log_message(LOG_ERROR, "Failed to create processor thread");
+    if (start_scan_workers(&g_server_state, num_workers) != 0) {
         cleanup_server_state(&g_server_state);
         return 1;
     }
@@ -618,6 +1492,7 @@ int main(int argc, char* argv[]) {
     
     log_message(LOG_INFO, "Shutting down server...");
     cleanup_server_state(&g_server_state);
+    scanner_cleanup();
     
     printf("Antivirus Server Stopped.\n");
     return 0;
@@ -0,0 +1,1054 @@
+#include "../../include/archive_scan.h"
+#include <clamav.h>
+#include <zlib.h>
+
+#define INPUT_BUFFER_SIZE (64 * 1024)
+#define TAR_BLOCK 512
+
+enum { FORMAT_NONE, FORMAT_ZIP, FORMAT_TAR, FORMAT_GZIP };
+
+// Walk results
+#define WALK_DONE 0
+#define WALK_UNSUPPORTED -1     // Layout the walker cannot follow: ClamAV scans the container whole
+#define WALK_STOP -2            // A limit was reached or the verdict is known
+
+// Member decompression
+enum { MEMBER_OK, MEMBER_TOO_LARGE, MEMBER_BOMB, MEMBER_DAMAGED };
+
+typedef struct {
+    archive_scan_t* scan;
+    archive_member_handler_t handler;
+    void* context;
+} walk_t;
+
+// Buffered input: the archive file, a member in memory, or the output of
+// a gzip stream read from another input. Unread bytes are data[start, end).
+typedef struct input {
+    const unsigned char* data;
+    size_t start;
+    size_t end;
+    unsigned char* buffer;              // Owned (file and gzip inputs)
+    int fd;                             // File input, -1 otherwise
+    off_t offset;                       // Next file offset
+    struct input* inner;                // gzip input: the compressed bytes
+    z_stream stream;
+    unsigned long long produced;        // gzip input: decompressed / compressed bytes
+    unsigned long long consumed;
+    int finished;                       // gzip input: end of the last gzip member
+    int bomb;                           // gzip input stopped at ARCHIVE_MAX_RATIO
+    unsigned long long filled;          // Bytes made available so far (read or unread)
+} input_t;
+
+// Local header offsets of a ZIP walk, checked against its central directory
+typedef struct {
+    unsigned long long* offsets;
+    size_t count;
+    size_t capacity;
+} zip_headers_t;
+
+static uint16_t le16(const unsigned char* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const unsigned char* p) {
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static int is_bomb(unsigned long long produced, unsigned long long consumed) {
+    return produced > ARCHIVE_RATIO_MIN_SIZE && produced > ARCHIVE_MAX_RATIO * consumed;
+}
+
+static int archive_format(const unsigned char* head, size_t length) {
+    if (length >= 4 && memcmp(head, "PK\x03\x04", 4) == 0) return FORMAT_ZIP;
+    if (length >= 3 && memcmp(head, "\x1F\x8B\x08", 3) == 0) return FORMAT_GZIP;
+    if (length >= 262 && memcmp(head + 257, "ustar", 5) == 0) return FORMAT_TAR;
+    return FORMAT_NONE;
+}
+
+// ZIP based formats ClamAV parses as documents, recognized by their first entry
+static int is_zip_document(const unsigned char* head, size_t length) {
+    static const char* first_entries[] = {
+        "[Content_Types].xml",          // Office Open XML
+        "mimetype",                     // OpenDocument, EPUB
+        "META-INF/",                    // JAR
+        "AndroidManifest.xml",          // APK
+    };
+    if (length < 30) {
+        return 0;
+    }
+    size_t name_length = le16(head + 26);
+    const char* name = (const char*)head + 30;
+    for (size_t i = 0; i < sizeof(first_entries) / sizeof(first_entries[0]); i++) {
+        size_t entry_length = strlen(first_entries[i]);
+        if (30 + entry_length <= length && name_length >= entry_length &&
+            memcmp(name, first_entries[i], entry_length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Inputs
+
+static void input_from_memory(input_t* in, const unsigned char* data, size_t size) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->data = data;
+    in->end = size;
+    in->filled = size;
+}
+
+static int input_from_file(input_t* in, int fd) {
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+    in->buffer = malloc(INPUT_BUFFER_SIZE);
+    in->data = in->buffer;
+    return in->buffer ? 0 : -1;
+}
+
+static int input_from_gzip(input_t* in, input_t* inner) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->inner = inner;
+    in->buffer = malloc(INPUT_BUFFER_SIZE);
+    in->data = in->buffer;
+    if (!in->buffer || inflateInit2(&in->stream, 16 + MAX_WBITS) != Z_OK) {
+        free(in->buffer);
+        in->buffer = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void input_close(input_t* in) {
+    if (in->inner) {
+        inflateEnd(&in->stream);
+    }
+    free(in->buffer);
+}
+
+// Unread bytes available: 1, or 0 at the end of the input or on an error
+static int input_fill(input_t* in) {
+    if (in->start < in->end) {
+        return 1;
+    }
+
+    if (in->fd != -1) {
+        ssize_t length;
+        do {
+            length = pread(in->fd, in->buffer, INPUT_BUFFER_SIZE, in->offset);
+        } while (length == -1 && errno == EINTR);
+        if (length <= 0) {
+            return 0;
+        }
+        in->offset += length;
+        in->filled += (unsigned long long)length;
+        in->start = 0;
+        in->end = (size_t)length;
+        return 1;
+    }
+
+    if (!in->inner || in->finished) {
+        return 0;  // Memory, or the end of the gzip data
+    }
+
+    for (;;) {
+        if (!input_fill(in->inner)) {
+            return 0;  // End of the compressed data (truncated if the stream did not end)
+        }
+        input_t* inner = in->inner;
+        in->stream.next_in = (unsigned char*)inner->data + inner->start;
+        in->stream.avail_in = (unsigned int)(inner->end - inner->start);
+        in->stream.next_out = in->buffer;
+        in->stream.avail_out = INPUT_BUFFER_SIZE;
+
+        int ret = inflate(&in->stream, Z_NO_FLUSH);
+        size_t consumed = (inner->end - inner->start) - in->stream.avail_in;
+        size_t produced = INPUT_BUFFER_SIZE - in->stream.avail_out;
+        inner->start += consumed;
+        in->consumed += consumed;
+        in->produced += produced;
+
+        if (ret == Z_STREAM_END) {
+            // Concatenated gzip members continue the same data
+            if (inflateReset(&in->stream) != Z_OK || !input_fill(inner) ||
+                inner->end - inner->start < 2 || memcmp(inner->data + inner->start, "\x1F\x8B", 2) != 0) {
+                in->finished = 1;  // Trailing garbage is ignored
+            }
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return 0;
+        }
+        if (is_bomb(in->produced, in->consumed)) {
+            in->bomb = 1;
+            return 0;
+        }
+        if (produced > 0) {
+            in->filled += produced;
+            in->start = 0;
+            in->end = produced;
+            return 1;
+        }
+        if (in->finished) {
+            return 0;
+        }
+    }
+}
+
+// Offset of the next unread byte from the start of the input
+static unsigned long long input_position(const input_t* in) {
+    return in->filled - (in->end - in->start);
+}
+
+static size_t input_read(input_t* in, void* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length && input_fill(in)) {
+        size_t available = in->end - in->start;
+        size_t count = available < length - done ? available : length - done;
+        memcpy((unsigned char*)buffer + done, in->data + in->start, count);
+        in->start += count;
+        done += count;
+    }
+    return done;
+}
+
+static int input_skip(input_t* in, unsigned long long length) {
+    while (length > 0) {
+        if (!input_fill(in)) {
+            return -1;
+        }
+        size_t available = in->end - in->start;
+        size_t count = available < length ? available : (size_t)length;
+        in->start += count;
+        length -= count;
+    }
+    return 0;
+}
+
+// Members
+
+static int walk_stopped(const archive_scan_t* scan) {
+    return scan->limit[0] != '\0' || __atomic_load_n(&scan->infected, __ATOMIC_RELAXED);
+}
+
+static void member_path(char* path, const char* prefix, const char* name) {
+    if (prefix[0]) {
+        snprintf(path, ARCHIVE_MAX_NAME, "%s/%s", prefix, name);
+    } else {
+        snprintf(path, ARCHIVE_MAX_NAME, "%s", name);
+    }
+}
+
+static archive_member_t* add_member(archive_scan_t* scan, const char* name) {
+    archive_member_t* member = calloc(1, sizeof(archive_member_t));
+    if (!member) {
+        return NULL;
+    }
+    member->scan = scan;
+    member->status = SCAN_RESULT_CLEAN;
+    snprintf(member->name, sizeof(member->name), "%s", name);
+    if (scan->members_tail) scan->members_tail->next = member;
+    else scan->members = member;
+    scan->members_tail = member;
+    scan->member_count++;
+    return member;
+}
+
+// A member with a verdict of its own, not scanned (reason says why)
+static void add_unscanned_member(archive_scan_t* scan, const char* name, int status, const char* reason) {
+    archive_member_t* member = add_member(scan, name);
+    if (member) {
+        member->status = status;
+        snprintf(member->virus_name, sizeof(member->virus_name), "%s", reason);
+    }
+    if (status == SCAN_RESULT_INFECTED) {
+        __atomic_store_n(&scan->infected, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void set_limit(archive_scan_t* scan, const char* reason) {
+    if (!scan->limit[0]) {
+        snprintf(scan->limit, sizeof(scan->limit), "%s", reason);
+    }
+}
+
+// Hand a member's content (owned by the member from now on) to the workers;
+// data NULL is the archive file, parsed as the formats in parsers
+static int emit_member(walk_t* walk, const char* name, unsigned char* data, size_t size, unsigned int parsers) {
+    archive_member_t* member = add_member(walk->scan, name);
+    if (!member) {
+        free(data);
+        set_limit(walk->scan, "out of memory");
+        return WALK_STOP;
+    }
+    member->data = data;
+    member->size = size;
+    member->parsers = parsers;
+    if (data) {
+        __atomic_add_fetch(&walk->scan->buffered, size, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&walk->scan->members_left, 1, __ATOMIC_RELAXED);
+    walk->handler(member, walk->context);
+    return WALK_DONE;
+}
+
+static int count_file(archive_scan_t* scan) {
+    if (++scan->file_count > ARCHIVE_MAX_FILES) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "more than %d files", ARCHIVE_MAX_FILES);
+        set_limit(scan, reason);
+        return -1;
+    }
+    return 0;
+}
+
+// A read stopped short: a gzip bomb, or a truncated / damaged archive
+static int input_failed(archive_scan_t* scan, const input_t* in, const char* name) {
+    if (in->bomb) {
+        add_unscanned_member(scan, name, SCAN_RESULT_INFECTED, ARCHIVE_BOMB_NAME);
+        return WALK_STOP;
+    }
+    return WALK_UNSUPPORTED;
+}
+
+static int walk_input(walk_t* walk, input_t* in, int format, const char* prefix, int depth);
+
+// Decompressed content of a member: walk it if it is an archive itself,
+// otherwise queue it for a scan. Takes ownership of data.
+static int handle_member(walk_t* walk, const char* name, unsigned char* data, size_t size, int depth) {
+    archive_scan_t* scan = walk->scan;
+    scan->total_size += size;
+    if (scan->total_size > ARCHIVE_MAX_TOTAL_SIZE) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "more than %llu MB decompressed", ARCHIVE_MAX_TOTAL_SIZE / (1024 * 1024));
+        set_limit(scan, reason);
+        free(data);
+        return WALK_STOP;
+    }
+    if (size == 0) {
+        add_member(scan, name);  // Nothing to scan
+        free(data);
+        return WALK_DONE;
+    }
+
+    int format = archive_format(data, size);
+    if (format != FORMAT_NONE && depth < ARCHIVE_MAX_DEPTH) {
+        input_t in;
+        input_from_memory(&in, data, size);
+        int result = walk_input(walk, &in, format, name, depth + 1);
+        input_close(&in);
+        if (result != WALK_UNSUPPORTED) {
+            free(data);
+            return result;
+        }
+        // Let ClamAV parse the rest of it
+    }
+    return emit_member(walk, name, data, size, SCAN_PARSERS_ALL);
+}
+
+// Member data stored as is
+static int read_stored(input_t* in, unsigned long long size, unsigned char** data) {
+    if (size > ARCHIVE_MAX_MEMBER_SIZE) {
+        return MEMBER_TOO_LARGE;
+    }
+    *data = malloc(size ? (size_t)size : 1);
+    if (!*data) {
+        return MEMBER_TOO_LARGE;
+    }
+    if (input_read(in, *data, (size_t)size) < size) {
+        free(*data);
+        *data = NULL;
+        return MEMBER_DAMAGED;
+    }
+    return MEMBER_OK;
+}
+
+// Raw deflate member data, up to the end of its stream. consumed gets the
+// compressed bytes read (to skip the rest when the member is abandoned).
+static int read_deflated(input_t* in, unsigned long long size_hint, unsigned char** data, size_t* size,
+                         unsigned long long* consumed) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return MEMBER_DAMAGED;
+    }
+
+    size_t capacity = size_hint > 0 && size_hint < INPUT_BUFFER_SIZE ? (size_t)size_hint : INPUT_BUFFER_SIZE;
+    unsigned char* buffer = malloc(capacity);
+    size_t length = 0;
+    int outcome = buffer ? MEMBER_DAMAGED : MEMBER_TOO_LARGE;
+    *consumed = 0;
+
+    while (buffer) {
+        if (length == capacity) {
+            if (capacity >= ARCHIVE_MAX_MEMBER_SIZE) {
+                outcome = MEMBER_TOO_LARGE;
+                break;
+            }
+            size_t new_capacity = capacity * 2 < ARCHIVE_MAX_MEMBER_SIZE ? capacity * 2 : ARCHIVE_MAX_MEMBER_SIZE;
+            unsigned char* grown = realloc(buffer, new_capacity);
+            if (!grown) {
+                outcome = MEMBER_TOO_LARGE;
+                break;
+            }
+            buffer = grown;
+            capacity = new_capacity;
+        }
+        if (!input_fill(in)) {
+            break;  // Truncated
+        }
+
+        stream.next_in = (unsigned char*)in->data + in->start;
+        stream.avail_in = (unsigned int)(in->end - in->start);
+        stream.next_out = buffer + length;
+        stream.avail_out = (unsigned int)(capacity - length);
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        size_t used = (in->end - in->start) - stream.avail_in;
+        in->start += used;
+        *consumed += used;
+        length = capacity - stream.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            outcome = MEMBER_OK;
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            break;
+        }
+        if (is_bomb(length, *consumed)) {
+            outcome = MEMBER_BOMB;
+            break;
+        }
+    }
+    inflateEnd(&stream);
+
+    if (outcome != MEMBER_OK) {
+        free(buffer);
+        return outcome;
+    }
+    *data = buffer;
+    *size = length;
+    return MEMBER_OK;
+}
+
+// The ZIP64 extra field of a central directory entry: the 64-bit values
+// of the fields saturated at 0xFFFFFFFF, in this order
+static unsigned long long zip64_header_offset(const unsigned char* extra, size_t extra_length,
+                                              const unsigned char* entry) {
+    unsigned long long offset = le32(entry + 42);
+    for (size_t position = 0; position + 4 <= extra_length; ) {
+        uint16_t id = le16(extra + position);
+        uint16_t field_length = le16(extra + position + 2);
+        if (id == 0x0001 && position + 4 + field_length <= extra_length) {
+            size_t value = position + 4;
+            value += le32(entry + 24) == 0xFFFFFFFFU ? 8 : 0;      // Uncompressed size
+            value += le32(entry + 20) == 0xFFFFFFFFU ? 8 : 0;      // Compressed size
+            if (value + 8 <= position + 4 + field_length) {
+                offset = le64(extra + value);
+            }
+            break;
+        }
+        position += 4 + field_length;
+    }
+    return offset;
+}
+
+// The central directory the walk reached (signature read, at offset
+// directory) must be the one unzip reads: one entry per local header
+// seen, in order, then the end record, at the very end of the input,
+// pointing back here. A decoy directory with more members behind it
+// fails this, and ClamAV scans the file whole.
+static int check_central_directory(input_t* in, uint32_t signature, unsigned long long directory,
+                                   const zip_headers_t* headers, unsigned char* extra) {
+    unsigned char record[56];
+    size_t entries = 0;
+    unsigned long long base = input_position(in) - 4 - directory;  // Offsets are from the start of the ZIP
+
+    while (signature == 0x02014b50) {
+        if (input_read(in, record + 4, 42) < 42) {
+            return WALK_UNSUPPORTED;
+        }
+        size_t extra_length = le16(record + 30);
+        if (input_skip(in, le16(record + 28)) != 0 || input_read(in, extra, extra_length) < extra_length ||
+            input_skip(in, le16(record + 32)) != 0) {
+            return WALK_UNSUPPORTED;
+        }
+        unsigned long long offset = le32(record + 42);
+        if (offset == 0xFFFFFFFFULL) {
+            offset = zip64_header_offset(extra, extra_length, record);
+        }
+        if (le16(record + 34) != 0 || entries >= headers->count || offset != headers->offsets[entries]) {
+            return WALK_UNSUPPORTED;
+        }
+        entries++;
+        if (input_read(in, record, 4) < 4) {
+            return WALK_UNSUPPORTED;
+        }
+        signature = le32(record);
+    }
+    unsigned long long directory_size = input_position(in) - 4 - base - directory;
+
+    int zip64 = 0;
+    if (signature == 0x06064b50) {
+        // ZIP64 end record, then its locator
+        unsigned long long end_record = input_position(in) - 4 - base;
+        if (input_read(in, record + 4, 52) < 52 || le64(record + 4) < 44 ||
+            le32(record + 16) != 0 || le32(record + 20) != 0 ||
+            le64(record + 24) != entries || le64(record + 32) != entries ||
+            le64(record + 40) != directory_size || le64(record + 48) != directory ||
+            input_skip(in, le64(record + 4) - 44) != 0) {
+            return WALK_UNSUPPORTED;
+        }
+        if (input_read(in, record, 20) < 20 || le32(record) != 0x07064b50 ||
+            le64(record + 8) != end_record || input_read(in, record, 4) < 4) {
+            return WALK_UNSUPPORTED;
+        }
+        signature = le32(record);
+        zip64 = 1;
+    }
+
+    if (signature != 0x06054b50 || input_read(in, record + 4, 18) < 18 ||
+        le16(record + 4) != 0 || le16(record + 6) != 0 || entries != headers->count) {
+        return WALK_UNSUPPORTED;
+    }
+    // With a ZIP64 end record the fields may be saturated
+    if ((le16(record + 8) != entries && !(zip64 && le16(record + 8) == 0xFFFF)) ||
+        (le16(record + 10) != entries && !(zip64 && le16(record + 10) == 0xFFFF)) ||
+        (le32(record + 12) != directory_size && !(zip64 && le32(record + 12) == 0xFFFFFFFFU)) ||
+        (le32(record + 16) != directory && !(zip64 && le32(record + 16) == 0xFFFFFFFFU))) {
+        return WALK_UNSUPPORTED;
+    }
+    if (input_skip(in, le16(record + 20)) != 0 || input_fill(in)) {
+        return WALK_UNSUPPORTED;  // Comment cut short, or bytes after the end record
+    }
+    return WALK_DONE;
+}
+
+static int add_header_offset(zip_headers_t* headers, unsigned long long offset) {
+    if (headers->count == headers->capacity) {
+        size_t capacity = headers->capacity ? headers->capacity * 2 : 64;
+        unsigned long long* grown = realloc(headers->offsets, capacity * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        headers->offsets = grown;
+        headers->capacity = capacity;
+    }
+    headers->offsets[headers->count++] = offset;
+    return 0;
+}
+
+// ZIP, through the local headers in order (no seeking to the central
+// directory, so it also works on a ZIP inside a gzip or in memory); the
+// central directory is checked once the walk gets there
+static int walk_zip_entries(walk_t* walk, input_t* in, const char* prefix, int depth, zip_headers_t* headers) {
+    archive_scan_t* scan = walk->scan;
+    unsigned char header[30];
+    unsigned char extra[65536];
+    unsigned long long start = input_position(in);
+
+    for (;;) {
+        if (walk_stopped(scan)) {
+            return WALK_STOP;
+        }
+        unsigned long long offset = input_position(in) - start;
+        size_t length = input_read(in, header, 4);
+        if (length == 0) {
+            return WALK_DONE;
+        }
+        if (length < 4) {
+            return input_failed(scan, in, prefix);
+        }
+        uint32_t signature = le32(header);
+        if (signature == 0x02014b50 || signature == 0x06054b50 || signature == 0x06064b50) {
+            return check_central_directory(in, signature, offset, headers, extra);
+        }
+        if (signature != 0x04034b50 || input_read(in, header + 4, 26) < 26) {
+            return input_failed(scan, in, prefix);
+        }
+        if (add_header_offset(headers, offset) != 0) {
+            return WALK_UNSUPPORTED;
+        }
+
+        uint16_t flags = le16(header + 6);
+        uint16_t method = le16(header + 8);
+        unsigned long long compressed_size = le32(header + 18);
+        unsigned long long size = le32(header + 22);
+        size_t name_length = le16(header + 26);
+        size_t extra_length = le16(header + 28);
+
+        char name[ARCHIVE_MAX_NAME];
+        size_t kept = name_length < sizeof(name) - 1 ? name_length : sizeof(name) - 1;
+        if (input_read(in, name, kept) < kept || input_skip(in, name_length - kept) != 0 ||
+            input_read(in, extra, extra_length) < extra_length) {
+            return input_failed(scan, in, prefix);
+        }
+        name[kept] = '\0';
+
+        // ZIP64: the real sizes are in the extra field
+        int zip64 = 0;
+        for (size_t offset = 0; offset + 4 <= extra_length; ) {
+            uint16_t id = le16(extra + offset);
+            uint16_t field_length = le16(extra + offset + 2);
+            const unsigned char* field = extra + offset + 4;
+            if (id == 0x0001 && offset + 4 + field_length <= extra_length) {
+                zip64 = 1;
+                size_t position = 0;
+                if (size == 0xFFFFFFFFULL && position + 8 <= field_length) {
+                    size = le64(field + position);
+                    position += 8;
+                }
+                if (compressed_size == 0xFFFFFFFFULL && position + 8 <= field_length) {
+                    compressed_size = le64(field + position);
+                }
+            }
+            offset += 4 + field_length;
+        }
+
+        int streamed = (flags & 0x0008) != 0;  // Sizes in a data descriptor after the data
+        if (kept > 0 && name[kept - 1] == '/') {
+            if (!streamed && input_skip(in, compressed_size) == 0) continue;  // Directory
+            return input_failed(scan, in, prefix);
+        }
+        if (count_file(scan) != 0) {
+            return WALK_STOP;
+        }
+
+        char path[ARCHIVE_MAX_NAME];
+        member_path(path, prefix, name);
+        if (flags & 0x0001) {
+            // Content unknown: never released as clean
+            add_unscanned_member(scan, path, SCAN_RESULT_ERROR, "encrypted, not scanned");
+            if (!streamed && input_skip(in, compressed_size) == 0) continue;
+            return input_failed(scan, in, prefix);
+        }
+        if ((method != 0 && method != 8) || (method == 0 && streamed)) {
+            return WALK_UNSUPPORTED;  // bzip2, LZMA, ... or a stored member of unknown size
+        }
+
+        unsigned char* data = NULL;
+        size_t data_size = (size_t)compressed_size;
+        unsigned long long consumed = compressed_size;
+        int outcome = (method == 0) ? read_stored(in, compressed_size, &data)
+                                    : read_deflated(in, size, &data, &data_size, &consumed);
+        if (outcome == MEMBER_DAMAGED) {
+            return input_failed(scan, in, prefix);
+        }
+        if (outcome == MEMBER_BOMB) {
+            add_unscanned_member(scan, path, SCAN_RESULT_INFECTED, ARCHIVE_BOMB_NAME);
+            return WALK_STOP;
+        }
+        if (outcome == MEMBER_TOO_LARGE) {
+            return WALK_UNSUPPORTED;  // Not held in memory: ClamAV scans the container whole
+        }
+
+        // Past the data: the rest of an abandoned member, the data descriptor
+        if (!streamed && consumed < compressed_size && input_skip(in, compressed_size - consumed) != 0) {
+            free(data);
+            return input_failed(scan, in, prefix);
+        }
+        if (streamed) {
+            if (outcome != MEMBER_OK) {
+                return WALK_UNSUPPORTED;  // End of the abandoned data unknown
+            }
+            unsigned char descriptor[4];
+            size_t sizes_length = zip64 ? 16 : 8;
+            if (input_read(in, descriptor, 4) < 4 ||
+                input_skip(in, (le32(descriptor) == 0x08074b50 ? 4 : 0) + sizes_length) != 0) {
+                free(data);
+                return input_failed(scan, in, prefix);
+            }
+        }
+        if (outcome == MEMBER_OK) {
+            int result = handle_member(walk, path, data, data_size, depth);
+            if (result != WALK_DONE) {
+                return result;
+            }
+        }
+    }
+}
+
+static int walk_zip(walk_t* walk, input_t* in, const char* prefix, int depth) {
+    zip_headers_t headers = { NULL, 0, 0 };
+    int result = walk_zip_entries(walk, in, prefix, depth, &headers);
+    free(headers.offsets);
+    return result;
+}
+
+static unsigned long long tar_number(const unsigned char* field, size_t length) {
+    unsigned long long value = 0;
+    if (field[0] & 0x80) {
+        // Base-256 (GNU, sizes over 8 GB)
+        for (size_t i = 1; i < length; i++) {
+            value = value << 8 | field[i];
+        }
+        return value;
+    }
+    for (size_t i = 0; i < length && field[i]; i++) {
+        if (field[i] >= '0' && field[i] <= '7') {
+            value = value << 3 | (unsigned long long)(field[i] - '0');
+        }
+    }
+    return value;
+}
+
+static int tar_checksum_ok(const unsigned char* block) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : block[i];
+    }
+    return sum == tar_number(block + 148, 8);
+}
+
+static int walk_tar(walk_t* walk, input_t* in, const char* prefix, int depth) {
+    archive_scan_t* scan = walk->scan;
+    unsigned char block[TAR_BLOCK];
+    char long_name[ARCHIVE_MAX_NAME] = "";
+    int zero_blocks = 0;
+
+    for (;;) {
+        if (walk_stopped(scan)) {
+            return WALK_STOP;
+        }
+        size_t length = input_read(in, block, TAR_BLOCK);
+        if (length == 0) {
+            return in->bomb ? input_failed(scan, in, prefix) : WALK_DONE;
+        }
+        if (length < TAR_BLOCK) {
+            return input_failed(scan, in, prefix);
+        }
+
+        int zero = 1;
+        for (int i = 0; i < TAR_BLOCK && zero; i++) {
+            zero = (block[i] == 0);
+        }
+        if (zero) {
+            if (++zero_blocks == 2) {
+                return WALK_DONE;
+            }
+            continue;
+        }
+        zero_blocks = 0;
+        if (!tar_checksum_ok(block)) {
+            return WALK_UNSUPPORTED;
+        }
+
+        unsigned long long size = tar_number(block + 124, 12);
+        unsigned long long padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+        char type = (char)block[156];
+
+        if (type == 'L') {
+            // GNU long name of the next entry
+            size_t kept = size < sizeof(long_name) - 1 ? (size_t)size : sizeof(long_name) - 1;
+            if (input_read(in, long_name, kept) < kept || input_skip(in, size - kept + padding) != 0) {
+                return input_failed(scan, in, prefix);
+            }
+            long_name[kept] = '\0';
+            continue;
+        }
+        if (type != '0' && type != '\0' && type != '7') {
+            // Directories, links, devices, pax headers
+            if (input_skip(in, size + padding) != 0) {
+                return input_failed(scan, in, prefix);
+            }
+            continue;
+        }
+
+        char name[ARCHIVE_MAX_NAME];
+        if (long_name[0]) {
+            snprintf(name, sizeof(name), "%s", long_name);
+        } else if (memcmp(block + 257, "ustar", 5) == 0 && block[345]) {
+            snprintf(name, sizeof(name), "%.154s/%.100s", (const char*)block + 345, (const char*)block);
+        } else {
+            snprintf(name, sizeof(name), "%.100s", (const char*)block);
+        }
+        long_name[0] = '\0';
+
+        if (count_file(scan) != 0) {
+            return WALK_STOP;
+        }
+        char path[ARCHIVE_MAX_NAME];
+        member_path(path, prefix, name);
+
+        unsigned char* data = NULL;
+        int outcome = read_stored(in, size, &data);
+        if (outcome == MEMBER_DAMAGED) {
+            return input_failed(scan, in, prefix);
+        }
+        if (outcome == MEMBER_TOO_LARGE) {
+            return WALK_UNSUPPORTED;  // Not held in memory: ClamAV scans the container whole
+        }
+        if (input_skip(in, padding) != 0) {
+            free(data);
+            return input_failed(scan, in, prefix);
+        }
+        if (outcome == MEMBER_OK) {
+            int result = handle_member(walk, path, data, (size_t)size, depth);
+            if (result != WALK_DONE) {
+                return result;
+            }
+        }
+    }
+}
+
+// gzip: a tar.gz is walked as it is decompressed; anything else is one
+// member named after the container without ".gz"
+static int walk_gzip(walk_t* walk, input_t* in, const char* prefix, int depth) {
+    archive_scan_t* scan = walk->scan;
+    input_t gzip;
+    if (input_from_gzip(&gzip, in) != 0) {
+        return WALK_UNSUPPORTED;
+    }
+
+    int result;
+    if (input_fill(&gzip) && gzip.end - gzip.start >= 262 &&
+        archive_format(gzip.data + gzip.start, gzip.end - gzip.start) == FORMAT_TAR) {
+        result = walk_tar(walk, &gzip, prefix, depth);
+    } else if (gzip.bomb) {
+        result = input_failed(scan, &gzip, prefix[0] ? prefix : scan->job->filename);
+    } else {
+        const char* container = prefix[0] ? prefix : scan->job->filename;
+        const char* base = strrchr(container, '/');
+        base = base ? base + 1 : container;
+        char name[ARCHIVE_MAX_NAME];
+        size_t base_length = strlen(base);
+        if (base_length > 4 && strcmp(base + base_length - 4, ".tgz") == 0) {
+            snprintf(name, sizeof(name), "%.*s.tar", (int)(base_length - 4), base);
+        } else if (base_length > 3 && strcmp(base + base_length - 3, ".gz") == 0) {
+            snprintf(name, sizeof(name), "%.*s", (int)(base_length - 3), base);
+        } else {
+            snprintf(name, sizeof(name), "%.250s.data", base);
+        }
+        char path[ARCHIVE_MAX_NAME];
+        member_path(path, prefix, name);
+
+        if (count_file(scan) != 0) {
+            result = WALK_STOP;
+        } else {
+            unsigned char* data = malloc(INPUT_BUFFER_SIZE);
+            size_t capacity = data ? INPUT_BUFFER_SIZE : 0;
+            size_t size = 0;
+            int too_large = 0;
+            while (data && input_fill(&gzip)) {
+                size_t available = gzip.end - gzip.start;
+                if (size + available > ARCHIVE_MAX_MEMBER_SIZE) {
+                    too_large = 1;
+                    break;
+                }
+                if (size + available > capacity) {
+                    size_t new_capacity = capacity * 2 >= size + available ? capacity * 2 : size + available;
+                    unsigned char* grown = realloc(data, new_capacity);
+                    if (!grown) {
+                        too_large = 1;
+                        break;
+                    }
+                    data = grown;
+                    capacity = new_capacity;
+                }
+                memcpy(data + size, gzip.data + gzip.start, available);
+                gzip.start = gzip.end;
+                size += available;
+            }
+
+            if (gzip.bomb) {
+                free(data);
+                result = input_failed(scan, &gzip, path);
+            } else if (!data || too_large) {
+                free(data);
+                result = WALK_UNSUPPORTED;  // Not held in memory: ClamAV scans the container whole
+            } else {
+                result = handle_member(walk, path, data, size, depth);
+            }
+        }
+    }
+
+    input_close(&gzip);
+    return result;
+}
+
+static int walk_input(walk_t* walk, input_t* in, int format, const char* prefix, int depth) {
+    switch (format) {
+        case FORMAT_ZIP: return walk_zip(walk, in, prefix, depth);
+        case FORMAT_TAR: return walk_tar(walk, in, prefix, depth);
+        case FORMAT_GZIP: return walk_gzip(walk, in, prefix, depth);
+        default: return WALK_UNSUPPORTED;
+    }
+}
+
+// Scan
+
+int archive_scan_probe(const unsigned char* head, size_t length) {
+    int format = archive_format(head, length);
+    return format != FORMAT_NONE && !(format == FORMAT_ZIP && is_zip_document(head, length));
+}
+
+archive_scan_t* archive_scan_create(scan_job_t* job) {
+    int fd = open(job->filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    unsigned char head[ARCHIVE_PROBE_SIZE];
+    struct stat st;
+    ssize_t length = pread(fd, head, sizeof(head), 0);
+    if (length <= 0 || !archive_scan_probe(head, (size_t)length) || fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    archive_scan_t* scan = calloc(1, sizeof(archive_scan_t));
+    if (!scan) {
+        close(fd);
+        return NULL;
+    }
+    scan->job = job;
+    scan->fd = fd;
+    scan->file_size = (size_t)st.st_size;
+    scan->format = archive_format(head, (size_t)length);
+    scan->members_left = 1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return scan;
+}
+
+void archive_scan_destroy(archive_scan_t* scan) {
+    if (!scan) {
+        return;
+    }
+    while (scan->members) {
+        archive_member_t* member = scan->members;
+        scan->members = member->next;
+        free(member->data);
+        free(member);
+    }
+    close(scan->fd);
+    free(scan);
+}
+
+void archive_scan_walk(archive_scan_t* scan, archive_member_handler_t handler, void* context) {
+    walk_t walk = { scan, handler, context };
+    input_t in;
+    int result = WALK_UNSUPPORTED;
+    if (input_from_file(&in, scan->fd) == 0) {
+        result = walk_input(&walk, &in, scan->format, "", 1);
+    }
+    input_close(&in);
+
+    // ClamAV takes whatever the walker could not follow. After a complete
+    // walk it still gets the file itself for whole-file hash and container
+    // signatures, without extracting the members a second time.
+    if (result == WALK_UNSUPPORTED && !walk_stopped(scan)) {
+        emit_member(&walk, scan->job->filename, NULL, scan->file_size, SCAN_PARSERS_ALL);
+    } else if (result == WALK_DONE && !walk_stopped(scan)) {
+        emit_member(&walk, scan->job->filename, NULL, scan->file_size, SCAN_PARSERS_ALL & ~CL_SCAN_PARSE_ARCHIVE);
+    }
+}
+
+size_t archive_scan_buffered(const archive_scan_t* scan) {
+    return __atomic_load_n(&scan->buffered, __ATOMIC_RELAXED);
+}
+
+void archive_scan_run(archive_member_t* member) {
+    archive_scan_t* scan = member->scan;
+    if (!__atomic_load_n(&scan->infected, __ATOMIC_RELAXED)) {
+        if (member->data) {
+            member->status = scanner_scan_buffer(member->data, member->size,
+                                                 member->virus_name, sizeof(member->virus_name));
+        } else {
+            member->status = scanner_scan_range(scan->fd, 0, member->size, member->parsers,
+                                                member->virus_name, sizeof(member->virus_name));
+        }
+        member->scanned = 1;
+        if (member->status == SCAN_RESULT_INFECTED) {
+            __atomic_store_n(&scan->infected, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (member->data) {
+        free(member->data);
+        member->data = NULL;
+        __atomic_sub_fetch(&scan->buffered, member->size, __ATOMIC_RELAXED);
+    }
+}
+
+int archive_scan_release(archive_scan_t* scan, unsigned long long scan_ms) {
+    __atomic_add_fetch(&scan->busy_ms, scan_ms, __ATOMIC_RELAXED);
+    // Release/acquire: the last one sees the status of every member
+    return __atomic_sub_fetch(&scan->members_left, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static const char* member_verdict(const archive_member_t* member) {
+    if (member->status != SCAN_RESULT_CLEAN || (!member->scanned && member->virus_name[0])) {
+        return member->virus_name;
+    }
+    return member->scanned || member->size == 0 ? "OK" : "skipped";
+}
+
+// "(archive: N members: name verdict, ...)", members with a finding
+// first, "... N more" when they do not all fit
+static void format_members(const archive_scan_t* scan, char* buffer, size_t buffer_size) {
+    const size_t reserve = 32;
+    if (buffer_size <= reserve) {
+        buffer[0] = '\0';
+        return;
+    }
+    size_t length = snprintf(buffer, buffer_size, "(archive: %d members", scan->member_count);
+    if (scan->limit[0]) {
+        length += snprintf(buffer + length, buffer_size - length, ", stopped at %s", scan->limit);
+    }
+
+    int listed = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (const archive_member_t* member = scan->members; member; member = member->next) {
+            int finding = member->status != SCAN_RESULT_CLEAN;
+            if (finding != (pass == 0)) {
+                continue;
+            }
+            char entry[ARCHIVE_MAX_NAME + MAX_VIRUS_NAME + 4];
+            int entry_length = snprintf(entry, sizeof(entry), "%s%s %s", listed ? ", " : ": ",
+                                        member->name, member_verdict(member));
+            if (length + (size_t)entry_length + reserve >= buffer_size) {
+                length += snprintf(buffer + length, buffer_size - length, "%s... %d more",
+                                   listed ? ", " : ": ", scan->member_count - listed);
+                pass = 2;
+                break;
+            }
+            memcpy(buffer + length, entry, (size_t)entry_length + 1);
+            length += (size_t)entry_length;
+            listed++;
+        }
+    }
+    snprintf(buffer + length, buffer_size - length, ")");
+}
+
+int archive_scan_verdict(const archive_scan_t* scan, char* result, size_t result_size,
+                         char* members, size_t members_size) {
+    const archive_member_t* infected = NULL;
+    const archive_member_t* error = NULL;
+    for (const archive_member_t* member = scan->members; member; member = member->next) {
+        if (member->status == SCAN_RESULT_INFECTED && !infected) {
+            infected = member;
+        } else if (member->status == SCAN_RESULT_ERROR && !error) {
+            error = member;
+        }
+    }
+    format_members(scan, members, members_size);
+
+    if (infected) {
+        snprintf(result, result_size, "%s in %s", infected->virus_name, infected->name);
+        return SCAN_RESULT_INFECTED;
+    }
+    if (scan->limit[0]) {
+        snprintf(result, result_size, "Archive not fully scanned: %s", scan->limit);
+        return SCAN_RESULT_ERROR;
+    }
+    if (error) {
+        snprintf(result, result_size, "%s: %s (%s)", error->scanned ? "Error running scanner" :
+                 "Archive not fully scanned", error->virus_name, error->name);
+        return SCAN_RESULT_ERROR;
+    }
+    snprintf(result, result_size, "OK");
+    return SCAN_RESULT_CLEAN;
+}
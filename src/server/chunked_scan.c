@@ -0,0 +1,163 @@
+#include "../../include/chunked_scan.h"
+
+// Formats ClamAV parses instead of scanning as bytes
+typedef struct {
+    size_t offset;
+    const char* magic;
+    size_t length;
+} file_magic_t;
+
+static const file_magic_t g_structured_formats[] = {
+    { 0, "PK\x03\x04", 4 },                 // ZIP, JAR, APK, OOXML
+    { 0, "Rar!", 4 },
+    { 0, "7z\xBC\xAF\x27\x1C", 6 },
+    { 0, "\x1F\x8B", 2 },                   // gzip
+    { 0, "BZh", 3 },
+    { 0, "\xFD" "7zXZ", 5 },
+    { 0, "\x28\xB5\x2F\xFD", 4 },           // zstd
+    { 0, "MSCF", 4 },                       // CAB
+    { 0, "ITSF", 4 },                       // CHM
+    { 0, "!<arch>", 7 },                    // ar, deb
+    { 257, "ustar", 5 },                    // tar
+    { 0, "MZ", 2 },                         // PE
+    { 0, "\x7F" "ELF", 4 },
+    { 0, "\xCF\xFA\xED\xFE", 4 },           // Mach-O 64
+    { 0, "\xCE\xFA\xED\xFE", 4 },           // Mach-O 32
+    { 0, "\xCA\xFE\xBA\xBE", 4 },           // Mach-O universal, Java class
+    { 0, "%PDF", 4 },
+    { 0, "\xD0\xCF\x11\xE0", 4 },           // OLE2 (MS Office)
+    { 0, "FWS", 3 },                        // SWF
+    { 0, "CWS", 3 },
+    { 0, "ZWS", 3 },
+};
+
+#define NUM_STRUCTURED_FORMATS (sizeof(g_structured_formats) / sizeof(g_structured_formats[0]))
+#define FORMAT_PROBE_SIZE 512
+
+static int has_structured_format(int fd) {
+    unsigned char head[FORMAT_PROBE_SIZE];
+    ssize_t length = pread(fd, head, sizeof(head), 0);
+    if (length < 0) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_STRUCTURED_FORMATS; i++) {
+        const file_magic_t* format = &g_structured_formats[i];
+        if ((size_t)length >= format->offset + format->length &&
+            memcmp(head + format->offset, format->magic, format->length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+chunked_scan_t* chunked_scan_create(scan_job_t* job, size_t chunk_size) {
+    if (chunk_size == 0) {
+        return NULL;
+    }
+
+    int fd = open(job->filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < SCAN_CHUNK_MIN_COUNT * chunk_size ||
+        has_structured_format(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    int chunk_count = (int)((size + chunk_size - 1) / chunk_size);
+    chunked_scan_t* scan = calloc(1, sizeof(chunked_scan_t) + chunk_count * sizeof(scan_chunk_t));
+    if (!scan) {
+        close(fd);
+        return NULL;
+    }
+
+    scan->job = job;
+    scan->fd = fd;
+    scan->size = size;
+    scan->hash_status = SCAN_RESULT_CLEAN;
+    scan->chunk_count = chunk_count;
+    scan->chunks_left = chunk_count + 1;
+    for (int i = 0; i < chunk_count; i++) {
+        scan_chunk_t* chunk = &scan->chunks[i];
+        size_t offset = (size_t)i * chunk_size;
+        size_t end = offset + chunk_size + SCAN_CHUNK_OVERLAP;
+        chunk->scan = scan;
+        chunk->offset = (off_t)offset;
+        chunk->length = (end < size ? end : size) - offset;
+        chunk->status = SCAN_RESULT_CLEAN;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return scan;
+}
+
+void chunked_scan_destroy(chunked_scan_t* scan) {
+    if (!scan) {
+        return;
+    }
+    close(scan->fd);
+    free(scan);
+}
+
+void chunked_scan_run(scan_chunk_t* chunk) {
+    chunked_scan_t* scan = chunk->scan;
+    if (__atomic_load_n(&scan->infected, __ATOMIC_RELAXED)) {
+        return;  // Verdict already known
+    }
+
+    chunk->status = scanner_scan_range(scan->fd, chunk->offset, chunk->length, SCAN_PARSERS_ALL,
+                                       chunk->virus_name, sizeof(chunk->virus_name));
+    if (chunk->status == SCAN_RESULT_INFECTED) {
+        __atomic_store_n(&scan->infected, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void chunked_scan_run_hashes(chunked_scan_t* scan) {
+    scan->hash_status = scanner_scan_hashes(scan->fd, scan->size, scan->has_hash ? scan->hash : NULL,
+                                            scan->hash_virus_name, sizeof(scan->hash_virus_name));
+    if (scan->hash_status == SCAN_RESULT_INFECTED) {
+        __atomic_store_n(&scan->infected, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int chunked_scan_release(chunked_scan_t* scan, unsigned long long scan_ms) {
+    __atomic_add_fetch(&scan->busy_ms, scan_ms, __ATOMIC_RELAXED);
+    // Release/acquire: the last one sees the status of every chunk
+    return __atomic_sub_fetch(&scan->chunks_left, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+int chunked_scan_verdict(const chunked_scan_t* scan, char* result, size_t result_size) {
+    if (scan->hash_status == SCAN_RESULT_INFECTED) {
+        snprintf(result, result_size, "%s", scan->hash_virus_name);
+        return SCAN_RESULT_INFECTED;
+    }
+
+    const scan_chunk_t* error = NULL;
+    for (int i = 0; i < scan->chunk_count; i++) {
+        const scan_chunk_t* chunk = &scan->chunks[i];
+        if (chunk->status == SCAN_RESULT_INFECTED) {
+            snprintf(result, result_size, "%s", chunk->virus_name);
+            return SCAN_RESULT_INFECTED;
+        }
+        if (chunk->status == SCAN_RESULT_ERROR && !error) {
+            error = chunk;
+        }
+    }
+
+    if (error) {
+        snprintf(result, result_size, "Error running scanner: %s (offset %lld)",
+                 error->virus_name, (long long)error->offset);
+        return SCAN_RESULT_ERROR;
+    }
+    if (scan->hash_status == SCAN_RESULT_ERROR) {
+        snprintf(result, result_size, "Error running scanner: %s (whole-file hash)", scan->hash_virus_name);
+        return SCAN_RESULT_ERROR;
+    }
+    snprintf(result, result_size, "OK");
+    return SCAN_RESULT_CLEAN;
+}
@@ -0,0 +1,1182 @@
+#include "../../include/common.h"
+#include "../../include/client_session.h"
+#include "../../include/job_queue.h"
+#include "../../include/frame.h"
+#include "../../include/scan_scheduler.h"
+#include "../../include/admission.h"
+#include "../../include/archive_scan.h"
+
+// Internal results of the input/output steps
+typedef enum {
+    IO_DONE,      // Output: everything sent
+    IO_BLOCKED,   // Socket would block (EAGAIN)
+    IO_PAUSED,    // Input: waiting for pending output to drain
+    IO_BUDGET,    // I/O budget for this turn used up
+    IO_CLOSED     // Peer gone or fatal error
+} io_result_t;
+
+// Only touched by the reactor thread
+static unsigned long g_upload_sequence = 0;
+
+void client_session_init(client_info_t* client) {
+    client->session_state = SESSION_KEY_EXCHANGE;
+    client->framed = -1;
+    client->splice_pipe[0] = client->splice_pipe[1] = -1;
+}
+
+// Streams
+
+static session_stream_t* new_stream(uint32_t id, int is_upload) {
+    session_stream_t* stream = calloc(1, sizeof(session_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->id = id;
+    stream->is_upload = is_upload;
+    stream->upload_fd = -1;
+    stream->download_fd = -1;
+    return stream;
+}
+
+static void free_stream(session_stream_t* stream) {
+    if (stream->upload_fd != -1) {
+        close(stream->upload_fd);
+        unlink(stream->upload_path);  // Incomplete upload
+    }
+    if (stream->download_fd != -1) {
+        close(stream->download_fd);
+    }
+    aead_stream_free(&stream->upload_stream);
+    aead_stream_free(&stream->download_stream);
+    sha256_stream_free(&stream->upload_hash);
+    free(stream->aead_buffer);
+    free(stream);
+}
+
+// The caller has checked that a slot is free. Text connections have one
+// transfer at a time, so theirs is always streams[0].
+static void attach_stream(client_info_t* client, session_stream_t* stream) {
+    for (int i = 0; i < SESSION_MAX_STREAMS; i++) {
+        if (!client->streams[i]) {
+            client->streams[i] = stream;
+            client->stream_count++;
+            return;
+        }
+    }
+}
+
+static void close_stream(client_info_t* client, session_stream_t* stream) {
+    for (int i = 0; i < SESSION_MAX_STREAMS; i++) {
+        if (client->streams[i] == stream) {
+            client->streams[i] = NULL;
+            client->stream_count--;
+        }
+    }
+    if (client->input_stream == stream) {
+        client->input_stream = NULL;
+    }
+    if (client->output_stream == stream) {
+        client->output_stream = NULL;
+    }
+    free_stream(stream);
+}
+
+static session_stream_t* find_stream(const client_info_t* client, uint32_t id) {
+    for (int i = 0; i < SESSION_MAX_STREAMS; i++) {
+        if (client->streams[i] && client->streams[i]->id == id) {
+            return client->streams[i];
+        }
+    }
+    return NULL;
+}
+
+static int has_open_download(const client_info_t* client) {
+    for (int i = 0; i < SESSION_MAX_STREAMS; i++) {
+        if (client->streams[i] && !client->streams[i]->is_upload) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void client_session_release(server_state_t* state, client_info_t* client) {
+    for (int i = 0; i < SESSION_MAX_STREAMS; i++) {
+        session_stream_t* stream = client->streams[i];
+        if (stream) {
+            if (stream->is_upload && stream->upload_fd != -1) {
+                admission_upload_ended(state, stream->upload_size);  // Abandoned
+            }
+            close_stream(client, stream);
+        }
+    }
+    transfer_pipe_close(client->splice_pipe);
+    free(client->deferred_output);
+    client->deferred_output = NULL;
+    client->deferred_length = 0;
+    free(client->send_buffer);
+    client->send_buffer = NULL;
+    client->send_offset = client->send_length = client->send_capacity = 0;
+}
+
+// Output queue
+
+static int ensure_send_space(client_info_t* client, size_t length) {
+    // Drop what has already been sent before growing the buffer
+    if (client->send_offset > 0) {
+        memmove(client->send_buffer, client->send_buffer + client->send_offset,
+                client->send_length - client->send_offset);
+        client->send_length -= client->send_offset;
+        client->send_offset = 0;
+    }
+
+    if (client->send_length + length <= client->send_capacity) {
+        return 0;
+    }
+
+    size_t capacity = client->send_capacity ? client->send_capacity : BUFFER_SIZE;
+    while (capacity < client->send_length + length) {
+        capacity *= 2;
+    }
+
+    char* buffer = realloc(client->send_buffer, capacity);
+    if (!buffer) {
+        return -1;
+    }
+    client->send_buffer = buffer;
+    client->send_capacity = capacity;
+    return 0;
+}
+
+static int queue_output(client_info_t* client, const void* data, size_t length) {
+    if (ensure_send_space(client, length) != 0) {
+        return -1;
+    }
+    memcpy(client->send_buffer + client->send_length, data, length);
+    client->send_length += length;
+    return 0;
+}
+
+// Raw file data is on its way out: a text download, or the body of a
+// sendfile DATA frame whose header is already queued. Nothing else may
+// land in between.
+static int output_held(const client_info_t* client) {
+    if (client->framed == 1) {
+        return client->output_stream != NULL;
+    }
+    return client->streams[0] && !client->streams[0]->is_upload;
+}
+
+static void release_deferred_output(client_info_t* client) {
+    if (client->deferred_length > 0 && !output_held(client) &&
+        queue_output(client, client->deferred_output, client->deferred_length) == 0) {
+        client->deferred_length = 0;
+    }
+}
+
+// A response or notification: queued, or held back until the raw data
+// in flight is sent
+static int queue_message(client_info_t* client, const void* data, size_t length) {
+    if (!output_held(client)) {
+        return queue_output(client, data, length);
+    }
+
+    char* buffer = realloc(client->deferred_output, client->deferred_length + length);
+    if (!buffer) {
+        return -1;
+    }
+    memcpy(buffer + client->deferred_length, data, length);
+    client->deferred_output = buffer;
+    client->deferred_length += length;
+    return 0;
+}
+
+// "<status> <message>\n", or a FRAME_RESPONSE on the command's stream
+// carrying the job id
+static int queue_job_response(client_info_t* client, uint32_t stream_id, const char* status, int job_id,
+                              const char* message) {
+    if (client->framed == 1) {
+        unsigned char frame[FRAME_HEADER_SIZE + MAX_MESSAGE];
+        size_t length = strnlen(message, MAX_MESSAGE);
+        return queue_message(client, frame, frame_encode(frame, FRAME_RESPONSE, frame_status_code(status),
+                                                         stream_id, job_id, message, length));
+    }
+
+    char response[MAX_MESSAGE];
+    int length = snprintf(response, sizeof(response), "%s %s\n", status, message);
+    if (length >= (int)sizeof(response)) {
+        length = sizeof(response) - 1;
+        response[length - 1] = '\n';
+    }
+    return queue_message(client, response, length);
+}
+
+static int queue_response(client_info_t* client, uint32_t stream_id, const char* status, const char* message) {
+    return queue_job_response(client, stream_id, status, 0, message);
+}
+
+// Queue a job notification: "NOTIFY <job_id> <result>\n" or FRAME_NOTIFY
+// on stream 0
+int client_session_notify(client_info_t* client, int job_id, const char* result) {
+    unsigned char notification[FRAME_HEADER_SIZE + MAX_MESSAGE + 32];
+    size_t length;
+    if (client->framed == 1) {
+        char status[16] = "";
+        sscanf(result, "%15s", status);
+        length = frame_encode(notification, FRAME_NOTIFY, frame_status_code(status), 0, job_id,
+                              result, strnlen(result, MAX_MESSAGE));
+    } else {
+        length = snprintf((char*)notification, sizeof(notification), "%s %d %s\n", RESP_NOTIFY, job_id, result);
+    }
+    return queue_message(client, notification, length);
+}
+
+// Download data goes out raw on text connections and as DATA frames on
+// framed ones. A chunk is read straight into the output queue, behind
+// room for its header.
+static unsigned char* reserve_download_chunk(client_info_t* client, size_t length) {
+    size_t header_size = client->framed == 1 ? FRAME_HEADER_SIZE : 0;
+    if (ensure_send_space(client, header_size + length) != 0) {
+        return NULL;
+    }
+    return (unsigned char*)client->send_buffer + client->send_length + header_size;
+}
+
+static void commit_download_chunk(client_info_t* client, const session_stream_t* stream, size_t length,
+                                  int last) {
+    if (client->framed == 1) {
+        frame_header_t header = { FRAME_DATA, last ? FRAME_FLAG_END : 0, stream->id, 0, (uint32_t)length };
+        frame_header_encode(&header, (unsigned char*)client->send_buffer + client->send_length);
+        client->send_length += FRAME_HEADER_SIZE;
+    }
+    client->send_length += length;
+}
+
+static int has_pending_output(const client_info_t* client) {
+    return client->send_offset < client->send_length || has_open_download(client);
+}
+
+static void finish_download(client_info_t* client, session_stream_t* stream) {
+    if (stream->download_remaining == 0 && stream->download_prefix_length == 0 &&
+        (!stream->aead || stream->download_final_sent) && stream != client->output_stream) {
+        close_stream(client, stream);
+        release_deferred_output(client);
+    }
+}
+
+// Holds one GCM record (upload) or one chunk of plaintext (download)
+static int ensure_aead_buffer(session_stream_t* stream) {
+    if (!stream->aead_buffer) {
+        stream->aead_buffer = malloc(AEAD_CHUNK_SIZE + AEAD_RECORD_OVERHEAD);
+    }
+    return stream->aead_buffer ? 0 : -1;
+}
+
+// GCM download: the next chunk of the file goes out as one sealed record
+static int seal_download_chunk(client_info_t* client, session_stream_t* stream) {
+    size_t to_read = stream->download_remaining < AEAD_CHUNK_SIZE ?
+                     stream->download_remaining : AEAD_CHUNK_SIZE;
+
+    unsigned char* record = reserve_download_chunk(client, to_read + AEAD_RECORD_OVERHEAD);
+    if (!record || ensure_aead_buffer(stream) != 0) {
+        return -1;
+    }
+
+    // Record sizes are announced in SIZE, so a short read cannot be sent
+    ssize_t bytes_read = pread(stream->download_fd, stream->aead_buffer, to_read, stream->download_offset);
+    if (bytes_read != (ssize_t)to_read) {
+        log_message(LOG_ERROR, "Download read failed for %s", client->ip_string);
+        return -1;
+    }
+
+    int final = (stream->download_remaining == to_read);
+    if (aead_seal_record(&stream->download_stream, stream->aead_buffer, to_read, final, record) != 0) {
+        log_message(LOG_ERROR, "Download encryption failed for %s", client->ip_string);
+        return -1;
+    }
+    commit_download_chunk(client, stream, to_read + AEAD_RECORD_OVERHEAD, final);
+    stream->download_offset += to_read;
+    stream->download_remaining -= to_read;
+    stream->download_final_sent = final;
+    finish_download(client, stream);
+    return 0;
+}
+
+// XOR download: read and encrypt the next piece of the file
+static int fill_download_chunk(client_info_t* client, session_stream_t* stream) {
+    size_t to_read = stream->download_remaining < TRANSFER_CHUNK_SIZE ?
+                     stream->download_remaining : TRANSFER_CHUNK_SIZE;
+
+    unsigned char* chunk = reserve_download_chunk(client, to_read);
+    if (!chunk) {
+        return -1;
+    }
+
+    ssize_t bytes_read = pread(stream->download_fd, chunk, to_read, stream->download_offset);
+    if (bytes_read <= 0) {
+        // File shrank under us: the client would wait forever for the rest
+        log_message(LOG_ERROR, "Download read failed for %s", client->ip_string);
+        return -1;
+    }
+
+    xor_stream_crypt(chunk, chunk, bytes_read, &client->session_key, stream->download_offset);
+    commit_download_chunk(client, stream, bytes_read, stream->download_remaining == (size_t)bytes_read);
+    stream->download_offset += bytes_read;
+    stream->download_remaining -= bytes_read;
+    finish_download(client, stream);
+    return 0;
+}
+
+// The sendfile run of output_stream is complete
+static void end_output_frame(client_info_t* client) {
+    session_stream_t* stream = client->output_stream;
+    client->output_stream = NULL;
+    finish_download(client, stream);
+    release_deferred_output(client);
+}
+
+// sendfile unsupported by the file system: copy the rest of the run
+// through the output queue instead
+static int copy_output_frame(client_info_t* client) {
+    session_stream_t* stream = client->output_stream;
+    size_t to_read = client->output_frame_remaining < TRANSFER_CHUNK_SIZE ?
+                     client->output_frame_remaining : TRANSFER_CHUNK_SIZE;
+    if (ensure_send_space(client, to_read) != 0) {
+        return -1;
+    }
+
+    ssize_t bytes_read = pread(stream->download_fd, client->send_buffer + client->send_length, to_read,
+                               stream->download_offset);
+    if (bytes_read <= 0) {
+        log_message(LOG_ERROR, "Download read failed for %s", client->ip_string);
+        return -1;
+    }
+
+    client->send_length += bytes_read;
+    stream->download_offset += bytes_read;
+    stream->download_remaining -= bytes_read;
+    client->output_frame_remaining -= bytes_read;
+    if (client->output_frame_remaining == 0) {
+        end_output_frame(client);
+    }
+    return 0;
+}
+
+// Plaintext download: the kernel copies file pages straight to the socket
+static io_result_t sendfile_download_chunk(client_info_t* client, size_t* budget) {
+    if (*budget == 0) {
+        return IO_BUDGET;
+    }
+
+    session_stream_t* stream = client->output_stream;
+    size_t to_send = client->output_frame_remaining < *budget ? client->output_frame_remaining : *budget;
+    off_t offset = stream->download_offset;
+    ssize_t bytes_sent = sendfile(client->socket_fd, stream->download_fd, &offset, to_send);
+    if (bytes_sent == -1) {
+        if (errno == EINTR) return IO_DONE;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return IO_BLOCKED;
+        if (errno == EINVAL || errno == ENOSYS) {
+            return copy_output_frame(client) == 0 ? IO_DONE : IO_CLOSED;
+        }
+        return IO_CLOSED;
+    }
+    if (bytes_sent == 0) {
+        log_message(LOG_ERROR, "Download read failed for %s", client->ip_string);
+        return IO_CLOSED;
+    }
+
+    stream->download_offset += bytes_sent;
+    stream->download_remaining -= bytes_sent;
+    client->output_frame_remaining -= bytes_sent;
+    *budget -= bytes_sent;
+    if (client->output_frame_remaining == 0) {
+        end_output_frame(client);
+    }
+    return IO_DONE;
+}
+
+// Next download to send a chunk of, round-robin, so one large file
+// cannot hold back the others on the connection
+static session_stream_t* next_download(client_info_t* client) {
+    for (int n = 0; n < SESSION_MAX_STREAMS; n++) {
+        int i = (client->next_download + n) % SESSION_MAX_STREAMS;
+        session_stream_t* stream = client->streams[i];
+        if (stream && !stream->is_upload) {
+            client->next_download = i + 1;
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+// One turn of a download: the IV / nonce, a sealed or XORed chunk, or the
+// start of a sendfile run (framed: one DATA frame, text: the whole file)
+static int produce_download_chunk(client_info_t* client, session_stream_t* stream) {
+    if (stream->download_prefix_length > 0) {
+        size_t length = stream->download_prefix_length;
+        unsigned char* chunk = reserve_download_chunk(client, length);
+        if (!chunk) {
+            return -1;
+        }
+        memcpy(chunk, stream->download_prefix, length);
+        stream->download_prefix_length = 0;
+        commit_download_chunk(client, stream, length, !stream->aead && stream->download_remaining == 0);
+        finish_download(client, stream);
+        return 0;
+    }
+
+    if (stream->aead) {
+        return seal_download_chunk(client, stream);
+    }
+    if (!stream->plain) {
+        return fill_download_chunk(client, stream);
+    }
+
+    size_t length = stream->download_remaining;
+    if (client->framed == 1) {
+        if (length > FRAME_DATA_CHUNK) length = FRAME_DATA_CHUNK;
+        unsigned char header[FRAME_HEADER_SIZE];
+        frame_header_t data = { FRAME_DATA, length == stream->download_remaining ? FRAME_FLAG_END : 0,
+                                stream->id, 0, (uint32_t)length };
+        frame_header_encode(&data, header);
+        if (queue_output(client, header, sizeof(header)) != 0) {
+            return -1;
+        }
+    }
+    client->output_stream = stream;
+    client->output_frame_remaining = length;
+    return 0;
+}
+
+static io_result_t flush_output(client_info_t* client, size_t* budget) {
+    for (;;) {
+        if (client->send_offset == client->send_length) {
+            client->send_offset = client->send_length = 0;
+            if (client->output_stream) {
+                io_result_t result = sendfile_download_chunk(client, budget);
+                if (result != IO_DONE) {
+                    return result;
+                }
+                continue;
+            }
+
+            session_stream_t* stream = next_download(client);
+            if (!stream) {
+                return IO_DONE;
+            }
+            if (produce_download_chunk(client, stream) != 0) {
+                return IO_CLOSED;
+            }
+            continue;
+        }
+
+        if (*budget == 0) {
+            return IO_BUDGET;
+        }
+
+        size_t to_send = client->send_length - client->send_offset;
+        if (to_send > *budget) {
+            to_send = *budget;
+        }
+
+        ssize_t bytes_sent = send(client->socket_fd, client->send_buffer + client->send_offset,
+                                  to_send, MSG_NOSIGNAL);
+        if (bytes_sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return IO_BLOCKED;
+            return IO_CLOSED;
+        }
+
+        client->send_offset += bytes_sent;
+        *budget -= bytes_sent;
+    }
+}
+
+// Upload
+
+static int is_valid_filename(const char* filename) {
+    return filename[0] != '\0' && filename[0] != '.' && strchr(filename, '/') == NULL;
+}
+
+static void finish_upload(server_state_t* state, client_info_t* client, session_stream_t* stream) {
+    size_t file_size = stream->plain ? stream->upload_size :
+                       stream->upload_size - sizeof(stream->upload_iv);
+    if (stream->aead) {
+        file_size = lseek(stream->upload_fd, 0, SEEK_CUR);
+    }
+    close(stream->upload_fd);
+    stream->upload_fd = -1;
+    admission_upload_ended(state, stream->upload_size);
+    if (client->framed != 1) {
+        client->session_state = SESSION_COMMAND;
+    }
+
+    if (stream->aead && !stream->upload_final_seen && !stream->upload_failed) {
+        log_message(LOG_WARNING, "GCM upload from %s ended without a final record", client->ip_string);
+        stream->upload_failed = 1;
+    }
+    if (stream->upload_failed) {
+        unlink(stream->upload_path);
+        queue_response(client, stream->id, RESP_ERROR, "Upload failed");
+        close_stream(client, stream);
+        return;
+    }
+
+    // Known content is decided right here (submit_scan_job), unless it is
+    // an archive, which is walked again for its member verdicts
+    unsigned char hash[CONTENT_HASH_SIZE];
+    int has_hash = stream->upload_hash.ctx && sha256_stream_final(&stream->upload_hash, hash) == 0;
+    int archive = archive_scan_probe(stream->upload_head, stream->upload_head_length);
+    int job_id = submit_scan_job(state, stream->upload_name, stream->upload_path, client->socket_fd,
+                                 file_size, client->ip_string, stream->upload_priority, has_hash ? hash : NULL,
+                                 archive);
+    if (job_id == -1) {
+        unlink(stream->upload_path);
+        queue_response(client, stream->id, RESP_ERROR, "Scan queue full");
+        close_stream(client, stream);
+        return;
+    }
+
+    char message[MAX_MESSAGE];
+    snprintf(message, sizeof(message), "File uploaded. Job ID: %d", job_id);
+    queue_job_response(client, stream->id, RESP_OK, job_id, message);
+    log_message(LOG_INFO, "Upload of %s from %s complete (%zu bytes), job %d",
+               stream->upload_name, client->ip_string, file_size, job_id);
+    close_stream(client, stream);
+}
+
+static int write_upload(session_stream_t* stream, const unsigned char* data, size_t length) {
+    if (stream->upload_hash.ctx && sha256_stream_update(&stream->upload_hash, data, length) != 0) {
+        sha256_stream_free(&stream->upload_hash);  // The scan worker hashes the file instead
+    }
+    if (stream->upload_head_length < UPLOAD_HEAD_SIZE) {
+        size_t head = UPLOAD_HEAD_SIZE - stream->upload_head_length;
+        head = head < length ? head : length;
+        memcpy(stream->upload_head + stream->upload_head_length, data, head);
+        stream->upload_head_length += head;
+    }
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = write(stream->upload_fd, data + written, length - written);
+        if (result == -1) {
+            if (errno == EINTR) continue;
+            log_message(LOG_ERROR, "Failed to write upload %s: %s", stream->upload_path, strerror(errno));
+            return -1;
+        }
+        written += result;
+    }
+    return 0;
+}
+
+// GCM upload data: collect each record, then authenticate, decrypt and
+// store it, so nothing unverified reaches the disk
+static void consume_aead_records(client_info_t* client, session_stream_t* stream,
+                                 const unsigned char* data, size_t length) {
+    while (length > 0 && !stream->upload_failed) {
+        if (stream->upload_final_seen) {
+            log_message(LOG_WARNING, "Data after the final GCM record from %s", client->ip_string);
+            stream->upload_failed = 1;
+            return;
+        }
+
+        // Header first, then the rest of the record it announces
+        size_t record_length = AEAD_HEADER_SIZE;
+        if (stream->aead_buffered >= AEAD_HEADER_SIZE) {
+            size_t plaintext_length;
+            int final;
+            aead_parse_header(stream->aead_buffer, &plaintext_length, &final);
+            record_length = plaintext_length + AEAD_RECORD_OVERHEAD;
+        }
+
+        size_t take = record_length - stream->aead_buffered;
+        if (take > length) take = length;
+        memcpy(stream->aead_buffer + stream->aead_buffered, data, take);
+        stream->aead_buffered += take;
+        data += take;
+        length -= take;
+
+        size_t plaintext_length;
+        int final;
+        if (stream->aead_buffered == AEAD_HEADER_SIZE &&
+            aead_parse_header(stream->aead_buffer, &plaintext_length, &final) != 0) {
+            log_message(LOG_WARNING, "Invalid GCM record from %s", client->ip_string);
+            stream->upload_failed = 1;
+            return;
+        }
+        if (stream->aead_buffered < AEAD_HEADER_SIZE || stream->aead_buffered < record_length ||
+            record_length == AEAD_HEADER_SIZE) {
+            continue;
+        }
+
+        // Decrypted in place, over the ciphertext
+        unsigned char* plaintext = stream->aead_buffer + AEAD_HEADER_SIZE;
+        stream->aead_buffered = 0;
+        if (aead_open_record(&stream->upload_stream, stream->aead_buffer, plaintext,
+                             &plaintext_length, &final) != 0) {
+            log_message(LOG_WARNING, "GCM authentication failed for upload from %s", client->ip_string);
+            stream->upload_failed = 1;
+            return;
+        }
+        if (write_upload(stream, plaintext, plaintext_length) != 0) {
+            stream->upload_failed = 1;
+            return;
+        }
+        stream->upload_final_seen = final;
+    }
+}
+
+// Consume upload bytes: IV (or GCM nonce) first, then data decrypted and
+// written to disk
+static void consume_upload_data(server_state_t* state, client_info_t* client, session_stream_t* stream,
+                                unsigned char* data, size_t length) {
+    size_t iv_size = stream->plain ? 0 : stream->aead ? AEAD_NONCE_SIZE : sizeof(stream->upload_iv);
+
+    if (stream->upload_received < iv_size) {
+        size_t take = iv_size - stream->upload_received;
+        if (take > length) take = length;
+        memcpy(stream->upload_iv + stream->upload_received, data, take);
+        stream->upload_received += take;
+        data += take;
+        length -= take;
+
+        if (stream->upload_received == iv_size && stream->aead) {
+            if (aead_stream_init(&stream->upload_stream, &client->session_key, stream->upload_iv) != 0) {
+                log_message(LOG_ERROR, "Cannot start GCM decryption for %s", client->ip_string);
+                stream->upload_failed = 1;
+            }
+        } else if (stream->upload_received == iv_size &&
+                   memcmp(stream->upload_iv, client->session_key.iv, iv_size) != 0) {
+            log_message(LOG_WARNING, "IV mismatch in upload from %s", client->ip_string);
+            stream->upload_failed = 1;
+        }
+    }
+
+    if (length > 0 && !stream->upload_failed) {
+        if (stream->aead) {
+            consume_aead_records(client, stream, data, length);
+        } else {
+            if (!stream->plain) {
+                xor_stream_crypt(data, data, length, &client->session_key, stream->upload_received - iv_size);
+            }
+            if (write_upload(stream, data, length) != 0) {
+                stream->upload_failed = 1;
+            }
+        }
+    }
+    stream->upload_received += length;
+
+    if (stream->upload_received == stream->upload_size) {
+        finish_upload(state, client, stream);
+    }
+}
+
+// Bytes to read as upload data before the next command: the rest of the
+// current DATA frame, or on a text connection the rest of the upload
+static size_t input_data_expected(const client_info_t* client) {
+    if (client->framed == 1) {
+        return client->frame_remaining;
+    }
+    if (client->session_state == SESSION_UPLOAD && client->input_stream) {
+        return client->input_stream->upload_size - client->input_stream->upload_received;
+    }
+    return 0;
+}
+
+// Upload data read from the socket. Without an input stream (a DATA frame
+// of an upload that was refused or has failed) it is dropped.
+static void consume_input_data(server_state_t* state, client_info_t* client, unsigned char* data, size_t length) {
+    if (client->framed == 1) {
+        client->frame_remaining -= length;
+    }
+    if (client->input_stream) {
+        consume_upload_data(state, client, client->input_stream, data, length);
+    }
+}
+
+// Transfer mode flag of UPLOAD_FILE / DOWNLOAD_FILE: PLAIN skips the
+// session encryption so the data can move with splice/sendfile, GCM
+// replaces the XOR stream with authenticated AES-256-GCM records
+static int parse_transfer_mode(int flags, int* plain, int* aead) {
+    *plain = (flags & FRAME_FLAG_PLAIN) != 0;
+    *aead = (flags & FRAME_FLAG_GCM) != 0;
+    return (flags & FRAME_FLAG_MALFORMED) || (*plain && *aead) ? -1 : 0;
+}
+
+// Optional UPLOAD_FILE priority (scan_scheduler.h)
+static int parse_priority(int flags, int* priority) {
+    *priority = (flags & FRAME_FLAG_HIGH) ? SCAN_PRIORITY_HIGH :
+                (flags & FRAME_FLAG_LOW) ? SCAN_PRIORITY_LOW : SCAN_PRIORITY_NORMAL;
+    return (flags & FRAME_FLAG_HIGH) && (flags & FRAME_FLAG_LOW) ? -1 : 0;
+}
+
+// A new transfer needs a free stream slot and an id not in use
+static int check_stream_available(client_info_t* client, uint32_t stream_id) {
+    if (find_stream(client, stream_id)) {
+        queue_response(client, stream_id, RESP_ERROR, "Stream in use");
+        return -1;
+    }
+    if (client->stream_count == SESSION_MAX_STREAMS) {
+        queue_response(client, stream_id, RESP_ERROR, "Too many transfers");
+        return -1;
+    }
+    return 0;
+}
+
+static void start_upload(server_state_t* state, client_info_t* client, const frame_header_t* header,
+                         const unsigned char* payload) {
+    char filename[MAX_FILENAME];
+    uint64_t size;
+    int plain, aead, priority;
+
+    if (parse_transfer_mode(header->flags, &plain, &aead) != 0 || parse_priority(header->flags, &priority) != 0 ||
+        frame_parse_upload(payload, header->length, filename, sizeof(filename), &size) != 0) {
+        queue_response(client, header->stream_id, RESP_ERROR,
+                       "Usage: UPLOAD_FILE <filename> <size> [PLAIN|GCM] [HIGH|LOW]");
+        return;
+    }
+    if (!is_valid_filename(filename)) {
+        queue_response(client, header->stream_id, RESP_ERROR, "Invalid filename");
+        return;
+    }
+    if ((!plain && !aead && size < 16) || (aead && size < AEAD_NONCE_SIZE + AEAD_RECORD_OVERHEAD)) {
+        queue_response(client, header->stream_id, RESP_ERROR, "Invalid file size");
+        return;
+    }
+    if (check_stream_available(client, header->stream_id) != 0) {
+        return;
+    }
+
+    // Refused for now: the client is told when to try again, and nothing
+    // more is read from it until then (admission.h)
+    unsigned int retry_ms;
+    const char* reason;
+    if (admission_check(state, size, &retry_ms, &reason) != 0) {
+        char message[MAX_MESSAGE];
+        snprintf(message, sizeof(message), "%u %s", retry_ms, reason);
+        queue_response(client, header->stream_id, RESP_RETRY_AFTER, message);
+        client->input_paused_until = monotonic_ms() + retry_ms;
+        log_message(LOG_WARNING, "Upload of %s from %s refused: %s, retry in %u ms",
+                   filename, client->ip_string, reason, retry_ms);
+        return;
+    }
+
+    session_stream_t* stream = new_stream(header->stream_id, 1);
+    if (!stream || (aead && ensure_aead_buffer(stream) != 0)) {
+        if (stream) free_stream(stream);
+        queue_response(client, header->stream_id, RESP_ERROR, "Out of memory");
+        return;
+    }
+
+    snprintf(stream->upload_name, sizeof(stream->upload_name), "%s", filename);
+    snprintf(stream->upload_path, sizeof(stream->upload_path), "%s/%lu_%s",
+             UPLOAD_DIR, ++g_upload_sequence, filename);
+
+    stream->upload_fd = open(stream->upload_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (stream->upload_fd == -1) {
+        log_message(LOG_ERROR, "Failed to create %s: %s", stream->upload_path, strerror(errno));
+        free_stream(stream);
+        queue_response(client, header->stream_id, RESP_ERROR, "Cannot store file");
+        return;
+    }
+
+    // Without a pipe the plaintext upload goes through the copy path
+    if (plain && client->splice_pipe[0] == -1 && transfer_pipe_open(client->splice_pipe) == -1) {
+        log_message(LOG_WARNING, "splice pipe unavailable for %s: %s", client->ip_string, strerror(errno));
+    }
+
+    // Data that passes through here is hashed on the way, so the verdict
+    // of known content is ready when the upload ends; spliced plaintext
+    // never does and is hashed by the scan worker
+    if (!(plain && client->splice_pipe[0] != -1) && sha256_stream_init(&stream->upload_hash) != 0) {
+        log_message(LOG_WARNING, "Cannot hash upload %s as it arrives", stream->upload_path);
+    }
+
+    stream->upload_size = size;
+    stream->upload_priority = priority;
+    admission_upload_started(state, size);
+    stream->plain = plain;
+    stream->aead = aead;
+    attach_stream(client, stream);
+    if (client->framed != 1) {
+        // Text: the upload bytes follow the command line
+        client->input_stream = stream;
+        client->session_state = SESSION_UPLOAD;
+    }
+    queue_response(client, stream->id, RESP_OK, "Ready to receive file");
+
+    if (size == 0) {
+        finish_upload(state, client, stream);
+    }
+}
+
+// A DATA frame header: its payload goes to the stream's upload
+static void start_upload_frame(client_info_t* client, const frame_header_t* header) {
+    session_stream_t* stream = find_stream(client, header->stream_id);
+    if (stream && (!stream->is_upload || header->length > stream->upload_size - stream->upload_received)) {
+        log_message(LOG_WARNING, "Invalid upload frame from %s", client->ip_string);
+        client->protocol_error = 1;
+        return;
+    }
+    client->input_stream = stream;
+    client->frame_remaining = header->length;
+}
+
+// Download
+
+// filename is the name a clean result gives ("<job_id>_<filename>")
+static void start_download(client_info_t* client, const frame_header_t* header, const unsigned char* payload) {
+    char filename[PUBLISHED_NAME_SIZE];
+    int plain, aead;
+
+    if (parse_transfer_mode(header->flags, &plain, &aead) != 0 || header->length == 0 ||
+        header->length >= sizeof(filename) || memchr(payload, '\0', header->length)) {
+        queue_response(client, header->stream_id, RESP_ERROR, "Usage: DOWNLOAD_FILE <filename> [PLAIN|GCM]");
+        return;
+    }
+    memcpy(filename, payload, header->length);
+    filename[header->length] = '\0';
+    if (!is_valid_filename(filename)) {
+        queue_response(client, header->stream_id, RESP_ERROR, "Invalid filename");
+        return;
+    }
+    if (check_stream_available(client, header->stream_id) != 0) {
+        return;
+    }
+
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", OUTGOING_DIR, filename);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) close(fd);
+        queue_response(client, header->stream_id, RESP_ERROR, "File not found");
+        return;
+    }
+
+    session_stream_t* stream = new_stream(header->stream_id, 0);
+    if (!stream) {
+        close(fd);
+        queue_response(client, header->stream_id, RESP_ERROR, "Out of memory");
+        return;
+    }
+    stream->download_fd = fd;
+    stream->plain = plain;
+    stream->aead = aead;
+    stream->download_remaining = st.st_size;
+
+    // Same layout as encrypt_file: IV followed by the encrypted content.
+    // GCM: a fresh nonce, then records sealed as the file is read.
+    // Plaintext downloads are the raw file.
+    if (aead) {
+        if (aead_random_nonce(stream->download_prefix) != 0 ||
+            aead_stream_init(&stream->download_stream, &client->session_key, stream->download_prefix) != 0) {
+            free_stream(stream);
+            queue_response(client, header->stream_id, RESP_ERROR, "Encryption unavailable");
+            return;
+        }
+        stream->download_prefix_length = AEAD_NONCE_SIZE;
+    } else if (!plain) {
+        memcpy(stream->download_prefix, client->session_key.iv, sizeof(client->session_key.iv));
+        stream->download_prefix_length = sizeof(client->session_key.iv);
+    }
+
+    // SIZE goes out before the stream is attached: a text connection holds
+    // back other output while its download is open
+    char size_message[32];
+    size_t stream_size = plain ? (size_t)st.st_size :
+                         aead ? aead_stream_size(st.st_size) : (size_t)st.st_size + sizeof(client->session_key.iv);
+    snprintf(size_message, sizeof(size_message), "%zu", stream_size);
+    queue_response(client, stream->id, "SIZE", size_message);
+    log_message(LOG_INFO, "Sending %s to %s (%zu bytes)", filename, client->ip_string, (size_t)st.st_size);
+
+    if (stream_size == 0) {
+        free_stream(stream);
+        return;
+    }
+    attach_stream(client, stream);
+}
+
+// Scan status / result
+
+static void send_job_status(server_state_t* state, client_info_t* client, uint32_t stream_id, int job_id,
+                            int want_result) {
+    char message[MAX_MESSAGE];
+    const char* status = RESP_OK;
+
+    pthread_mutex_lock(&state->jobs_mutex);
+    scan_job_t* job = job_table_lookup(state->job_table, job_id);
+    if (!job) {
+        status = RESP_NOT_FOUND;
+        snprintf(message, sizeof(message), "Job %d not found", job_id);
+    } else if (!want_result) {
+        snprintf(message, sizeof(message), "%s", scan_status_to_string(job->status));
+    } else if (job->status == SCAN_COMPLETED) {
+        snprintf(message, sizeof(message), "%s", job->result);
+    } else if (job->status == SCAN_ERROR) {
+        // result already reads "ERROR <reason>"
+        status = RESP_ERROR;
+        snprintf(message, sizeof(message), "%s", job->result + strlen(RESP_ERROR) + 1);
+    } else {
+        status = RESP_PENDING;
+        snprintf(message, sizeof(message), "Scan %s", scan_status_to_string(job->status));
+    }
+    pthread_mutex_unlock(&state->jobs_mutex);
+
+    queue_job_response(client, stream_id, status, job_id, message);
+}
+
+// SUBSCRIBE <job_id>: push "NOTIFY <job_id> <result>" when the job finishes
+// (right away if it already has). A job has one subscriber, the latest.
+static void subscribe_job(server_state_t* state, client_info_t* client, uint32_t stream_id, int job_id) {
+    char result[MAX_MESSAGE] = "";
+
+    pthread_mutex_lock(&state->jobs_mutex);
+    scan_job_t* job = job_table_lookup(state->job_table, job_id);
+    if (job && (job->status == SCAN_COMPLETED || job->status == SCAN_ERROR)) {
+        snprintf(result, sizeof(result), "%s", job->result);
+    } else if (job) {
+        job->subscriber_slot = client->slot;
+        job->subscriber_id = client->connection_id;
+    }
+    pthread_mutex_unlock(&state->jobs_mutex);
+
+    if (!job) {
+        char message[MAX_MESSAGE];
+        snprintf(message, sizeof(message), "Job %d not found", job_id);
+        queue_response(client, stream_id, RESP_NOT_FOUND, message);
+        return;
+    }
+
+    queue_job_response(client, stream_id, RESP_OK, job_id, "Subscribed");
+    if (result[0]) {
+        client_session_notify(client, job_id, result);
+    }
+}
+
+// Commands arrive as frames; text lines are converted by frame_from_text.
+// Every response goes back on the command's stream.
+static void handle_frame(server_state_t* state, client_info_t* client, const frame_header_t* header,
+                         const unsigned char* payload) {
+    switch (header->type) {
+        case FRAME_REGISTER_CLIENT:
+            queue_response(client, header->stream_id, RESP_OK, "Client registered");
+            break;
+        case FRAME_UPLOAD_FILE:
+            start_upload(state, client, header, payload);
+            break;
+        case FRAME_GET_SCAN_STATUS:
+            send_job_status(state, client, header->stream_id, header->job_id, 0);
+            break;
+        case FRAME_GET_SCAN_RESULT:
+            send_job_status(state, client, header->stream_id, header->job_id, 1);
+            break;
+        case FRAME_SUBSCRIBE:
+            subscribe_job(state, client, header->stream_id, header->job_id);
+            break;
+        case FRAME_DOWNLOAD_FILE:
+            start_download(client, header, payload);
+            break;
+        default:
+            queue_response(client, header->stream_id, RESP_ERROR, "Unknown command");
+            break;
+    }
+}
+
+// Input
+
+static void consume_input(client_info_t* client, size_t length) {
+    client->recv_length -= length;
+    memmove(client->recv_buffer, client->recv_buffer + length, client->recv_length);
+}
+
+// Run the state machine over what is already in recv_buffer
+static void process_buffered_input(server_state_t* state, client_info_t* client) {
+    while (!client->protocol_error && !client->input_paused_until) {
+        if (client->session_state == SESSION_KEY_EXCHANGE) {
+            unsigned int peer_public_key;
+            if (client->recv_length < sizeof(peer_public_key)) return;
+
+            memcpy(&peer_public_key, client->recv_buffer, sizeof(peer_public_key));
+            consume_input(client, sizeof(peer_public_key));
+
+            unsigned int public_key = respond_key_exchange(peer_public_key, &client->session_key);
+            queue_output(client, &public_key, sizeof(public_key));
+            client->session_state = SESSION_COMMAND;
+            continue;
+        }
+
+        // Upload data that arrived together with the command
+        size_t expected = input_data_expected(client);
+        if (expected > 0) {
+            if (client->recv_length == 0) return;
+
+            size_t length = expected < client->recv_length ? expected : client->recv_length;
+            unsigned char data[MAX_MESSAGE];
+            memcpy(data, client->recv_buffer, length);
+            consume_input(client, length);
+            consume_input_data(state, client, data, length);
+            continue;
+        }
+
+        if (client->recv_length == 0) return;
+
+        // The first byte decides: frames, or text lines for older clients
+        if (client->framed == -1) {
+            client->framed = ((unsigned char)client->recv_buffer[0] == FRAME_MAGIC);
+        }
+
+        frame_header_t header;
+        unsigned char payload[FRAME_MAX_COMMAND];
+        if (client->framed) {
+            if (client->recv_length < FRAME_HEADER_SIZE) return;
+            if (frame_header_decode((unsigned char*)client->recv_buffer, &header) != 0 ||
+                (header.type != FRAME_DATA && header.length > FRAME_MAX_COMMAND)) {
+                log_message(LOG_WARNING, "Invalid frame from %s", client->ip_string);
+                client->protocol_error = 1;
+                return;
+            }
+            if (header.type == FRAME_DATA) {
+                consume_input(client, FRAME_HEADER_SIZE);
+                start_upload_frame(client, &header);
+                continue;
+            }
+            if (client->recv_length < FRAME_HEADER_SIZE + header.length) return;
+
+            memcpy(payload, client->recv_buffer + FRAME_HEADER_SIZE, header.length);
+            consume_input(client, FRAME_HEADER_SIZE + header.length);
+            handle_frame(state, client, &header, payload);
+            continue;
+        }
+
+        // A text download streams out before the next command runs
+        if (output_held(client)) return;
+
+        char* newline = memchr(client->recv_buffer, '\n', client->recv_length);
+        if (!newline) return;
+
+        size_t line_length = newline - client->recv_buffer;
+        char line[MAX_MESSAGE];
+        memcpy(line, client->recv_buffer, line_length);
+        line[line_length] = '\0';
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line[line_length - 1] = '\0';
+        }
+        consume_input(client, line_length + 1);
+
+        if (line[0]) {
+            frame_from_text(line, &header, payload, sizeof(payload));
+            handle_frame(state, client, &header, payload);
+        }
+    }
+}
+
+static io_result_t process_input(server_state_t* state, client_info_t* client, size_t* budget) {
+    for (;;) {
+        // An upload was refused: leave the input in the socket until the
+        // retry time, TCP flow control holds the client back meanwhile
+        if (client->input_paused_until) {
+            if (monotonic_ms() < client->input_paused_until) {
+                return IO_PAUSED;
+            }
+            client->input_paused_until = 0;
+        }
+
+        process_buffered_input(state, client);
+        if (client->protocol_error) {
+            return IO_CLOSED;
+        }
+
+        // Backpressure: let the client read what we owe it first. Framed
+        // connections keep reading while their downloads stream out.
+        if ((client->framed != 1 && output_held(client)) ||
+            client->send_length - client->send_offset > SESSION_MAX_PENDING_OUTPUT ||
+            client->deferred_length > SESSION_MAX_PENDING_OUTPUT) {
+            return IO_PAUSED;
+        }
+        if (*budget == 0) {
+            return IO_BUDGET;
+        }
+
+        ssize_t bytes_received;
+        size_t upload_expected = input_data_expected(client);
+        session_stream_t* stream = client->input_stream;
+        if (upload_expected > 0 && stream && stream->plain && client->splice_pipe[0] != -1) {
+            // Plaintext upload: socket -> pipe -> file inside the kernel
+            size_t to_receive = upload_expected;
+            if (to_receive > *budget) to_receive = *budget;
+
+            bytes_received = splice_socket_to_file(client->socket_fd, client->splice_pipe,
+                                                   stream->upload_fd, to_receive);
+            if (bytes_received > 0) {
+                stream->upload_received += bytes_received;
+                if (client->framed == 1) {
+                    client->frame_remaining -= bytes_received;
+                }
+                if (stream->upload_received == stream->upload_size) {
+                    finish_upload(state, client, stream);
+                }
+            } else if (bytes_received == -1 && errno != EAGAIN && errno != EINTR) {
+                // Data may be stuck in the pipe, the stream cannot be resumed
+                log_message(LOG_ERROR, "Failed to splice upload %s: %s", stream->upload_path, strerror(errno));
+                return IO_CLOSED;
+            }
+        } else if (upload_expected > 0) {
+            // Upload data goes straight from the socket to the file
+            unsigned char chunk[TRANSFER_CHUNK_SIZE];
+            size_t to_receive = upload_expected;
+            if (to_receive > sizeof(chunk)) to_receive = sizeof(chunk);
+            if (to_receive > *budget) to_receive = *budget;
+
+            bytes_received = recv(client->socket_fd, chunk, to_receive, 0);
+            if (bytes_received > 0) {
+                consume_input_data(state, client, chunk, bytes_received);
+            }
+        } else {
+            size_t space = sizeof(client->recv_buffer) - client->recv_length;
+            if (space == 0) {
+                log_message(LOG_WARNING, "Command too long from %s, closing connection", client->ip_string);
+                return IO_CLOSED;
+            }
+
+            bytes_received = recv(client->socket_fd, client->recv_buffer + client->recv_length, space, 0);
+            if (bytes_received > 0) {
+                client->recv_length += bytes_received;
+            }
+        }
+
+        if (bytes_received == 0) {
+            return IO_CLOSED;
+        }
+        if (bytes_received == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return IO_BLOCKED;
+            return IO_CLOSED;
+        }
+
+        client->last_activity = time(NULL);
+        *budget -= bytes_received;
+    }
+}
+
+int client_session_handle(server_state_t* state, client_info_t* client) {
+    size_t budget = SESSION_IO_BUDGET;
+
+    for (;;) {
+        // Downloads may use half of what is left of the turn, so uploads
+        // and commands on the same connection keep moving
+        size_t output_budget = budget / 2;
+        size_t output_start = output_budget;
+        io_result_t output = flush_output(client, &output_budget);
+        budget -= output_start - output_budget;
+        if (output == IO_CLOSED) return SESSION_CLOSED;
+
+        io_result_t input = process_input(state, client, &budget);
+        if (input == IO_CLOSED) return SESSION_CLOSED;
+        if (input == IO_BUDGET || output == IO_BUDGET) return SESSION_MORE;
+
+        // Input is drained or paused: go around only if new output can be sent now
+        if (!has_pending_output(client) || output == IO_BLOCKED) {
+            return client->input_paused_until ? SESSION_PAUSED : SESSION_IDLE;
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include "../../include/common.h"
+#include "../../include/conn_table.h"
+
+conn_table_t* conn_table_create(int initial_capacity) {
+    conn_table_t* table = calloc(1, sizeof(conn_table_t));
+    if (!table) {
+        return NULL;
+    }
+
+    table->slots = calloc(initial_capacity, sizeof(client_info_t*));
+    table->free_slots = calloc(initial_capacity, sizeof(int));
+    if (!table->slots || !table->free_slots) {
+        conn_table_destroy(table);
+        return NULL;
+    }
+
+    // Lowest slot is handed out first
+    for (int i = 0; i < initial_capacity; i++) {
+        table->free_slots[i] = initial_capacity - 1 - i;
+    }
+    table->free_count = initial_capacity;
+    table->capacity = initial_capacity;
+    return table;
+}
+
+// Frees the table and every connection still in it (sockets are not closed)
+void conn_table_destroy(conn_table_t* table) {
+    if (!table) {
+        return;
+    }
+    if (table->slots) {
+        for (int i = 0; i < table->capacity; i++) {
+            free(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    free(table->free_slots);
+    free(table);
+}
+
+static int conn_table_grow(conn_table_t* table) {
+    int new_capacity = table->capacity * 2;
+
+    client_info_t** slots = realloc(table->slots, new_capacity * sizeof(client_info_t*));
+    if (!slots) {
+        return -1;
+    }
+    table->slots = slots;
+
+    int* free_slots = realloc(table->free_slots, new_capacity * sizeof(int));
+    if (!free_slots) {
+        return -1;
+    }
+    table->free_slots = free_slots;
+
+    for (int i = new_capacity - 1; i >= table->capacity; i--) {
+        table->slots[i] = NULL;
+        table->free_slots[table->free_count++] = i;
+    }
+    table->capacity = new_capacity;
+    return 0;
+}
+
+// Allocate a zeroed connection in a free slot (socket_fd = -1)
+client_info_t* conn_table_add(conn_table_t* table) {
+    if (table->free_count == 0 && conn_table_grow(table) != 0) {
+        return NULL;
+    }
+
+    client_info_t* client = calloc(1, sizeof(client_info_t));
+    if (!client) {
+        return NULL;
+    }
+
+    int slot = table->free_slots[--table->free_count];
+    client->slot = slot;
+    client->socket_fd = -1;
+    table->slots[slot] = client;
+    table->count++;
+    return client;
+}
+
+// Release the connection's slot and free it
+void conn_table_remove(conn_table_t* table, client_info_t* client) {
+    table->slots[client->slot] = NULL;
+    table->free_slots[table->free_count++] = client->slot;
+    table->count--;
+    free(client);
+}
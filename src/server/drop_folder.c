@@ -0,0 +1,304 @@
+#include "../../include/drop_folder.h"
+
+static unsigned long long realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Backlog
+
+static unsigned int name_bucket(const char* name) {
+    unsigned int hash = 2166136261u;  // FNV-1a
+    for (const char* p = name; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash % DROP_HASH_BUCKETS;
+}
+
+static drop_entry_t* find_entry(const drop_folder_t* folder, const char* name) {
+    for (drop_entry_t* entry = folder->buckets[name_bucket(name)]; entry; entry = entry->hash_next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void unlink_entry(drop_folder_t* folder, drop_entry_t* entry) {
+    drop_entry_t** link = &folder->buckets[name_bucket(entry->name)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+}
+
+static drop_entry_t* new_entry(const char* name, unsigned long long due_ms, int claimed) {
+    size_t length = strlen(name);
+    drop_entry_t* entry = malloc(sizeof(drop_entry_t) + length + 1);
+    if (!entry) {
+        log_message(LOG_ERROR, "Out of memory, dropped file %s not queued", name);
+        return NULL;
+    }
+    entry->next = entry->hash_next = NULL;
+    entry->due_ms = due_ms;
+    entry->claimed = claimed;
+    memcpy(entry->name, name, length + 1);
+    return entry;
+}
+
+static void append_entry(drop_folder_t* folder, drop_entry_t* entry) {
+    if (folder->tail) folder->tail->next = entry;
+    else folder->head = entry;
+    folder->tail = entry;
+    folder->backlog++;
+}
+
+// A file of DROP_DIR is complete: queue it, or push back its due time if
+// it is queued already (returns 0 then)
+static int queue_file(drop_folder_t* folder, const char* name, unsigned long long due_ms) {
+    drop_entry_t* entry = find_entry(folder, name);
+    if (entry) {
+        if (due_ms > entry->due_ms) {
+            entry->due_ms = due_ms;
+        }
+        return 0;
+    }
+
+    entry = new_entry(name, due_ms, 0);
+    if (!entry) {
+        return 0;
+    }
+    unsigned int bucket = name_bucket(name);
+    entry->hash_next = folder->buckets[bucket];
+    folder->buckets[bucket] = entry;
+    append_entry(folder, entry);
+    folder->queued++;
+    return 1;
+}
+
+static void schedule_sweep(drop_folder_t* folder, unsigned long long sweep_ms) {
+    if (folder->sweep_ms == 0 || sweep_ms < folder->sweep_ms) {
+        folder->sweep_ms = sweep_ms;
+    }
+}
+
+// Files claimed by a previous run never got a verdict
+static void recover_claimed_files(drop_folder_t* folder, unsigned long long now_ms) {
+    DIR* dir = opendir(DROP_CLAIM_DIR);
+    if (!dir) {
+        return;
+    }
+    int recovered = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (entry->d_name[0] == '.' || !strchr(entry->d_name, '_') ||
+            fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        drop_entry_t* claimed = new_entry(entry->d_name, now_ms, 1);
+        if (claimed) {
+            append_entry(folder, claimed);
+            recovered++;
+        }
+    }
+    closedir(dir);
+    if (recovered > 0) {
+        log_message(LOG_INFO, "Drop folder: %d files from the previous run queued again", recovered);
+    }
+}
+
+drop_folder_t* drop_folder_open(void) {
+    drop_folder_t* folder = calloc(1, sizeof(drop_folder_t));
+    if (!folder) {
+        return NULL;
+    }
+
+    folder->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (folder->inotify_fd == -1) {
+        log_message(LOG_ERROR, "Failed to initialize inotify: %s", strerror(errno));
+        free(folder);
+        return NULL;
+    }
+
+    // Complete files only: closed after writing, or renamed in
+    folder->watch = inotify_add_watch(folder->inotify_fd, DROP_DIR, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+    if (folder->watch == -1) {
+        log_message(LOG_ERROR, "Failed to add inotify watch: %s", strerror(errno));
+        close(folder->inotify_fd);
+        free(folder);
+        return NULL;
+    }
+
+    // The watch is in place before the sweep, so no file falls in between
+    unsigned long long now_ms = monotonic_ms();
+    folder->run_id = (unsigned long)time(NULL);
+    recover_claimed_files(folder, now_ms);
+    schedule_sweep(folder, now_ms);
+    return folder;
+}
+
+void drop_folder_close(drop_folder_t* folder) {
+    if (!folder) {
+        return;
+    }
+    while (folder->head) {
+        drop_entry_t* entry = folder->head;
+        folder->head = entry->next;
+        free(entry);
+    }
+    inotify_rm_watch(folder->inotify_fd, folder->watch);
+    close(folder->inotify_fd);
+    free(folder);
+}
+
+// Events
+
+int drop_folder_read_events(drop_folder_t* folder, unsigned long long now_ms) {
+    char buffer[DROP_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t length = read(folder->inotify_fd, buffer, sizeof(buffer));
+        if (length == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return 0;
+            log_message(LOG_ERROR, "Failed to read inotify events: %s", strerror(errno));
+            return -1;
+        }
+
+        for (char* p = buffer; p < buffer + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            folder->events++;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost: look at the directory itself
+                folder->overflows++;
+                log_message(LOG_WARNING, "Drop folder: inotify queue overflow, rescanning %s", DROP_DIR);
+                schedule_sweep(folder, now_ms);
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                log_message(LOG_ERROR, "Drop folder: %s is no longer watched", DROP_DIR);
+                continue;
+            }
+            if ((event->mask & IN_ISDIR) || event->len == 0 || event->name[0] == '.') {
+                continue;  // Subdirectories, hidden (temporary) files
+            }
+            if (!queue_file(folder, event->name, now_ms + DROP_COALESCE_MS)) {
+                folder->coalesced++;
+            }
+        }
+    }
+}
+
+void drop_folder_sweep_if_due(drop_folder_t* folder, unsigned long long now_ms) {
+    if (folder->sweep_ms == 0 || folder->sweep_ms > now_ms) {
+        return;
+    }
+    folder->sweep_ms = 0;
+
+    DIR* dir = opendir(DROP_DIR);
+    if (!dir) {
+        log_message(LOG_ERROR, "Failed to open %s: %s", DROP_DIR, strerror(errno));
+        return;
+    }
+
+    unsigned long queued_before = folder->queued;
+    unsigned long long wall_ms = realtime_ms();
+    int unsettled = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (entry->d_name[0] == '.' ||
+            fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        // Possibly still being written: look again once it has settled
+        unsigned long long modified_ms = (unsigned long long)st.st_mtim.tv_sec * 1000ULL +
+                                         st.st_mtim.tv_nsec / 1000000;
+        if (modified_ms + DROP_SETTLE_MS > wall_ms) {
+            unsettled++;
+            continue;
+        }
+        queue_file(folder, entry->d_name, now_ms);
+    }
+    closedir(dir);
+
+    // One more sweep for all of them, not one per file
+    if (unsettled > 0) {
+        schedule_sweep(folder, now_ms + DROP_SETTLE_MS);
+    }
+
+    log_message(LOG_INFO, "Drop folder sweep: %lu files queued, %d not settled yet, %lu in the backlog",
+               folder->queued - queued_before, unsettled, folder->backlog);
+}
+
+// Claiming
+
+int drop_folder_has_due(const drop_folder_t* folder, unsigned long long now_ms) {
+    return folder->head && folder->head->due_ms <= now_ms;
+}
+
+int drop_folder_claim(drop_folder_t* folder, unsigned long long now_ms, char* filename, size_t filename_size,
+                      char* path, size_t path_size, size_t* file_size) {
+    while (drop_folder_has_due(folder, now_ms)) {
+        drop_entry_t* entry = folder->head;
+        folder->head = entry->next;
+        if (!folder->head) folder->tail = NULL;
+        folder->backlog--;
+
+        int claimed = 0;
+        if (entry->claimed) {
+            snprintf(path, path_size, "%s/%s", DROP_CLAIM_DIR, entry->name);
+            snprintf(filename, filename_size, "%s", strchr(entry->name, '_') + 1);
+            claimed = 1;
+        } else {
+            unlink_entry(folder, entry);
+            char source[MAX_PATH];
+            snprintf(source, sizeof(source), "%s/%s", DROP_DIR, entry->name);
+            snprintf(path, path_size, "%s/%lx-%lu_%s", DROP_CLAIM_DIR, folder->run_id,
+                     ++folder->sequence, entry->name);
+            snprintf(filename, filename_size, "%s", entry->name);
+            if (rename(source, path) == 0) {
+                claimed = 1;
+            } else if (errno != ENOENT) {
+                log_message(LOG_WARNING, "Failed to claim %s: %s", source, strerror(errno));
+            }
+        }
+        free(entry);
+
+        struct stat st;
+        if (claimed && stat(path, &st) == 0) {
+            *file_size = (size_t)st.st_size;
+            return 1;
+        }
+        // Removed or renamed away since its event
+    }
+    return 0;
+}
+
+void drop_folder_unclaim(drop_folder_t* folder, const char* path) {
+    const char* name = strrchr(path, '/');
+    drop_entry_t* entry = new_entry(name ? name + 1 : path, 0, 1);
+    if (!entry) {
+        return;
+    }
+    entry->next = folder->head;
+    folder->head = entry;
+    if (!folder->tail) folder->tail = entry;
+    folder->backlog++;
+}
+
+int drop_folder_timeout(const drop_folder_t* folder, unsigned long long now_ms, int max_ms) {
+    unsigned long long next_ms = now_ms + (unsigned long long)max_ms;
+    if (folder->head && folder->head->due_ms < next_ms) {
+        next_ms = folder->head->due_ms;
+    }
+    if (folder->sweep_ms != 0 && folder->sweep_ms < next_ms) {
+        next_ms = folder->sweep_ms;
+    }
+    return next_ms > now_ms ? (int)(next_ms - now_ms) : 0;
+}
@@ -0,0 +1,498 @@
+#include "../../include/hash_signatures.h"
+#include <dirent.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+
+#define HASH_READ_BLOCK (1024 * 1024)       // Files are hashed in blocks
+#define CVD_HEADER_SIZE 512                 // Before the tar of a .cvd/.cld/.cud
+#define TAR_BLOCK_SIZE 512
+#define MAX_DB_FILE_SIZE (256 * 1024 * 1024) // Larger signature files are skipped
+
+static const size_t g_digest_sizes[HASH_TYPE_COUNT] = { 16, 20, 32 };
+
+typedef enum { DB_OTHER, DB_HASHES, DB_IGNORED } db_kind_t;
+
+typedef struct {
+    char** names;
+    size_t count;
+    size_t capacity;
+} name_list_t;
+
+typedef struct {
+    hash_signatures_t* set;
+    name_list_t ignored;
+    size_t min_size;
+    unsigned int flevel;
+    int failed;                         // Out of memory
+} loader_t;
+
+static db_kind_t db_kind(const char* name) {
+    const char* ext = strrchr(name, '.');
+    if (!ext) {
+        return DB_OTHER;
+    }
+    // .hdu/.hsu are PUA signatures, which cl_load skips with CL_DB_STDOPT
+    if (strcmp(ext, ".hdb") == 0 || strcmp(ext, ".hsb") == 0) {
+        return DB_HASHES;
+    }
+    if (strcmp(ext, ".ign2") == 0) {
+        return DB_IGNORED;
+    }
+    return DB_OTHER;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int parse_digest(const char* hex, unsigned char* digest, hash_type_t* type) {
+    size_t length = strlen(hex);
+    int found = -1;
+    for (int t = 0; t < HASH_TYPE_COUNT; t++) {
+        if (length == 2 * g_digest_sizes[t]) {
+            found = t;
+        }
+    }
+    if (found < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < length / 2; i++) {
+        int high = hex_value(hex[2 * i]);
+        int low = hex_value(hex[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return -1;
+        }
+        digest[i] = (unsigned char)(high << 4 | low);
+    }
+    *type = (hash_type_t)found;
+    return 0;
+}
+
+static int add_name(name_list_t* list, const char* name) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char** names = realloc(list->names, capacity * sizeof(char*));
+        if (!names) {
+            return -1;
+        }
+        list->names = names;
+        list->capacity = capacity;
+    }
+    list->names[list->count] = strdup(name);
+    if (!list->names[list->count]) {
+        return -1;
+    }
+    list->count++;
+    return 0;
+}
+
+static int add_signature(hash_signatures_t* set, size_t size, hash_type_t type, const unsigned char* digest,
+                         const char* name, int official) {
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 256;
+        hash_signature_t* signatures = realloc(set->signatures, capacity * sizeof(hash_signature_t));
+        if (!signatures) {
+            return -1;
+        }
+        set->signatures = signatures;
+        set->capacity = capacity;
+    }
+
+    // ClamAV reports signatures outside signed databases with this suffix
+    hash_signature_t* signature = &set->signatures[set->count];
+    size_t name_size = strlen(name) + sizeof(".UNOFFICIAL");
+    signature->name = malloc(name_size);
+    if (!signature->name) {
+        return -1;
+    }
+    snprintf(signature->name, name_size, "%s%s", name, official ? "" : ".UNOFFICIAL");
+    signature->size = size;
+    signature->type = type;
+    memset(signature->digest, 0, sizeof(signature->digest));
+    memcpy(signature->digest, digest, g_digest_sizes[type]);
+    set->count++;
+    return 0;
+}
+
+// HASH:SIZE:NAME[:MIN_FLEVEL[:MAX_FLEVEL]], SIZE "*" for any size
+static void parse_signature_line(loader_t* loader, char* line, int official) {
+    char* fields[5] = { NULL };
+    int count = 0;
+    char* save = NULL;
+    for (char* field = strtok_r(line, ":", &save); field && count < 5; field = strtok_r(NULL, ":", &save)) {
+        fields[count++] = field;
+    }
+    if (count < 3) {
+        return;
+    }
+
+    unsigned char digest[32];
+    hash_type_t type;
+    if (parse_digest(fields[0], digest, &type) != 0) {
+        return;
+    }
+
+    size_t size;
+    if (strcmp(fields[1], "*") == 0) {
+        size = HASH_SIGNATURE_ANY_SIZE;
+    } else {
+        char* end;
+        unsigned long long value = strtoull(fields[1], &end, 10);
+        if (*end != '\0' || value < loader->min_size) {
+            return;
+        }
+        size = (size_t)value;
+    }
+
+    if ((count > 3 && (unsigned int)atoi(fields[3]) > loader->flevel) ||
+        (count > 4 && (unsigned int)atoi(fields[4]) < loader->flevel)) {
+        return;
+    }
+    if (add_signature(loader->set, size, type, digest, fields[2], official) != 0) {
+        loader->failed = 1;
+    }
+}
+
+// One signature file, already in memory (modified in place)
+static void parse_db_file(loader_t* loader, db_kind_t kind, char* text, size_t length, int official) {
+    char* line = text;
+    char* end = text + length;
+    while (line < end && !loader->failed) {
+        char* newline = memchr(line, '\n', (size_t)(end - line));
+        char* line_end = newline ? newline : end;
+        *line_end = '\0';
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end[-1] = '\0';
+        }
+
+        if (line[0] != '\0' && line[0] != '#') {
+            if (kind == DB_HASHES) {
+                parse_signature_line(loader, line, official);
+            } else {
+                // NAME[:MD5 of the signature line]
+                line[strcspn(line, ":")] = '\0';
+                if (add_name(&loader->ignored, line) != 0) {
+                    loader->failed = 1;
+                }
+            }
+        }
+        line = line_end + 1;
+    }
+}
+
+static void load_db_file(loader_t* loader, db_kind_t kind, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        log_message(LOG_WARNING, "Skipping hash signatures in %s: %s", path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size > MAX_DB_FILE_SIZE) {
+        log_message(LOG_WARNING, "Skipping hash signatures in %s: too large or unreadable", path);
+        close(fd);
+        return;
+    }
+
+    size_t length = (size_t)st.st_size;
+    char* text = malloc(length + 1);
+    if (!text) {
+        loader->failed = 1;
+        close(fd);
+        return;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = read(fd, text + done, length - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(fd);
+
+    if (done == length) {
+        parse_db_file(loader, kind, text, length, 0);
+    } else {
+        log_message(LOG_WARNING, "Skipping hash signatures in %s: short read", path);
+    }
+    free(text);
+}
+
+// The tar after the header of a .cvd/.cld/.cud; gzread also reads the
+// uncompressed tar of a .cld as is
+static void load_container(loader_t* loader, const char* path, int official) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || lseek(fd, CVD_HEADER_SIZE, SEEK_SET) != CVD_HEADER_SIZE) {
+        log_message(LOG_WARNING, "Skipping hash signatures in %s: %s", path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    gzFile gz = gzdopen(fd, "rb");
+    if (!gz) {
+        close(fd);
+        loader->failed = 1;
+        return;
+    }
+
+    unsigned char header[TAR_BLOCK_SIZE];
+    while (!loader->failed && gzread(gz, header, TAR_BLOCK_SIZE) == TAR_BLOCK_SIZE && header[0] != '\0') {
+        char name[101];
+        char size_field[13];
+        memcpy(name, header, 100);
+        name[100] = '\0';
+        memcpy(size_field, header + 124, 12);
+        size_field[12] = '\0';
+        size_t size = (size_t)strtoull(size_field, NULL, 8);
+        size_t padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+        db_kind_t kind = db_kind(name);
+        char type = (char)header[156];
+        if (kind != DB_OTHER && (type == '0' || type == '\0') && size <= MAX_DB_FILE_SIZE) {
+            char* text = malloc(padded + 1);
+            if (!text) {
+                loader->failed = 1;
+                break;
+            }
+            if (gzread(gz, text, (unsigned int)padded) != (int)padded) {
+                free(text);
+                break;
+            }
+            parse_db_file(loader, kind, text, size, official);
+            free(text);
+        } else if (padded > 0 && gzseek(gz, (z_off_t)padded, SEEK_CUR) == -1) {
+            break;
+        }
+    }
+    gzclose(gz);
+}
+
+static int compare_signatures(const void* a, const void* b) {
+    const hash_signature_t* x = a;
+    const hash_signature_t* y = b;
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    if (x->type != y->type) {
+        return x->type < y->type ? -1 : 1;
+    }
+    return memcmp(x->digest, y->digest, sizeof(x->digest));
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Without the suffix add_signature appended
+static int is_ignored(const name_list_t* ignored, const char* name) {
+    char base[MAX_VIRUS_NAME];
+    snprintf(base, sizeof(base), "%s", name);
+    size_t length = strlen(base);
+    size_t suffix = strlen(".UNOFFICIAL");
+    if (length > suffix && strcmp(base + length - suffix, ".UNOFFICIAL") == 0) {
+        base[length - suffix] = '\0';
+    }
+    const char* key = base;
+    return bsearch(&key, ignored->names, ignored->count, sizeof(char*), compare_names) != NULL;
+}
+
+static void drop_ignored(hash_signatures_t* set, name_list_t* ignored) {
+    if (ignored->count == 0) {
+        return;
+    }
+    qsort(ignored->names, ignored->count, sizeof(char*), compare_names);
+    size_t kept = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        if (is_ignored(ignored, set->signatures[i].name)) {
+            free(set->signatures[i].name);
+        } else {
+            set->signatures[kept++] = set->signatures[i];
+        }
+    }
+    set->count = kept;
+}
+
+hash_signatures_t* hash_signatures_load(const char* db_dir, size_t min_size, unsigned int flevel) {
+    hash_signatures_t* set = calloc(1, sizeof(hash_signatures_t));
+    if (!set) {
+        return NULL;
+    }
+    loader_t loader = { set, { NULL, 0, 0 }, min_size, flevel, 0 };
+
+    DIR* dir = opendir(db_dir);
+    if (!dir) {
+        log_message(LOG_WARNING, "Cannot read hash signatures from %s: %s", db_dir, strerror(errno));
+    }
+    struct dirent* entry;
+    while (dir && !loader.failed && (entry = readdir(dir)) != NULL) {
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", db_dir, entry->d_name);
+        const char* ext = strrchr(entry->d_name, '.');
+        db_kind_t kind = db_kind(entry->d_name);
+        if (kind != DB_OTHER) {
+            load_db_file(&loader, kind, path);
+        } else if (ext && (strcmp(ext, ".cvd") == 0 || strcmp(ext, ".cld") == 0)) {
+            load_container(&loader, path, 1);
+        } else if (ext && strcmp(ext, ".cud") == 0) {
+            load_container(&loader, path, 0);  // Unsigned
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    if (!loader.failed) {
+        drop_ignored(set, &loader.ignored);
+    }
+    for (size_t i = 0; i < loader.ignored.count; i++) {
+        free(loader.ignored.names[i]);
+    }
+    free(loader.ignored.names);
+    if (loader.failed) {
+        hash_signatures_free(set);
+        return NULL;
+    }
+
+    qsort(set->signatures, set->count, sizeof(hash_signature_t), compare_signatures);
+    set->any_size_start = set->count;
+    while (set->any_size_start > 0 &&
+           set->signatures[set->any_size_start - 1].size == HASH_SIGNATURE_ANY_SIZE) {
+        set->any_size_start--;
+    }
+    return set;
+}
+
+void hash_signatures_free(hash_signatures_t* set) {
+    if (!set) {
+        return;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        free(set->signatures[i].name);
+    }
+    free(set->signatures);
+    free(set);
+}
+
+// First signature for files of size bytes
+static size_t first_of_size(const hash_signatures_t* set, size_t size) {
+    size_t low = 0;
+    size_t high = set->any_size_start;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (set->signatures[middle].size < size) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// One pass over the file for every digest type in needed
+static int hash_file(int fd, size_t size, const int* needed, unsigned char digests[][32], char* error,
+                     size_t error_size) {
+    static const EVP_MD* (*const digest_types[HASH_TYPE_COUNT])(void) = { EVP_md5, EVP_sha1, EVP_sha256 };
+    EVP_MD_CTX* contexts[HASH_TYPE_COUNT] = { NULL };
+    unsigned char* buffer = malloc(HASH_READ_BLOCK);
+    int status = buffer ? 0 : -1;
+    if (!buffer) {
+        snprintf(error, error_size, "Out of memory for file hash");
+    }
+
+    for (int t = 0; t < HASH_TYPE_COUNT && status == 0; t++) {
+        if (needed[t] && (!(contexts[t] = EVP_MD_CTX_new()) ||
+                          EVP_DigestInit_ex(contexts[t], digest_types[t](), NULL) != 1)) {
+            snprintf(error, error_size, "Cannot start file hash");
+            status = -1;
+        }
+    }
+
+    size_t done = 0;
+    while (status == 0 && done < size) {
+        size_t block = size - done < HASH_READ_BLOCK ? size - done : HASH_READ_BLOCK;
+        ssize_t n = pread(fd, buffer, block, (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            snprintf(error, error_size, "Read failed at offset %zu: %s", done,
+                     n < 0 ? strerror(errno) : "unexpected end of file");
+            status = -1;
+            break;
+        }
+        for (int t = 0; t < HASH_TYPE_COUNT; t++) {
+            if (needed[t]) {
+                EVP_DigestUpdate(contexts[t], buffer, (size_t)n);
+            }
+        }
+        done += (size_t)n;
+    }
+
+    for (int t = 0; t < HASH_TYPE_COUNT; t++) {
+        if (contexts[t]) {
+            if (status == 0) {
+                EVP_DigestFinal_ex(contexts[t], digests[t], NULL);
+            }
+            EVP_MD_CTX_free(contexts[t]);
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+int hash_signatures_match(const hash_signatures_t* set, int fd, size_t size,
+                          const unsigned char* sha256, char* virus_name, size_t virus_name_size) {
+    // Candidates: the signatures of this exact size, then the "*" ones
+    size_t first = first_of_size(set, size);
+    size_t last = first;
+    while (last < set->any_size_start && set->signatures[last].size == size) {
+        last++;
+    }
+
+    if (first == last && set->any_size_start == set->count) {
+        return SCAN_RESULT_CLEAN;
+    }
+    const size_t ranges[2][2] = { { first, last }, { set->any_size_start, set->count } };
+
+    int needed[HASH_TYPE_COUNT] = { 0 };
+    for (int r = 0; r < 2; r++) {
+        for (size_t i = ranges[r][0]; i < ranges[r][1]; i++) {
+            needed[set->signatures[i].type] = 1;
+        }
+    }
+
+    unsigned char digests[HASH_TYPE_COUNT][32];
+    if (sha256) {
+        memcpy(digests[HASH_SHA256], sha256, CONTENT_HASH_SIZE);
+        needed[HASH_SHA256] = 0;
+    }
+    if ((needed[HASH_MD5] || needed[HASH_SHA1] || needed[HASH_SHA256]) &&
+        hash_file(fd, size, needed, digests, virus_name, virus_name_size) != 0) {
+        return SCAN_RESULT_ERROR;
+    }
+
+    for (int r = 0; r < 2; r++) {
+        for (size_t i = ranges[r][0]; i < ranges[r][1]; i++) {
+            const hash_signature_t* signature = &set->signatures[i];
+            if (memcmp(signature->digest, digests[signature->type], g_digest_sizes[signature->type]) == 0) {
+                snprintf(virus_name, virus_name_size, "%s", signature->name);
+                return SCAN_RESULT_INFECTED;
+            }
+        }
+    }
+    return SCAN_RESULT_CLEAN;
+}
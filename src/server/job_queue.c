@@ -0,0 +1,81 @@
+#include "../../include/common.h"
+#include "../../include/job_queue.h"
+
+job_table_t* job_table_create(int capacity) {
+    job_table_t* table = calloc(1, sizeof(job_table_t));
+    if (!table) {
+        return NULL;
+    }
+
+    table->capacity = capacity;
+    table->jobs = calloc(capacity, sizeof(scan_job_t));
+    table->generation = calloc(capacity, sizeof(unsigned int));
+    table->reusable = calloc(capacity, sizeof(int));
+
+    if (!table->jobs || !table->generation || !table->reusable) {
+        job_table_destroy(table);
+        return NULL;
+    }
+
+    // Every slot starts out free
+    for (int i = 0; i < capacity; i++) {
+        table->reusable[i] = i;
+    }
+    table->reusable_count = capacity;
+
+    return table;
+}
+
+void job_table_destroy(job_table_t* table) {
+    if (!table) {
+        return;
+    }
+    free(table->jobs);
+    free(table->generation);
+    free(table->reusable);
+    free(table);
+}
+
+// Take the oldest free/finished slot and give it a fresh job id.
+// Returns NULL when every slot holds a pending or running job.
+scan_job_t* job_table_alloc(job_table_t* table) {
+    if (table->reusable_count == 0) {
+        return NULL;
+    }
+
+    int slot = table->reusable[table->reusable_head];
+    table->reusable_head = (table->reusable_head + 1) % table->capacity;
+    table->reusable_count--;
+
+    scan_job_t* job = &table->jobs[slot];
+    memset(job, 0, sizeof(scan_job_t));
+    job->job_id = (int)(table->generation[slot] * (unsigned int)table->capacity) + slot + 1;
+    job->client_fd = -1;
+    job->status = SCAN_PENDING;
+    job->created_time = time(NULL);
+
+    table->generation[slot]++;
+    return job;
+}
+
+scan_job_t* job_table_lookup(job_table_t* table, int job_id) {
+    if (job_id <= 0) {
+        return NULL;
+    }
+
+    int slot = (job_id - 1) % table->capacity;
+    scan_job_t* job = &table->jobs[slot];
+    return (job->job_id == job_id) ? job : NULL;
+}
+
+// Job has a final result: its slot may be recycled by a later allocation
+// (the result stays available for lookups until then)
+void job_table_finish(job_table_t* table, scan_job_t* job) {
+    int tail = (table->reusable_head + table->reusable_count) % table->capacity;
+    table->reusable[tail] = (int)(job - table->jobs);
+    table->reusable_count++;
+}
+
+int job_table_active(const job_table_t* table) {
+    return table->capacity - table->reusable_count;
+}
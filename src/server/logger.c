@@ -0,0 +1,349 @@
+#include "../../include/logger.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+typedef struct {
+    uint64_t time_ns;       // Orders lines from different threads
+    size_t length;
+    char text[LOG_ENTRY_SIZE];
+} log_entry_t;
+
+// Written by one thread, read by the flusher. Rings are never freed while
+// the logger runs: when a thread exits its ring is handed to the next one.
+typedef struct log_ring {
+    log_entry_t entries[LOG_RING_SIZE];
+    struct log_ring* next;
+    int in_use;
+    size_t head __attribute__((aligned(64)));   // Next slot to fill (owner)
+    size_t tail __attribute__((aligned(64)));   // Next slot to write out (flusher)
+} log_ring_t;
+
+// Flusher's view of one ring during a flush
+typedef struct {
+    log_ring_t* ring;
+    size_t tail;
+    size_t head;
+} ring_cursor_t;
+
+static struct {
+    int running;
+    int fd;
+    int event_fd;
+    pthread_t flusher;
+    pthread_key_t ring_key;
+    log_ring_t* rings;
+    unsigned long dropped;
+} g_logger = { 0, -1, -1, 0, 0, NULL, 0 };
+
+static __thread log_ring_t* t_ring;
+
+// localtime + strftime only once per second per thread
+static __thread time_t t_cached_second;
+static __thread char t_cached_timestamp[32];
+
+static void format_line(log_entry_t* entry, log_level_t level, const char* format, va_list args) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec != t_cached_second || t_cached_timestamp[0] == '\0') {
+        struct tm timeinfo;
+        localtime_r(&now.tv_sec, &timeinfo);
+        strftime(t_cached_timestamp, sizeof(t_cached_timestamp), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        t_cached_second = now.tv_sec;
+    }
+    entry->time_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+
+    int prefix = snprintf(entry->text, sizeof(entry->text), "[%s] [%s] ",
+                          t_cached_timestamp, log_level_to_string(level));
+    // Keep one byte for the newline
+    int message = vsnprintf(entry->text + prefix, sizeof(entry->text) - prefix - 1, format, args);
+    if (message < 0) {
+        message = 0;
+    } else if (prefix + message > (int)sizeof(entry->text) - 2) {
+        message = sizeof(entry->text) - 2 - prefix;
+    }
+
+    entry->text[prefix + message] = '\n';
+    entry->length = prefix + message + 1;
+}
+
+static void format_linef(log_entry_t* entry, log_level_t level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    format_line(entry, level, format, args);
+    va_end(args);
+}
+
+static int writev_all(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static void write_batch(const struct iovec* batch, int count) {
+    struct iovec iov[IOV_MAX];
+
+    memcpy(iov, batch, count * sizeof(struct iovec));
+    writev_all(STDOUT_FILENO, iov, count);
+    if (g_logger.fd != -1) {
+        memcpy(iov, batch, count * sizeof(struct iovec));
+        writev_all(g_logger.fd, iov, count);
+    }
+}
+
+static void wake_flusher(void) {
+    uint64_t one = 1;
+    if (write(g_logger.event_fd, &one, sizeof(one)) == -1) {
+        // Counter saturated: the flusher is awake anyway
+    }
+}
+
+// Ring of a thread that exited, or a new one
+static log_ring_t* claim_ring(void) {
+    log_ring_t* ring;
+
+    for (ring = __atomic_load_n(&g_logger.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        void* memory = NULL;
+        if (posix_memalign(&memory, 64, sizeof(log_ring_t)) != 0) {
+            return NULL;
+        }
+        ring = memory;
+        memset(ring, 0, sizeof(*ring));
+        ring->in_use = 1;
+
+        ring->next = __atomic_load_n(&g_logger.rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_logger.rings, &ring->next, ring, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            // ring->next was refreshed by the failed CAS
+        }
+    }
+
+    pthread_setspecific(g_logger.ring_key, ring);
+    t_ring = ring;
+    return ring;
+}
+
+// pthread key destructor: the flusher still drains what is left
+static void release_ring(void* arg) {
+    log_ring_t* ring = arg;
+    __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// Before logger_init and after logger_shutdown lines are written directly
+static void write_direct(log_level_t level, const char* format, va_list args) {
+    log_entry_t entry;
+    format_line(&entry, level, format, args);
+
+    struct iovec iov;
+    iov.iov_base = entry.text;
+    iov.iov_len = entry.length;
+    write_batch(&iov, 1);
+}
+
+void logger_vwrite(log_level_t level, const char* format, va_list args) {
+    if (!__atomic_load_n(&g_logger.running, __ATOMIC_ACQUIRE)) {
+        write_direct(level, format, args);
+        return;
+    }
+
+    log_ring_t* ring = t_ring ? t_ring : claim_ring();
+    if (!ring) {
+        __atomic_add_fetch(&g_logger.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == LOG_RING_SIZE) {
+        // Full: only warnings and errors are worth waiting for
+        int spins = (level >= LOG_WARNING) ? LOG_BACKPRESSURE_SPINS : 0;
+        wake_flusher();
+        while (spins-- > 0 && head - tail == LOG_RING_SIZE) {
+            sched_yield();
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        }
+        if (head - tail == LOG_RING_SIZE) {
+            __atomic_add_fetch(&g_logger.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    format_line(&ring->entries[head & (LOG_RING_SIZE - 1)], level, format, args);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    // Don't wait for the timer when a burst is filling the ring
+    if (head + 1 - tail == LOG_RING_SIZE / 2) {
+        wake_flusher();
+    }
+}
+
+static log_entry_t* cursor_entry(const ring_cursor_t* cursor) {
+    return &cursor->ring->entries[cursor->tail & (LOG_RING_SIZE - 1)];
+}
+
+static void write_and_release(const struct iovec* batch, int count,
+                              const ring_cursor_t* cursors, size_t num_cursors) {
+    if (count > 0) {
+        write_batch(batch, count);
+    }
+    for (size_t i = 0; i < num_cursors; i++) {
+        __atomic_store_n(&cursors[i].ring->tail, cursors[i].tail, __ATOMIC_RELEASE);
+    }
+}
+
+// Write out everything the rings hold, merged in time order,
+// IOV_MAX lines per writev
+static void flush_rings(void) {
+    static unsigned long reported_drops = 0;
+    static log_entry_t drop_entry;
+    static ring_cursor_t* cursors = NULL;
+    static size_t cursor_capacity = 0;
+
+    struct iovec batch[IOV_MAX];
+    int count = 0;
+
+    unsigned long dropped = __atomic_load_n(&g_logger.dropped, __ATOMIC_RELAXED);
+    if (dropped != reported_drops) {
+        format_linef(&drop_entry, LOG_WARNING, "%lu log messages dropped (ring full)",
+                     dropped - reported_drops);
+        reported_drops = dropped;
+        batch[count].iov_base = drop_entry.text;
+        batch[count].iov_len = drop_entry.length;
+        count++;
+    }
+
+    // Snapshot the rings that have something to write
+    size_t num_cursors = 0;
+    for (log_ring_t* ring = __atomic_load_n(&g_logger.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == ring->tail) continue;
+
+        if (num_cursors == cursor_capacity) {
+            size_t capacity = cursor_capacity ? cursor_capacity * 2 : 16;
+            ring_cursor_t* grown = realloc(cursors, capacity * sizeof(ring_cursor_t));
+            if (!grown) break;  // The rest waits for the next flush
+            cursors = grown;
+            cursor_capacity = capacity;
+        }
+        cursors[num_cursors].ring = ring;
+        cursors[num_cursors].tail = ring->tail;
+        cursors[num_cursors].head = head;
+        num_cursors++;
+    }
+
+    for (;;) {
+        ring_cursor_t* oldest = NULL;
+        for (size_t i = 0; i < num_cursors; i++) {
+            if (cursors[i].tail != cursors[i].head &&
+                (!oldest || cursor_entry(&cursors[i])->time_ns < cursor_entry(oldest)->time_ns)) {
+                oldest = &cursors[i];
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+
+        if (count == IOV_MAX) {
+            write_and_release(batch, count, cursors, num_cursors);
+            count = 0;
+        }
+
+        log_entry_t* entry = cursor_entry(oldest);
+        batch[count].iov_base = entry->text;
+        batch[count].iov_len = entry->length;
+        count++;
+        oldest->tail++;
+    }
+
+    write_and_release(batch, count, cursors, num_cursors);
+}
+
+static void* flusher_thread(void* arg) {
+    (void)arg;
+    struct pollfd pfd;
+    pfd.fd = g_logger.event_fd;
+    pfd.events = POLLIN;
+
+    while (__atomic_load_n(&g_logger.running, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, LOG_FLUSH_INTERVAL_MS) > 0) {
+            uint64_t wakeups;
+            if (read(g_logger.event_fd, &wakeups, sizeof(wakeups)) == -1) {
+                // Nothing to consume
+            }
+        }
+        flush_rings();
+    }
+
+    flush_rings();
+    return NULL;
+}
+
+int logger_init(const char* path) {
+    g_logger.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (g_logger.fd == -1) {
+        perror("open log file");
+        return -1;
+    }
+
+    g_logger.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_logger.event_fd == -1 || pthread_key_create(&g_logger.ring_key, release_ring) != 0) {
+        perror("logger");
+        return -1;
+    }
+
+    // Console output from here on bypasses stdio
+    fflush(stdout);
+
+    __atomic_store_n(&g_logger.running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&g_logger.flusher, NULL, flusher_thread, NULL) != 0) {
+        __atomic_store_n(&g_logger.running, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+    return 0;
+}
+
+// Called once every other thread has stopped logging. The rings stay
+// allocated: a straggler may still hold one, but only writes directly now.
+void logger_shutdown(void) {
+    if (!__atomic_load_n(&g_logger.running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    __atomic_store_n(&g_logger.running, 0, __ATOMIC_RELEASE);
+    wake_flusher();
+    pthread_join(g_logger.flusher, NULL);
+
+    close(g_logger.event_fd);
+    g_logger.event_fd = -1;
+    close(g_logger.fd);
+    g_logger.fd = -1;
+}
+
+unsigned long logger_dropped_count(void) {
+    return __atomic_load_n(&g_logger.dropped, __ATOMIC_RELAXED);
+}
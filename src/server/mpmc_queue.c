@@ -0,0 +1,151 @@
+#include "../../include/mpmc_queue.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+// capacity is rounded up to a power of two
+int mpmc_queue_init(mpmc_queue_t* queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue->cells = calloc(size, sizeof(mpmc_cell_t));
+    if (!queue->cells) {
+        return -1;
+    }
+
+    queue->event_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->event_fd == -1) {
+        free(queue->cells);
+        queue->cells = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->mask = size - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    queue->waiters = 0;
+    return 0;
+}
+
+void mpmc_queue_destroy(mpmc_queue_t* queue) {
+    if (queue->event_fd != -1) {
+        close(queue->event_fd);
+        queue->event_fd = -1;
+    }
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+// Returns 0 on success, -1 if the queue is full
+int mpmc_queue_push(mpmc_queue_t* queue, void* item) {
+    mpmc_cell_t* cell;
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = item;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in mpmc_queue_pop_wait: either the consumer sees
+    // the item on its second try, or we see it waiting and wake it up
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->waiters, __ATOMIC_RELAXED) > 0) {
+        uint64_t one = 1;
+        if (write(queue->event_fd, &one, sizeof(one)) == -1) {
+            // Counter saturated: consumers are awake anyway
+        }
+    }
+    return 0;
+}
+
+// Returns NULL if the queue is empty
+void* mpmc_queue_try_pop(mpmc_queue_t* queue) {
+    mpmc_cell_t* cell;
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    void* item = cell->data;
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// Pop an item, parking on the eventfd while the queue is empty.
+// Returns NULL if nothing arrived within timeout_ms.
+void* mpmc_queue_pop_wait(mpmc_queue_t* queue, int timeout_ms) {
+    // Short bursts usually refill the queue within a few yields,
+    // which is much cheaper than a park/wake round trip
+    for (int spin = 0; spin < MPMC_SPIN_COUNT; spin++) {
+        void* item = mpmc_queue_try_pop(queue);
+        if (item) {
+            return item;
+        }
+        sched_yield();
+    }
+
+    __atomic_add_fetch(&queue->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    void* item = mpmc_queue_try_pop(queue);
+    if (!item) {
+        struct pollfd pfd;
+        pfd.fd = queue->event_fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            uint64_t token;
+            if (read(queue->event_fd, &token, sizeof(token)) == -1) {
+                // Another consumer took the wakeup
+            }
+        }
+        item = mpmc_queue_try_pop(queue);
+    }
+
+    __atomic_sub_fetch(&queue->waiters, 1, __ATOMIC_RELAXED);
+    return item;
+}
+
+// Approximate number of queued items
+size_t mpmc_queue_size(mpmc_queue_t* queue) {
+    size_t head = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    return (tail > head) ? tail - head : 0;
+}
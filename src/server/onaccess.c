@@ -0,0 +1,647 @@
+#include "../../include/onaccess.h"
+#include "../../include/scanner.h"
+#include <sys/fanotify.h>
+
+// An open waiting for its verdict. Referenced by the pending list until
+// it is answered and by the scan queue until its scan is done.
+typedef struct onaccess_request {
+    struct onaccess_request* pending_prev;  // By deadline
+    struct onaccess_request* pending_next;
+    struct onaccess_request* queue_next;
+    int fd;                                 // Event fd, read-only
+    pid_t pid;
+    struct stat st;
+    unsigned long long start_us;
+    unsigned long long deadline_ms;
+    int answered;
+    int refs;
+    char path[MAX_PATH];
+} onaccess_request_t;
+
+// Verdict of an inode, valid while it looks the same
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    unsigned long long signature_version;
+    int verdict;                            // SCAN_RESULT_CLEAN / SCAN_RESULT_INFECTED
+    int in_use;
+} identity_entry_t;
+
+struct onaccess {
+    server_state_t* state;
+    int fanotify_fd;
+    char root[MAX_PATH];
+    size_t root_length;
+    int filter_prefix;                      // root is not the root of its mount
+    onaccess_policy_t policy;
+    int timeout_ms;
+    int running;
+    pid_t pid;
+    pthread_t reader_thread;
+    pthread_t scan_threads[ONACCESS_SCAN_THREADS];
+    int reader_started;
+    int scan_thread_count;
+
+    // Requests: answered, refs, the pending list and the scan queue
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    onaccess_request_t* pending_head;
+    onaccess_request_t* pending_tail;
+    onaccess_request_t* queue_head;
+    onaccess_request_t* queue_tail;
+    int live;                               // Requests not freed yet (atomic)
+
+    pthread_mutex_t cache_lock;
+    identity_entry_t* cache;
+
+    onaccess_stats_t stats[ONACCESS_DECISION_COUNT];  // Atomic counters
+    unsigned long overflows;
+};
+
+static const char* g_decision_names[ONACCESS_DECISION_COUNT] = {
+    "Pass", "Cached", "Verdict", "Scanned", "Error", "Timeout", "Overload"
+};
+
+int onaccess_parse_policy(const char* name, onaccess_policy_t* policy) {
+    if (strcmp(name, "open") == 0) {
+        *policy = ONACCESS_FAIL_OPEN;
+        return 0;
+    }
+    if (strcmp(name, "closed") == 0) {
+        *policy = ONACCESS_FAIL_CLOSED;
+        return 0;
+    }
+    return -1;
+}
+
+// Decisions
+
+static void record_decision(onaccess_t* onaccess, onaccess_decision_t decision, int allow,
+                            unsigned long long start_us) {
+    unsigned long long latency_us = monotonic_us() - start_us;
+    int bucket = 0;
+    while (bucket < ONACCESS_HISTOGRAM_BUCKETS - 1 && latency_us >= (1ULL << bucket)) {
+        bucket++;
+    }
+
+    onaccess_stats_t* stats = &onaccess->stats[decision];
+    __atomic_add_fetch(allow ? &stats->allowed : &stats->denied, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static void respond(onaccess_t* onaccess, int fd, int allow) {
+    struct fanotify_response response = { .fd = fd, .response = allow ? FAN_ALLOW : FAN_DENY };
+    if (write(onaccess->fanotify_fd, &response, sizeof(response)) != sizeof(response)) {
+        log_message(LOG_WARNING, "On-access: failed to answer an open: %s", strerror(errno));
+    }
+}
+
+// Answer at once an event the reader thread decided itself; closes its fd
+static void answer_event(onaccess_t* onaccess, int fd, int allow, onaccess_decision_t decision,
+                         unsigned long long start_us) {
+    respond(onaccess, fd, allow);
+    record_decision(onaccess, decision, allow, start_us);
+    close(fd);
+}
+
+static int fail_policy_allows(const onaccess_t* onaccess) {
+    return onaccess->policy == ONACCESS_FAIL_OPEN;
+}
+
+// Identity cache
+
+static identity_entry_t* identity_slot(onaccess_t* onaccess, dev_t dev, ino_t ino) {
+    unsigned long long key = ((unsigned long long)dev << 32) ^ (unsigned long long)ino;
+    key *= 0x9E3779B97F4A7C15ULL;
+    return &onaccess->cache[key >> 48 & (ONACCESS_CACHE_SLOTS - 1)];
+}
+
+static int same_time(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static int identity_lookup(onaccess_t* onaccess, const struct stat* st, unsigned long long signature_version,
+                           int* verdict) {
+    pthread_mutex_lock(&onaccess->cache_lock);
+    identity_entry_t* entry = identity_slot(onaccess, st->st_dev, st->st_ino);
+    int hit = entry->in_use && entry->dev == st->st_dev && entry->ino == st->st_ino &&
+              entry->size == st->st_size && same_time(&entry->mtime, &st->st_mtim) &&
+              same_time(&entry->ctime, &st->st_ctim) && entry->signature_version == signature_version;
+    if (hit) {
+        *verdict = entry->verdict;
+    }
+    pthread_mutex_unlock(&onaccess->cache_lock);
+    return hit;
+}
+
+// st was taken before the scan: if the file changed meanwhile, the entry
+// does not match it
+static void identity_store(onaccess_t* onaccess, const struct stat* st, unsigned long long signature_version,
+                           int verdict) {
+    pthread_mutex_lock(&onaccess->cache_lock);
+    identity_entry_t* entry = identity_slot(onaccess, st->st_dev, st->st_ino);
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ctime = st->st_ctim;
+    entry->signature_version = signature_version;
+    entry->verdict = verdict;
+    entry->in_use = 1;
+    pthread_mutex_unlock(&onaccess->cache_lock);
+}
+
+// A writer closed the file: whatever it wrote is scanned on the next open,
+// even if the timestamps did not move
+static void identity_forget(onaccess_t* onaccess, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return;
+    }
+    pthread_mutex_lock(&onaccess->cache_lock);
+    identity_entry_t* entry = identity_slot(onaccess, st.st_dev, st.st_ino);
+    if (entry->dev == st.st_dev && entry->ino == st.st_ino) {
+        entry->in_use = 0;
+    }
+    pthread_mutex_unlock(&onaccess->cache_lock);
+}
+
+static void identity_clear(onaccess_t* onaccess) {
+    pthread_mutex_lock(&onaccess->cache_lock);
+    memset(onaccess->cache, 0, ONACCESS_CACHE_SLOTS * sizeof(identity_entry_t));
+    pthread_mutex_unlock(&onaccess->cache_lock);
+}
+
+// Requests
+
+static void free_request(onaccess_t* onaccess, onaccess_request_t* request) {
+    close(request->fd);
+    free(request);
+    __atomic_sub_fetch(&onaccess->live, 1, __ATOMIC_RELAXED);
+}
+
+// Called with lock held: answer the open, take it off the pending list
+// and drop the list's reference
+static void answer_locked(onaccess_t* onaccess, onaccess_request_t* request, int allow) {
+    request->answered = 1;
+    respond(onaccess, request->fd, allow);
+
+    if (request->pending_prev) request->pending_prev->pending_next = request->pending_next;
+    else onaccess->pending_head = request->pending_next;
+    if (request->pending_next) request->pending_next->pending_prev = request->pending_prev;
+    else onaccess->pending_tail = request->pending_prev;
+    request->pending_prev = request->pending_next = NULL;
+    request->refs--;
+}
+
+static void fd_path(int fd, char* path, size_t path_size) {
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t length = readlink(link, path, path_size - 1);
+    if (length < 0) {
+        length = snprintf(path, path_size, "fd %d", fd);
+    }
+    path[length] = '\0';
+}
+
+static int under_root(const onaccess_t* onaccess, const char* path) {
+    return strncmp(path, onaccess->root, onaccess->root_length) == 0 &&
+           (path[onaccess->root_length] == '/' || path[onaccess->root_length] == '\0');
+}
+
+// FAN_OPEN_PERM: answer now if possible, otherwise queue it for a scan
+static void handle_open(onaccess_t* onaccess, int fd, pid_t pid) {
+    unsigned long long start_us = monotonic_us();
+    struct stat st;
+
+    // The server's own opens (the scanners read through the event fds,
+    // which raise no events, but the drop folder may live here)
+    if (pid == onaccess->pid || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        answer_event(onaccess, fd, 1, ONACCESS_PASS, start_us);
+        return;
+    }
+
+    char path[MAX_PATH];
+    path[0] = '\0';
+    if (onaccess->filter_prefix) {
+        fd_path(fd, path, sizeof(path));
+        if (!under_root(onaccess, path)) {
+            answer_event(onaccess, fd, 1, ONACCESS_PASS, start_us);
+            return;
+        }
+    }
+
+    int verdict;
+    if (identity_lookup(onaccess, &st, scanner_signature_version(), &verdict)) {
+        int allow = (verdict != SCAN_RESULT_INFECTED);
+        if (!allow) {
+            if (!path[0]) fd_path(fd, path, sizeof(path));
+            log_message(LOG_WARNING, "On-access: denied open of infected %s by pid %d", path, (int)pid);
+        }
+        answer_event(onaccess, fd, allow, ONACCESS_CACHED, start_us);
+        return;
+    }
+
+    onaccess_request_t* request = NULL;
+    if (__atomic_load_n(&onaccess->live, __ATOMIC_RELAXED) < ONACCESS_MAX_PENDING) {
+        request = malloc(sizeof(onaccess_request_t));
+    }
+    if (!request) {
+        int allow = fail_policy_allows(onaccess);
+        log_message(LOG_DEBUG, "On-access: %d opens waiting, open by pid %d %s without a scan",
+                   ONACCESS_MAX_PENDING, (int)pid, allow ? "allowed" : "denied");
+        answer_event(onaccess, fd, allow, ONACCESS_OVERLOAD, start_us);
+        return;
+    }
+
+    if (!path[0]) fd_path(fd, path, sizeof(path));
+    request->pending_next = request->queue_next = NULL;
+    request->fd = fd;
+    request->pid = pid;
+    request->st = st;
+    request->start_us = start_us;
+    request->deadline_ms = start_us / 1000 + (unsigned long long)onaccess->timeout_ms;
+    request->answered = 0;
+    request->refs = 2;
+    snprintf(request->path, sizeof(request->path), "%s", path);
+    __atomic_add_fetch(&onaccess->live, 1, __ATOMIC_RELAXED);
+
+    // Deadlines are start + the same timeout: appending keeps the list sorted
+    pthread_mutex_lock(&onaccess->lock);
+    request->pending_prev = onaccess->pending_tail;
+    if (onaccess->pending_tail) onaccess->pending_tail->pending_next = request;
+    else onaccess->pending_head = request;
+    onaccess->pending_tail = request;
+    if (onaccess->queue_tail) onaccess->queue_tail->queue_next = request;
+    else onaccess->queue_head = request;
+    onaccess->queue_tail = request;
+    pthread_cond_signal(&onaccess->work);
+    pthread_mutex_unlock(&onaccess->lock);
+}
+
+// Reader thread
+
+static void read_events(onaccess_t* onaccess, char* buffer, size_t buffer_size) {
+    for (;;) {
+        ssize_t length = read(onaccess->fanotify_fd, buffer, buffer_size);
+        if (length == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) {
+                log_message(LOG_ERROR, "On-access: failed to read fanotify events: %s", strerror(errno));
+            }
+            return;
+        }
+
+        struct fanotify_event_metadata* event = (struct fanotify_event_metadata*)buffer;
+        for (; FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length)) {
+            if (event->vers != FANOTIFY_METADATA_VERSION) {
+                log_message(LOG_ERROR, "On-access: unsupported fanotify metadata version %d", event->vers);
+                return;
+            }
+            if (event->mask & FAN_Q_OVERFLOW) {
+                // Lost FAN_CLOSE_WRITE events: no cached identity can be trusted
+                onaccess->overflows++;
+                log_message(LOG_WARNING, "On-access: fanotify queue overflow, identity cache cleared");
+                identity_clear(onaccess);
+                continue;
+            }
+            if (event->fd < 0) {
+                continue;
+            }
+            if (event->mask & FAN_OPEN_PERM) {
+                handle_open(onaccess, event->fd, event->pid);
+            } else {
+                if (event->mask & FAN_CLOSE_WRITE) {
+                    identity_forget(onaccess, event->fd);
+                }
+                close(event->fd);
+            }
+        }
+    }
+}
+
+// Opens past their deadline get the fail policy answer; their scans go on
+static void expire_requests(onaccess_t* onaccess) {
+    unsigned long long now_ms = monotonic_us() / 1000;
+    int allow = fail_policy_allows(onaccess);
+
+    for (;;) {
+        pthread_mutex_lock(&onaccess->lock);
+        onaccess_request_t* request = onaccess->pending_head;
+        if (!request || request->deadline_ms > now_ms) {
+            pthread_mutex_unlock(&onaccess->lock);
+            return;
+        }
+        answer_locked(onaccess, request, allow);
+        record_decision(onaccess, ONACCESS_TIMEOUT, allow, request->start_us);
+        log_message(allow ? LOG_DEBUG : LOG_WARNING, "On-access: no verdict for %s within %d ms, open by pid %d %s",
+                   request->path, onaccess->timeout_ms, (int)request->pid, allow ? "allowed" : "denied");
+        // Still referenced by its scan otherwise, which may free it once unlocked
+        int last = (request->refs == 0);
+        pthread_mutex_unlock(&onaccess->lock);
+
+        if (last) {
+            free_request(onaccess, request);
+        }
+    }
+}
+
+static int pending_timeout(onaccess_t* onaccess) {
+    int timeout_ms = 1000;
+    pthread_mutex_lock(&onaccess->lock);
+    if (onaccess->pending_head) {
+        unsigned long long now_ms = monotonic_us() / 1000;
+        unsigned long long deadline_ms = onaccess->pending_head->deadline_ms;
+        timeout_ms = deadline_ms > now_ms ? (int)(deadline_ms - now_ms) : 0;
+    }
+    pthread_mutex_unlock(&onaccess->lock);
+    return timeout_ms;
+}
+
+static void* reader_thread_handler(void* arg) {
+    onaccess_t* onaccess = arg;
+    char* buffer = malloc(ONACCESS_EVENT_BUFFER);
+    if (!buffer) {
+        log_message(LOG_ERROR, "On-access: out of memory for the event buffer");
+        return NULL;
+    }
+
+    while (__atomic_load_n(&onaccess->running, __ATOMIC_RELAXED)) {
+        struct pollfd pfd = { .fd = onaccess->fanotify_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, pending_timeout(onaccess));
+        if (ready == -1 && errno != EINTR) {
+            log_message(LOG_ERROR, "On-access: poll failed: %s", strerror(errno));
+            break;
+        }
+        if (ready > 0) {
+            read_events(onaccess, buffer, ONACCESS_EVENT_BUFFER);
+        }
+        expire_requests(onaccess);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+// Scan threads
+
+static void scan_request(onaccess_t* onaccess, onaccess_request_t* request) {
+    unsigned long long signature_version = scanner_signature_version();
+    unsigned char hash[CONTENT_HASH_SIZE];
+    char result[MAX_VIRUS_NAME * 2];
+    int verdict;
+    onaccess_decision_t decision;
+
+    int has_hash = (sha256_fd(request->fd, hash) == 0);
+    if (has_hash && lookup_verdict(onaccess->state, hash, signature_version, &verdict, result, sizeof(result))) {
+        decision = ONACCESS_VERDICT;
+    } else {
+        verdict = scanner_scan_range(request->fd, 0, (size_t)request->st.st_size, SCAN_PARSERS_ALL,
+                                     result, sizeof(result));
+        decision = (verdict == SCAN_RESULT_ERROR) ? ONACCESS_ERROR : ONACCESS_SCANNED;
+        if (has_hash && verdict != SCAN_RESULT_ERROR) {
+            store_verdict(onaccess->state, hash, signature_version, verdict, result);
+        }
+    }
+    if (verdict != SCAN_RESULT_ERROR) {
+        identity_store(onaccess, &request->st, signature_version, verdict);
+    }
+
+    int allow = (verdict == SCAN_RESULT_ERROR) ? fail_policy_allows(onaccess) : (verdict == SCAN_RESULT_CLEAN);
+    pthread_mutex_lock(&onaccess->lock);
+    int in_time = !request->answered;
+    if (in_time) {
+        answer_locked(onaccess, request, allow);
+    }
+    pthread_mutex_unlock(&onaccess->lock);
+
+    if (in_time) {
+        record_decision(onaccess, decision, allow, request->start_us);
+    }
+    if (verdict == SCAN_RESULT_INFECTED) {
+        log_message(LOG_WARNING, "On-access: %s opened by pid %d is infected (%s)%s", request->path,
+                   (int)request->pid, result, in_time ? ", open denied" : ", verdict came too late");
+    } else if (verdict == SCAN_RESULT_ERROR) {
+        log_message(LOG_WARNING, "On-access: failed to scan %s: %s", request->path, result);
+    }
+}
+
+static void* scan_thread_handler(void* arg) {
+    onaccess_t* onaccess = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&onaccess->lock);
+        while (onaccess->running && !onaccess->queue_head) {
+            pthread_cond_wait(&onaccess->work, &onaccess->lock);
+        }
+        if (!onaccess->running) {
+            pthread_mutex_unlock(&onaccess->lock);
+            break;
+        }
+        onaccess_request_t* request = onaccess->queue_head;
+        onaccess->queue_head = request->queue_next;
+        if (!onaccess->queue_head) onaccess->queue_tail = NULL;
+        pthread_mutex_unlock(&onaccess->lock);
+
+        scan_request(onaccess, request);
+
+        pthread_mutex_lock(&onaccess->lock);
+        int last = (--request->refs == 0);
+        pthread_mutex_unlock(&onaccess->lock);
+        if (last) {
+            free_request(onaccess, request);
+        }
+    }
+    return NULL;
+}
+
+// Lifetime
+
+static void destroy_onaccess(onaccess_t* onaccess) {
+    // Opens still waiting are let through: the server stops gating them
+    onaccess_request_t* request = onaccess->queue_head;
+    while (request) {
+        onaccess_request_t* next = request->queue_next;
+        if (--request->refs == 0) {
+            free_request(onaccess, request);
+        }
+        request = next;
+    }
+    while (onaccess->pending_head) {
+        request = onaccess->pending_head;
+        answer_locked(onaccess, request, 1);
+        if (request->refs == 0) {
+            free_request(onaccess, request);
+        }
+    }
+
+    if (onaccess->fanotify_fd != -1) {
+        close(onaccess->fanotify_fd);
+    }
+    pthread_mutex_destroy(&onaccess->lock);
+    pthread_cond_destroy(&onaccess->work);
+    pthread_mutex_destroy(&onaccess->cache_lock);
+    free(onaccess->cache);
+    free(onaccess);
+}
+
+// Whether path is the root of its mount (its parent is on another device,
+// or is itself, for "/")
+static int is_mount_root(const char* path) {
+    char parent[MAX_PATH];
+    struct stat st, parent_st;
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    if (stat(path, &st) == -1 || stat(parent, &parent_st) == -1) {
+        return 0;
+    }
+    return st.st_dev != parent_st.st_dev || st.st_ino == parent_st.st_ino;
+}
+
+onaccess_t* onaccess_start(server_state_t* state, const char* path, onaccess_policy_t policy, int timeout_ms) {
+    onaccess_t* onaccess = calloc(1, sizeof(onaccess_t));
+    if (!onaccess) {
+        return NULL;
+    }
+    onaccess->cache = calloc(ONACCESS_CACHE_SLOTS, sizeof(identity_entry_t));
+    pthread_mutex_init(&onaccess->lock, NULL);
+    pthread_cond_init(&onaccess->work, NULL);
+    pthread_mutex_init(&onaccess->cache_lock, NULL);
+    onaccess->fanotify_fd = -1;
+    onaccess->state = state;
+    onaccess->policy = policy;
+    onaccess->timeout_ms = timeout_ms;
+    onaccess->pid = getpid();
+    if (!onaccess->cache) {
+        destroy_onaccess(onaccess);
+        return NULL;
+    }
+
+    struct stat st;
+    if (!realpath(path, onaccess->root) || stat(onaccess->root, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        log_message(LOG_ERROR, "On-access: %s is not a directory", path);
+        destroy_onaccess(onaccess);
+        return NULL;
+    }
+    onaccess->root_length = strcmp(onaccess->root, "/") == 0 ? 0 : strlen(onaccess->root);
+    onaccess->filter_prefix = !is_mount_root(onaccess->root);
+
+    onaccess->fanotify_fd = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC | FAN_NONBLOCK,
+                                          O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (onaccess->fanotify_fd == -1) {
+        log_message(LOG_ERROR, "On-access: fanotify_init failed: %s%s", strerror(errno),
+                   errno == EPERM ? " (needs CAP_SYS_ADMIN)" : "");
+        destroy_onaccess(onaccess);
+        return NULL;
+    }
+
+    // fanotify watches whole mounts; opens outside root are let through
+    if (fanotify_mark(onaccess->fanotify_fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN_PERM | FAN_CLOSE_WRITE,
+                      AT_FDCWD, onaccess->root) == -1) {
+        log_message(LOG_ERROR, "On-access: fanotify_mark on %s failed: %s", onaccess->root, strerror(errno));
+        destroy_onaccess(onaccess);
+        return NULL;
+    }
+
+    onaccess->running = 1;
+    for (int i = 0; i < ONACCESS_SCAN_THREADS; i++) {
+        if (pthread_create(&onaccess->scan_threads[i], NULL, scan_thread_handler, onaccess) != 0) {
+            log_message(LOG_ERROR, "On-access: failed to create scan thread %d", i);
+            onaccess_stop(onaccess);
+            return NULL;
+        }
+        onaccess->scan_thread_count++;
+    }
+    if (pthread_create(&onaccess->reader_thread, NULL, reader_thread_handler, onaccess) != 0) {
+        log_message(LOG_ERROR, "On-access: failed to create reader thread");
+        onaccess_stop(onaccess);
+        return NULL;
+    }
+    onaccess->reader_started = 1;
+
+    log_message(LOG_INFO, "On-access scanning of %s%s: fail-%s, %d ms timeout", onaccess->root,
+               onaccess->filter_prefix ? "" : " (whole mount)",
+               policy == ONACCESS_FAIL_OPEN ? "open" : "closed", timeout_ms);
+    return onaccess;
+}
+
+void onaccess_stop(onaccess_t* onaccess) {
+    if (!onaccess) {
+        return;
+    }
+
+    pthread_mutex_lock(&onaccess->lock);
+    __atomic_store_n(&onaccess->running, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&onaccess->work);
+    pthread_mutex_unlock(&onaccess->lock);
+
+    if (onaccess->reader_started) {
+        pthread_join(onaccess->reader_thread, NULL);
+    }
+    for (int i = 0; i < onaccess->scan_thread_count; i++) {
+        pthread_join(onaccess->scan_threads[i], NULL);
+    }
+
+    char stats[MAX_MESSAGE];
+    onaccess_format_stats(onaccess, stats, sizeof(stats));
+    log_message(LOG_INFO, "On-access: %s", stats);
+    destroy_onaccess(onaccess);
+}
+
+// Statistics
+
+void onaccess_get_stats(onaccess_t* onaccess, onaccess_stats_t stats[ONACCESS_DECISION_COUNT]) {
+    for (int d = 0; d < ONACCESS_DECISION_COUNT; d++) {
+        stats[d].allowed = __atomic_load_n(&onaccess->stats[d].allowed, __ATOMIC_RELAXED);
+        stats[d].denied = __atomic_load_n(&onaccess->stats[d].denied, __ATOMIC_RELAXED);
+        for (int b = 0; b < ONACCESS_HISTOGRAM_BUCKETS; b++) {
+            stats[d].histogram[b] = __atomic_load_n(&onaccess->stats[d].histogram[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Upper bound of the bucket holding the given fraction of the decisions
+static void format_percentile(const onaccess_stats_t* stats, unsigned long total, double fraction,
+                              char* buffer, size_t buffer_size) {
+    unsigned long rank = (unsigned long)(fraction * (double)total);
+    if (rank < 1) rank = 1;
+    unsigned long seen = 0;
+    int bucket = 0;
+    for (; bucket < ONACCESS_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += stats->histogram[bucket];
+        if (seen >= rank) break;
+    }
+
+    unsigned long long bound_us = 1ULL << bucket;
+    const char* op = (bucket == ONACCESS_HISTOGRAM_BUCKETS - 1) ? ">=" : "<";
+    if (bucket == ONACCESS_HISTOGRAM_BUCKETS - 1) bound_us >>= 1;
+    if (bound_us < 1000) {
+        snprintf(buffer, buffer_size, "%s %llu us", op, bound_us);
+    } else {
+        snprintf(buffer, buffer_size, "%s %.1f ms", op, (double)bound_us / 1000.0);
+    }
+}
+
+void onaccess_format_stats(onaccess_t* onaccess, char* buffer, size_t buffer_size) {
+    onaccess_stats_t stats[ONACCESS_DECISION_COUNT];
+    onaccess_get_stats(onaccess, stats);
+
+    size_t length = snprintf(buffer, buffer_size, "%s, fail-%s, timeout %d ms, waiting: %d, overflows: %lu",
+                             onaccess->root, onaccess->policy == ONACCESS_FAIL_OPEN ? "open" : "closed",
+                             onaccess->timeout_ms, __atomic_load_n(&onaccess->live, __ATOMIC_RELAXED),
+                             onaccess->overflows);
+    for (int d = 0; d < ONACCESS_DECISION_COUNT && length < buffer_size; d++) {
+        unsigned long total = stats[d].allowed + stats[d].denied;
+        if (total == 0) {
+            continue;
+        }
+        char p50[32], p99[32];
+        format_percentile(&stats[d], total, 0.50, p50, sizeof(p50));
+        format_percentile(&stats[d], total, 0.99, p99, sizeof(p99));
+        length += snprintf(buffer + length, buffer_size - length,
+                           " | %s: %lu allowed, %lu denied, p50 %s, p99 %s",
+                           g_decision_names[d], stats[d].allowed, stats[d].denied, p50, p99);
+    }
+}
@@ -0,0 +1,785 @@
+#include "../../include/common.h"
+#include "../../include/pattern_engine.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATTERN_KERNEL_X86 1
+#endif
+
+// Transition targets carry this bit when the target state completes a
+// pattern, so the scan loop tests the state it already holds
+#define MATCH_FLAG 0x80000000u
+#define STATE_MASK 0x7FFFFFFFu
+#define MAX_STATES (STATE_MASK - 1)
+#define SPARSE_LINEAR_EDGES 8               // Larger edge sets are binary searched
+#define QUAD_BYTES 4                        // Patterns this long are also tested on a 4-byte hash
+#define ANCHOR_DEPTH (QUAD_BYTES - 1)       // States this shallow go back to the prefilter
+#define QUAD_BITS_PER_PATTERN 32
+#define QUAD_MIN_BITS 16                    // log2 of the 4-byte hash bitmap size, 8 KB..
+#define QUAD_MAX_BITS 24                    // ..2 MB
+
+typedef struct {
+    uint32_t fail;
+    uint32_t edges;                     // First edge in labels / targets
+    uint32_t match;                     // First pattern ending here or on the fail chain
+    uint32_t count;                     // Edges
+} node_t;
+
+// Byte set for the SIMD test: bit (h & 7) of low[h >= 8][l] is set when
+// byte h * 16 + l is in the set
+typedef struct {
+    unsigned char low[2][16];
+    int size;
+} byte_set_t;
+
+typedef size_t (*skip_fn)(const pattern_engine_t* engine, const unsigned char* data, size_t position,
+                          size_t length);
+
+struct pattern_engine {
+    size_t state_count;
+    size_t dense_count;
+    uint32_t depth_end[ANCHOR_DEPTH + 1];   // Last state at each depth (BFS order)
+    uint32_t* dense;                    // dense_count rows of 256 targets
+    node_t* nodes;                      // Every state (dense ones use match only)
+    unsigned char* labels;              // Edges of sparse states, sorted per state
+    uint32_t* targets;
+
+    uint64_t pairs[65536 / 64];         // First two bytes of some pattern
+    uint64_t short_pairs[65536 / 64];   // .. of some pattern shorter than QUAD_BYTES
+    uint64_t* quads;                    // Hashed first four bytes of the others
+    int quad_shift;
+    byte_set_t first;                   // First / second bytes of the patterns
+    byte_set_t second;
+    int use_simd;                       // The byte sets skip enough to be worth testing
+
+    size_t pattern_count;
+    uint32_t* name_offsets;
+    char* names;
+    size_t names_size;
+    uint64_t version;
+};
+
+// Build-time trie
+
+typedef struct {
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t fail;
+    uint32_t match;
+    unsigned char byte;
+} trie_node_t;
+
+// Child lookup: root_children, and an open-addressing table keyed by
+// (parent, byte) below the root (sibling lists are only walked in order)
+typedef struct {
+    uint64_t key;                       // parent << 8 | byte, plus one (0 is free)
+    uint32_t child;
+} child_slot_t;
+
+typedef struct {
+    trie_node_t* nodes;
+    size_t count;
+    size_t capacity;
+    uint32_t root_children[256];
+    child_slot_t* slots;
+    size_t slot_mask;
+} trie_t;
+
+static size_t child_slot(const trie_t* trie, uint64_t key) {
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 20) & trie->slot_mask;
+    while (trie->slots[slot].key && trie->slots[slot].key != key) {
+        slot = (slot + 1) & trie->slot_mask;
+    }
+    return slot;
+}
+
+static uint32_t trie_child(const trie_t* trie, uint32_t node, unsigned char byte) {
+    if (node == 0) {
+        return trie->root_children[byte];
+    }
+    return trie->slots[child_slot(trie, ((uint64_t)node << 8 | byte) + 1)].child;
+}
+
+// Keep the table at most half full
+static int grow_slots(trie_t* trie) {
+    size_t capacity = (trie->slot_mask + 1) * 2;
+    child_slot_t* old = trie->slots;
+    size_t old_capacity = trie->slot_mask + 1;
+    trie->slots = calloc(capacity, sizeof(child_slot_t));
+    if (!trie->slots) {
+        trie->slots = old;
+        return -1;
+    }
+    trie->slot_mask = capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key) {
+            trie->slots[child_slot(trie, old[i].key)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static uint32_t trie_add_child(trie_t* trie, uint32_t node, unsigned char byte) {
+    if (trie->count == trie->capacity) {
+        size_t capacity = trie->capacity * 2;
+        if (capacity > MAX_STATES) {
+            return 0;
+        }
+        trie_node_t* nodes = realloc(trie->nodes, capacity * sizeof(trie_node_t));
+        if (!nodes) {
+            return 0;
+        }
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+    if (node != 0 && trie->count * 2 > trie->slot_mask && grow_slots(trie) != 0) {
+        return 0;
+    }
+    uint32_t child = (uint32_t)trie->count++;
+    trie_node_t* entry = &trie->nodes[child];
+    entry->first_child = 0;
+    entry->fail = 0;
+    entry->match = PATTERN_NO_MATCH;
+    entry->byte = byte;
+    if (node == 0) {
+        entry->next_sibling = 0;
+        trie->root_children[byte] = child;
+    } else {
+        entry->next_sibling = trie->nodes[node].first_child;
+        trie->nodes[node].first_child = child;
+        uint64_t key = ((uint64_t)node << 8 | byte) + 1;
+        child_slot_t* slot = &trie->slots[child_slot(trie, key)];
+        slot->key = key;
+        slot->child = child;
+    }
+    return child;
+}
+
+static void byte_set_add(byte_set_t* set, unsigned char byte) {
+    unsigned char* slot = &set->low[byte >> 7][byte & 15];
+    unsigned char bit = (unsigned char)(1u << ((byte >> 4) & 7));
+    if (!(*slot & bit)) {
+        *slot |= bit;
+        set->size++;
+    }
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline uint32_t quad_hash(const pattern_engine_t* engine, const unsigned char* bytes) {
+    uint32_t quad;
+    memcpy(&quad, bytes, sizeof(quad));
+    return (quad * 0x9E3779B1u) >> engine->quad_shift;
+}
+
+static int compare_edges(const void* a, const void* b) {
+    return (int)((const trie_node_t* const*)a)[0]->byte - (int)((const trie_node_t* const*)b)[0]->byte;
+}
+
+static void link_child(trie_t* trie, uint32_t node, uint32_t child) {
+    if (node != 0) {
+        unsigned char byte = trie->nodes[child].byte;
+        uint32_t fail = trie->nodes[node].fail;
+        while (fail != 0 && !trie_child(trie, fail, byte)) {
+            fail = trie->nodes[fail].fail;
+        }
+        trie->nodes[child].fail = trie_child(trie, fail, byte);
+    }
+    // A pattern ending on the fail chain also ends here
+    if (trie->nodes[child].match == PATTERN_NO_MATCH) {
+        trie->nodes[child].match = trie->nodes[trie->nodes[child].fail].match;
+    }
+}
+
+// Fail links in BFS order; order gets the states in that order
+static void link_failures(trie_t* trie, uint32_t* order) {
+    size_t head = 0;
+    size_t tail = 0;
+    order[tail++] = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        if (trie->root_children[byte]) {
+            order[tail++] = trie->root_children[byte];
+            link_child(trie, 0, trie->root_children[byte]);
+        }
+    }
+    head = 1;
+    while (head < tail) {
+        uint32_t node = order[head++];
+        for (uint32_t child = trie->nodes[node].first_child; child; child = trie->nodes[child].next_sibling) {
+            order[tail++] = child;
+            link_child(trie, node, child);
+        }
+    }
+}
+
+// Lay the trie out as the scanning automaton
+static int build_automaton(pattern_engine_t* engine, trie_t* trie, const uint32_t* order) {
+    size_t count = trie->count;
+    uint32_t* renumber = malloc(count * sizeof(uint32_t));
+    trie_node_t** children = malloc(256 * sizeof(trie_node_t*));
+    unsigned char* depths = malloc(count);  // Patterns are at most 255 bytes
+    engine->state_count = count;
+    engine->dense_count = count < PATTERN_DENSE_STATES ? count : PATTERN_DENSE_STATES;
+    engine->dense = malloc(engine->dense_count * 256 * sizeof(uint32_t));
+    engine->nodes = calloc(count, sizeof(node_t));
+    engine->labels = malloc(count);
+    engine->targets = malloc(count * sizeof(uint32_t));
+    if (!renumber || !children || !depths || !engine->dense || !engine->nodes || !engine->labels || !engine->targets) {
+        free(renumber);
+        free(children);
+        free(depths);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        renumber[order[i]] = (uint32_t)i;
+    }
+
+    memset(depths, 0, count);
+
+    uint32_t edges = 0;
+    for (size_t i = 0; i < count; i++) {
+        const trie_node_t* source = &trie->nodes[order[i]];
+        node_t* node = &engine->nodes[i];
+        node->fail = renumber[source->fail];
+        node->match = source->match;
+        node->edges = edges;
+
+        size_t child_count = 0;
+        if (order[i] == 0) {
+            for (int byte = 0; byte < 256; byte++) {
+                if (trie->root_children[byte]) children[child_count++] = &trie->nodes[trie->root_children[byte]];
+            }
+        } else {
+            for (uint32_t child = source->first_child; child; child = trie->nodes[child].next_sibling) {
+                children[child_count++] = &trie->nodes[child];
+            }
+            qsort(children, child_count, sizeof(children[0]), compare_edges);
+        }
+        for (size_t c = 0; c < child_count; c++) {
+            uint32_t target = renumber[children[c] - trie->nodes];
+            engine->labels[edges] = children[c]->byte;
+            engine->targets[edges] = target | (children[c]->match != PATTERN_NO_MATCH ? MATCH_FLAG : 0);
+            depths[target] = (unsigned char)(depths[i] + 1);
+            edges++;
+        }
+        node->count = (uint32_t)child_count;
+
+        // BFS order is depth order, so each depth ends at a state number
+        for (int d = depths[i]; d <= ANCHOR_DEPTH; d++) {
+            engine->depth_end[d] = (uint32_t)i;
+        }
+
+        // Full row: the edge if there is one, otherwise the row of the
+        // fail state (shallower, so numbered and filled before this one)
+        if (i < engine->dense_count) {
+            uint32_t* row = &engine->dense[i * 256];
+            if (i == 0) {
+                for (int byte = 0; byte < 256; byte++) row[byte] = 0;
+            } else {
+                memcpy(row, &engine->dense[(size_t)node->fail * 256], 256 * sizeof(uint32_t));
+            }
+            for (uint32_t e = node->edges; e < node->edges + node->count; e++) {
+                row[engine->labels[e]] = engine->targets[e];
+            }
+        }
+    }
+    free(renumber);
+    free(children);
+    free(depths);
+    return 0;
+}
+
+pattern_engine_t* pattern_engine_compile(const pattern_t* patterns, size_t count, char* error, size_t error_size) {
+    pattern_engine_t* engine = calloc(1, sizeof(pattern_engine_t));
+    trie_t trie;
+    memset(&trie, 0, sizeof(trie));
+    trie.capacity = 1024;
+    trie.nodes = malloc(trie.capacity * sizeof(trie_node_t));
+    trie.slot_mask = 2 * trie.capacity - 1;
+    trie.slots = calloc(trie.slot_mask + 1, sizeof(child_slot_t));
+    uint32_t* order = NULL;
+    int quad_bits = QUAD_MIN_BITS;
+    while (quad_bits < QUAD_MAX_BITS && ((size_t)1 << quad_bits) < count * QUAD_BITS_PER_PATTERN) {
+        quad_bits++;
+    }
+    if (engine) {
+        engine->quad_shift = 32 - quad_bits;
+        engine->quads = calloc(((size_t)1 << quad_bits) / 64, sizeof(uint64_t));
+    }
+    if (!engine || !trie.nodes || !trie.slots || !engine->quads) {
+        snprintf(error, error_size, "out of memory");
+        goto fail;
+    }
+    trie.count = 1;
+    memset(&trie.nodes[0], 0, sizeof(trie_node_t));
+    trie.nodes[0].match = PATTERN_NO_MATCH;
+
+    engine->version = 0xcbf29ce484222325ULL;
+    for (size_t p = 0; p < count; p++) {
+        const pattern_t* pattern = &patterns[p];
+        if (pattern->length < PATTERN_MIN_LENGTH || pattern->length > PATTERN_MAX_LENGTH) {
+            snprintf(error, error_size, "pattern %s: length %zu outside %d-%d bytes", pattern->name,
+                     pattern->length, PATTERN_MIN_LENGTH, PATTERN_MAX_LENGTH);
+            goto fail;
+        }
+        uint32_t node = 0;
+        for (size_t i = 0; i < pattern->length; i++) {
+            uint32_t child = trie_child(&trie, node, pattern->bytes[i]);
+            if (!child && !(child = trie_add_child(&trie, node, pattern->bytes[i]))) {
+                snprintf(error, error_size, "out of memory at pattern %zu", p);
+                goto fail;
+            }
+            node = child;
+        }
+        if (trie.nodes[node].match == PATTERN_NO_MATCH) {
+            trie.nodes[node].match = (uint32_t)p;  // A duplicate reports the first name
+        }
+
+        unsigned int pair = pattern->bytes[0] | (unsigned int)pattern->bytes[1] << 8;
+        engine->pairs[pair / 64] |= 1ULL << (pair % 64);
+        if (pattern->length < QUAD_BYTES) {
+            engine->short_pairs[pair / 64] |= 1ULL << (pair % 64);
+        } else {
+            uint32_t quad = quad_hash(engine, pattern->bytes);
+            engine->quads[quad / 64] |= 1ULL << (quad % 64);
+        }
+        byte_set_add(&engine->first, pattern->bytes[0]);
+        byte_set_add(&engine->second, pattern->bytes[1]);
+
+        size_t name_length = strlen(pattern->name) + 1;
+        engine->names_size += name_length;
+        engine->version = fnv1a(engine->version, pattern->bytes, pattern->length);
+        engine->version = fnv1a(engine->version, pattern->name, name_length);
+    }
+
+    order = malloc(trie.count * sizeof(uint32_t));
+    if (!order) {
+        snprintf(error, error_size, "out of memory");
+        goto fail;
+    }
+    link_failures(&trie, order);
+    if (build_automaton(engine, &trie, order) != 0) {
+        snprintf(error, error_size, "out of memory for %zu states", trie.count);
+        goto fail;
+    }
+
+    engine->pattern_count = count;
+    engine->name_offsets = malloc((count ? count : 1) * sizeof(uint32_t));
+    engine->names = malloc(engine->names_size ? engine->names_size : 1);
+    if (!engine->name_offsets || !engine->names) {
+        snprintf(error, error_size, "out of memory");
+        goto fail;
+    }
+    size_t offset = 0;
+    for (size_t p = 0; p < count; p++) {
+        size_t name_length = strlen(patterns[p].name) + 1;
+        engine->name_offsets[p] = (uint32_t)offset;
+        memcpy(engine->names + offset, patterns[p].name, name_length);
+        offset += name_length;
+    }
+
+    // Uniform data passes both byte tests at this rate; above one half the
+    // SIMD pass costs more than it skips
+    engine->use_simd = (size_t)engine->first.size * (size_t)engine->second.size < 65536 / 2;
+
+    free(order);
+    free(trie.nodes);
+    free(trie.slots);
+    return engine;
+
+fail:
+    free(order);
+    free(trie.nodes);
+    free(trie.slots);
+    pattern_engine_free(engine);
+    return NULL;
+}
+
+void pattern_engine_free(pattern_engine_t* engine) {
+    if (!engine) {
+        return;
+    }
+    free(engine->quads);
+    free(engine->dense);
+    free(engine->nodes);
+    free(engine->labels);
+    free(engine->targets);
+    free(engine->name_offsets);
+    free(engine->names);
+    free(engine);
+}
+
+// Signature file
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+pattern_engine_t* pattern_engine_load(const char* path, char* error, size_t error_size) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    pattern_t* patterns = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char line[PATTERN_MAX_NAME + 2 * PATTERN_MAX_LENGTH + 64];
+    int line_number = 0;
+    int failed = 0;
+
+    while (!failed && fgets(line, sizeof(line), file)) {
+        line_number++;
+        size_t length = strcspn(line, "#\r\n");
+        line[length] = '\0';
+        while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        char* hex = strchr(line, ':');
+        size_t hex_length = hex ? strlen(hex + 1) : 0;
+        if (!hex || hex == line || (size_t)(hex - line) >= PATTERN_MAX_NAME || hex_length % 2 != 0 ||
+            hex_length / 2 < PATTERN_MIN_LENGTH || hex_length / 2 > PATTERN_MAX_LENGTH) {
+            snprintf(error, error_size, "%s:%d: expected Name:hexbytes (%d-%d bytes)", path, line_number,
+                     PATTERN_MIN_LENGTH, PATTERN_MAX_LENGTH);
+            failed = 1;
+            break;
+        }
+        *hex++ = '\0';
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            pattern_t* grown = realloc(patterns, capacity * sizeof(pattern_t));
+            if (!grown) {
+                snprintf(error, error_size, "out of memory at %s:%d", path, line_number);
+                failed = 1;
+                break;
+            }
+            patterns = grown;
+        }
+        unsigned char* bytes = malloc(hex_length / 2);
+        char* name = strdup(line);
+        if (!bytes || !name) {
+            free(bytes);
+            free(name);
+            snprintf(error, error_size, "out of memory at %s:%d", path, line_number);
+            failed = 1;
+            break;
+        }
+        for (size_t i = 0; i < hex_length / 2; i++) {
+            int high = hex_value(hex[2 * i]);
+            int low = hex_value(hex[2 * i + 1]);
+            if (high < 0 || low < 0) {
+                snprintf(error, error_size, "%s:%d: invalid hex digit", path, line_number);
+                failed = 1;
+                break;
+            }
+            bytes[i] = (unsigned char)(high << 4 | low);
+        }
+        patterns[count].name = name;
+        patterns[count].bytes = bytes;
+        patterns[count].length = hex_length / 2;
+        count++;
+    }
+    fclose(file);
+
+    pattern_engine_t* engine = NULL;
+    if (!failed) {
+        engine = pattern_engine_compile(patterns, count, error, error_size);
+    }
+    for (size_t i = 0; i < count; i++) {
+        free((void*)patterns[i].name);
+        free((void*)patterns[i].bytes);
+    }
+    free(patterns);
+    return engine;
+}
+
+// Prefilter kernels: the first position in [position, length - 1) where
+// a pattern may start, else length - 1 (the last byte is stepped without
+// a pair to test), or position when that is already past it
+
+// The pair bitmap, then for pairs only long patterns start with the hash
+// of four bytes (too close to the end of the block to read them, the
+// pair alone decides)
+static inline int starts_pattern(const pattern_engine_t* engine, const unsigned char* data, size_t position,
+                                 size_t length) {
+    unsigned int pair = data[position] | (unsigned int)data[position + 1] << 8;
+    uint64_t bit = 1ULL << (pair % 64);
+    if (!(engine->pairs[pair / 64] & bit)) {
+        return 0;
+    }
+    if ((engine->short_pairs[pair / 64] & bit) || position + QUAD_BYTES > length) {
+        return 1;
+    }
+    uint32_t quad = quad_hash(engine, data + position);
+    return (engine->quads[quad / 64] >> (quad % 64)) & 1;
+}
+
+// The same test without branches, for positions with QUAD_BYTES to read:
+// what passed the SIMD byte-set tests passes the pair test too often for
+// that branch to predict well (the scalar kernel runs when the pairs alone
+// reject most positions, and keeps the branch)
+static inline int may_start_pattern(const pattern_engine_t* engine, const unsigned char* data) {
+    unsigned int pair = data[0] | (unsigned int)data[1] << 8;
+    uint32_t quad = quad_hash(engine, data);
+    uint64_t hit = (engine->short_pairs[pair / 64] >> (pair % 64)) | (engine->quads[quad / 64] >> (quad % 64));
+    return (int)((engine->pairs[pair / 64] >> (pair % 64)) & hit & 1);
+}
+
+static size_t skip_scalar(const pattern_engine_t* engine, const unsigned char* data, size_t position,
+                          size_t length) {
+    for (; position + 1 < length; position++) {
+        if (starts_pattern(engine, data, position, length)) {
+            return position;
+        }
+    }
+    return position;
+}
+
+#ifdef PATTERN_KERNEL_X86
+// 0xFF in the lanes whose byte is not in the set
+__attribute__((target("ssse3")))
+static inline __m128i not_in_set_ssse3(__m128i bytes, __m128i low0, __m128i low1) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+    __m128i low = _mm_and_si128(bytes, nibble);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+    __m128i upper = _mm_cmpgt_epi8(high, _mm_set1_epi8(7));
+    __m128i rows = _mm_or_si128(_mm_andnot_si128(upper, _mm_shuffle_epi8(low0, low)),
+                                _mm_and_si128(upper, _mm_shuffle_epi8(low1, low)));
+    __m128i bit = _mm_shuffle_epi8(bits, high);
+    return _mm_cmpeq_epi8(_mm_and_si128(rows, bit), _mm_setzero_si128());
+}
+
+__attribute__((target("ssse3")))
+static size_t skip_ssse3(const pattern_engine_t* engine, const unsigned char* data, size_t position,
+                         size_t length) {
+    const __m128i first0 = _mm_loadu_si128((const __m128i*)engine->first.low[0]);
+    const __m128i first1 = _mm_loadu_si128((const __m128i*)engine->first.low[1]);
+    const __m128i second0 = _mm_loadu_si128((const __m128i*)engine->second.low[0]);
+    const __m128i second1 = _mm_loadu_si128((const __m128i*)engine->second.low[1]);
+
+    for (; position + 15 + QUAD_BYTES <= length; position += 16) {
+        __m128i first = _mm_loadu_si128((const __m128i*)(data + position));
+        __m128i second = _mm_loadu_si128((const __m128i*)(data + position + 1));
+        __m128i miss = _mm_or_si128(not_in_set_ssse3(first, first0, first1),
+                                    not_in_set_ssse3(second, second0, second1));
+        unsigned int candidates = ~(unsigned int)_mm_movemask_epi8(miss) & 0xFFFF;
+        while (candidates) {
+            size_t candidate = position + (size_t)__builtin_ctz(candidates);
+            if (may_start_pattern(engine, data + candidate)) {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return skip_scalar(engine, data, position, length);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i not_in_set_avx2(__m256i bytes, __m256i low0, __m256i low1) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128,
+                                          1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+    __m256i low = _mm256_and_si256(bytes, nibble);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+    __m256i upper = _mm256_cmpgt_epi8(high, _mm256_set1_epi8(7));
+    __m256i rows = _mm256_blendv_epi8(_mm256_shuffle_epi8(low0, low), _mm256_shuffle_epi8(low1, low), upper);
+    __m256i bit = _mm256_shuffle_epi8(bits, high);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(rows, bit), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static size_t skip_avx2(const pattern_engine_t* engine, const unsigned char* data, size_t position,
+                        size_t length) {
+    // The 16-byte tables in both lanes (the shuffle stays within a lane)
+    const __m256i first0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)engine->first.low[0]));
+    const __m256i first1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)engine->first.low[1]));
+    const __m256i second0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)engine->second.low[0]));
+    const __m256i second1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)engine->second.low[1]));
+
+    for (; position + 31 + QUAD_BYTES <= length; position += 32) {
+        __m256i first = _mm256_loadu_si256((const __m256i*)(data + position));
+        __m256i second = _mm256_loadu_si256((const __m256i*)(data + position + 1));
+        __m256i miss = _mm256_or_si256(not_in_set_avx2(first, first0, first1),
+                                       not_in_set_avx2(second, second0, second1));
+        unsigned int candidates = ~(unsigned int)_mm256_movemask_epi8(miss);
+        while (candidates) {
+            size_t candidate = position + (size_t)__builtin_ctz(candidates);
+            if (may_start_pattern(engine, data + candidate)) {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return skip_scalar(engine, data, position, length);
+}
+#endif
+
+typedef struct {
+    const char* name;
+    skip_fn fn;
+} pattern_kernel_t;
+
+// Fastest first
+static const pattern_kernel_t g_kernels[] = {
+#ifdef PATTERN_KERNEL_X86
+    { "avx2", skip_avx2 },
+    { "ssse3", skip_ssse3 },
+#endif
+    { "scalar", skip_scalar },
+};
+
+#define NUM_KERNELS (sizeof(g_kernels) / sizeof(g_kernels[0]))
+
+static const pattern_kernel_t* g_selected = NULL;
+
+static int kernel_supported(const pattern_kernel_t* kernel) {
+#ifdef PATTERN_KERNEL_X86
+    __builtin_cpu_init();
+    if (strcmp(kernel->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+#endif
+    return strcmp(kernel->name, "scalar") == 0;
+}
+
+static const pattern_kernel_t* selected_kernel(void) {
+    const pattern_kernel_t* kernel = __atomic_load_n(&g_selected, __ATOMIC_ACQUIRE);
+    if (kernel) {
+        return kernel;
+    }
+
+    // Every thread that races here picks the same kernel
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+        if (kernel_supported(&g_kernels[i])) {
+            kernel = &g_kernels[i];
+            break;
+        }
+    }
+    __atomic_store_n(&g_selected, kernel, __ATOMIC_RELEASE);
+    return kernel;
+}
+
+// Use a given kernel (benchmarks); -1 if it is unknown or the CPU lacks it
+int pattern_kernel_select(const char* name) {
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(g_kernels[i].name, name) == 0 && kernel_supported(&g_kernels[i])) {
+            __atomic_store_n(&g_selected, &g_kernels[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* pattern_engine_kernel(const pattern_engine_t* engine) {
+    return engine->use_simd ? selected_kernel()->name : "pairs";
+}
+
+// Scanning
+
+static inline uint32_t next_state(const pattern_engine_t* engine, uint32_t state, unsigned char byte) {
+    for (;;) {
+        if (state < engine->dense_count) {
+            return engine->dense[(size_t)state * 256 + byte];
+        }
+        const node_t* node = &engine->nodes[state];
+        const unsigned char* labels = engine->labels + node->edges;
+        if (node->count <= SPARSE_LINEAR_EDGES) {
+            for (uint32_t i = 0; i < node->count; i++) {
+                if (labels[i] == byte) {
+                    return engine->targets[node->edges + i];
+                }
+            }
+        } else {
+            uint32_t low = 0;
+            uint32_t high = node->count;
+            while (low < high) {
+                uint32_t middle = (low + high) / 2;
+                if (labels[middle] == byte) {
+                    return engine->targets[node->edges + middle];
+                }
+                if (labels[middle] < byte) low = middle + 1;
+                else high = middle;
+            }
+        }
+        state = node->fail;
+    }
+}
+
+uint32_t pattern_engine_scan(const pattern_engine_t* engine, uint32_t* state,
+                             const unsigned char* data, size_t length, size_t* end) {
+    skip_fn skip = engine->use_simd ? selected_kernel()->fn : skip_scalar;
+    uint32_t current = *state;
+    size_t position = 0;
+    size_t anchored = 0;                // No return to the prefilter before this
+
+    while (position < length) {
+        // In a state at most ANCHOR_DEPTH deep, whatever is under way
+        // started at most that many bytes back: restart from the root there
+        // and let the prefilter jump to where a pattern can start. Bytes
+        // stepped again end no match (it would have been returned already).
+        // After a candidate, QUAD_BYTES are stepped before the next restart,
+        // so the scan always moves forward.
+        if (current <= engine->depth_end[ANCHOR_DEPTH] && position >= anchored) {
+            size_t depth = (current > engine->depth_end[0]) + (current > engine->depth_end[1]) +
+                           (current > engine->depth_end[2]);
+            if (depth <= position) {
+                current = 0;
+                position = skip(engine, data, position - depth, length);
+                if (position >= length) {
+                    break;
+                }
+                anchored = position + QUAD_BYTES;
+            }
+        }
+        uint32_t next = next_state(engine, current, data[position++]);
+        current = next & STATE_MASK;
+        if (next & MATCH_FLAG) {
+            *state = current;
+            if (end) {
+                *end = position;
+            }
+            return engine->nodes[current].match;
+        }
+    }
+    *state = current;
+    return PATTERN_NO_MATCH;
+}
+
+size_t pattern_engine_count(const pattern_engine_t* engine) {
+    return engine->pattern_count;
+}
+
+size_t pattern_engine_states(const pattern_engine_t* engine) {
+    return engine->state_count;
+}
+
+size_t pattern_engine_memory(const pattern_engine_t* engine) {
+    return sizeof(*engine) + ((size_t)1 << (32 - engine->quad_shift)) / 8 + engine->dense_count * 256 * sizeof(uint32_t) +
+           engine->state_count * (sizeof(node_t) + 1 + sizeof(uint32_t)) +
+           engine->pattern_count * sizeof(uint32_t) + engine->names_size;
+}
+
+const char* pattern_engine_name(const pattern_engine_t* engine, uint32_t pattern) {
+    return pattern < engine->pattern_count ? engine->names + engine->name_offsets[pattern] : "Unknown";
+}
+
+uint64_t pattern_engine_version(const pattern_engine_t* engine) {
+    return engine->version;
+}
@@ -0,0 +1,442 @@
+#include "../../include/prefilter.h"
+#include <clamav.h>
+#include <sys/mman.h>
+
+// Sorted digests of one list file, mapped read-only
+typedef struct {
+    const unsigned char* entries;
+    size_t count;
+    size_t map_size;
+} hash_list_t;
+
+// Both lists and the Bloom filter over them; replaced whole on reload
+typedef struct {
+    hash_list_t allow;
+    hash_list_t block;
+    uint64_t* bloom;
+    uint64_t bloom_mask;                // Bits - 1 (a power of two)
+} hash_lists_t;
+
+typedef struct {
+    unsigned long jobs;
+    unsigned long long bytes;
+    unsigned long long scan_us;         // Types only
+} prefilter_counter_t;
+
+struct prefilter {
+    pthread_rwlock_t lock;              // Readers check the lists, reload swaps them
+    hash_lists_t* lists;
+
+    // Counters (atomic)
+    unsigned long lookups;              // Hashes checked against the lists
+    unsigned long bloom_hits;           // Passed the Bloom filter
+    unsigned long list_hits;            // Found in a list
+    prefilter_counter_t stages[PREFILTER_STAGE_COUNT];
+    prefilter_counter_t types[PREFILTER_TYPE_COUNT];
+};
+
+static const char* g_stage_names[PREFILTER_STAGE_COUNT] = { "Allowlist", "Blocklist", "Uniform" };
+static const char* g_type_names[PREFILTER_TYPE_COUNT] = { "Other", "PE", "ELF", "Image", "Text" };
+
+// Image parsing (0.105) and image fuzzy hashes (1.0) are missing from
+// older libclamav
+#ifndef CL_SCAN_PARSE_IMAGE
+#define CL_SCAN_PARSE_IMAGE 0
+#endif
+#ifndef CL_SCAN_PARSE_IMAGE_FUZZY_HASH
+#define CL_SCAN_PARSE_IMAGE_FUZZY_HASH 0
+#endif
+
+// ClamAV parsers per type: the format itself, plus archives and PE for
+// what can carry a payload appended (self-extracting executables, ELF
+// droppers, polyglot images). Text is only known from its first 4 KB, so
+// it keeps archives and PE too: a script header with a payload appended
+// (makeself .run installers, shell droppers) is still unpacked.
+static const unsigned int g_type_parsers[PREFILTER_TYPE_COUNT] = {
+    SCAN_PARSERS_ALL,
+    CL_SCAN_PARSE_PE | CL_SCAN_PARSE_ARCHIVE,
+    CL_SCAN_PARSE_ELF | CL_SCAN_PARSE_ARCHIVE | CL_SCAN_PARSE_PE,
+    CL_SCAN_PARSE_IMAGE | CL_SCAN_PARSE_IMAGE_FUZZY_HASH | CL_SCAN_PARSE_ARCHIVE | CL_SCAN_PARSE_PE,
+    CL_SCAN_PARSE_HTML | CL_SCAN_PARSE_MAIL | CL_SCAN_PARSE_ARCHIVE | CL_SCAN_PARSE_PE,
+};
+
+static void count(prefilter_counter_t* counter, size_t bytes, unsigned long long scan_us) {
+    __atomic_add_fetch(&counter->jobs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->scan_us, scan_us, __ATOMIC_RELAXED);
+}
+
+// Hash lists
+
+// Map a list file. A missing file is an empty list; a file that is not a
+// sorted array of digests is rejected (-1) so a bad list never half-works.
+static int map_list(const char* path, hash_list_t* list) {
+    memset(list, 0, sizeof(*list));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        log_message(LOG_ERROR, "Failed to open hash list %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size % CONTENT_HASH_SIZE != 0) {
+        log_message(LOG_ERROR, "Hash list %s is not a list of %d-byte digests", path, CONTENT_HASH_SIZE);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message(LOG_ERROR, "Failed to map hash list %s: %s", path, strerror(errno));
+        return -1;
+    }
+    list->entries = map;
+    list->map_size = (size_t)st.st_size;
+    list->count = list->map_size / CONTENT_HASH_SIZE;
+
+    for (size_t i = 1; i < list->count; i++) {
+        if (memcmp(list->entries + (i - 1) * CONTENT_HASH_SIZE, list->entries + i * CONTENT_HASH_SIZE,
+                   CONTENT_HASH_SIZE) > 0) {
+            log_message(LOG_ERROR, "Hash list %s is not sorted (entry %zu)", path, i);
+            munmap(map, list->map_size);
+            memset(list, 0, sizeof(*list));
+            return -1;
+        }
+    }
+    // Lookups jump around the file
+    madvise(map, list->map_size, MADV_RANDOM);
+    return 0;
+}
+
+static void unmap_list(hash_list_t* list) {
+    if (list->entries) {
+        munmap((void*)list->entries, list->map_size);
+    }
+}
+
+static int list_contains(const hash_list_t* list, const unsigned char* hash) {
+    size_t low = 0;
+    size_t high = list->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = memcmp(list->entries + middle * CONTENT_HASH_SIZE, hash, CONTENT_HASH_SIZE);
+        if (order == 0) {
+            return 1;
+        }
+        if (order < 0) low = middle + 1;
+        else high = middle;
+    }
+    return 0;
+}
+
+// Bloom probes: SHA-256 is uniform already, so two of its words give
+// the double hashing h1 + i * h2 directly
+static void bloom_probes(const unsigned char* hash, uint64_t* h1, uint64_t* h2) {
+    memcpy(h1, hash, sizeof(*h1));
+    memcpy(h2, hash + sizeof(*h1), sizeof(*h2));
+    *h2 |= 1;
+}
+
+static void bloom_add(hash_lists_t* lists, const unsigned char* hash) {
+    uint64_t h1, h2;
+    bloom_probes(hash, &h1, &h2);
+    for (int i = 0; i < PREFILTER_BLOOM_PROBES; i++) {
+        uint64_t bit = (h1 + (uint64_t)i * h2) & lists->bloom_mask;
+        lists->bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int bloom_test(const hash_lists_t* lists, const unsigned char* hash) {
+    uint64_t h1, h2;
+    bloom_probes(hash, &h1, &h2);
+    for (int i = 0; i < PREFILTER_BLOOM_PROBES; i++) {
+        uint64_t bit = (h1 + (uint64_t)i * h2) & lists->bloom_mask;
+        if (!(lists->bloom[bit / 64] & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void free_lists(hash_lists_t* lists) {
+    if (!lists) {
+        return;
+    }
+    unmap_list(&lists->allow);
+    unmap_list(&lists->block);
+    free(lists->bloom);
+    free(lists);
+}
+
+static hash_lists_t* load_lists(void) {
+    hash_lists_t* lists = calloc(1, sizeof(hash_lists_t));
+    if (!lists) {
+        return NULL;
+    }
+    if (map_list(PREFILTER_ALLOWLIST_PATH, &lists->allow) != 0 ||
+        map_list(PREFILTER_BLOCKLIST_PATH, &lists->block) != 0) {
+        free_lists(lists);
+        return NULL;
+    }
+
+    size_t entries = lists->allow.count + lists->block.count;
+    uint64_t bits = 1024;
+    while (bits < (uint64_t)entries * PREFILTER_BLOOM_BITS_PER_ENTRY) {
+        bits <<= 1;
+    }
+    lists->bloom = calloc((size_t)(bits / 64), sizeof(uint64_t));
+    if (!lists->bloom) {
+        free_lists(lists);
+        return NULL;
+    }
+    lists->bloom_mask = bits - 1;
+    for (size_t i = 0; i < lists->allow.count; i++) {
+        bloom_add(lists, lists->allow.entries + i * CONTENT_HASH_SIZE);
+    }
+    for (size_t i = 0; i < lists->block.count; i++) {
+        bloom_add(lists, lists->block.entries + i * CONTENT_HASH_SIZE);
+    }
+
+    log_message(LOG_INFO, "Hash lists: %zu allowed, %zu blocked (Bloom filter %llu KB)",
+               lists->allow.count, lists->block.count, (unsigned long long)(bits / 8 / 1024));
+    return lists;
+}
+
+prefilter_t* prefilter_create(void) {
+    prefilter_t* prefilter = calloc(1, sizeof(prefilter_t));
+    if (!prefilter) {
+        return NULL;
+    }
+    pthread_rwlock_init(&prefilter->lock, NULL);
+    prefilter->lists = load_lists();
+    if (!prefilter->lists) {
+        prefilter_destroy(prefilter);
+        return NULL;
+    }
+    return prefilter;
+}
+
+void prefilter_destroy(prefilter_t* prefilter) {
+    if (!prefilter) {
+        return;
+    }
+    free_lists(prefilter->lists);
+    pthread_rwlock_destroy(&prefilter->lock);
+    free(prefilter);
+}
+
+int prefilter_reload(prefilter_t* prefilter) {
+    hash_lists_t* lists = load_lists();
+    if (!lists) {
+        return -1;  // Keep the lists in use
+    }
+    pthread_rwlock_wrlock(&prefilter->lock);
+    hash_lists_t* old_lists = prefilter->lists;
+    prefilter->lists = lists;
+    pthread_rwlock_unlock(&prefilter->lock);
+    free_lists(old_lists);
+    return 0;
+}
+
+// PREFILTER_ALLOWLIST / PREFILTER_BLOCKLIST, or -1 if in neither list
+static int lookup_lists(prefilter_t* prefilter, const unsigned char* hash) {
+    __atomic_add_fetch(&prefilter->lookups, 1, __ATOMIC_RELAXED);
+    int found = -1;
+    pthread_rwlock_rdlock(&prefilter->lock);
+    const hash_lists_t* lists = prefilter->lists;
+    if (bloom_test(lists, hash)) {
+        __atomic_add_fetch(&prefilter->bloom_hits, 1, __ATOMIC_RELAXED);
+        // Blocklist first: a hash in both lists is not trusted
+        if (list_contains(&lists->block, hash)) {
+            found = PREFILTER_BLOCKLIST;
+        } else if (list_contains(&lists->allow, hash)) {
+            found = PREFILTER_ALLOWLIST;
+        }
+    }
+    pthread_rwlock_unlock(&prefilter->lock);
+    if (found != -1) {
+        __atomic_add_fetch(&prefilter->list_hits, 1, __ATOMIC_RELAXED);
+    }
+    return found;
+}
+
+// Content
+
+static int is_uniform_block(const unsigned char* data, size_t length, unsigned char value) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The rest of a file whose first bytes were all value
+static int is_uniform_file(int fd, off_t offset, unsigned char value) {
+    unsigned char buffer[64 * 1024];
+    for (;;) {
+        ssize_t length = pread(fd, buffer, sizeof(buffer), offset);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return length == 0;
+        }
+        if (!is_uniform_block(buffer, (size_t)length, value)) {
+            return 0;
+        }
+        offset += length;
+    }
+}
+
+static int is_text(const unsigned char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        // Printable ASCII, whitespace and UTF-8 bytes; no NUL or other controls
+        if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1B) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static prefilter_type_t detect_type(const unsigned char* head, size_t length) {
+    if (length >= 2 && memcmp(head, "MZ", 2) == 0) return PREFILTER_TYPE_PE;
+    if (length >= 4 && memcmp(head, "\x7F" "ELF", 4) == 0) return PREFILTER_TYPE_ELF;
+    if ((length >= 8 && memcmp(head, "\x89PNG\r\n\x1A\n", 8) == 0) ||
+        (length >= 3 && memcmp(head, "\xFF\xD8\xFF", 3) == 0) ||
+        (length >= 6 && (memcmp(head, "GIF87a", 6) == 0 || memcmp(head, "GIF89a", 6) == 0))) {
+        return PREFILTER_TYPE_IMAGE;
+    }
+    // Text that is really a document or a script container keeps every parser
+    if (length >= 5 && memcmp(head, "%PDF-", 5) == 0) return PREFILTER_TYPE_OTHER;
+    if (length >= 5 && memcmp(head, "{\\rtf", 5) == 0) return PREFILTER_TYPE_OTHER;
+    if (length > 0 && is_text(head, length)) return PREFILTER_TYPE_TEXT;
+    return PREFILTER_TYPE_OTHER;
+}
+
+// Result of the stage that decided a job
+static int decide(prefilter_t* prefilter, int decided, size_t file_size, int* status, char* result,
+                  size_t result_size, prefilter_stage_t* stage) {
+    *stage = (prefilter_stage_t)decided;
+    if (decided == PREFILTER_BLOCKLIST) {
+        *status = SCAN_RESULT_INFECTED;
+        snprintf(result, result_size, "%s", PREFILTER_BLOCKED_NAME);
+    } else {
+        *status = SCAN_RESULT_CLEAN;
+        snprintf(result, result_size, "OK");
+    }
+    count(&prefilter->stages[decided], file_size, 0);
+    return 1;
+}
+
+int prefilter_check(prefilter_t* prefilter, const char* filepath, const unsigned char* hash,
+                    int* status, char* result, size_t result_size,
+                    prefilter_stage_t* stage, prefilter_type_t* type) {
+    *type = PREFILTER_TYPE_OTHER;
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;  // The engine reports the error
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 0;
+    }
+    size_t file_size = (size_t)st.st_size;
+
+    int decided = -1;
+    if (hash) {
+        decided = lookup_lists(prefilter, hash);
+    }
+
+    unsigned char head[PREFILTER_PROBE_SIZE];
+    ssize_t length = 0;
+    if (decided == -1) {
+        length = pread(fd, head, sizeof(head), 0);
+        if (length >= 0 && (length == 0 || is_uniform_block(head, (size_t)length, head[0])) &&
+            is_uniform_file(fd, length, length > 0 ? head[0] : 0)) {
+            decided = PREFILTER_UNIFORM;
+        }
+    }
+    close(fd);
+
+    if (decided == -1) {
+        *type = detect_type(head, length > 0 ? (size_t)length : 0);
+        return 0;
+    }
+    return decide(prefilter, decided, file_size, status, result, result_size, stage);
+}
+
+int prefilter_check_hash(prefilter_t* prefilter, const unsigned char* hash, size_t file_size,
+                         int* status, char* result, size_t result_size, prefilter_stage_t* stage) {
+    int decided = lookup_lists(prefilter, hash);
+    if (decided == -1) {
+        return 0;
+    }
+    return decide(prefilter, decided, file_size, status, result, result_size, stage);
+}
+
+int prefilter_scan(prefilter_t* prefilter, const char* filepath, size_t file_size, prefilter_type_t type,
+                   char* result, size_t result_size) {
+    unsigned long long start_us = monotonic_us();
+    int status = scan_file_with_parsers(filepath, g_type_parsers[type], result, result_size);
+    count(&prefilter->types[type], file_size, monotonic_us() - start_us);
+    return status;
+}
+
+const char* prefilter_stage_name(prefilter_stage_t stage) {
+    return stage < PREFILTER_STAGE_COUNT ? g_stage_names[stage] : "Unknown";
+}
+
+static double mb(unsigned long long bytes) {
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+void prefilter_format_stats(prefilter_t* prefilter, char* buffer, size_t buffer_size) {
+    prefilter_counter_t stages[PREFILTER_STAGE_COUNT];
+    prefilter_counter_t types[PREFILTER_TYPE_COUNT];
+    for (int i = 0; i < PREFILTER_STAGE_COUNT; i++) {
+        stages[i].jobs = __atomic_load_n(&prefilter->stages[i].jobs, __ATOMIC_RELAXED);
+        stages[i].bytes = __atomic_load_n(&prefilter->stages[i].bytes, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < PREFILTER_TYPE_COUNT; i++) {
+        types[i].jobs = __atomic_load_n(&prefilter->types[i].jobs, __ATOMIC_RELAXED);
+        types[i].bytes = __atomic_load_n(&prefilter->types[i].bytes, __ATOMIC_RELAXED);
+        types[i].scan_us = __atomic_load_n(&prefilter->types[i].scan_us, __ATOMIC_RELAXED);
+    }
+
+    // Time saved: short-circuited bytes at the rate of scans with every
+    // parser (the cost those jobs would have had)
+    const prefilter_counter_t* full = &types[PREFILTER_TYPE_OTHER];
+    double us_per_byte = full->bytes > 0 ? (double)full->scan_us / (double)full->bytes : 0.0;
+
+    unsigned long lookups = __atomic_load_n(&prefilter->lookups, __ATOMIC_RELAXED);
+    unsigned long bloom_hits = __atomic_load_n(&prefilter->bloom_hits, __ATOMIC_RELAXED);
+    unsigned long list_hits = __atomic_load_n(&prefilter->list_hits, __ATOMIC_RELAXED);
+    int length = snprintf(buffer, buffer_size, "Lookups: %lu, Bloom passed: %lu (%lu false)",
+                          lookups, bloom_hits, bloom_hits - list_hits);
+
+    for (int i = 0; i < PREFILTER_STAGE_COUNT && length < (int)buffer_size; i++) {
+        length += snprintf(buffer + length, buffer_size - length, " | %s: %lu jobs, %.1f MB, ~%.0f ms saved",
+                           g_stage_names[i], stages[i].jobs, mb(stages[i].bytes),
+                           us_per_byte * (double)stages[i].bytes / 1000.0);
+    }
+    for (int i = 0; i < PREFILTER_TYPE_COUNT && length < (int)buffer_size; i++) {
+        if (types[i].jobs == 0) {
+            continue;
+        }
+        double seconds = (double)types[i].scan_us / 1e6;
+        length += snprintf(buffer + length, buffer_size - length, " | %s: %lu scans, %.1f MB, %.1f MB/s",
+                           g_type_names[i], types[i].jobs, mb(types[i].bytes),
+                           seconds > 0 ? mb(types[i].bytes) / seconds : 0.0);
+    }
+}
@@ -0,0 +1,156 @@
+#include "../../include/result_cache.h"
+
+result_cache_t* result_cache_create(size_t capacity) {
+    result_cache_t* cache = calloc(1, sizeof(result_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->capacity = capacity;
+    cache->num_buckets = 1;
+    while (cache->num_buckets < capacity) {
+        cache->num_buckets <<= 1;
+    }
+    cache->entries = calloc(capacity, sizeof(result_cache_entry_t));
+    cache->buckets = malloc(cache->num_buckets * sizeof(int));
+    if (!cache->entries || !cache->buckets) {
+        result_cache_destroy(cache);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cache->num_buckets; i++) {
+        cache->buckets[i] = -1;
+    }
+    return cache;
+}
+
+void result_cache_destroy(result_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+// The hash is already uniformly distributed: its first bytes are the bucket
+static size_t bucket_of(const result_cache_t* cache, const unsigned char* hash,
+                        unsigned long long signature_version) {
+    size_t value;
+    memcpy(&value, hash, sizeof(value));
+    return (value ^ signature_version) & (cache->num_buckets - 1);
+}
+
+static int find_entry(const result_cache_t* cache, const unsigned char* hash,
+                      unsigned long long signature_version, size_t bucket) {
+    for (int i = cache->buckets[bucket]; i != -1; i = cache->entries[i].next) {
+        const result_cache_entry_t* entry = &cache->entries[i];
+        if (entry->signature_version == signature_version &&
+            memcmp(entry->hash, hash, CONTENT_HASH_SIZE) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void unlink_entry(result_cache_t* cache, int index) {
+    result_cache_entry_t* entry = &cache->entries[index];
+    int* link = &cache->buckets[bucket_of(cache, entry->hash, entry->signature_version)];
+    while (*link != index) {
+        link = &cache->entries[*link].next;
+    }
+    *link = entry->next;
+    entry->in_use = 0;
+    cache->count--;
+}
+
+// Slot for a new entry: a free one, or the first unreferenced one the hand finds
+static int take_slot(result_cache_t* cache) {
+    for (;;) {
+        int index = cache->clock_hand;
+        result_cache_entry_t* entry = &cache->entries[index];
+        cache->clock_hand = (cache->clock_hand + 1) % cache->capacity;
+
+        if (!entry->in_use) {
+            return index;
+        }
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+        unlink_entry(cache, index);
+        return index;
+    }
+}
+
+// Returns 1 and fills verdict/virus_name on a hit, 0 on a miss
+int result_cache_lookup(result_cache_t* cache, const unsigned char* hash, unsigned long long signature_version,
+                        int* verdict, char* virus_name, size_t virus_name_size) {
+    pthread_mutex_lock(&cache->mutex);
+    int index = find_entry(cache, hash, signature_version, bucket_of(cache, hash, signature_version));
+    if (index == -1) {
+        cache->misses++;
+        pthread_mutex_unlock(&cache->mutex);
+        return 0;
+    }
+
+    result_cache_entry_t* entry = &cache->entries[index];
+    entry->referenced = 1;
+    *verdict = entry->verdict;
+    snprintf(virus_name, virus_name_size, "%s", entry->virus_name);
+    cache->hits++;
+    pthread_mutex_unlock(&cache->mutex);
+    return 1;
+}
+
+void result_cache_insert(result_cache_t* cache, const unsigned char* hash, unsigned long long signature_version,
+                         int verdict, const char* virus_name) {
+    if (verdict != SCAN_RESULT_CLEAN && verdict != SCAN_RESULT_INFECTED) {
+        return;  // Errors may be transient
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    size_t bucket = bucket_of(cache, hash, signature_version);
+    int index = find_entry(cache, hash, signature_version, bucket);
+
+    if (index == -1) {
+        index = take_slot(cache);
+        // The eviction may have emptied this very bucket
+        cache->entries[index].next = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+        cache->count++;
+    }
+
+    result_cache_entry_t* entry = &cache->entries[index];
+    memcpy(entry->hash, hash, CONTENT_HASH_SIZE);
+    entry->signature_version = signature_version;
+    entry->verdict = verdict;
+    snprintf(entry->virus_name, sizeof(entry->virus_name), "%s", virus_name ? virus_name : "");
+    entry->in_use = 1;
+    entry->referenced = 0;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+// Drop every entry (signature database changed)
+void result_cache_clear(result_cache_t* cache) {
+    pthread_mutex_lock(&cache->mutex);
+    for (size_t i = 0; i < cache->num_buckets; i++) {
+        cache->buckets[i] = -1;
+    }
+    for (size_t i = 0; i < cache->capacity; i++) {
+        cache->entries[i].in_use = 0;
+    }
+    cache->count = 0;
+    cache->clock_hand = 0;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void result_cache_get_stats(result_cache_t* cache, unsigned long* hits, unsigned long* misses, size_t* entries) {
+    pthread_mutex_lock(&cache->mutex);
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *entries = cache->count;
+    pthread_mutex_unlock(&cache->mutex);
+}
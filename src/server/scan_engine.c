@@ -0,0 +1,280 @@
+#include "../../include/common.h"
+#include "../../include/scan_engine.h"
+#include "../../include/chunked_scan.h"
+#include "../../include/hash_signatures.h"
+#include <clamav.h>
+
+// Engine shared by all scanner threads (read-only after compile).
+// Scans hold the read lock; a reload compiles the new engine unlocked and
+// takes the write lock only to swap it in. The lock prefers writers: a
+// reload waits for the scans in progress, and scans that start meanwhile
+// wait behind it instead of starving it.
+static struct cl_engine* g_engine = NULL;
+static hash_signatures_t* g_hash_signatures = NULL;  // Checked against files scanned in chunks
+static unsigned int g_signature_count = 0;
+static unsigned long long g_signature_version = 0;
+static char g_db_dir[MAX_PATH];
+static pthread_rwlock_t g_engine_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+
+// Identifies the database content: the same version means the same
+// verdicts, across reloads and restarts
+static unsigned long long compute_signature_version(const struct cl_engine* engine, unsigned int signatures) {
+    int err = 0;
+    unsigned long long db_version = (unsigned long long)cl_engine_get_num(engine, CL_ENGINE_DB_VERSION, &err);
+    unsigned long long db_time = (unsigned long long)cl_engine_get_num(engine, CL_ENGINE_DB_TIME, &err);
+    return (db_version << 40) ^ (db_time << 8) ^ signatures;
+}
+
+static struct cl_engine* load_engine(const char* db_dir, unsigned int* signatures) {
+    struct cl_engine* engine = cl_engine_new();
+    if (!engine) {
+        log_message(LOG_ERROR, "Failed to create ClamAV engine");
+        return NULL;
+    }
+
+    int ret = cl_load(db_dir, engine, signatures, CL_DB_STDOPT);
+    if (ret != CL_SUCCESS) {
+        log_message(LOG_ERROR, "Failed to load signatures from %s: %s", db_dir, cl_strerror(ret));
+        cl_engine_free(engine);
+        return NULL;
+    }
+
+    ret = cl_engine_compile(engine);
+    if (ret != CL_SUCCESS) {
+        log_message(LOG_ERROR, "Failed to compile ClamAV engine: %s", cl_strerror(ret));
+        cl_engine_free(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+// Only files large enough to be split need them
+static hash_signatures_t* load_hash_signatures(const char* db_dir) {
+    hash_signatures_t* set = hash_signatures_load(db_dir, SCAN_CHUNK_MIN_FILE_SIZE, cl_retflevel());
+    if (!set) {
+        log_message(LOG_ERROR, "Out of memory loading whole-file hash signatures from %s", db_dir);
+    }
+    return set;
+}
+
+int scan_engine_init(const char* db_dir) {
+    if (g_engine) {
+        return 0;
+    }
+
+    int ret = cl_init(CL_INIT_DEFAULT);
+    if (ret != CL_SUCCESS) {
+        log_message(LOG_ERROR, "ClamAV initialization failed: %s", cl_strerror(ret));
+        return -1;
+    }
+
+    if (!db_dir) {
+        db_dir = cl_retdbdir();
+    }
+    snprintf(g_db_dir, sizeof(g_db_dir), "%s", db_dir);
+
+    // Load signature database (done only once, at server startup)
+    unsigned int signatures = 0;
+    struct cl_engine* engine = load_engine(g_db_dir, &signatures);
+    if (!engine) {
+        return -1;
+    }
+    hash_signatures_t* hash_signatures = load_hash_signatures(g_db_dir);
+    if (!hash_signatures) {
+        cl_engine_free(engine);
+        return -1;
+    }
+
+    g_engine = engine;
+    g_hash_signatures = hash_signatures;
+    g_signature_count = signatures;
+    g_signature_version = compute_signature_version(engine, signatures);
+
+    log_message(LOG_INFO, "Scan engine ready: %u signatures loaded from %s (%zu whole-file hashes for large files)",
+               signatures, g_db_dir, hash_signatures->count);
+    return 0;
+}
+
+// Load the database again and switch to it once compiled. The swap waits
+// until the scans in progress release the read lock, then the old engine
+// is freed; scans queued behind the swap run on the new one. Returns 1
+// if the signature version changed, 0 if not, -1 if the new database
+// could not be loaded.
+int scan_engine_reload(void) {
+    unsigned int signatures = 0;
+    struct cl_engine* engine = load_engine(g_db_dir, &signatures);
+    if (!engine) {
+        return -1;
+    }
+    hash_signatures_t* hash_signatures = load_hash_signatures(g_db_dir);
+    if (!hash_signatures) {
+        cl_engine_free(engine);
+        return -1;
+    }
+    unsigned long long version = compute_signature_version(engine, signatures);
+
+    pthread_rwlock_wrlock(&g_engine_lock);
+    struct cl_engine* old_engine = g_engine;
+    hash_signatures_t* old_hash_signatures = g_hash_signatures;
+    int changed = (version != g_signature_version);
+    g_engine = engine;
+    g_hash_signatures = hash_signatures;
+    g_signature_count = signatures;
+    g_signature_version = version;
+    pthread_rwlock_unlock(&g_engine_lock);
+
+    if (old_engine) {
+        cl_engine_free(old_engine);
+    }
+    hash_signatures_free(old_hash_signatures);
+    log_message(LOG_INFO, "Scan engine reloaded: %u signatures%s", signatures,
+               changed ? "" : " (unchanged)");
+    return changed;
+}
+
+void scan_engine_cleanup(void) {
+    pthread_rwlock_wrlock(&g_engine_lock);
+    if (g_engine) {
+        cl_engine_free(g_engine);
+        g_engine = NULL;
+        g_signature_count = 0;
+    }
+    hash_signatures_free(g_hash_signatures);
+    g_hash_signatures = NULL;
+    pthread_rwlock_unlock(&g_engine_lock);
+}
+
+unsigned long long scan_engine_signature_version(void) {
+    pthread_rwlock_rdlock(&g_engine_lock);
+    unsigned long long version = g_signature_version;
+    pthread_rwlock_unlock(&g_engine_lock);
+    return version;
+}
+
+unsigned int scan_engine_signature_count(void) {
+    return g_signature_count;
+}
+
+static void default_scan_options(struct cl_scan_options* options) {
+    memset(options, 0, sizeof(*options));
+    options->parse = SCAN_PARSERS_ALL;  // Enable all parsers (archives, PE, ELF, documents ...)
+    options->general = CL_SCAN_GENERAL_HEURISTICS;
+}
+
+// Called with the read lock held: virname points into the engine, copy it
+// before a reload can free it
+static int translate_scan_result(int ret, const char* virname, char* virus_name, size_t virus_name_size) {
+    if (ret == CL_VIRUS) {
+        snprintf(virus_name, virus_name_size, "%s", virname ? virname : "Unknown");
+        return SCAN_RESULT_INFECTED;
+    }
+    if (ret == CL_CLEAN) {
+        return SCAN_RESULT_CLEAN;
+    }
+    snprintf(virus_name, virus_name_size, "%s", cl_strerror(ret));
+    return SCAN_RESULT_ERROR;
+}
+
+// parsers limits the formats ClamAV parses the file as (prefilter.h);
+// signatures still all run on the raw content
+int scan_engine_scan_file(const char* filepath, unsigned int parsers, char* virus_name, size_t virus_name_size) {
+    if (virus_name_size > 0) {
+        virus_name[0] = '\0';
+    }
+
+    struct cl_scan_options options;
+    default_scan_options(&options);
+    options.parse = parsers;
+    const char* virname = NULL;
+    unsigned long int scanned = 0;
+
+    pthread_rwlock_rdlock(&g_engine_lock);
+    if (!g_engine) {
+        pthread_rwlock_unlock(&g_engine_lock);
+        snprintf(virus_name, virus_name_size, "Scan engine not initialized");
+        return SCAN_RESULT_ERROR;
+    }
+    int ret = cl_scanfile(filepath, &virname, &scanned, g_engine, &options);
+    int status = translate_scan_result(ret, virname, virus_name, virus_name_size);
+    pthread_rwlock_unlock(&g_engine_lock);
+    return status;
+}
+
+// Scan a mapped file, range or buffer with the current engine
+static int scan_map(cl_fmap_t* map, unsigned int parsers, char* virus_name, size_t virus_name_size) {
+    struct cl_scan_options options;
+    default_scan_options(&options);
+    options.parse = parsers;
+    const char* virname = NULL;
+    unsigned long int scanned = 0;
+
+    pthread_rwlock_rdlock(&g_engine_lock);
+    int status = SCAN_RESULT_ERROR;
+    if (g_engine) {
+        int ret = cl_scanmap_callback(map, NULL, &virname, &scanned, g_engine, &options, NULL);
+        status = translate_scan_result(ret, virname, virus_name, virus_name_size);
+    } else {
+        snprintf(virus_name, virus_name_size, "Scan engine not initialized");
+    }
+    pthread_rwlock_unlock(&g_engine_lock);
+    return status;
+}
+
+static off_t pread_handle(void* handle, void* buffer, size_t count, off_t offset) {
+    return pread((int)(intptr_t)handle, buffer, count, offset);
+}
+
+// Scan bytes [offset, offset + length) of an open file as if they were a
+// file of their own, parsed as the formats in parsers. Several threads may
+// scan ranges of the same fd.
+int scan_engine_scan_range(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                           size_t virus_name_size) {
+    if (virus_name_size > 0) {
+        virus_name[0] = '\0';
+    }
+
+    cl_fmap_t* map = cl_fmap_open_handle((void*)(intptr_t)fd, (size_t)offset, length, pread_handle, 1);
+    if (!map) {
+        snprintf(virus_name, virus_name_size, "Failed to map range at offset %lld", (long long)offset);
+        return SCAN_RESULT_ERROR;
+    }
+
+    int status = scan_map(map, parsers, virus_name, virus_name_size);
+    cl_fmap_close(map);
+    return status;
+}
+
+// Scan content already in memory (an archive member decompressed by
+// archive_scan.c)
+int scan_engine_scan_buffer(const void* data, size_t length, char* virus_name, size_t virus_name_size) {
+    if (virus_name_size > 0) {
+        virus_name[0] = '\0';
+    }
+
+    cl_fmap_t* map = cl_fmap_open_memory(data, length);
+    if (!map) {
+        snprintf(virus_name, virus_name_size, "Failed to map %zu bytes", length);
+        return SCAN_RESULT_ERROR;
+    }
+
+    int status = scan_map(map, SCAN_PARSERS_ALL, virus_name, virus_name_size);
+    cl_fmap_close(map);
+    return status;
+}
+
+// Whole-file hash signatures for a file ClamAV only sees in chunks;
+// sha256 (may be NULL) is its content hash when already computed
+int scan_engine_scan_hashes(int fd, size_t size, const unsigned char* sha256, char* virus_name,
+                            size_t virus_name_size) {
+    if (virus_name_size > 0) {
+        virus_name[0] = '\0';
+    }
+
+    pthread_rwlock_rdlock(&g_engine_lock);
+    int status = SCAN_RESULT_CLEAN;
+    if (g_hash_signatures) {
+        status = hash_signatures_match(g_hash_signatures, fd, size, sha256, virus_name, virus_name_size);
+    }
+    pthread_rwlock_unlock(&g_engine_lock);
+    return status;
+}
@@ -0,0 +1,253 @@
+#include "../../include/scan_scheduler.h"
+
+scan_scheduler_t* scan_scheduler_create(mpmc_queue_t* queue, int window) {
+    scan_scheduler_t* scheduler = calloc(1, sizeof(scan_scheduler_t));
+    if (!scheduler) {
+        return NULL;
+    }
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    scheduler->queue = queue;
+    scheduler->window = window > 0 ? window : 1;
+    return scheduler;
+}
+
+void scan_scheduler_destroy(scan_scheduler_t* scheduler) {
+    if (!scheduler) {
+        return;
+    }
+    for (int i = 0; i < SCHED_FLOW_BUCKETS; i++) {
+        while (scheduler->buckets[i]) {
+            sched_flow_t* flow = scheduler->buckets[i];
+            scheduler->buckets[i] = flow->next;
+            free(flow);
+        }
+    }
+    pthread_mutex_destroy(&scheduler->mutex);
+    free(scheduler);
+}
+
+// Flows
+
+static unsigned int address_bucket(const char* address) {
+    unsigned int hash = 2166136261u;  // FNV-1a
+    for (const char* p = address; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash % SCHED_FLOW_BUCKETS;
+}
+
+static sched_flow_t* get_flow(scan_scheduler_t* scheduler, const char* address) {
+    unsigned int bucket = address_bucket(address);
+    for (sched_flow_t* flow = scheduler->buckets[bucket]; flow; flow = flow->next) {
+        if (strcmp(flow->address, address) == 0) {
+            return flow;
+        }
+    }
+
+    sched_flow_t* flow = calloc(1, sizeof(sched_flow_t));
+    if (!flow) {
+        return NULL;
+    }
+    snprintf(flow->address, sizeof(flow->address), "%s", address);
+    flow->next = scheduler->buckets[bucket];
+    scheduler->buckets[bucket] = flow;
+    scheduler->flow_count++;
+    return flow;
+}
+
+// Flows are dropped as soon as they have nothing queued, so the table
+// only holds clients with pending work
+static void release_flow(scan_scheduler_t* scheduler, sched_flow_t* flow) {
+    if (flow->lanes[SCHED_LANE_FAST].count > 0 || flow->lanes[SCHED_LANE_NORMAL].count > 0) {
+        return;
+    }
+    sched_flow_t** link = &scheduler->buckets[address_bucket(flow->address)];
+    while (*link != flow) {
+        link = &(*link)->next;
+    }
+    *link = flow->next;
+    scheduler->flow_count--;
+    free(flow);
+}
+
+static int job_lane(const scan_job_t* job) {
+    if (job->priority == SCAN_PRIORITY_HIGH) {
+        return SCHED_LANE_FAST;
+    }
+    return job->priority != SCAN_PRIORITY_LOW && job->file_size <= SCHED_FAST_LANE_SIZE ?
+           SCHED_LANE_FAST : SCHED_LANE_NORMAL;
+}
+
+static long long job_cost(const scan_job_t* job, int lane) {
+    if (lane == SCHED_LANE_FAST) {
+        return SCHED_QUANTUM;  // One job per turn
+    }
+    long long cost = (long long)job->file_size;
+    if (cost < SCHED_MIN_COST) cost = SCHED_MIN_COST;
+    if (cost > SCHED_MAX_COST) cost = SCHED_MAX_COST;
+    return job->priority == SCAN_PRIORITY_LOW ? cost * SCHED_LOW_PRIORITY_FACTOR : cost;
+}
+
+// Deficit round robin
+
+static void activate_flow(sched_active_list_t* list, sched_flow_t* flow, int lane) {
+    flow->lanes[lane].next_active = NULL;
+    if (list->tail) list->tail->lanes[lane].next_active = flow;
+    else list->head = flow;
+    list->tail = flow;
+}
+
+static sched_flow_t* pop_active_flow(sched_active_list_t* list, int lane) {
+    sched_flow_t* flow = list->head;
+    list->head = flow->lanes[lane].next_active;
+    if (!list->head) list->tail = NULL;
+    flow->lanes[lane].next_active = NULL;
+    return flow;
+}
+
+// The flow at the head of the lane dispatches while its deficit covers
+// the next job; otherwise it gets a quantum and goes to the back. The
+// loop ends within SCHED_MAX_COST * SCHED_LOW_PRIORITY_FACTOR / quantum
+// rounds.
+static scan_job_t* drr_next(scan_scheduler_t* scheduler, int lane, sched_flow_t** job_flow) {
+    sched_active_list_t* list = &scheduler->lanes[lane];
+    for (;;) {
+        sched_flow_t* flow = list->head;
+        if (!flow) {
+            return NULL;
+        }
+
+        sched_flow_queue_t* queue = &flow->lanes[lane];
+        scan_job_t* job = queue->head;
+        long long cost = job_cost(job, lane);
+        if (queue->deficit < cost) {
+            queue->deficit += SCHED_QUANTUM;
+            activate_flow(list, pop_active_flow(list, lane), lane);
+            continue;
+        }
+
+        queue->deficit -= cost;
+        queue->head = job->sched_next;
+        job->sched_next = NULL;
+        queue->count--;
+        list->jobs--;
+        if (!queue->head) {
+            // An idle flow does not keep credit
+            queue->tail = NULL;
+            queue->deficit = 0;
+            pop_active_flow(list, lane);
+        }
+        *job_flow = flow;
+        return job;
+    }
+}
+
+static scan_job_t* pick_next(scan_scheduler_t* scheduler, sched_flow_t** job_flow) {
+    int fast_waiting = scheduler->lanes[SCHED_LANE_FAST].jobs > 0;
+    int normal_waiting = scheduler->lanes[SCHED_LANE_NORMAL].jobs > 0;
+
+    if (fast_waiting && (!normal_waiting || scheduler->fast_streak < SCHED_FAST_LANE_BURST)) {
+        scheduler->fast_streak++;
+        return drr_next(scheduler, SCHED_LANE_FAST, job_flow);
+    }
+    scheduler->fast_streak = 0;
+    return normal_waiting ? drr_next(scheduler, SCHED_LANE_NORMAL, job_flow) : NULL;
+}
+
+// Called with the mutex held
+static void dispatch(scan_scheduler_t* scheduler) {
+    unsigned long long now = monotonic_ms();
+    while (scheduler->dispatched < scheduler->window) {
+        sched_flow_t* flow;
+        scan_job_t* job = pick_next(scheduler, &flow);
+        if (!job) {
+            return;
+        }
+
+        unsigned long long wait_ms = now - job->queued_ms;
+        flow->queued_bytes -= job->file_size;
+        flow->dispatched++;
+        flow->total_wait_ms += wait_ms;
+        scheduler->total_dispatched++;
+        scheduler->total_wait_ms += wait_ms;
+        release_flow(scheduler, flow);
+
+        // Cannot fail: the queue has room for every job in the table
+        mpmc_queue_push(scheduler->queue, job);
+        scheduler->dispatched++;
+    }
+}
+
+void scan_scheduler_submit(scan_scheduler_t* scheduler, scan_job_t* job) {
+    pthread_mutex_lock(&scheduler->mutex);
+    job->queued_ms = monotonic_ms();
+    job->sched_next = NULL;
+
+    sched_flow_t* flow = get_flow(scheduler, job->client_address);
+    if (!flow) {
+        // Out of memory: skip the fair queue rather than lose the job
+        mpmc_queue_push(scheduler->queue, job);
+        scheduler->dispatched++;
+        pthread_mutex_unlock(&scheduler->mutex);
+        return;
+    }
+
+    int lane = job_lane(job);
+    sched_flow_queue_t* queue = &flow->lanes[lane];
+    if (queue->tail) {
+        queue->tail->sched_next = job;
+    } else {
+        queue->head = job;
+        activate_flow(&scheduler->lanes[lane], flow, lane);
+    }
+    queue->tail = job;
+    queue->count++;
+    flow->queued_bytes += job->file_size;
+    scheduler->lanes[lane].jobs++;
+
+    dispatch(scheduler);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void scan_scheduler_job_started(scan_scheduler_t* scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    if (scheduler->dispatched > 0) {
+        scheduler->dispatched--;
+    }
+    dispatch(scheduler);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void scan_scheduler_set_window(scan_scheduler_t* scheduler, int window) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->window = window > 0 ? window : 1;
+    dispatch(scheduler);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void scan_scheduler_format_stats(scan_scheduler_t* scheduler, char* buffer, size_t buffer_size) {
+    pthread_mutex_lock(&scheduler->mutex);
+    unsigned long long now = monotonic_ms();
+    int queued = scheduler->lanes[SCHED_LANE_FAST].jobs + scheduler->lanes[SCHED_LANE_NORMAL].jobs;
+    size_t len = snprintf(buffer, buffer_size, "Queued: %d, Clients: %d, Avg wait: %llu ms",
+                          queued, scheduler->flow_count,
+                          scheduler->total_dispatched ? scheduler->total_wait_ms / scheduler->total_dispatched : 0);
+
+    for (int i = 0; i < SCHED_FLOW_BUCKETS && len < buffer_size; i++) {
+        for (sched_flow_t* flow = scheduler->buckets[i]; flow && len < buffer_size; flow = flow->next) {
+            unsigned long long oldest = now;
+            for (int lane = 0; lane < SCHED_NUM_LANES; lane++) {
+                if (flow->lanes[lane].head && flow->lanes[lane].head->queued_ms < oldest) {
+                    oldest = flow->lanes[lane].head->queued_ms;
+                }
+            }
+            len += snprintf(buffer + len, buffer_size - len,
+                            " | %s: %d jobs (fast %d) %zu MB, oldest %llu ms, avg wait %llu ms",
+                            flow->address,
+                            flow->lanes[SCHED_LANE_FAST].count + flow->lanes[SCHED_LANE_NORMAL].count,
+                            flow->lanes[SCHED_LANE_FAST].count, flow->queued_bytes / (1024 * 1024),
+                            now - oldest, flow->dispatched ? flow->total_wait_ms / flow->dispatched : 0);
+        }
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+}
@@ -0,0 +1,311 @@
+#include "../../include/common.h"
+#include "../../include/scanner.h"
+#include "../../include/pattern_engine.h"
+
+#define PATTERN_READ_BLOCK (1024 * 1024)    // Files and ranges are read and matched in blocks
+
+// Pattern backend: one compiled engine shared by all scanner threads.
+// Scans hold the read lock; a reload swaps in a new engine under the
+// write lock, which waits for the scans in progress and holds new ones
+// back (writer-preferring, as scan_engine.c does for ClamAV).
+static pattern_engine_t* g_patterns = NULL;
+static char g_patterns_path[MAX_PATH];
+static pthread_rwlock_t g_patterns_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+
+// Match length bytes from data, or from fd at offset when data is NULL;
+// called with the read lock held
+static int pattern_scan(const pattern_engine_t* engine, int fd, off_t offset, const unsigned char* data,
+                        size_t length, char* virus_name, size_t virus_name_size) {
+    unsigned char* buffer = NULL;
+    if (!data) {
+        buffer = malloc(length < PATTERN_READ_BLOCK ? (length ? length : 1) : PATTERN_READ_BLOCK);
+        if (!buffer) {
+            snprintf(virus_name, virus_name_size, "Out of memory for pattern scan");
+            return SCAN_RESULT_ERROR;
+        }
+    }
+
+    // The state carries matches across block boundaries
+    uint32_t state = 0;
+    size_t done = 0;
+    while (done < length) {
+        size_t block = length - done;
+        const unsigned char* bytes;
+        if (data) {
+            bytes = data + done;
+        } else {
+            if (block > PATTERN_READ_BLOCK) {
+                block = PATTERN_READ_BLOCK;
+            }
+            ssize_t n = pread(fd, buffer, block, offset + (off_t)done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                snprintf(virus_name, virus_name_size, "Read failed at offset %lld: %s",
+                         (long long)(offset + (off_t)done), n < 0 ? strerror(errno) : "unexpected end of file");
+                free(buffer);
+                return SCAN_RESULT_ERROR;
+            }
+            block = (size_t)n;
+            bytes = buffer;
+        }
+
+        uint32_t match = pattern_engine_scan(engine, &state, bytes, block, NULL);
+        if (match != PATTERN_NO_MATCH) {
+            snprintf(virus_name, virus_name_size, "%s", pattern_engine_name(engine, match));
+            free(buffer);
+            return SCAN_RESULT_INFECTED;
+        }
+        done += block;
+    }
+    free(buffer);
+    return SCAN_RESULT_CLEAN;
+}
+
+static int pattern_scan_range(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                              size_t virus_name_size) {
+    (void)parsers;
+    pthread_rwlock_rdlock(&g_patterns_lock);
+    int status = SCAN_RESULT_CLEAN;
+    if (g_patterns) {
+        status = pattern_scan(g_patterns, fd, offset, NULL, length, virus_name, virus_name_size);
+    }
+    pthread_rwlock_unlock(&g_patterns_lock);
+    return status;
+}
+
+// The raw bytes only: formats are ClamAV's business (parsers is ignored,
+// here and for ranges)
+static int pattern_scan_file(const char* filepath, unsigned int parsers, char* virus_name,
+                             size_t virus_name_size) {
+    (void)parsers;
+    if (!g_patterns_path[0]) {
+        return SCAN_RESULT_CLEAN;  // No pattern file (set once, at startup): skip the open
+    }
+
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        snprintf(virus_name, virus_name_size, "Cannot open %s: %s", filepath, strerror(errno));
+        return SCAN_RESULT_ERROR;
+    }
+    struct stat st;
+    int status;
+    if (fstat(fd, &st) != 0) {
+        snprintf(virus_name, virus_name_size, "Cannot stat %s: %s", filepath, strerror(errno));
+        status = SCAN_RESULT_ERROR;
+    } else {
+        status = pattern_scan_range(fd, 0, (size_t)st.st_size, parsers, virus_name, virus_name_size);
+    }
+    close(fd);
+    return status;
+}
+
+static int pattern_scan_buffer(const void* data, size_t length, char* virus_name, size_t virus_name_size) {
+    pthread_rwlock_rdlock(&g_patterns_lock);
+    int status = SCAN_RESULT_CLEAN;
+    if (g_patterns) {
+        status = pattern_scan(g_patterns, -1, 0, data, length, virus_name, virus_name_size);
+    }
+    pthread_rwlock_unlock(&g_patterns_lock);
+    return status;
+}
+
+// 0 without a pattern file, so the ClamAV version alone keys the caches
+static unsigned long long pattern_signature_version(void) {
+    pthread_rwlock_rdlock(&g_patterns_lock);
+    unsigned long long version = g_patterns ? pattern_engine_version(g_patterns) : 0;
+    pthread_rwlock_unlock(&g_patterns_lock);
+    return version;
+}
+
+static pattern_engine_t* load_patterns(const char* path) {
+    char error[MAX_PATH + 128];
+    pattern_engine_t* engine = pattern_engine_load(path, error, sizeof(error));
+    if (!engine) {
+        log_message(LOG_ERROR, "Failed to load patterns: %s", error);
+        return NULL;
+    }
+    log_message(LOG_INFO, "Pattern engine ready: %zu patterns from %s (%zu states, %zu KB, %s prefilter)",
+               pattern_engine_count(engine), path, pattern_engine_states(engine),
+               pattern_engine_memory(engine) / 1024, pattern_engine_kernel(engine));
+    return engine;
+}
+
+// Cheapest first: a pattern hit ends the scan before ClamAV runs
+static const scanner_backend_t g_backends[] = {
+    { "patterns", pattern_scan_file, pattern_scan_range, pattern_scan_buffer, NULL, pattern_signature_version },
+    { "clamav", scan_engine_scan_file, scan_engine_scan_range, scan_engine_scan_buffer, scan_engine_scan_hashes,
+      scan_engine_signature_version },
+};
+
+#define NUM_BACKENDS (sizeof(g_backends) / sizeof(g_backends[0]))
+
+int scanner_init(const char* db_dir, const char* patterns_path) {
+    if (scan_engine_init(db_dir) != 0) {
+        return -1;
+    }
+    if (patterns_path) {
+        snprintf(g_patterns_path, sizeof(g_patterns_path), "%s", patterns_path);
+        pattern_engine_t* engine = load_patterns(g_patterns_path);
+        if (!engine) {
+            return -1;
+        }
+        g_patterns = engine;  // Before any scanner thread starts
+    }
+    return 0;
+}
+
+int scanner_reload(int* patterns_failed) {
+    *patterns_failed = 0;
+    unsigned long long old_version = scanner_signature_version();
+    if (scan_engine_reload() == -1) {
+        return -1;
+    }
+
+    if (g_patterns_path[0]) {
+        pattern_engine_t* engine = load_patterns(g_patterns_path);
+        if (engine) {
+            pthread_rwlock_wrlock(&g_patterns_lock);
+            pattern_engine_t* old_engine = g_patterns;
+            g_patterns = engine;
+            pthread_rwlock_unlock(&g_patterns_lock);
+            pattern_engine_free(old_engine);
+        } else {
+            *patterns_failed = 1;
+        }
+    }
+    return scanner_signature_version() != old_version;
+}
+
+void scanner_cleanup(void) {
+    pthread_rwlock_wrlock(&g_patterns_lock);
+    pattern_engine_free(g_patterns);
+    g_patterns = NULL;
+    pthread_rwlock_unlock(&g_patterns_lock);
+    scan_engine_cleanup();
+}
+
+typedef struct {
+    int status;
+    char error[MAX_VIRUS_NAME];
+} verdict_t;
+
+// First detection wins; otherwise the first error, otherwise clean.
+// Returns 1 once the verdict is final.
+static int merge_verdict(verdict_t* verdict, int status, const char* virus_name) {
+    if (status == SCAN_RESULT_INFECTED) {
+        verdict->status = status;
+        return 1;
+    }
+    if (status == SCAN_RESULT_ERROR && verdict->status != SCAN_RESULT_ERROR) {
+        verdict->status = status;
+        snprintf(verdict->error, sizeof(verdict->error), "%s", virus_name);
+    }
+    return 0;
+}
+
+static int final_verdict(const verdict_t* verdict, char* virus_name, size_t virus_name_size) {
+    if (verdict->status != SCAN_RESULT_INFECTED) {
+        snprintf(virus_name, virus_name_size, "%s", verdict->error);
+    }
+    return verdict->status;
+}
+
+int scanner_scan_file(const char* filepath, unsigned int parsers, char* virus_name, size_t virus_name_size) {
+    verdict_t verdict = { SCAN_RESULT_CLEAN, "" };
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        int status = g_backends[i].scan_file(filepath, parsers, virus_name, virus_name_size);
+        if (merge_verdict(&verdict, status, virus_name)) {
+            break;
+        }
+    }
+    return final_verdict(&verdict, virus_name, virus_name_size);
+}
+
+int scanner_scan_range(int fd, off_t offset, size_t length, unsigned int parsers, char* virus_name,
+                       size_t virus_name_size) {
+    verdict_t verdict = { SCAN_RESULT_CLEAN, "" };
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        int status = g_backends[i].scan_range(fd, offset, length, parsers, virus_name, virus_name_size);
+        if (merge_verdict(&verdict, status, virus_name)) {
+            break;
+        }
+    }
+    return final_verdict(&verdict, virus_name, virus_name_size);
+}
+
+int scanner_scan_buffer(const void* data, size_t length, char* virus_name, size_t virus_name_size) {
+    verdict_t verdict = { SCAN_RESULT_CLEAN, "" };
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        int status = g_backends[i].scan_buffer(data, length, virus_name, virus_name_size);
+        if (merge_verdict(&verdict, status, virus_name)) {
+            break;
+        }
+    }
+    return final_verdict(&verdict, virus_name, virus_name_size);
+}
+
+int scanner_scan_hashes(int fd, size_t size, const unsigned char* sha256, char* virus_name,
+                        size_t virus_name_size) {
+    verdict_t verdict = { SCAN_RESULT_CLEAN, "" };
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        if (!g_backends[i].scan_hashes) {
+            continue;
+        }
+        int status = g_backends[i].scan_hashes(fd, size, sha256, virus_name, virus_name_size);
+        if (merge_verdict(&verdict, status, virus_name)) {
+            break;
+        }
+    }
+    return final_verdict(&verdict, virus_name, virus_name_size);
+}
+
+unsigned long long scanner_signature_version(void) {
+    unsigned long long version = 0;
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        // Rotated per backend so equal versions do not cancel out; ClamAV,
+        // last, is not, so without patterns the version is the one verdicts
+        // were stored under before
+        unsigned long long backend = g_backends[i].signature_version();
+        unsigned int rotate = 8 * (unsigned int)(NUM_BACKENDS - 1 - i);
+        version ^= rotate ? (backend << rotate) | (backend >> (64 - rotate)) : backend;
+    }
+    return version;
+}
+
+size_t scanner_pattern_count(void) {
+    pthread_rwlock_rdlock(&g_patterns_lock);
+    size_t count = g_patterns ? pattern_engine_count(g_patterns) : 0;
+    pthread_rwlock_unlock(&g_patterns_lock);
+    return count;
+}
+
+// Scanner functions used by the server and the prefilter
+int scan_file_with_clamav(const char* filepath, char* result, size_t result_size) {
+    return scan_file_with_parsers(filepath, SCAN_PARSERS_ALL, result, result_size);
+}
+
+int scan_file_with_parsers(const char* filepath, unsigned int parsers, char* result, size_t result_size) {
+    char virus_name[MAX_VIRUS_NAME];
+    int status = scanner_scan_file(filepath, parsers, virus_name, sizeof(virus_name));
+
+    switch (status) {
+        case SCAN_RESULT_INFECTED:
+            snprintf(result, result_size, "%s", virus_name);
+            break;
+        case SCAN_RESULT_CLEAN:
+            snprintf(result, result_size, "OK");
+            break;
+        default:
+            snprintf(result, result_size, "Error running scanner: %s", virus_name);
+            break;
+    }
+
+    return status;
+}
+
+int is_file_infected(const char* filepath) {
+    char result[MAX_MESSAGE];
+    return scan_file_with_clamav(filepath, result, sizeof(result));
+}
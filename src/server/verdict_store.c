@@ -0,0 +1,540 @@
+#include "../../include/verdict_store.h"
+#include "../../include/scan_engine.h"
+#include <sys/mman.h>
+
+#define VERDICT_LOG_OLD_PATH VERDICT_LOG_PATH ".old"
+#define VERDICT_DB_TMP_PATH VERDICT_DB_PATH ".tmp"
+
+typedef char verdict_record_size_check[(sizeof(verdict_record_t) == 128) ? 1 : -1];
+typedef char verdict_header_size_check[(sizeof(verdict_db_header_t) == 64) ? 1 : -1];
+
+// FNV-1a over everything but the checksum field
+static uint32_t record_checksum(const verdict_record_t* record) {
+    const unsigned char* bytes = (const unsigned char*)record;
+    size_t skip_start = offsetof(verdict_record_t, checksum);
+    size_t skip_end = skip_start + sizeof(record->checksum);
+    uint32_t checksum = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (i >= skip_start && i < skip_end) continue;
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+static int compare_key(const unsigned char* hash, uint64_t version, const verdict_record_t* record) {
+    int result = memcmp(hash, record->hash, CONTENT_HASH_SIZE);
+    if (result != 0) {
+        return result;
+    }
+    return (version > record->signature_version) - (version < record->signature_version);
+}
+
+static int compare_records(const void* a, const void* b) {
+    const verdict_record_t* left = a;
+    return compare_key(left->hash, left->signature_version, b);
+}
+
+// Log index
+
+static size_t index_slot(const verdict_store_t* store, const unsigned char* hash, uint64_t version) {
+    size_t value;
+    memcpy(&value, hash, sizeof(value));
+    return (value ^ version) & (store->log_index_size - 1);
+}
+
+static void index_insert(verdict_store_t* store, size_t record_index) {
+    const verdict_record_t* record = &store->log_records[record_index];
+    size_t slot = index_slot(store, record->hash, record->signature_version);
+
+    // Newer records replace older ones with the same key
+    while (store->log_index[slot] != 0) {
+        if (compare_key(record->hash, record->signature_version,
+                        &store->log_records[store->log_index[slot] - 1]) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (store->log_index_size - 1);
+    }
+    store->log_index[slot] = record_index + 1;
+}
+
+static const verdict_record_t* index_find(const verdict_store_t* store, const unsigned char* hash, uint64_t version) {
+    if (store->log_index_size == 0) {
+        return NULL;
+    }
+    size_t slot = index_slot(store, hash, version);
+    while (store->log_index[slot] != 0) {
+        const verdict_record_t* record = &store->log_records[store->log_index[slot] - 1];
+        if (compare_key(hash, version, record) == 0) {
+            return record;
+        }
+        slot = (slot + 1) & (store->log_index_size - 1);
+    }
+    return NULL;
+}
+
+static int index_rebuild(verdict_store_t* store, size_t index_size) {
+    uint32_t* index = calloc(index_size, sizeof(uint32_t));
+    if (!index) {
+        return -1;
+    }
+    free(store->log_index);
+    store->log_index = index;
+    store->log_index_size = index_size;
+    for (size_t i = 0; i < store->log_count; i++) {
+        index_insert(store, i);
+    }
+    return 0;
+}
+
+// Add a record to the in-memory log, growing the array and the index
+static int log_add(verdict_store_t* store, const verdict_record_t* record) {
+    if (store->log_count == store->log_capacity) {
+        size_t capacity = store->log_capacity ? store->log_capacity * 2 : 1024;
+        verdict_record_t* records = realloc(store->log_records, capacity * sizeof(verdict_record_t));
+        if (!records) {
+            return -1;
+        }
+        store->log_records = records;
+        store->log_capacity = capacity;
+    }
+
+    store->log_records[store->log_count++] = *record;
+
+    // Keep the index at most half full
+    if (store->log_count * 2 > store->log_index_size) {
+        size_t index_size = store->log_index_size ? store->log_index_size * 2 : 2048;
+        while (store->log_count * 2 > index_size) {
+            index_size *= 2;
+        }
+        if (index_rebuild(store, index_size) != 0) {
+            store->log_count--;
+            return -1;
+        }
+    } else {
+        index_insert(store, store->log_count - 1);
+    }
+    return 0;
+}
+
+// Read a log file into memory; a torn record at the end is cut off
+static void load_log(verdict_store_t* store, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    size_t batch_capacity = TRANSFER_BUFFER_SIZE / sizeof(verdict_record_t);
+    verdict_record_t* batch = malloc(batch_capacity * sizeof(verdict_record_t));
+    size_t loaded = 0, rejected = 0;
+    ssize_t bytes;
+    while (batch && (bytes = read(fd, batch, batch_capacity * sizeof(verdict_record_t))) > 0) {
+        // A partial record can only be the torn end of the file
+        for (size_t i = 0; i < (size_t)bytes / sizeof(verdict_record_t); i++) {
+            if (batch[i].checksum != record_checksum(&batch[i])) {
+                rejected++;
+                continue;
+            }
+            if (log_add(store, &batch[i]) == 0) {
+                loaded++;
+            }
+        }
+    }
+    free(batch);
+    close(fd);
+
+    if (rejected > 0) {
+        log_message(LOG_WARNING, "Verdict log %s: %zu damaged records skipped", path, rejected);
+    }
+    log_message(LOG_DEBUG, "Verdict log %s: %zu records", path, loaded);
+}
+
+// Base file
+
+static int map_base(const char* path, void** map, size_t* map_size, const verdict_record_t** records, size_t* count) {
+    *map = NULL;
+    *map_size = 0;
+    *records = NULL;
+    *count = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(verdict_db_header_t)) {
+        close(fd);
+        return -1;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    const verdict_db_header_t* header = data;
+    if (memcmp(header->magic, VERDICT_DB_MAGIC, sizeof(header->magic)) != 0 ||
+        sizeof(*header) + header->count * sizeof(verdict_record_t) != (size_t)st.st_size) {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    // Lookups jump around the file
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    *map = data;
+    *map_size = st.st_size;
+    *records = (const verdict_record_t*)((const char*)data + sizeof(*header));
+    *count = header->count;
+    return 0;
+}
+
+static const verdict_record_t* base_find(const verdict_store_t* store, const unsigned char* hash, uint64_t version) {
+    size_t low = 0, high = store->base_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int result = compare_key(hash, version, &store->base[middle]);
+        if (result == 0) {
+            return &store->base[middle];
+        }
+        if (result < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return NULL;
+}
+
+// Compaction
+
+static int write_all(int fd, const void* data, size_t length) {
+    const char* bytes = data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// Merge the sorted base with the (sorted) frozen log into a new base file.
+// Records of other signature versions are dropped; on equal keys the log wins.
+static int write_merged_base(const verdict_store_t* store, const verdict_record_t* log, size_t log_count,
+                             uint64_t keep_version, size_t* written_count) {
+    int fd = open(VERDICT_DB_TMP_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    verdict_db_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VERDICT_DB_MAGIC, sizeof(header.magic));
+
+    size_t batch_capacity = TRANSFER_BUFFER_SIZE / sizeof(verdict_record_t);
+    verdict_record_t* batch = malloc(batch_capacity * sizeof(verdict_record_t));
+    size_t batch_count = 0, total = 0, i = 0, j = 0;
+    int result = (batch && write_all(fd, &header, sizeof(header)) == 0) ? 0 : -1;
+
+    while (result == 0 && (i < store->base_count || j < log_count)) {
+        const verdict_record_t* next;
+        if (j == log_count) {
+            next = &store->base[i++];
+        } else if (i == store->base_count) {
+            next = &log[j++];
+        } else {
+            int order = compare_records(&store->base[i], &log[j]);
+            if (order < 0) {
+                next = &store->base[i++];
+            } else {
+                if (order == 0) i++;
+                next = &log[j++];
+            }
+        }
+
+        if (next->signature_version != keep_version) {
+            continue;
+        }
+        batch[batch_count++] = *next;
+        total++;
+        if (batch_count == batch_capacity) {
+            result = write_all(fd, batch, batch_count * sizeof(verdict_record_t));
+            batch_count = 0;
+        }
+    }
+
+    if (result == 0 && batch_count > 0) {
+        result = write_all(fd, batch, batch_count * sizeof(verdict_record_t));
+    }
+    free(batch);
+
+    // The count goes in last: a half-written file never looks valid
+    header.count = total;
+    if (result == 0 && (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fsync(fd) == -1)) {
+        result = -1;
+    }
+    close(fd);
+
+    if (result != 0) {
+        unlink(VERDICT_DB_TMP_PATH);
+        return -1;
+    }
+    *written_count = total;
+    return 0;
+}
+
+static void compact(verdict_store_t* store) {
+    // Freeze the current log and start a new one; appends go on meanwhile
+    pthread_rwlock_wrlock(&store->lock);
+    int new_log_fd = -1;
+    if (rename(VERDICT_LOG_PATH, VERDICT_LOG_OLD_PATH) == 0) {
+        new_log_fd = open(VERDICT_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (new_log_fd == -1) {
+        pthread_rwlock_unlock(&store->lock);
+        log_message(LOG_ERROR, "Verdict store: cannot rotate log: %s", strerror(errno));
+        return;
+    }
+    close(store->log_fd);
+    store->log_fd = new_log_fd;
+    store->frozen_count = store->log_count;
+
+    size_t frozen_count = store->frozen_count;
+    verdict_record_t* frozen = malloc((frozen_count + 1) * sizeof(verdict_record_t));
+    if (frozen) {
+        memcpy(frozen, store->log_records, frozen_count * sizeof(verdict_record_t));
+    }
+    pthread_rwlock_unlock(&store->lock);
+
+    if (!frozen) {
+        return;  // Retried at the next threshold, the frozen records stay in memory
+    }
+
+    // qsort is not stable: among duplicate keys keep the newest record
+    qsort(frozen, frozen_count, sizeof(verdict_record_t), compare_records);
+    size_t unique = 0;
+    for (size_t k = 0; k < frozen_count; k++) {
+        if (unique > 0 && compare_records(&frozen[unique - 1], &frozen[k]) == 0) {
+            if (frozen[k].timestamp >= frozen[unique - 1].timestamp) {
+                frozen[unique - 1] = frozen[k];
+            }
+            continue;
+        }
+        frozen[unique++] = frozen[k];
+    }
+
+    // Only this thread replaces the base, so it can be read without the lock
+    size_t written_count = 0;
+    uint64_t keep_version = store->current_version();
+    int result = write_merged_base(store, frozen, unique, keep_version, &written_count);
+    free(frozen);
+
+    void* map = NULL;
+    size_t map_size = 0, count = 0;
+    const verdict_record_t* records = NULL;
+    if (result == 0 && (rename(VERDICT_DB_TMP_PATH, VERDICT_DB_PATH) == -1 ||
+                        map_base(VERDICT_DB_PATH, &map, &map_size, &records, &count) != 0)) {
+        result = -1;
+    }
+    if (result != 0) {
+        log_message(LOG_ERROR, "Verdict store compaction failed: %s", strerror(errno));
+        return;
+    }
+
+    // Swap in the new base and forget the frozen records
+    pthread_rwlock_wrlock(&store->lock);
+    void* old_map = store->base_map;
+    size_t old_map_size = store->base_map_size;
+    store->base_map = map;
+    store->base_map_size = map_size;
+    store->base = records;
+    store->base_count = count;
+
+    store->log_count -= store->frozen_count;
+    memmove(store->log_records, store->log_records + store->frozen_count,
+            store->log_count * sizeof(verdict_record_t));
+    store->frozen_count = 0;
+    index_rebuild(store, store->log_index_size);
+    pthread_rwlock_unlock(&store->lock);
+
+    if (old_map) {
+        munmap(old_map, old_map_size);
+    }
+    unlink(VERDICT_LOG_OLD_PATH);
+    log_message(LOG_INFO, "Verdict store compacted: %zu records", written_count);
+}
+
+static void* compactor_thread(void* arg) {
+    verdict_store_t* store = arg;
+
+    pthread_mutex_lock(&store->compact_mutex);
+    while (store->running) {
+        if (!store->compact_requested) {
+            pthread_cond_wait(&store->compact_cond, &store->compact_mutex);
+            continue;
+        }
+        store->compact_requested = 0;
+        pthread_mutex_unlock(&store->compact_mutex);
+
+        compact(store);
+
+        pthread_mutex_lock(&store->compact_mutex);
+    }
+    pthread_mutex_unlock(&store->compact_mutex);
+    return NULL;
+}
+
+// Merge the log into the base in the background; also drops the records of
+// older signature versions after a reload
+void verdict_store_compact(verdict_store_t* store) {
+    pthread_mutex_lock(&store->compact_mutex);
+    store->compact_requested = 1;
+    pthread_cond_signal(&store->compact_cond);
+    pthread_mutex_unlock(&store->compact_mutex);
+}
+
+// Public API
+
+verdict_store_t* verdict_store_open(unsigned long long (*current_version)(void)) {
+    create_directory_if_not_exists(VERDICT_STORE_DIR);
+
+    verdict_store_t* store = calloc(1, sizeof(verdict_store_t));
+    if (!store) {
+        return NULL;
+    }
+    pthread_rwlock_init(&store->lock, NULL);
+    pthread_mutex_init(&store->compact_mutex, NULL);
+    pthread_cond_init(&store->compact_cond, NULL);
+    store->current_version = current_version;
+    store->log_fd = -1;
+
+    if (map_base(VERDICT_DB_PATH, &store->base_map, &store->base_map_size,
+                 &store->base, &store->base_count) != 0) {
+        log_message(LOG_WARNING, "Verdict store %s is damaged, starting empty", VERDICT_DB_PATH);
+    }
+
+    // A log frozen by an interrupted compaction is merged again
+    int interrupted = (access(VERDICT_LOG_OLD_PATH, F_OK) == 0);
+    if (interrupted) {
+        load_log(store, VERDICT_LOG_OLD_PATH);
+        unlink(VERDICT_LOG_OLD_PATH);
+    }
+    load_log(store, VERDICT_LOG_PATH);
+
+    store->log_fd = open(VERDICT_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (store->log_fd == -1) {
+        log_message(LOG_ERROR, "Cannot open %s: %s", VERDICT_LOG_PATH, strerror(errno));
+        verdict_store_close(store);
+        return NULL;
+    }
+    // Rewrite the log when it had a torn end (appends must stay record
+    // aligned) or when the records of an interrupted compaction joined it
+    struct stat st;
+    if (interrupted || (fstat(store->log_fd, &st) == 0 && st.st_size % sizeof(verdict_record_t) != 0)) {
+        if (ftruncate(store->log_fd, 0) == -1 ||
+            write_all(store->log_fd, store->log_records, store->log_count * sizeof(verdict_record_t)) != 0) {
+            log_message(LOG_ERROR, "Cannot rewrite %s: %s", VERDICT_LOG_PATH, strerror(errno));
+        }
+    }
+
+    store->running = 1;
+    if (pthread_create(&store->compactor, NULL, compactor_thread, store) != 0) {
+        store->running = 0;
+        verdict_store_close(store);
+        return NULL;
+    }
+    if (store->log_count >= VERDICT_COMPACT_THRESHOLD) {
+        verdict_store_compact(store);
+    }
+
+    log_message(LOG_INFO, "Verdict store opened: %zu records in %s, %zu in %s",
+               store->base_count, VERDICT_DB_PATH, store->log_count, VERDICT_LOG_PATH);
+    return store;
+}
+
+void verdict_store_close(verdict_store_t* store) {
+    if (!store) {
+        return;
+    }
+
+    if (store->running) {
+        pthread_mutex_lock(&store->compact_mutex);
+        store->running = 0;
+        pthread_cond_signal(&store->compact_cond);
+        pthread_mutex_unlock(&store->compact_mutex);
+        pthread_join(store->compactor, NULL);
+    }
+
+    if (store->log_fd != -1) {
+        close(store->log_fd);
+    }
+    if (store->base_map) {
+        munmap(store->base_map, store->base_map_size);
+    }
+    free(store->log_records);
+    free(store->log_index);
+    pthread_rwlock_destroy(&store->lock);
+    pthread_mutex_destroy(&store->compact_mutex);
+    pthread_cond_destroy(&store->compact_cond);
+    free(store);
+}
+
+// Returns 1 and fills verdict/virus_name on a hit, 0 on a miss
+int verdict_store_lookup(verdict_store_t* store, const unsigned char* hash, unsigned long long signature_version,
+                         int* verdict, char* virus_name, size_t virus_name_size) {
+    pthread_rwlock_rdlock(&store->lock);
+    const verdict_record_t* record = index_find(store, hash, signature_version);
+    if (!record) {
+        record = base_find(store, hash, signature_version);
+    }
+    if (record) {
+        *verdict = record->verdict;
+        snprintf(virus_name, virus_name_size, "%.*s", VERDICT_NAME_SIZE, record->virus_name);
+    }
+    pthread_rwlock_unlock(&store->lock);
+    return record != NULL;
+}
+
+void verdict_store_append(verdict_store_t* store, const unsigned char* hash, unsigned long long signature_version,
+                          int verdict, const char* virus_name) {
+    if (verdict != SCAN_RESULT_CLEAN && verdict != SCAN_RESULT_INFECTED) {
+        return;
+    }
+
+    verdict_record_t record;
+    memset(&record, 0, sizeof(record));
+    memcpy(record.hash, hash, CONTENT_HASH_SIZE);
+    record.signature_version = signature_version;
+    record.timestamp = time(NULL);
+    record.verdict = verdict;
+    if (verdict == SCAN_RESULT_INFECTED && virus_name) {
+        strncpy(record.virus_name, virus_name, VERDICT_NAME_SIZE - 1);
+    }
+    record.checksum = record_checksum(&record);
+
+    pthread_rwlock_wrlock(&store->lock);
+    // One write per record: O_APPEND keeps concurrent appends whole
+    if (write_all(store->log_fd, &record, sizeof(record)) != 0) {
+        log_message(LOG_ERROR, "Failed to append to %s: %s", VERDICT_LOG_PATH, strerror(errno));
+    }
+    log_add(store, &record);
+    int full = (store->log_count - store->frozen_count >= VERDICT_COMPACT_THRESHOLD);
+    pthread_rwlock_unlock(&store->lock);
+
+    if (full) {
+        verdict_store_compact(store);
+    }
+}
+
+size_t verdict_store_count(verdict_store_t* store) {
+    pthread_rwlock_rdlock(&store->lock);
+    size_t count = store->base_count + store->log_count;
+    pthread_rwlock_unlock(&store->lock);
+    return count;
+}
@@ -9,6 +9,7 @@ import tkinter as tk
 from tkinter import ttk, filedialog, messagebox, scrolledtext
 import threading
 import time
+import random
 import os
 import struct
 import hashlib
@@ -17,6 +18,10 @@ from cryptography.hazmat.primitives import hashes
 from cryptography.hazmat.primitives.kdf.pbkdf2 import PBKDF2HMAC
 import base64
 
+UPLOAD_MAX_RETRIES = 10      # RETRY_AFTER answers before an upload is given up
+UPLOAD_RETRY_BASE_MS = 200   # Backoff after the first RETRY_AFTER, doubled each time
+UPLOAD_RETRY_MAX_MS = 30000
+
 class AntivirusClient:
     def __init__(self):
         self.socket = None
@@ -298,15 +303,30 @@ class AntivirusClient:
                 self.log(f"Uploading {filename} ({file_size} bytes encrypted)")
                 self.update_progress("Uploading file...")
                 
-                # Send upload command
+                # Send upload command; a busy server answers
+                # "RETRY_AFTER <ms> <reason>": wait at least that long,
+                # with exponential backoff and jitter, then ask again
                 upload_cmd = f"UPLOAD_FILE {filename} {file_size}"
-                if not self.send_command(upload_cmd):
-                    return
+                for attempt in range(UPLOAD_MAX_RETRIES + 1):
+                    if not self.send_command(upload_cmd):
+                        return
+                        
+                    # Wait for ready response
+                    response = self.receive_response()
+                    if not response.startswith("RETRY_AFTER") or attempt == UPLOAD_MAX_RETRIES:
+                        break
+                    parts = response.split(" ", 2)
+                    hint_ms = int(parts[1]) if len(parts) > 1 and parts[1].isdigit() else 0
+                    delay_ms = max(hint_ms, min(UPLOAD_RETRY_MAX_MS, UPLOAD_RETRY_BASE_MS << attempt))
+                    delay_ms += random.randint(0, delay_ms // 2)
+                    reason = parts[2] if len(parts) > 2 else "busy"
+                    self.log(f"Server busy ({reason}), retrying in {delay_ms} ms")
+                    self.update_progress("Server busy, waiting...")
+                    time.sleep(delay_ms / 1000.0)
                     
-                # Wait for ready response
-                response = self.receive_response()
                 if not response.startswith("OK"):
                     self.log(f"Upload failed: {response}")
+                    os.unlink(encrypted_path)
                     return
                     
                 # Send file data
@@ -0,0 +1,121 @@
+#!/bin/bash
+
+# On-access scanning test (fanotify)
+# Mounts a tmpfs, starts the server with -a on it and checks that opens
+# of infected files fail while clean files open normally.
+# Needs root (fanotify permission events and mount need CAP_SYS_ADMIN).
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+print_step() {
+    echo -e "${BLUE}[STEP]${NC} $1"
+}
+
+print_success() {
+    echo -e "${GREEN}[SUCCESS]${NC} $1"
+}
+
+print_error() {
+    echo -e "${RED}[ERROR]${NC} $1"
+}
+
+if [ ! -f "bin/antivirus_server" ]; then
+    print_error "Project not compiled. Run 'make all' first."
+    exit 1
+fi
+
+if [ "$(id -u)" -ne 0 ]; then
+    print_error "On-access test needs root (fanotify, mount)."
+    exit 1
+fi
+
+MOUNT_DIR=$(mktemp -d /tmp/onaccess_test.XXXXXX)
+SERVER_PID=""
+FAILURES=0
+
+cleanup() {
+    if [ -n "$SERVER_PID" ] && kill -0 "$SERVER_PID" 2>/dev/null; then
+        kill -INT "$SERVER_PID"
+        wait "$SERVER_PID" 2>/dev/null
+    fi
+    umount "$MOUNT_DIR" 2>/dev/null
+    rmdir "$MOUNT_DIR" 2>/dev/null
+}
+trap cleanup EXIT
+
+check() {
+    if [ "$1" -eq 0 ]; then
+        print_success "$2"
+    else
+        print_error "$2"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+print_step "Mounting tmpfs on $MOUNT_DIR..."
+if ! mount -t tmpfs -o size=64m onaccess_test "$MOUNT_DIR"; then
+    print_error "Failed to mount tmpfs"
+    exit 1
+fi
+
+# Files are written before the server starts watching
+mkdir -p "$MOUNT_DIR/docs"
+echo "This is a clean test file for on-access scanning." > "$MOUNT_DIR/docs/clean.txt"
+echo 'X5O!P%@AP[4\PZX54(P^)7CC)7}$EICAR-STANDARD-ANTIVIRUS-TEST-FILE!$H+H*' > "$MOUNT_DIR/docs/eicar.txt"
+
+print_step "Starting server with on-access scanning of $MOUNT_DIR..."
+./bin/antivirus_server -a "$MOUNT_DIR" -p open -t 2000 > /dev/null 2>&1 &
+SERVER_PID=$!
+sleep 2
+if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+    print_error "Server failed to start (see logs/server.log)"
+    exit 1
+fi
+
+print_step "Test 1: clean file opens"
+cat "$MOUNT_DIR/docs/clean.txt" > /dev/null 2>&1
+check $? "clean.txt opened"
+
+print_step "Test 2: infected file is denied"
+cat "$MOUNT_DIR/docs/eicar.txt" > /dev/null 2>&1
+[ $? -ne 0 ]
+check $? "eicar.txt open denied"
+
+print_step "Test 3: a file rewritten after its scan is scanned again"
+cp "$MOUNT_DIR/docs/clean.txt" "$MOUNT_DIR/docs/copy.txt"
+cat "$MOUNT_DIR/docs/copy.txt" > /dev/null 2>&1
+check $? "copy.txt opened"
+echo 'X5O!P%@AP[4\PZX54(P^)7CC)7}$EICAR-STANDARD-ANTIVIRUS-TEST-FILE!$H+H*' > "$MOUNT_DIR/docs/copy.txt"
+cat "$MOUNT_DIR/docs/copy.txt" > /dev/null 2>&1
+[ $? -ne 0 ]
+check $? "rewritten copy.txt open denied"
+
+print_step "Test 4: repeated opens are answered from the identity cache"
+DENIED=0
+for i in $(seq 1 100); do
+    cat "$MOUNT_DIR/docs/clean.txt" > /dev/null 2>&1 || DENIED=$((DENIED + 1))
+done
+[ "$DENIED" -eq 0 ]
+check $? "100 opens of clean.txt ($DENIED denied)"
+
+print_step "Stopping server..."
+kill -INT "$SERVER_PID"
+wait "$SERVER_PID" 2>/dev/null
+SERVER_PID=""
+# The shutdown line has the counters per decision: the 100 opens must
+# show up under Cached, not Scanned
+STATS=$(grep -a "On-access: $MOUNT_DIR" logs/server.log | tail -1)
+echo "$STATS"
+CACHED=$(echo "$STATS" | sed -n 's/.*| Cached: \([0-9]*\) allowed.*/\1/p')
+[ "${CACHED:-0}" -ge 100 ]
+check $? "repeated opens answered from the cache (Cached: ${CACHED:-0} allowed)"
+
+if [ "$FAILURES" -eq 0 ]; then
+    print_success "On-access test passed"
+    exit 0
+fi
+print_error "On-access test: $FAILURES checks failed"
+exit 1